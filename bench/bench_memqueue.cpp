@@ -0,0 +1,1519 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <fcntl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/mem_queue.h"
+#include "../include/mem_copy.h"
+#include "../include/timer_wheel.h"
+#include "../include/fixed_ring.h"
+#include "../include/queue.h"
+#include "../daemon/Affinity.h"
+#include "../daemon/EventLoop.h"
+#include "../daemon/AsyncQueue.h"
+#include "../daemon/WorkerPool.h"
+#include "../daemon/WaitStrategy.h"
+#include "../daemon/SegmentWriter.h"
+#include "../daemon/BufferPool.h"
+#include "../daemon/StripedWriter.h"
+#include "../daemon/CompressedWriter.h"
+#include "../daemon/Frame.h"
+#include "../daemon/MessageIndex.h"
+#include "../daemon/ShmRing.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static double elapsed_ms(bench_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+static size_t resident_kb()
+{
+    long pages_total = 0, pages_resident = 0;
+    FILE * f = fopen("/proc/self/statm", "r");
+    if (f == NULL)
+        return 0;
+    if (fscanf(f, "%ld %ld", &pages_total, &pages_resident) != 2)
+        pages_resident = 0;
+    fclose(f);
+    return pages_resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// ========== memqueue_open time and RSS against ring size ==========
+
+static void bench_open()
+{
+    const size_t message_size = 4096;
+    std::vector<char> buffer(message_size, 'a');
+
+    printf("%-6s %10s %12s %14s %16s\n", "mode", "size_mb", "open_ms", "rss_open_kb", "rss_1mb_kb");
+
+    for (size_t size_mb : { 16, 64, 256, 1024 })
+    {
+        for (unsigned int flags : { 0, MEMQUEUE_LAZY_ALLOC })
+        {
+            memqueue_params params = { size_mb << 20, flags, 0 };
+            auto rss_before = resident_kb();
+
+            auto start = bench_clock::now();
+            if (memqueue_open_params(&params) != 0)
+            {
+                printf("memqueue_open_params failed for %zu MB\n", size_mb);
+                continue;
+            }
+            auto open_ms = elapsed_ms(start);
+            auto rss_open = resident_kb() - rss_before;
+
+            for (size_t written = 0; written < (1 << 20); written += message_size)
+                memqueue_write(buffer.data(), message_size);
+            auto rss_written = resident_kb() - rss_before;
+
+            printf("%-6s %10zu %12.2f %14zu %16zu\n", flags ? "lazy" : "eager", 
+                size_mb, open_ms, rss_open, rss_written);
+
+            memqueue_close();
+        }
+    }
+}
+
+// ========== write/read throughput with and without huge pages ==========
+
+static double sweep_gbps(size_t message_size, size_t total_bytes)
+{
+    std::vector<char> w_buffer(message_size, 'a');
+    std::vector<char> r_buffer(message_size);
+    const size_t batch = 64;
+
+    auto start = bench_clock::now();
+    for (size_t done = 0; done < total_bytes; done += batch * message_size)
+    {
+        for (size_t i = 0; i < batch; i++)
+            memqueue_write(w_buffer.data(), message_size);
+        for (size_t i = 0; i < batch; i++)
+            memqueue_read(r_buffer.data(), message_size);
+    }
+    return total_bytes / (elapsed_ms(start) / 1000) / (1 << 30);
+}
+
+static void bench_hugepages()
+{
+    const size_t total_bytes = (size_t)8 << 30;
+
+    printf("%-8s %10s %12s %8s %10s\n", "pages", "ring_mb", "message_kb", "huge", "GB/s");
+
+    for (size_t ring_mb : { 256, 1024 })
+    {
+        for (size_t message_kb : { 64, 1024 })
+        {
+            for (unsigned int flags : { 0, MEMQUEUE_HUGEPAGES })
+            {
+                memqueue_stats stats;
+                memqueue_params params = { ring_mb << 20, flags, 0 };
+                if (memqueue_open_params(&params) != 0)
+                {
+                    printf("memqueue_open_params failed for %zu MB\n", ring_mb);
+                    continue;
+                }
+                memqueue_get_stats(&stats);
+
+                auto gbps = sweep_gbps(message_kb << 10, total_bytes);
+                printf("%-8s %10zu %12zu %8zu %10.2f\n", flags ? "huge" : "regular", 
+                    ring_mb, message_kb, stats.chunks_huge, gbps);
+
+                memqueue_close();
+            }
+        }
+    }
+}
+
+// ========== producers contention with and without shards ==========
+
+static double producers_mps(size_t producers, size_t messages_per_producer, size_t message_size)
+{
+    std::vector<std::thread> threads;
+    size_t received = 0;
+
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < producers; i++)
+    {
+        threads.emplace_back([&]()
+        {
+            std::vector<char> buffer(message_size, 'a');
+            for (size_t n = 0; n < messages_per_producer; )
+            {
+                if (memqueue_write(buffer.data(), message_size) > 0)
+                    n++;
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    std::vector<char> buffer(message_size);
+    while (received < producers * messages_per_producer)
+    {
+        if (memqueue_read(buffer.data(), message_size) > 0)
+            received++;
+        else
+            std::this_thread::yield();
+    }
+
+    for (auto & thread : threads)
+        thread.join();
+    return received / (elapsed_ms(start) / 1000) / 1e6;
+}
+
+static void bench_shards()
+{
+    const size_t message_size = 64;
+    const size_t messages     = 1000000;
+
+    printf("%-10s %10s %12s\n", "mode", "producers", "Mmsg/s");
+
+    for (size_t producers : { 1, 2, 4, 8 })
+    {
+        for (unsigned int flags : { 0, MEMQUEUE_SHARDED, MEMQUEUE_SHARDED | MEMQUEUE_SHARD_ORDERED })
+        {
+            memqueue_params params = { (size_t)64 << 20, flags, 0, 0 };
+            if (memqueue_open_params(&params) != 0)
+                continue;
+
+            auto mps = producers_mps(producers, messages / producers, message_size);
+            printf("%-10s %10zu %12.2f\n", 
+                flags & MEMQUEUE_SHARD_ORDERED ? "ordered" : flags ? "sharded" : "single", producers, mps);
+
+            memqueue_close();
+        }
+    }
+}
+
+// ========== local and remote NUMA placement ==========
+
+static void bench_numa()
+{
+    const size_t total_bytes = (size_t)4 << 30;
+    std::vector<int> nodes;
+
+    for (int node = 0; node < 64; node++)
+    {
+        try
+        {
+            if (Affinity::node_cpus(node).size())
+                nodes.push_back(node);
+        }
+        catch (std::exception &)
+        {
+        }
+    }
+
+    printf("%-10s %10s %10s %10s\n", "ring_node", "cpu_node", "placement", "GB/s");
+
+    for (int ring_node : nodes)
+    {
+        for (int cpu_node : nodes)
+        {
+            std::thread thread([&]()
+            {
+                Affinity::pin_to_node(cpu_node);
+
+                memqueue_params params = { (size_t)256 << 20, MEMQUEUE_NUMA_NODE, 0, 0, ring_node };
+                if (memqueue_open_params(&params) != 0)
+                    return;
+
+                auto gbps = sweep_gbps(64 << 10, total_bytes);
+                printf("%-10d %10d %10s %10.2f\n", ring_node, cpu_node, 
+                    ring_node == cpu_node ? "local" : "remote", gbps);
+
+                memqueue_close();
+            });
+            thread.join();
+        }
+    }
+}
+
+// ========== copy strategies across message sizes ==========
+
+/**
+ * Producer copies messages from its hot buffer into a cold ring-sized area
+ * and touches its working set after every megabyte, 
+ * streaming stores should keep that working set in cache.
+ */
+static double copy_gbps(size_t message_size, size_t nt_threshold, double * working_set_ms)
+{
+    const size_t area_size    = (size_t)256 << 20;
+    const size_t working_size = (size_t)1 << 20;
+    const size_t total_bytes  = (size_t)1 << 30;
+    std::vector<char> area(area_size, 0);
+    std::vector<char> message(message_size, 'a');
+    std::vector<char> working_set(working_size, 1);
+    size_t pos = 0;
+    size_t probe_bytes = 0;
+    volatile char sink = 0;
+
+    struct memcopy copy;
+    memcopy_init(&copy, nt_threshold);
+
+    *working_set_ms = 0;
+    auto start = bench_clock::now();
+    for (size_t done = 0; done < total_bytes; done += message_size)
+    {
+        if (pos + message_size > area_size)
+            pos = 0;
+
+        memcopy_to_ring(&copy, area.data() + pos, message.data(), message_size);
+        pos += message_size;
+        probe_bytes += message_size;
+
+        if (probe_bytes >= working_size)
+        {
+            auto probe_start = bench_clock::now();
+            for (size_t i = 0; i < working_size; i += 64)
+                sink = sink + working_set[i];
+            *working_set_ms += elapsed_ms(probe_start);
+            probe_bytes = 0;
+        }
+    }
+    auto copy_ms = elapsed_ms(start) - *working_set_ms;
+
+    return total_bytes / (copy_ms / 1000) / (1 << 30);
+}
+
+static void bench_copy()
+{
+    const char * strategies[] = { "plain", "sse2_nt", "avx_nt" };
+
+    struct memcopy copy;
+    memcopy_init(&copy, 0);
+    printf("large copy strategy: %s\n", strategies[memcopy_strategy(&copy)]);
+    printf("%12s %12s %14s %12s %14s\n", "message_b", "plain_GB/s", "plain_ws_ms", "auto_GB/s", "auto_ws_ms");
+
+    for (size_t message_size : { 16, 64, 256, 4096, 65536, 262144, 1048576, 4194304 })
+    {
+        double plain_ws = 0, auto_ws = 0;
+        auto plain = copy_gbps(message_size, (size_t)-1, &plain_ws);
+        auto dispatched = copy_gbps(message_size, 0, &auto_ws);
+        printf("%12zu %12.2f %14.2f %12.2f %14.2f\n", message_size, plain, plain_ws, dispatched, auto_ws);
+    }
+}
+
+/**
+ * Drain queue of <message_size> messages into a sink buffer 
+ * by memqueue_read or by framed batches of memqueue_consume.
+ */
+static double drain_gbps(size_t message_size, bool consume)
+{
+    const size_t queue_size = 64 << 20;
+    const size_t batch_size = 1 << 20;
+    const size_t rounds = 20;
+    std::vector<char> message(message_size, 'a');
+    std::vector<char> sink(batch_size + message_size);
+    size_t drained = 0;
+    double ms = 0;
+
+    memqueue_open(queue_size);
+
+    auto framed = [](void * context, const char * segment, size_t length, size_t offset, size_t message_length) -> int
+    {
+        auto out = static_cast<char**>(context);
+        if (offset == 0)
+        {
+            memcpy(*out, &message_length, sizeof(size_t));
+            *out += sizeof(size_t);
+        }
+        memcpy(*out, segment, length);
+        *out += length;
+        return 0;
+    };
+
+    for (size_t round = 0; round < rounds; round++)
+    {
+        while (memqueue_write(message.data(), message_size) > 0)
+            ;
+
+        auto start = bench_clock::now();
+        while (true)
+        {
+            ssize_t n_bytes = 0;
+            if (consume)
+            {
+                char * out = sink.data();
+                n_bytes = memqueue_consume(framed, &out, batch_size);
+            }
+            else
+            {
+                n_bytes = memqueue_read(sink.data(), sink.size());
+            }
+            if (n_bytes <= 0)
+                break;
+            drained += n_bytes;
+        }
+        ms += elapsed_ms(start);
+    }
+
+    memqueue_close();
+    return drained / ms / 1e6;
+}
+
+static void bench_drain()
+{
+    printf("%12s %12s %14s\n", "message_b", "read_GB/s", "consume_GB/s");
+
+    for (size_t message_size : { 64, 512, 4096, 65536 })
+    {
+        auto read = drain_gbps(message_size, false);
+        auto consume = drain_gbps(message_size, true);
+        printf("%12zu %12.2f %14.2f\n", message_size, read, consume);
+    }
+}
+
+/**
+ * Latency of urgent messages under saturated bulk load. Producer keeps 
+ * bulk lane full, consumer reads <service> messages per step, urgent 
+ * message is written every 100 steps. One thread does both sides,
+ * so the numbers don't depend on scheduler.
+ */
+static std::vector<double> urgent_latency_us(bool lanes)
+{
+    const size_t queue_size = 16 << 20;
+    const size_t bulk_size  = 1024;
+    const size_t service    = 16;
+    const size_t steps      = 200000;
+    std::vector<char> message(bulk_size, 'b');
+    std::vector<char> buffer(bulk_size);
+    std::vector<double> latency;
+
+    memqueue_params params = { queue_size };
+    if (lanes)
+    {
+        params.flags = MEMQUEUE_PRIORITY_LANES;
+        params.lanes = 2;
+        params.lane_size = 1 << 20;
+    }
+    memqueue_open_params(&params);
+
+    memqueue_write_opts bulk = { MEMQUEUE_WRITE_PRIORITY, 0, 0 };
+    memqueue_write_opts urgent = { MEMQUEUE_WRITE_PRIORITY, 0, 1 };
+
+    for (size_t step = 0; step < steps; step++)
+    {
+        while (memqueue_write_ex(message.data(), bulk_size, &bulk) > 0)
+            ;
+
+        if (step % 100 == 0)
+        {
+            // urgent message carries its write time and is marked by size
+            uint64_t stamp = bench_clock::now().time_since_epoch().count();
+            memqueue_write_ex((const char*)&stamp, sizeof(stamp), &urgent);
+        }
+
+        for (size_t index = 0; index < service; index++)
+        {
+            auto n_bytes = memqueue_read(buffer.data(), buffer.size());
+            if (n_bytes == sizeof(uint64_t))
+            {
+                uint64_t stamp = 0;
+                memcpy(&stamp, buffer.data(), sizeof(stamp));
+                latency.push_back((bench_clock::now().time_since_epoch().count() - stamp) / 1e3);
+            }
+        }
+    }
+
+    memqueue_close();
+    std::sort(latency.begin(), latency.end());
+    return latency;
+}
+
+static void bench_lanes()
+{
+    printf("%8s %10s %12s %12s %12s\n", "mode", "urgent", "p50_us", "p99_us", "max_us");
+
+    for (bool lanes : { false, true })
+    {
+        auto latency = urgent_latency_us(lanes);
+        if (latency.empty())
+        {
+            printf("%8s %10d\n", lanes ? "lanes" : "fifo", 0);
+            continue;
+        }
+        printf("%8s %10zu %12.1f %12.1f %12.1f\n", lanes ? "lanes" : "fifo", latency.size(),
+            latency[latency.size() / 2], latency[latency.size() * 99 / 100], latency.back());
+    }
+}
+
+/**
+ * Timer wheel with millions of pending entries: cost of insert, 
+ * of advance by one tick and of expiry per entry.
+ */
+static void bench_delay()
+{
+    const uint64_t tick_ns = 1000000;
+    const uint64_t horizon_ns = 3600ULL * 1000 * tick_ns;
+
+    printf("%10s %12s %14s %14s %14s\n", "pending", "add_ns", "tick_ns", "expire_ns", "rss_kb");
+
+    for (size_t count : { 100000, 1000000, 4000000 })
+    {
+        std::vector<timer_entry> entries(count);
+        uint64_t seed = 1;
+        timer_wheel wheel;
+        timer_wheel_init(&wheel, tick_ns, 0);
+
+        auto start = bench_clock::now();
+        for (auto & entry : entries)
+        {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            timer_wheel_add(&wheel, &entry, (seed >> 16) % horizon_ns);
+        }
+        double add_ms = elapsed_ms(start);
+
+        // the first 10 seconds tick by tick
+        const size_t ticks = 10000;
+        size_t expired = 0;
+        start = bench_clock::now();
+        for (size_t tick = 1; tick <= ticks; tick++)
+            for (auto entry = timer_wheel_advance(&wheel, tick * tick_ns); entry; entry = entry->next)
+                expired++;
+        double tick_ms = elapsed_ms(start);
+
+        // the rest by seconds
+        start = bench_clock::now();
+        for (uint64_t now = ticks * tick_ns; wheel.count; now += 1000 * tick_ns)
+            for (auto entry = timer_wheel_advance(&wheel, now); entry; entry = entry->next)
+                expired++;
+        double rest_ms = elapsed_ms(start);
+
+        printf("%10zu %12.1f %14.1f %14.1f %14zu\n", count, 
+            add_ms * 1e6 / count, tick_ms * 1e6 / ticks, (tick_ms + rest_ms) * 1e6 / expired, resident_kb());
+    }
+}
+
+/**
+ * Time to get rid of a full queue of stale messages: reader copies every one
+ * without TTL, with TTL it skips them, writer reclaims their space by itself.
+ */
+static double stale_ms(size_t message_size, int mode)
+{
+    const size_t queue_size = 64 << 20;
+    std::vector<char> message(message_size, 'a');
+    memqueue_params params = {};
+    memqueue_write_opts opts = {};
+    size_t count = 0;
+    double ms = 0;
+
+    params.queue_size = queue_size;
+    params.flags      = MEMQUEUE_EXPIRE_RECLAIM;
+    memqueue_open_params(&params);
+
+    // messages expire after queue is filled, else writer reclaims them at once
+    opts.flags     = mode ? MEMQUEUE_WRITE_EXPIRE : 0;
+    opts.expire_ns = memqueue_now_ns() + 500 * 1000000ULL;
+    while (memqueue_write_ex(message.data(), message_size, &opts) > 0)
+        count++;
+    while (memqueue_now_ns() <= opts.expire_ns)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    auto start = bench_clock::now();
+    if (mode == 2)
+    {
+        for (size_t index = 0; index < count; index++)
+            memqueue_write(message.data(), message_size);
+    }
+    else
+    {
+        while (memqueue_read(message.data(), message_size) > 0)
+            ;
+    }
+    ms = elapsed_ms(start);
+
+    memqueue_close();
+    return ms;
+}
+
+static void bench_ttl()
+{
+    printf("%10s %12s %12s %12s\n", "size", "read_ms", "skip_ms", "reclaim_ms");
+
+    for (size_t message_size : { 64, 512, 4096, 65536 })
+        printf("%10zu %12.2f %12.2f %12.2f\n", message_size, 
+            stale_ms(message_size, 0), stale_ms(message_size, 1), stale_ms(message_size, 2));
+}
+
+/**
+ * Reader wants one type of 16: it reads everything and drops the rest
+ * by type in payload, or it lets queue drop them by tag.
+ */
+static double filter_ms(size_t message_size, bool by_tag)
+{
+    const size_t queue_size = 64 << 20;
+    const unsigned int types = 16;
+    std::vector<char> message(message_size, 'a');
+    memqueue_write_opts write_opts = {};
+    memqueue_read_opts read_opts = {};
+    size_t count = 0;
+    size_t wanted = 0;
+
+    memqueue_open(queue_size);
+
+    write_opts.flags = MEMQUEUE_WRITE_TAG;
+    do
+    {
+        write_opts.tag = count % types;
+        message[0] = write_opts.tag;
+        count++;
+    }
+    while (memqueue_write_ex(message.data(), message_size, &write_opts) > 0);
+
+    read_opts.flags = by_tag ? MEMQUEUE_READ_TAGS : 0;
+    read_opts.tags  = 1 << 3;
+
+    auto start = bench_clock::now();
+    while (memqueue_read_ex(message.data(), message_size, &read_opts, 0) > 0)
+    {
+        if (message[0] == 3)
+            wanted++;
+    }
+    double ms = elapsed_ms(start);
+
+    memqueue_close();
+    return wanted ? ms : -1;
+}
+
+static void bench_filter()
+{
+    printf("%10s %12s %12s\n", "size", "user_ms", "tag_ms");
+
+    for (size_t message_size : { 64, 512, 4096, 65536 })
+        printf("%10zu %12.2f %12.2f\n", message_size, filter_ms(message_size, false), filter_ms(message_size, true));
+}
+
+template <size_t Size>
+struct FixedMessage
+{
+    char data[Size];
+};
+
+/**
+ * Million messages per second through generic byte ring and FixedRing
+ * (one by one and by batches of 64), filled to half and drained in turn.
+ */
+template <size_t Size>
+static void fixed_mps(double * generic, double * fixed, double * batched)
+{
+    const size_t count = 1 << 16;
+    const size_t rounds = 64;
+    std::vector<FixedMessage<Size>> messages(count);
+    memqueue::FixedRing<FixedMessage<Size>> ring(count);
+
+    memqueue_open(count * (Size + sizeof(size_t)) + 1);
+    auto start = bench_clock::now();
+    for (size_t round = 0; round < rounds; round++)
+    {
+        for (auto & message : messages)
+            memqueue_write(message.data, Size);
+        for (auto & message : messages)
+            memqueue_read(message.data, Size);
+    }
+    *generic = count * rounds / elapsed_ms(start) / 1e3;
+    memqueue_close();
+
+    start = bench_clock::now();
+    for (size_t round = 0; round < rounds; round++)
+    {
+        for (auto & message : messages)
+            ring.try_push(message);
+        for (auto & message : messages)
+            ring.try_pop(message);
+    }
+    *fixed = count * rounds / elapsed_ms(start) / 1e3;
+
+    start = bench_clock::now();
+    for (size_t round = 0; round < rounds; round++)
+    {
+        for (size_t index = 0; index < count; index += 64)
+            ring.push(&messages[index], 64);
+        for (size_t index = 0; index < count; index += 64)
+            ring.pop(&messages[index], 64);
+    }
+    *batched = count * rounds / elapsed_ms(start) / 1e3;
+}
+
+static void bench_fixed()
+{
+    double generic = 0;
+    double fixed = 0;
+    double batched = 0;
+
+    printf("%10s %12s %12s %12s\n", "size", "generic_mps", "fixed_mps", "batch_mps");
+
+    fixed_mps<16>(&generic, &fixed, &batched);
+    printf("%10d %12.1f %12.1f %12.1f\n", 16, generic, fixed, batched);
+    fixed_mps<64>(&generic, &fixed, &batched);
+    printf("%10d %12.1f %12.1f %12.1f\n", 64, generic, fixed, batched);
+    fixed_mps<256>(&generic, &fixed, &batched);
+    printf("%10d %12.1f %12.1f %12.1f\n", 256, generic, fixed, batched);
+}
+
+/**
+ * Messages per second of write and read by C functions into a buffer
+ * and of Queue consuming them in place.
+ */
+static void instance_mps(size_t message_size, double * copied, double * in_place)
+{
+    const size_t count = 1 << 14;
+    const size_t rounds = 64;
+    std::vector<std::byte> message(message_size);
+    std::vector<char> buffer(message_size);
+    size_t checksum = 0;
+
+    memqueue_open(count * (message_size + sizeof(size_t)) + 1);
+    auto start = bench_clock::now();
+    for (size_t round = 0; round < rounds; round++)
+    {
+        for (size_t index = 0; index < count; index++)
+            memqueue_write((const char *)message.data(), message_size);
+        for (size_t index = 0; index < count; index++)
+            checksum += memqueue_read(buffer.data(), buffer.size());
+    }
+    *copied = count * rounds / elapsed_ms(start) / 1e3;
+    memqueue_close();
+
+    memqueue_params params = {};
+    params.queue_size = count * (message_size + sizeof(size_t)) + 1;
+    memqueue::Queue queue = memqueue::Queue::memory(params);
+    auto consume = [&checksum](std::span<const std::byte> data) { checksum += data.size() + (size_t)data[0]; };
+
+    start = bench_clock::now();
+    for (size_t round = 0; round < rounds; round++)
+    {
+        for (size_t index = 0; index < count; index++)
+            queue.try_push(message);
+        while (queue.consume_batch(consume, 64))
+            ;
+    }
+    *in_place = count * rounds / elapsed_ms(start) / 1e3;
+
+    if (checksum == 0)
+        printf("empty\n");
+}
+
+static void bench_instance()
+{
+    double copied = 0;
+    double in_place = 0;
+
+    printf("%10s %12s %12s\n", "size", "copy_mps", "span_mps");
+
+    for (size_t message_size : { 64, 1024, 16384 })
+    {
+        instance_mps(message_size, &copied, &in_place);
+        printf("%10zu %12.1f %12.1f\n", message_size, copied, in_place);
+    }
+}
+
+static Task drain_queue(AsyncQueue & queue, size_t messages, size_t & checksum)
+{
+    for (size_t count = 0; count < messages; )
+    {
+        Batch batch = co_await queue.next_batch();
+        for (auto message : batch)
+        {
+            checksum += message.size();
+            count++;
+        }
+    }
+}
+
+/**
+ * Messages per second drained from <queues> memory queues by a thread
+ * per queue blocked on eventfd or by coroutines of one event loop.
+ * One producer thread writes bursts into queues in turn.
+ */
+static double async_mps(size_t queues, bool coroutines)
+{
+    const size_t message_size = 64;
+    const size_t messages = (1 << 20) / queues;
+    const size_t burst = 16;
+    std::vector<std::byte> message(message_size);
+    std::vector<memqueue::Queue> rings;
+    std::vector<int> notify;
+    size_t checksum = 0;
+
+    memqueue_params params = {};
+    params.queue_size = 64 * 1024;
+    for (size_t index = 0; index < queues; index++)
+    {
+        rings.push_back(memqueue::Queue::memory(params));
+        notify.push_back(eventfd(0, coroutines ? EFD_NONBLOCK : 0));
+    }
+
+    auto start = bench_clock::now();
+
+    std::thread producer([&]()
+    {
+        for (size_t sent = 0; sent < messages; sent += burst)
+        {
+            for (size_t index = 0; index < queues; index++)
+            {
+                for (size_t count = 0; count < burst; count++)
+                    while (rings[index].try_push(message) == false)
+                        std::this_thread::yield();
+                eventfd_write(notify[index], 1);
+            }
+        }
+    });
+
+    if (coroutines)
+    {
+        std::atomic_bool stop(false);
+        EventLoop loop;
+        std::vector<std::unique_ptr<MemorySource>> sources;
+        std::vector<std::unique_ptr<AsyncQueue>> async_queues;
+
+        for (size_t index = 0; index < queues; index++)
+        {
+            sources.push_back(std::make_unique<MemorySource>(rings[index], notify[index]));
+            async_queues.push_back(std::make_unique<AsyncQueue>(loop, *sources.back(), 64 * 1024));
+            loop.spawn(drain_queue(*async_queues.back(), messages, checksum));
+        }
+        loop.run(stop);
+    }
+    else
+    {
+        std::vector<std::thread> consumers;
+        std::vector<size_t> checksums(queues);
+
+        for (size_t index = 0; index < queues; index++)
+        {
+            consumers.emplace_back([&, index]()
+            {
+                size_t count = 0;
+                auto consume = [&](std::span<const std::byte> data) { checksums[index] += data.size(); count++; };
+
+                while (count < messages)
+                {
+                    if (rings[index].consume_batch(consume, 64) == 0)
+                    {
+                        eventfd_t value = 0;
+                        eventfd_read(notify[index], &value);
+                    }
+                }
+            });
+        }
+        for (auto & consumer : consumers)
+            consumer.join();
+        for (auto value : checksums)
+            checksum += value;
+    }
+
+    producer.join();
+    double mps = messages * queues / elapsed_ms(start) / 1e3;
+
+    for (auto fd : notify)
+        close(fd);
+    if (checksum != messages * queues * message_size)
+        printf("lost messages\n");
+    return mps;
+}
+
+static void bench_async()
+{
+    printf("%10s %12s %12s\n", "queues", "threads_mps", "coro_mps");
+
+    for (size_t queues : { 1, 4, 16, 64 })
+        printf("%10zu %12.2f %12.2f\n", queues, async_mps(queues, false), async_mps(queues, true));
+}
+
+/**
+ * MB per second drained from <queues> prefilled memory queues into
+ * segments in <path> by a pool of <workers>. If <hot> only queue 0 is
+ * filled, so other workers can only steal from it.
+ */
+static double workers_mbps(const std::string & path, size_t queues, size_t workers, bool hot)
+{
+    const size_t message_size = 1024;
+    const size_t queue_bytes = 16 << 20;
+    std::vector<std::byte> message(message_size);
+    std::vector<memqueue::Queue> rings;
+    std::vector<std::unique_ptr<MemorySource>> sources;
+    std::vector<Source *> pointers;
+    size_t total = 0;
+
+    memqueue_params params = {};
+    params.queue_size = queue_bytes + 1;
+    for (size_t index = 0; index < queues; index++)
+    {
+        rings.push_back(memqueue::Queue::memory(params));
+        while ((index == 0 || hot == false) && rings.back().try_push(message))
+            total += message_size + sizeof(size_t);
+    }
+    for (size_t index = 0; index < queues; index++)
+    {
+        sources.push_back(std::make_unique<MemorySource>(rings[index], -1));
+        pointers.push_back(sources.back().get());
+    }
+
+    system(("rm -rf " + path + " && mkdir -p " + path).c_str());
+
+    std::atomic_bool stop(false);
+    WorkerPool pool(pointers, workers, OutputDir{ path }, {}, WaitStrategy::for_latency(std::chrono::microseconds(1000)));
+    auto start = bench_clock::now();
+
+    std::thread monitor([&]()
+    {
+        size_t drained = 0;
+        while (drained < total)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            drained = 0;
+            for (size_t worker = 0; worker < workers; worker++)
+                drained += pool.stats(worker).bytes;
+        }
+        stop = true;
+    });
+    pool.run(stop);
+    monitor.join();
+
+    double mbps = total / elapsed_ms(start) / 1e3;
+    system(("rm -rf " + path).c_str());
+    return mbps;
+}
+
+static void bench_workers()
+{
+    const std::string path = "/dev/shm/bench_workers";
+
+    printf("%10s %10s %12s %12s\n", "queues", "workers", "spread_mbps", "hot_mbps");
+
+    for (size_t workers : { 1, 2, 4, 8 })
+        printf("%10d %10zu %12.0f %12.0f\n", 8, workers, workers_mbps(path, 8, workers, false), workers_mbps(path, 8, workers, true));
+}
+
+/**
+ * Latency of messages written one by one every <gap> and CPU time of
+ * reader per message. Reader sleeps 1 ms after empty read if <latency>
+ * is zero, else waits by WaitStrategy tuned for <latency>.
+ */
+static void wait_latency(std::chrono::microseconds gap, std::chrono::microseconds latency, 
+                         double * mean_us, double * p99_us, double * cpu_us)
+{
+    const size_t messages = std::max<size_t>(200, 200000 / gap.count());
+    std::vector<double> latencies;
+    int notify = eventfd(0, EFD_NONBLOCK);
+
+    memqueue_params params = {};
+    params.queue_size = 64 * 1024;
+    memqueue::Queue queue = memqueue::Queue::memory(params);
+
+    std::thread producer([&]()
+    {
+        for (size_t count = 0; count < messages; count++)
+        {
+            std::this_thread::sleep_for(gap);
+            int64_t now = bench_clock::now().time_since_epoch().count();
+            while (queue.try_push(std::as_bytes(std::span(&now, 1))) == false)
+                std::this_thread::yield();
+            eventfd_write(notify, 1);
+        }
+    });
+
+    WaitStrategy wait(WaitStrategy::for_latency(latency));
+    struct timespec cpu_start, cpu_end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+
+    while (latencies.size() < messages)
+    {
+        size_t count = queue.consume_batch([&latencies](std::span<const std::byte> message)
+        {
+            int64_t sent = 0;
+            memcpy(&sent, message.data(), sizeof(sent));
+            latencies.push_back((bench_clock::now().time_since_epoch().count() - sent) / 1e3);
+        }, 64);
+
+        if (count != 0)
+        {
+            eventfd_t value = 0;
+            eventfd_read(notify, &value);
+            wait.reset();
+        }
+        else if (latency.count() == 0)
+            usleep(1000);
+        else
+            wait.wait({ &notify, 1 });
+    }
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+    producer.join();
+    close(notify);
+
+    std::sort(latencies.begin(), latencies.end());
+    *mean_us = std::accumulate(latencies.begin(), latencies.end(), 0.0) / messages;
+    *p99_us  = latencies[messages * 99 / 100];
+    *cpu_us  = ((cpu_end.tv_sec - cpu_start.tv_sec) * 1e9 + (cpu_end.tv_nsec - cpu_start.tv_nsec)) / 1e3 / messages;
+}
+
+static void bench_wait()
+{
+    printf("%10s %12s %10s %10s %10s\n", "gap_us", "latency_us", "mean_us", "p99_us", "cpu_us");
+
+    for (int gap : { 10, 100, 1000, 10000 })
+    {
+        for (int latency : { 0, 10, 100, 1000 })
+        {
+            double mean = 0, p99 = 0, cpu = 0;
+            wait_latency(std::chrono::microseconds(gap), std::chrono::microseconds(latency), &mean, &p99, &cpu);
+            // latency 0 is fixed usleep(1000)
+            printf("%10d %12s %10.1f %10.1f %10.2f\n", gap, latency ? std::to_string(latency).c_str() : "sleep", mean, p99, cpu);
+        }
+    }
+}
+
+/**
+ * MB of <file_name> held in page cache.
+ */
+static double cached_mb(const std::string & file_name)
+{
+    struct stat st = {};
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size == 0)
+    {
+        if (fd != -1)
+            close(fd);
+        return 0;
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t pages = (st.st_size + page - 1) / page;
+    std::vector<unsigned char> resident(pages);
+    void * map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 0;
+
+    mincore(map, st.st_size, resident.data());
+    munmap(map, st.st_size);
+    return std::count_if(resident.begin(), resident.end(), [](unsigned char value) { return value & 1; }) * page / 1e6;
+}
+
+/**
+ * MB per second written into segments in <path> by batches of <batch_size>
+ * and MB of them left in page cache. Mode 0 - buffered, 1 - buffered with
+ * fsync of every segment, 2 - direct I/O.
+ */
+static double segment_mbps(const std::string & path, size_t batch_size, int mode, double * cache_mb)
+{
+    const size_t total = 256 << 20;
+    const size_t segment_size = 64 << 20;
+    std::vector<std::byte> batch(batch_size, std::byte('x'));
+    BufferPool pool(1, 1 << 20);
+
+    system(("rm -rf " + path + " && mkdir -p " + path).c_str());
+    auto prefix = path + "/memqueue_seg_";
+    auto start = bench_clock::now();
+    {
+        SegmentWriter writer(prefix, segment_size, mode == 2 ? &pool : nullptr);
+        for (size_t written = 0; written < total; written += batch_size)
+        {
+            if (mode == 1 && written != 0 && written % segment_size == 0)
+            {
+                int fd = open((prefix + std::to_string(written / segment_size - 1)).c_str(), O_WRONLY);
+                fsync(fd);
+                close(fd);
+            }
+            writer.write(Batch(batch));
+        }
+        writer.close();
+    }
+    if (mode == 1)
+    {
+        int fd = open((prefix + std::to_string(total / segment_size - 1)).c_str(), O_WRONLY);
+        fsync(fd);
+        close(fd);
+    }
+    double mbps = total / elapsed_ms(start) / 1e3;
+
+    *cache_mb = 0;
+    for (size_t index = 0; index < total / segment_size; index++)
+        *cache_mb += cached_mb(prefix + std::to_string(index));
+
+    system(("rm -rf " + path).c_str());
+    return mbps;
+}
+
+static void bench_direct()
+{
+    // tmpfs keeps everything in memory, segments go to a disk file system
+    const std::string path = "/var/tmp/bench_direct";
+    const char * modes[] = { "buffered", "fsync", "direct" };
+
+    printf("%10s %10s %10s %10s\n", "batch", "mode", "mbps", "cache_mb");
+
+    for (size_t batch_size : { 4096 + 100, 64 * 1024, 1 << 20 })
+    {
+        for (int mode = 0; mode < 3; mode++)
+        {
+            double cache = 0;
+            double mbps = segment_mbps(path, batch_size, mode, &cache);
+            printf("%10zu %10s %10.0f %10.1f\n", batch_size, modes[mode], mbps, cache);
+        }
+    }
+}
+
+/**
+ * MB per second written by <writers> threads into <targets> directories
+ * under <path> by StripedWriter. Order of batches restored from manifests
+ * is checked against numbers written at the start of every batch.
+ */
+static double stripes_mbps(const std::string & path, size_t targets, size_t writers, StripedWriter::Policy policy)
+{
+    const size_t batch_size = 256 * 1024;
+    const size_t batches = (512 << 20) / batch_size;
+    std::vector<OutputDir> outputs;
+    std::vector<std::string> dirs;
+
+    for (size_t target = 0; target < targets; target++)
+    {
+        dirs.push_back(path + "_" + std::to_string(target));
+        outputs.push_back(OutputDir{ dirs.back() });
+        system(("rm -rf " + dirs.back() + " && mkdir -p " + dirs.back()).c_str());
+    }
+
+    auto start = bench_clock::now();
+    {
+        StripedWriter striped(outputs, policy);
+        std::mutex lock;
+        std::vector<std::thread> threads;
+
+        for (size_t writer = 0; writer < writers; writer++)
+        {
+            threads.emplace_back([&]()
+            {
+                std::vector<std::byte> batch(batch_size, std::byte('x'));
+                while (true)
+                {
+                    // lock stands for busy flag of source
+                    std::unique_lock<std::mutex> guard(lock);
+                    uint64_t seq = striped.reserve();
+                    guard.unlock();
+                    if (seq >= batches)
+                        break;
+                    memcpy(batch.data(), &seq, sizeof(seq));
+                    striped.write(seq, Batch(batch));
+                }
+            });
+        }
+        for (auto & thread : threads)
+            thread.join();
+        striped.close();
+    }
+    double mbps = batches * batch_size / elapsed_ms(start) / 1e3;
+
+    auto records = StripedWriter::read_manifests(dirs);
+    bool ordered = records.size() == batches;
+    for (size_t index = 0; ordered && index < records.size(); index++)
+    {
+        auto & record = records[index];
+        uint64_t seq = -1;
+        int fd = open((dirs[record.target] + "/memqueue_seg_" + std::to_string(record.entry.segment)).c_str(), O_RDONLY);
+        pread(fd, &seq, sizeof(seq), record.entry.offset);
+        close(fd);
+        ordered = record.entry.seq == index && seq == index;
+    }
+    if (ordered == false)
+        printf("stripes are out of order\n");
+
+    for (auto & dir : dirs)
+        system(("rm -rf " + dir).c_str());
+    return mbps;
+}
+
+static void bench_stripes()
+{
+    const std::string path = "/dev/shm/bench_stripes";
+
+    printf("%10s %10s %10s %12s\n", "targets", "writers", "rr_mbps", "space_mbps");
+
+    for (size_t targets : { 1, 2, 4 })
+    {
+        for (size_t writers : { 1, 4 })
+        {
+            printf("%10zu %10zu %10.0f %12.0f\n", targets, writers,
+                stripes_mbps(path, targets, writers, StripedWriter::Policy::round_robin),
+                stripes_mbps(path, targets, writers, StripedWriter::Policy::free_space));
+        }
+    }
+}
+
+/**
+ * Batch of length-prefixed JSON events like those of applications.
+ */
+static std::vector<std::byte> json_batch(size_t batch_size, uint64_t seed)
+{
+    static const char * events[] = { "click", "view", "purchase", "login", "logout" };
+    std::vector<std::byte> batch;
+    char message[256];
+
+    while (batch.size() < batch_size)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t length = snprintf(message, sizeof(message),
+            "{\"id\":%llu,\"user\":\"user_%llu\",\"event\":\"%s\",\"ts\":%llu,\"price\":%llu.%02llu,\"tags\":[\"web\",\"eu\"]}",
+            (unsigned long long)(seed >> 40), (unsigned long long)(seed >> 52), events[(seed >> 33) % 5],
+            1690000000000ULL + (seed >> 44), (unsigned long long)(seed >> 56), (unsigned long long)(seed >> 20) % 100);
+
+        size_t offset = batch.size();
+        batch.resize(offset + sizeof(size_t) + length);
+        memcpy(batch.data() + offset, &length, sizeof(size_t));
+        memcpy(batch.data() + offset + sizeof(size_t), message, length);
+    }
+    return batch;
+}
+
+/**
+ * Write 256 MB of JSON batches by CompressedWriter of deflate <level>
+ * with <threads> compressors. Return MB per second, ratio and CPU seconds
+ * of compressors per GB, one batch is read back by index to check it.
+ */
+static void compress_stats(const std::string & path, int level, size_t threads, double * mbps, double * ratio, double * cpu_s_gb)
+{
+    const size_t batch_size = 256 * 1024;
+    const size_t batches = (256 << 20) / batch_size;
+    std::vector<std::vector<std::byte>> samples;
+
+    for (uint64_t seed = 0; seed < 16; seed++)
+        samples.push_back(json_batch(batch_size, seed));
+
+    system(("rm -rf " + path + " && mkdir -p " + path).c_str());
+    OutputDir output{ path };
+    output.compress = level;
+
+    auto start = bench_clock::now();
+    CompressedWriter writer(output, threads);
+    for (size_t index = 0; index < batches; index++)
+        writer.write(writer.reserve(), Batch(samples[index % samples.size()]));
+    writer.close();
+
+    *mbps     = writer.raw_bytes() / elapsed_ms(start) / 1e3;
+    *ratio    = (double)writer.raw_bytes() / writer.frame_bytes();
+    *cpu_s_gb = writer.cpu_ns() / 1e9 / (writer.raw_bytes() / 1e9);
+
+    // random access: batch 77 by index of segment 0
+    const size_t seq = 77;
+    FrameIndexEntry record = {};
+    int index_fd = open((path + "/memqueue_zseg_0.idx").c_str(), O_RDONLY);
+    pread(index_fd, &record, sizeof(record), seq * sizeof(record));
+    close(index_fd);
+
+    std::vector<std::byte> frame(record.length), batch;
+    int fd = open((path + "/memqueue_zseg_0").c_str(), O_RDONLY);
+    pread(fd, frame.data(), frame.size(), record.offset);
+    close(fd);
+    decode_frame(frame, batch);
+    if (record.seq != seq || batch != samples[seq % samples.size()])
+        printf("batch %zu differs\n", seq);
+
+    system(("rm -rf " + path).c_str());
+}
+
+static void bench_compress()
+{
+    const std::string path = "/dev/shm/bench_compress";
+
+    printf("%10s %10s %10s %10s %12s\n", "level", "threads", "mbps", "ratio", "cpu_s_gb");
+
+    for (int level : { 1, 9 })
+    {
+        for (size_t threads : { 1, 2 })
+        {
+            double mbps = 0, ratio = 0, cpu = 0;
+            compress_stats(path, level, threads, &mbps, &ratio, &cpu);
+            printf("%10d %10zu %10.0f %10.2f %12.2f\n", level, threads, mbps, ratio, cpu);
+        }
+    }
+}
+
+/**
+ * Messages of <dir> written in [<from>, <to>] found by listing and
+ * stat of all files.
+ */
+static size_t scan_range(const std::string & dir, uint64_t from, uint64_t to)
+{
+    size_t found = 0;
+    DIR * handle = opendir(dir.c_str());
+
+    while (struct dirent * entry = readdir(handle))
+    {
+        struct stat st = {};
+        if (strncmp(entry->d_name, "memqueue_elem_", 14) != 0 || fstatat(dirfd(handle), entry->d_name, &st, 0) == -1)
+            continue;
+        uint64_t time_ns = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+        found += time_ns >= from && time_ns <= to;
+    }
+    closedir(handle);
+    return found;
+}
+
+/**
+ * The same by index, only files of the range and strides around it are opened.
+ */
+static size_t index_range(const std::string & dir, uint64_t from, uint64_t to)
+{
+    MessageIndexView index(dir + "/memqueue_index");
+    size_t found = 0;
+
+    for (uint64_t seq = index.seq_before(from); seq <= index.seq_after(to); seq++)
+    {
+        struct stat st = {};
+        if (stat((dir + "/memqueue_elem_" + std::to_string(seq)).c_str(), &st) == -1)
+            break;
+        uint64_t time_ns = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+        found += time_ns >= from && time_ns <= to;
+    }
+    return found;
+}
+
+static void bench_index()
+{
+    const std::string dir = "/dev/shm/bench_index";
+
+    printf("%10s %10s %10s %10s %10s %10s\n", "files", "window", "found", "scan_ms", "index_ms", "rebuild_ms");
+
+    for (size_t files : { 10000, 100000 })
+    {
+        system(("rm -rf " + dir + " && mkdir -p " + dir).c_str());
+        {
+            MessageIndex index(dir + "/memqueue_index");
+            char message[100] = {};
+            for (size_t seq = 0; seq < files; seq++)
+            {
+                int fd = open((dir + "/memqueue_elem_" + std::to_string(seq)).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                write(fd, message, sizeof(message));
+                close(fd);
+                index.add(seq, MessageIndex::now());
+            }
+        }
+
+        // window of about a tenth of messages in the middle
+        uint64_t from = 0, to = 0;
+        {
+            MessageIndexView index(dir + "/memqueue_index");
+            auto records = index.records();
+            from = records[records.size() * 45 / 100].time_ns;
+            to   = records[records.size() * 55 / 100].time_ns;
+        }
+
+        auto start = bench_clock::now();
+        size_t scanned = scan_range(dir, from, to);
+        double scan_ms = elapsed_ms(start);
+
+        start = bench_clock::now();
+        size_t indexed = index_range(dir, from, to);
+        double index_ms = elapsed_ms(start);
+
+        start = bench_clock::now();
+        MessageIndex::rebuild(dir);
+        double rebuild_ms = elapsed_ms(start);
+
+        if (scanned != indexed || index_range(dir, from, to) != scanned)
+            printf("index found %zu of %zu\n", indexed, scanned);
+        printf("%10zu %10.0f %10zu %10.2f %10.2f %10.2f\n", files, (to - from) / 1e6, scanned, scan_ms, index_ms, rebuild_ms);
+    }
+
+    system(("rm -rf " + dir).c_str());
+}
+
+/**
+ * MB per second moved from producer through queue and worker pool into
+ * segments in <path>: 256 MB of JSON messages are written by a thread
+ * into memory queue ("memory"), by a thread into shared memory ring
+ * ("shm") or by another process into the ring ("process").
+ * Output is "plain", "direct" or compressed by deflate level 1 ("fast").
+ */
+static double pipeline_mbps(const std::string & path, const std::string & input, const std::string & output_kind)
+{
+    const std::string ring_name = "bench_pipeline";
+    auto sample = json_batch(64 * 1024, 1);
+    std::vector<std::span<const std::byte>> messages;
+    std::unique_ptr<memqueue::Queue> queue;
+    std::unique_ptr<ShmRing> ring;
+    std::unique_ptr<Source> source;
+    int notify = -1;
+    pid_t child = -1;
+
+    size_t count = 0;
+    size_t total = 0;
+
+    for (auto message : Batch(sample))
+        messages.push_back(message);
+    for (; total < (256 << 20); count++)
+        total += sizeof(size_t) + messages[count % messages.size()].size();
+
+    system(("rm -rf " + path + " && mkdir -p " + path).c_str());
+    ShmRing::remove(ring_name);
+
+    // producer writes <count> messages in turn, <total> bytes with prefixes
+    auto produce = [&](auto && push)
+    {
+        for (size_t index = 0; index < count; index++)
+        {
+            while (push(messages[index % messages.size()]) == false)
+                std::this_thread::yield();
+        }
+    };
+
+    if (input == "memory")
+    {
+        memqueue_params params = {};
+        params.queue_size = 16 << 20;
+        queue  = std::make_unique<memqueue::Queue>(memqueue::Queue::memory(params));
+        notify = eventfd(0, EFD_NONBLOCK);
+        source = std::make_unique<MemorySource>(*queue, notify);
+    }
+    else
+    {
+        source = std::make_unique<ShmSource>(ring_name, 16 << 20);
+        ring   = std::make_unique<ShmRing>(ring_name);
+    }
+
+    OutputDir output{ path, output_kind == "direct" };
+    std::unique_ptr<CompressedWriter> compressed;
+    if (output_kind == "fast")
+    {
+        output.compress = 1;
+        compressed = std::make_unique<CompressedWriter>(output, 2);
+    }
+
+    auto start = bench_clock::now();
+
+    // child process attaches the ring by its name as an application would
+    if (input == "process")
+    {
+        child = fork();
+        if (child == 0)
+        {
+            ShmRing producer_ring(ring_name);
+            produce([&](std::span<const std::byte> message) { return producer_ring.try_push(message); });
+            _exit(0);
+        }
+    }
+
+    std::thread producer([&]()
+    {
+        size_t pushed = 0;
+
+        if (input == "memory")
+        {
+            produce([&](std::span<const std::byte> message)
+            {
+                if (queue->try_push(message) == false)
+                    return false;
+                if (++pushed % 64 == 0)
+                    eventfd_write(notify, 1);
+                return true;
+            });
+            eventfd_write(notify, 1);
+        }
+        else if (input == "shm")
+        {
+            produce([&](std::span<const std::byte> message) { return ring->try_push(message); });
+        }
+    });
+
+    std::atomic_bool stop(false);
+    WorkerPool pool({ source.get() }, 1, output, {}, WaitStrategy::for_latency(std::chrono::microseconds(100)), compressed.get());
+
+    std::thread monitor([&]()
+    {
+        while (pool.stats(0).bytes < total)
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        stop = true;
+    });
+    pool.run(stop);
+    monitor.join();
+    producer.join();
+    if (compressed)
+        compressed->close();
+    double mbps = total / elapsed_ms(start) / 1e3;
+
+    if (child > 0)
+        waitpid(child, nullptr, 0);
+    if (pool.stats(0).bytes != total)
+        printf("drained %zu of %zu bytes\n", pool.stats(0).bytes.load(), total);
+
+    if (notify != -1)
+        close(notify);
+    ShmRing::remove(ring_name);
+    system(("rm -rf " + path).c_str());
+    return mbps;
+}
+
+static void bench_pipeline()
+{
+    const std::string path = "/var/tmp/bench_pipeline";
+
+    printf("%10s %12s %12s %12s\n", "source", "plain_mbps", "direct_mbps", "fast_mbps");
+
+    for (const char * input : { "memory", "shm", "process" })
+    {
+        printf("%10s %12.0f %12.0f %12.0f\n", input,
+            pipeline_mbps(path, input, "plain"), pipeline_mbps(path, input, "direct"), pipeline_mbps(path, input, "fast"));
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::map<std::string, std::function<void()>> benches = 
+    {
+        { "open",      bench_open },
+        { "hugepages", bench_hugepages },
+        { "shards",    bench_shards },
+        { "numa",      bench_numa },
+        { "copy",      bench_copy },
+        { "drain",     bench_drain },
+        { "lanes",     bench_lanes },
+        { "delay",     bench_delay },
+        { "ttl",       bench_ttl },
+        { "filter",    bench_filter },
+        { "fixed",     bench_fixed },
+        { "instance",  bench_instance },
+        { "async",     bench_async },
+        { "workers",   bench_workers },
+        { "wait",      bench_wait },
+        { "direct",    bench_direct },
+        { "stripes",   bench_stripes },
+        { "compress",  bench_compress },
+        { "index",     bench_index },
+        { "pipeline",  bench_pipeline },
+    };
+
+    if (argc < 2 || benches.count(argv[1]) == 0)
+    {
+        std::cout << "usage: " << argv[0] << " <bench>" << std::endl << "benches:";
+        for (auto & bench : benches)
+            std::cout << " " << bench.first;
+        std::cout << std::endl;
+        return 1;
+    }
+
+    benches[argv[1]]();
+    return 0;
+}
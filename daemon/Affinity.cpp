@@ -0,0 +1,89 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "Affinity.h"
+
+std::vector<int> Affinity::node_cpus(int node)
+{
+    std::vector<int> cpus;
+    std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string range;
+
+    if (!cpulist)
+        throw std::runtime_error("NUMA node " + std::to_string(node) + " not found");
+
+    // "0-3,8-11" or "0,2,4"
+    while (std::getline(cpulist, range, ','))
+    {
+        int first = 0, last = 0;
+        char dash = 0;
+        std::istringstream stream(range);
+
+        if (!(stream >> first))
+            continue;
+        last = first;
+        if (stream >> dash >> last && dash != '-')
+            last = first;
+
+        for (auto cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+
+    return cpus;
+}
+
+std::vector<int> Affinity::allowed_cpus(int node)
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == -1)
+        throw std::runtime_error("sched_getaffinity failed with error " + std::to_string(errno));
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &set))
+            cpus.push_back(cpu);
+    }
+
+    if (node >= 0)
+    {
+        auto node_list = node_cpus(node);
+        std::erase_if(cpus, [&node_list](int cpu) { return std::find(node_list.begin(), node_list.end(), cpu) == node_list.end(); });
+    }
+
+    return cpus;
+}
+
+void Affinity::pin_to_cpus(const std::vector<int> & cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus)
+        CPU_SET(cpu, &set);
+
+    auto ret_code = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret_code != 0)
+        throw std::runtime_error("pthread_setaffinity_np failed with error " + std::to_string(ret_code));
+}
+
+void Affinity::pin_to_node(int node)
+{
+    auto cpus = allowed_cpus(node);
+    if (cpus.empty())
+        throw std::runtime_error("NUMA node " + std::to_string(node) + " has no CPUs allowed to process");
+
+    pin_to_cpus(cpus);
+}
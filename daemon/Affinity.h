@@ -0,0 +1,32 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <vector>
+
+class Affinity
+{
+private:
+    Affinity() {}
+
+public:
+    /**
+     * CPUs of NUMA <node> from /sys/devices/system/node/node<N>/cpulist.
+     */
+    static std::vector<int> node_cpus(int node);
+
+    /**
+     * CPUs process may run on (affinity mask and cpuset),
+     * only those of NUMA <node> if it isn't negative.
+     */
+    static std::vector<int> allowed_cpus(int node = -1);
+
+    static void pin_to_cpus(const std::vector<int> & cpus);
+
+    /**
+     * Pin calling thread to CPUs of NUMA <node>.
+     */
+    static void pin_to_node(int node);
+};
@@ -0,0 +1,61 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "EventLoop.h"
+#include "Source.h"
+
+/**
+ * Source drained by coroutine: co_await queue.next_batch() returns
+ * the next non-empty batch, coroutine is suspended while source is empty.
+ */
+class AsyncQueue
+{
+public:
+    class BatchAwaiter : public EventLoop::Waiter
+    {
+    public:
+        explicit BatchAwaiter(AsyncQueue & queue) : queue_(queue) {}
+
+        bool await_ready() { return read(); }
+        void await_suspend(std::coroutine_handle<> handle) { handle_ = handle; queue_.loop_.wait(queue_.source_.fd(), this); }
+        Batch await_resume() const { return Batch(std::span<const std::byte>(queue_.buffer_.data(), length_)); }
+
+        bool try_complete() override
+        {
+            queue_.source_.clear_notify();
+            return read();
+        }
+
+    private:
+        bool read()
+        {
+            length_ = queue_.source_.read_batch(queue_.buffer_);
+            return length_ != 0;
+        }
+
+        AsyncQueue & queue_;
+        size_t length_ = 0;
+    };
+
+    AsyncQueue(EventLoop & loop, Source & source, size_t buffer_size = 1 << 20)
+        : loop_(loop), source_(source), buffer_(buffer_size)
+    {
+    }
+
+    AsyncQueue(const AsyncQueue &) = delete;
+    AsyncQueue & operator=(const AsyncQueue &) = delete;
+
+    BatchAwaiter next_batch() { return BatchAwaiter(*this); }
+
+private:
+    EventLoop & loop_;
+    Source & source_;
+    std::vector<std::byte> buffer_;
+};
@@ -0,0 +1,36 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <cstdint>
+
+#include "Source.h"
+
+/**
+ * Output shared by all workers of pool. Batches are numbered globally,
+ * the number is taken while source is locked, so order of source is kept.
+ */
+class BatchSink
+{
+public:
+    virtual ~BatchSink() = default;
+
+    /**
+     * Take sequence number for the next batch, every taken number
+     * must be written.
+     */
+    virtual uint64_t reserve() = 0;
+
+    /**
+     * Copy <batch> for writing, wait while output is behind.
+     * Error of output is rethrown here.
+     */
+    virtual void write(uint64_t seq, const Batch & batch) = 0;
+
+    /**
+     * Write queued batches and rethrow error of output.
+     */
+    virtual void close() = 0;
+};
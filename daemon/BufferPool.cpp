@@ -0,0 +1,55 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+#include <stdexcept>
+
+#include "BufferPool.h"
+
+BufferPool::BufferPool(size_t count, size_t buffer_size, size_t alignment)
+    : buffer_size_(buffer_size)
+    , alignment_(alignment)
+    , memory_(nullptr)
+{
+    if (count == 0 || alignment == 0 || buffer_size == 0 || buffer_size % alignment != 0)
+        throw std::invalid_argument("buffer size must be a multiple of alignment");
+
+    void * memory = nullptr;
+    if (posix_memalign(&memory, alignment, count * buffer_size) != 0)
+        throw std::bad_alloc();
+    memory_ = static_cast<std::byte *>(memory);
+    free_.reserve(count);
+
+    // pages are touched here, not on the first write of a segment
+    memset(memory_, 0, count * buffer_size);
+
+    for (size_t index = 0; index < count; index++)
+        free_.push_back(memory_ + index * buffer_size);
+}
+
+BufferPool::~BufferPool()
+{
+    free(memory_);
+}
+
+std::byte * BufferPool::acquire()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+
+    if (free_.empty())
+        return nullptr;
+
+    std::byte * buffer = free_.back();
+    free_.pop_back();
+    return buffer;
+}
+
+void BufferPool::release(std::byte * buffer)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    free_.push_back(buffer);
+}
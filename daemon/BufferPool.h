@@ -0,0 +1,41 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/**
+ * Buffers for direct I/O allocated once as one block. Every buffer
+ * is aligned to <alignment> and its size is a multiple of it.
+ */
+class BufferPool
+{
+public:
+    static constexpr size_t block_size = 4096;
+
+    BufferPool(size_t count, size_t buffer_size, size_t alignment = block_size);
+    ~BufferPool();
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool & operator=(const BufferPool &) = delete;
+
+    /**
+     * Take a free buffer, nullptr if all buffers are taken.
+     */
+    std::byte * acquire();
+    void release(std::byte * buffer);
+
+    size_t buffer_size() const { return buffer_size_; }
+    size_t alignment() const { return alignment_; }
+
+private:
+    size_t buffer_size_;
+    size_t alignment_;
+    std::byte * memory_;
+    std::mutex lock_;
+    std::vector<std::byte *> free_;
+};
@@ -0,0 +1,237 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include "CompressedWriter.h"
+#include "BufferPool.h"
+#include "Frame.h"
+
+// largest number in indexes "<prefix><counter>.idx" of <dir>, -1 if none
+static int64_t last_indexed_seq(const std::string & dir, const std::string & name_prefix)
+{
+    int64_t last = -1;
+    DIR * handle = opendir(dir.c_str());
+    if (handle == nullptr)
+        return last;
+
+    while (struct dirent * entry = readdir(handle))
+    {
+        std::string name = entry->d_name;
+        if (name.compare(0, name_prefix.size(), name_prefix) != 0 || name.size() < 4 || name.compare(name.size() - 4, 4, ".idx") != 0)
+            continue;
+
+        int fd = open((dir + "/" + name).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            continue;
+
+        // records are appended in order, the last one is the largest
+        FrameIndexEntry record;
+        off_t size = lseek(fd, 0, SEEK_END);
+        off_t offset = size / static_cast<off_t>(sizeof(record)) * sizeof(record) - sizeof(record);
+        if (offset >= 0 && pread(fd, &record, sizeof(record), offset) == sizeof(record))
+            last = std::max(last, static_cast<int64_t>(record.seq));
+        ::close(fd);
+    }
+
+    closedir(handle);
+    return last;
+}
+
+CompressedWriter::CompressedWriter(const OutputDir & output, size_t threads, size_t segment_size)
+    : prefix_(output.path + "/memqueue_zseg_")
+    , level_(output.compress)
+    , max_jobs_(threads * 2 + 2)
+{
+    if (threads == 0 || level_ <= 0)
+        throw std::invalid_argument("compressed writer needs threads and compression level");
+
+    if (output.direct)
+        buffers_ = std::make_unique<BufferPool>(1, 1 << 20);
+    writer_ = std::make_unique<SegmentWriter>(prefix_, segment_size, buffers_.get());
+
+    seq_      = last_indexed_seq(output.path, "memqueue_zseg_") + 1;
+    next_seq_ = seq_;
+
+    for (size_t thread = 0; thread < threads; thread++)
+        threads_.emplace_back([this]() { compress(); });
+    flush_thread_ = std::thread([this]() { flush(); });
+}
+
+CompressedWriter::~CompressedWriter()
+{
+    try
+    {
+        close();
+    }
+    catch (...)
+    {
+    }
+
+    if (index_fd_ != -1)
+        ::close(index_fd_);
+}
+
+void CompressedWriter::write(uint64_t seq, const Batch & batch)
+{
+    std::unique_lock<std::mutex> guard(lock_);
+
+    // the batch flush thread waits for is let in over the limit, otherwise
+    // later batches could take every job while its worker is preempted
+    // between reserve and write, and neither of them would ever go on
+    changed_.wait(guard, [this, seq]() { return jobs_ < max_jobs_ || seq == next_seq_ || failed_; });
+    if (failed_)
+        std::rethrow_exception(error_);
+
+    Job job;
+    if (spare_.empty() == false)
+    {
+        job = std::move(spare_.back());
+        spare_.pop_back();
+    }
+    job.seq = seq;
+    job.data.assign(batch.data().begin(), batch.data().end());
+
+    queued_.push_back(std::move(job));
+    jobs_++;
+    changed_.notify_all();
+}
+
+void CompressedWriter::close()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stop_ = true;
+        changed_.notify_all();
+    }
+
+    for (auto & thread : threads_)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+    if (flush_thread_.joinable())
+        flush_thread_.join();
+
+    std::lock_guard<std::mutex> guard(lock_);
+    if (error_)
+        std::rethrow_exception(std::exchange(error_, nullptr));
+}
+
+void CompressedWriter::compress()
+{
+    try
+    {
+        FrameEncoder encoder(level_);
+
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> guard(lock_);
+                changed_.wait(guard, [this]() { return queued_.empty() == false || stop_ || failed_; });
+                if (queued_.empty() || failed_)
+                    break;
+                job = std::move(queued_.front());
+                queued_.pop_front();
+                compressing_++;
+            }
+
+            job.frame_length = encoder.encode(job.seq, job.data, job.frame);
+
+            std::lock_guard<std::mutex> guard(lock_);
+            compressing_--;
+            done_.emplace(job.seq, std::move(job));
+            changed_.notify_all();
+        }
+    }
+    catch (...)
+    {
+        fail();
+    }
+
+    struct timespec cpu = {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    cpu_ns_ += cpu.tv_sec * 1000000000ULL + cpu.tv_nsec;
+}
+
+void CompressedWriter::flush()
+{
+    try
+    {
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> guard(lock_);
+                // frames are written in order of numbers, a gap waits for its batch,
+                // on stop gap of number never written doesn't hold the rest
+                auto ready = [this]()
+                {
+                    return done_.empty() == false
+                        && (done_.begin()->first == next_seq_ || (stop_ && queued_.empty() && compressing_ == 0));
+                };
+                changed_.wait(guard, [this, &ready]() { return ready() || (stop_ && jobs_ == 0) || failed_; });
+                if (failed_ || ready() == false)
+                    break;
+                job = std::move(done_.begin()->second);
+                done_.erase(done_.begin());
+                next_seq_ = job.seq;
+            }
+
+            writer_->write(Batch(std::span<const std::byte>(job.frame.data(), job.frame_length)));
+            if (index_fd_ == -1 || writer_->segment() != index_segment_)
+                open_index();
+
+            FrameIndexEntry record = { job.seq, writer_->segment_bytes() - job.frame_length, job.frame_length, job.data.size() };
+            if (::write(index_fd_, &record, sizeof(record)) != sizeof(record))
+                throw std::runtime_error(prefix_ + std::to_string(index_segment_) + ".idx write failed with error " + std::to_string(errno));
+
+            raw_bytes_   += job.data.size();
+            frame_bytes_ += job.frame_length;
+
+            std::lock_guard<std::mutex> guard(lock_);
+            next_seq_++;
+            jobs_--;
+            spare_.push_back(std::move(job));
+            changed_.notify_all();
+        }
+
+        writer_->close();
+    }
+    catch (...)
+    {
+        fail();
+    }
+}
+
+void CompressedWriter::fail()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    if (error_ == nullptr)
+        error_ = std::current_exception();
+    failed_ = true;
+    changed_.notify_all();
+}
+
+void CompressedWriter::open_index()
+{
+    if (index_fd_ != -1)
+        ::close(index_fd_);
+
+    index_segment_ = writer_->segment();
+    auto file_name = prefix_ + std::to_string(index_segment_) + ".idx";
+
+    index_fd_ = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (index_fd_ == -1)
+        throw std::runtime_error(file_name + " open failed with error " + std::to_string(errno));
+}
@@ -0,0 +1,109 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BatchSink.h"
+#include "SegmentWriter.h"
+
+class BufferPool;
+
+/**
+ * Writer of batches as compressed frames (daemon/Frame.h) into segments
+ * "memqueue_zseg_<counter>" of one directory. Batches are compressed by
+ * a pool of threads, a writer thread puts frames in order of sequence
+ * numbers and appends their positions to index "memqueue_zseg_<counter>.idx"
+ * of segment, so any batch is read without decoding others.
+ */
+class CompressedWriter : public BatchSink
+{
+public:
+    /**
+     * <output>.compress is deflate level, numbers continue after
+     * the largest one found in indexes.
+     */
+    CompressedWriter(const OutputDir & output, size_t threads, size_t segment_size = 64 << 20);
+    ~CompressedWriter() override;
+
+    CompressedWriter(const CompressedWriter &) = delete;
+    CompressedWriter & operator=(const CompressedWriter &) = delete;
+
+    uint64_t reserve() override { return seq_.fetch_add(1, std::memory_order_relaxed); }
+
+    /**
+     * Copy <batch> into queue of compressing threads, wait while
+     * too many batches are queued, unless <seq> is the next one to write.
+     */
+    void write(uint64_t seq, const Batch & batch) override;
+
+    /**
+     * Write queued batches, stop threads and rethrow their error.
+     */
+    void close() override;
+
+    size_t raw_bytes() const { return raw_bytes_; }
+    size_t frame_bytes() const { return frame_bytes_; }
+
+    /**
+     * CPU time of compressing threads, it is known after close.
+     */
+    uint64_t cpu_ns() const { return cpu_ns_; }
+
+private:
+    struct Job
+    {
+        uint64_t seq = 0;
+        std::vector<std::byte> data;
+        std::vector<std::byte> frame;
+        size_t frame_length = 0;
+    };
+
+    void compress();
+    void flush();
+    void fail();
+    void open_index();
+
+    std::string prefix_;
+    int level_;
+    size_t max_jobs_;
+    std::unique_ptr<BufferPool> buffers_;
+    std::unique_ptr<SegmentWriter> writer_;
+    int index_fd_ = -1;
+    size_t index_segment_ = 0;
+    std::atomic<uint64_t> seq_{0};
+
+    std::mutex lock_;
+    std::condition_variable changed_;
+    // batches to compress, compressed ones wait for their turn in done_
+    std::deque<Job> queued_;
+    std::map<uint64_t, Job> done_;
+    std::vector<Job> spare_;
+    size_t jobs_ = 0;
+    size_t compressing_ = 0;
+    uint64_t next_seq_ = 0;
+    bool stop_ = false;
+
+    std::atomic<size_t> raw_bytes_{0};
+    std::atomic<size_t> frame_bytes_{0};
+    std::atomic<uint64_t> cpu_ns_{0};
+
+    std::vector<std::thread> threads_;
+    std::thread flush_thread_;
+
+    std::atomic_bool failed_{false};
+    std::exception_ptr error_;
+};
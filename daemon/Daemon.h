@@ -4,6 +4,7 @@
  */
 #pragma once
 
+#include <cstdlib>
 #include <functional>
 
 class Daemon
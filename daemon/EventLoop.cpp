@@ -0,0 +1,141 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "EventLoop.h"
+
+Task::Task(Task && other) noexcept
+    : handle_(other.handle_)
+{
+    other.handle_ = nullptr;
+}
+
+Task & Task::operator=(Task && other) noexcept
+{
+    if (this != &other)
+    {
+        if (handle_)
+            handle_.destroy();
+        handle_ = other.handle_;
+        other.handle_ = nullptr;
+    }
+    return *this;
+}
+
+Task::~Task()
+{
+    // suspended coroutine is destroyed with its frame on stop
+    if (handle_)
+        handle_.destroy();
+}
+
+EventLoop::EventLoop()
+{
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ == -1)
+        throw std::runtime_error("epoll_create1 failed with error " + std::to_string(errno));
+}
+
+EventLoop::~EventLoop()
+{
+    // coroutines are destroyed before descriptor they wait on
+    tasks_.clear();
+    close(epoll_fd_);
+}
+
+void EventLoop::spawn(Task && task)
+{
+    ready_.push_back(task.handle_);
+    tasks_.push_back(std::move(task));
+}
+
+void EventLoop::wait(int fd, Waiter * waiter)
+{
+    struct epoll_event event = {};
+    event.events   = EPOLLIN | EPOLLONESHOT;
+    event.data.ptr = waiter;
+    waiter->fd_    = fd;
+
+    if (fd == -1)
+    {
+        polled_.push_back(waiter);
+        return;
+    }
+
+    // one shot descriptor is disabled after event, so it is only modified next time
+    bool added = registered_.count(fd) != 0;
+    if (epoll_ctl(epoll_fd_, added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event) == -1)
+        throw std::runtime_error("epoll_ctl failed with error " + std::to_string(errno));
+    if (!added)
+        registered_.insert(fd);
+}
+
+void EventLoop::run(const std::atomic_bool & stop, int tick_ms)
+{
+    const int max_events = 64;
+    struct epoll_event events[max_events];
+    std::vector<std::coroutine_handle<>> resumed;
+    std::vector<Waiter *> polled;
+
+    while (stop == false && tasks_.empty() == false)
+    {
+        // coroutine resumed here can make others ready, they wait for next round
+        resumed.swap(ready_);
+        for (auto handle : resumed)
+        {
+            handle.resume();
+            if (handle.done())
+                finish(handle);
+        }
+        resumed.clear();
+
+        if (ready_.empty() == false || tasks_.empty())
+            continue;
+
+        int count = epoll_wait(epoll_fd_, events, max_events, polled_.empty() ? tick_ms : std::min(tick_ms, poll_ms));
+        if (count == -1 && errno != EINTR)
+            throw std::runtime_error("epoll_wait failed with error " + std::to_string(errno));
+
+        for (int index = 0; index < count; index++)
+        {
+            auto waiter = static_cast<Waiter *>(events[index].data.ptr);
+            if (waiter->try_complete())
+                ready_.push_back(waiter->handle_);
+            else
+                wait(waiter->fd_, waiter);
+        }
+
+        polled.swap(polled_);
+        for (auto waiter : polled)
+        {
+            if (waiter->try_complete())
+                ready_.push_back(waiter->handle_);
+            else
+                polled_.push_back(waiter);
+        }
+        polled.clear();
+    }
+}
+
+void EventLoop::finish(std::coroutine_handle<> handle)
+{
+    auto task = std::find_if(tasks_.begin(), tasks_.end(), [handle](const Task & task)
+    {
+        return task.handle_ == handle;
+    });
+    if (task == tasks_.end())
+        return;
+
+    auto error = task->handle_.promise().error;
+    tasks_.erase(task);
+    if (error)
+        std::rethrow_exception(error);
+}
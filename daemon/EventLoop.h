@@ -0,0 +1,122 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Coroutine run by EventLoop, it starts when the loop runs.
+ */
+class Task
+{
+public:
+    struct promise_type
+    {
+        std::exception_ptr error;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    Task(Task && other) noexcept;
+    Task & operator=(Task && other) noexcept;
+    ~Task();
+
+    Task(const Task &) = delete;
+    Task & operator=(const Task &) = delete;
+
+private:
+    friend class EventLoop;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+/**
+ * Single thread loop resuming coroutines when their descriptors
+ * become readable, so one thread serves many queues.
+ */
+class EventLoop
+{
+public:
+    /**
+     * Coroutine waiting for descriptor. try_complete is called when
+     * descriptor is readable, false means wake up was spurious
+     * and coroutine waits again.
+     */
+    class Waiter
+    {
+    public:
+        virtual bool try_complete() { return true; }
+
+    protected:
+        ~Waiter() = default;
+
+        std::coroutine_handle<> handle_;
+        int fd_ = -1;
+
+        friend class EventLoop;
+    };
+
+    /**
+     * Awaitable resuming coroutine when <fd> is readable.
+     */
+    class Readable : public Waiter
+    {
+    public:
+        Readable(EventLoop & loop, int fd) : loop_(loop) { fd_ = fd; }
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { handle_ = handle; loop_.wait(fd_, this); }
+        void await_resume() const noexcept {}
+
+    private:
+        EventLoop & loop_;
+    };
+
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop & operator=(const EventLoop &) = delete;
+
+    void spawn(Task && task);
+
+    Readable readable(int fd) { return Readable(*this, fd); }
+
+    /**
+     * Wake <waiter> when <fd> is readable, one waiter per descriptor.
+     * Waiter without descriptor (-1) is polled by try_complete
+     * every <poll_ms> while it waits.
+     */
+    void wait(int fd, Waiter * waiter);
+
+    /**
+     * Run coroutines until all of them finish or <stop> is set,
+     * <stop> is checked every <tick_ms>. Exception of coroutine is rethrown.
+     */
+    void run(const std::atomic_bool & stop, int tick_ms = 100);
+
+private:
+    // remove finished coroutine, its exception is rethrown
+    void finish(std::coroutine_handle<> handle);
+
+    static constexpr int poll_ms = 1;
+
+    int epoll_fd_;
+    std::vector<Task> tasks_;
+    std::vector<std::coroutine_handle<>> ready_;
+    std::vector<Waiter *> polled_;
+    // descriptors added to epoll, they are rearmed by EPOLL_CTL_MOD
+    std::unordered_set<int> registered_;
+};
@@ -0,0 +1,78 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <string.h>
+
+#include <stdexcept>
+#include <string>
+
+#include "Frame.h"
+
+FrameEncoder::FrameEncoder(int level)
+{
+    memset(&stream_, 0, sizeof(stream_));
+    if (deflateInit(&stream_, level) != Z_OK)
+        throw std::runtime_error("deflateInit failed with level " + std::to_string(level));
+}
+
+FrameEncoder::~FrameEncoder()
+{
+    deflateEnd(&stream_);
+}
+
+size_t FrameEncoder::encode(uint64_t seq, std::span<const std::byte> batch, std::vector<std::byte> & frame)
+{
+    FrameHeader header = { frame_magic, frame_deflate, seq, 0, batch.size() };
+    size_t bound = deflateBound(&stream_, batch.size());
+
+    if (frame.size() < sizeof(header) + bound)
+        frame.resize(sizeof(header) + bound);
+
+    deflateReset(&stream_);
+    stream_.next_in   = reinterpret_cast<Bytef *>(const_cast<std::byte *>(batch.data()));
+    stream_.avail_in  = batch.size();
+    stream_.next_out  = reinterpret_cast<Bytef *>(frame.data() + sizeof(header));
+    stream_.avail_out = bound;
+
+    if (deflate(&stream_, Z_FINISH) != Z_STREAM_END)
+        throw std::runtime_error("deflate failed");
+    header.length = stream_.total_out;
+
+    // incompressible batch costs only its header
+    if (header.length >= batch.size())
+    {
+        header.codec  = frame_stored;
+        header.length = batch.size();
+        memcpy(frame.data() + sizeof(header), batch.data(), batch.size());
+    }
+
+    memcpy(frame.data(), &header, sizeof(header));
+    return sizeof(header) + header.length;
+}
+
+void decode_frame(std::span<const std::byte> frame, std::vector<std::byte> & batch)
+{
+    FrameHeader header;
+
+    if (frame.size() < sizeof(header))
+        throw std::runtime_error("frame is shorter than header");
+    memcpy(&header, frame.data(), sizeof(header));
+    if (header.magic != frame_magic || frame.size() - sizeof(header) < header.length)
+        throw std::runtime_error("frame " + std::to_string(header.seq) + " is damaged");
+
+    batch.resize(header.raw_length);
+    const std::byte * payload = frame.data() + sizeof(header);
+
+    if (header.codec == frame_stored && header.length == header.raw_length)
+    {
+        memcpy(batch.data(), payload, header.length);
+        return;
+    }
+
+    uLongf length = header.raw_length;
+    if (header.codec != frame_deflate
+        || uncompress(reinterpret_cast<Bytef *>(batch.data()), &length, reinterpret_cast<const Bytef *>(payload), header.length) != Z_OK
+        || length != header.raw_length)
+        throw std::runtime_error("frame " + std::to_string(header.seq) + " is damaged");
+}
@@ -0,0 +1,79 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <zlib.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+constexpr uint32_t frame_magic = 0x5a51514d;
+
+/**
+ * Codec of frame payload, batch which doesn't shrink is stored as is.
+ */
+enum FrameCodec : uint32_t
+{
+    frame_stored  = 0,
+    frame_deflate = 1,
+};
+
+/**
+ * Header of frame in compressed segment "memqueue_zseg_<counter>",
+ * every batch is a frame compressed independently of others.
+ */
+struct FrameHeader
+{
+    uint32_t magic;
+    uint32_t codec;
+    uint64_t seq;
+    // bytes of payload after header
+    uint64_t length;
+    // bytes of batch
+    uint64_t raw_length;
+};
+
+/**
+ * Record of index "memqueue_zseg_<counter>.idx", frame with its header
+ * is at <offset> of the segment.
+ */
+struct FrameIndexEntry
+{
+    uint64_t seq;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t raw_length;
+};
+
+/**
+ * Compressor of batches into frames, deflate state is allocated once
+ * and reset for every frame.
+ */
+class FrameEncoder
+{
+public:
+    explicit FrameEncoder(int level);
+    ~FrameEncoder();
+
+    FrameEncoder(const FrameEncoder &) = delete;
+    FrameEncoder & operator=(const FrameEncoder &) = delete;
+
+    /**
+     * Encode <batch> into <frame> with header, <frame> only grows.
+     * Return length of frame.
+     */
+    size_t encode(uint64_t seq, std::span<const std::byte> batch, std::vector<std::byte> & frame);
+
+private:
+    z_stream stream_;
+};
+
+/**
+ * Decode <frame> with header into <batch>, it is resized to the batch.
+ * Damaged frame is thrown as std::runtime_error.
+ */
+void decode_frame(std::span<const std::byte> frame, std::vector<std::byte> & batch);
@@ -0,0 +1,223 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "MessageIndex.h"
+
+static const char * elem_prefix = "memqueue_elem_";
+
+static void write_all(int fd, const void * data, size_t length, const std::string & file_name)
+{
+    const char * bytes = static_cast<const char *>(data);
+
+    for (size_t offset = 0; offset < length; )
+    {
+        ssize_t n_bytes = ::write(fd, bytes + offset, length - offset);
+        if (n_bytes == -1 && errno == EINTR)
+            continue;
+        if (n_bytes <= 0)
+            throw std::runtime_error(file_name + " write failed with error " + std::to_string(errno));
+        offset += n_bytes;
+    }
+}
+
+MessageIndex::MessageIndex(const std::string & file_name, size_t stride)
+    : stride_(stride)
+{
+    fd_ = open(file_name.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ == -1)
+        throw std::runtime_error(file_name + " open failed with error " + std::to_string(errno));
+
+    MessageIndexHeader header = {};
+    ssize_t n_bytes = pread(fd_, &header, sizeof(header), 0);
+
+    if (n_bytes == 0)
+    {
+        header = { message_index_magic, stride_ };
+        write_all(fd_, &header, sizeof(header), file_name);
+    }
+    else if (n_bytes != sizeof(header) || header.magic != message_index_magic || header.stride == 0)
+    {
+        close(fd_);
+        throw std::runtime_error(file_name + " isn't message index, rebuild it");
+    }
+    else
+    {
+        // record cut by crash is overwritten
+        stride_ = header.stride;
+        off_t size = lseek(fd_, 0, SEEK_END);
+        off_t records = (size - sizeof(header)) / sizeof(MessageIndexRecord);
+        if (ftruncate(fd_, sizeof(header) + records * sizeof(MessageIndexRecord)) == 0 && records > 0
+            && pread(fd_, &last_, sizeof(last_), sizeof(header) + (records - 1) * sizeof(MessageIndexRecord)) == sizeof(last_))
+            empty_ = false;
+    }
+}
+
+MessageIndex::~MessageIndex()
+{
+    close(fd_);
+}
+
+void MessageIndex::add(uint64_t seq, uint64_t time_ns)
+{
+    if (seq % stride_ != 0)
+        return;
+
+    std::lock_guard<std::mutex> guard(lock_);
+
+    if (empty_ == false && (seq <= last_.seq || time_ns < last_.time_ns))
+        return;
+
+    last_  = { seq, time_ns };
+    empty_ = false;
+    write_all(fd_, &last_, sizeof(last_), "memqueue_index");
+}
+
+uint64_t MessageIndex::now()
+{
+    struct timespec time = {};
+    clock_gettime(CLOCK_REALTIME_COARSE, &time);
+    return time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+size_t MessageIndex::rebuild(const std::string & dir, size_t stride)
+{
+    std::vector<MessageIndexRecord> files;
+    const std::string prefix = elem_prefix;
+
+    DIR * handle = opendir(dir.c_str());
+    if (handle == nullptr)
+        throw std::runtime_error(dir + " open failed with error " + std::to_string(errno));
+
+    while (struct dirent * entry = readdir(handle))
+    {
+        std::string name = entry->d_name;
+        struct stat st = {};
+        char * end = nullptr;
+
+        if (name.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        uint64_t seq = strtoull(name.c_str() + prefix.size(), &end, 10);
+        if (*end != '\0' || fstatat(dirfd(handle), name.c_str(), &st, 0) == -1)
+            continue;
+        files.push_back({ seq, st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec });
+    }
+    closedir(handle);
+
+    std::sort(files.begin(), files.end(), [](const MessageIndexRecord & left, const MessageIndexRecord & right)
+    {
+        return left.seq < right.seq;
+    });
+
+    // index is replaced at once, readers see the old or the new one
+    auto file_name = dir + "/memqueue_index";
+    auto tmp_name  = file_name + ".tmp";
+    int fd = open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        throw std::runtime_error(tmp_name + " open failed with error " + std::to_string(errno));
+
+    std::vector<MessageIndexRecord> records;
+    MessageIndexHeader header = { message_index_magic, stride };
+
+    for (auto & file : files)
+    {
+        if (file.seq % stride != 0)
+            continue;
+        if (records.empty() == false && file.time_ns < records.back().time_ns)
+            continue;
+        records.push_back(file);
+    }
+
+    try
+    {
+        write_all(fd, &header, sizeof(header), tmp_name);
+        write_all(fd, records.data(), records.size() * sizeof(MessageIndexRecord), tmp_name);
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+    close(fd);
+
+    if (rename(tmp_name.c_str(), file_name.c_str()) == -1)
+        throw std::runtime_error(file_name + " rename failed with error " + std::to_string(errno));
+    return records.size();
+}
+
+MessageIndexView::MessageIndexView(const std::string & file_name)
+{
+    struct stat st = {};
+    MessageIndexHeader header = {};
+
+    int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        throw std::runtime_error(file_name + " open failed with error " + std::to_string(errno));
+
+    if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(header))
+    {
+        close(fd);
+        throw std::runtime_error(file_name + " isn't message index, rebuild it");
+    }
+
+    size_   = st.st_size;
+    map_    = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map_ == MAP_FAILED)
+        throw std::runtime_error(file_name + " mmap failed with error " + std::to_string(errno));
+
+    memcpy(&header, map_, sizeof(header));
+    if (header.magic != message_index_magic || header.stride == 0)
+    {
+        munmap(map_, size_);
+        throw std::runtime_error(file_name + " isn't message index, rebuild it");
+    }
+
+    stride_  = header.stride;
+    records_ = std::span<const MessageIndexRecord>(
+        reinterpret_cast<const MessageIndexRecord *>(static_cast<const char *>(map_) + sizeof(header)),
+        (size_ - sizeof(header)) / sizeof(MessageIndexRecord));
+}
+
+MessageIndexView::~MessageIndexView()
+{
+    munmap(map_, size_);
+}
+
+uint64_t MessageIndexView::seq_before(uint64_t time_ns) const
+{
+    auto record = std::lower_bound(records_.begin(), records_.end(), time_ns, [](const MessageIndexRecord & record, uint64_t time)
+    {
+        return record.time_ns < time;
+    });
+    return record == records_.begin() ? 0 : std::prev(record)->seq;
+}
+
+uint64_t MessageIndexView::seq_after(uint64_t time_ns) const
+{
+    auto record = std::upper_bound(records_.begin(), records_.end(), time_ns, [](uint64_t time, const MessageIndexRecord & record)
+    {
+        return time < record.time_ns;
+    });
+    return record == records_.end() ? UINT64_MAX : record->seq;
+}
+
+std::pair<uint64_t, uint64_t> MessageIndexView::narrow(uint64_t first, uint64_t last, uint64_t from_ns, uint64_t to_ns) const
+{
+    return { std::max(first, seq_before(from_ns)), std::min(last, seq_after(to_ns)) };
+}
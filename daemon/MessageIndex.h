@@ -0,0 +1,119 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string>
+#include <utility>
+
+constexpr uint64_t message_index_magic = 0x5844494d5145554dULL;
+
+struct MessageIndexHeader
+{
+    uint64_t magic;
+    // one record per <stride> numbers of messages
+    uint64_t stride;
+};
+
+/**
+ * Record of index "memqueue_index": message <seq> stored in file
+ * "memqueue_elem_<seq>" was written at <time_ns> (CLOCK_REALTIME).
+ * Both fields grow from record to record.
+ */
+struct MessageIndexRecord
+{
+    uint64_t seq;
+    uint64_t time_ns;
+};
+
+/**
+ * Sparse index of message files appended by daemon. Time of message is
+ * the coarse clock, it has the resolution of file modification time,
+ * so the index can be rebuilt from the files.
+ */
+class MessageIndex
+{
+public:
+    /**
+     * Append to index <file_name>. <stride> is used for a new index only,
+     * existing one keeps its own (it may be rebuilt with another one),
+     * stride() returns the one in use.
+     */
+    explicit MessageIndex(const std::string & file_name, size_t stride = 64);
+    ~MessageIndex();
+
+    MessageIndex(const MessageIndex &) = delete;
+    MessageIndex & operator=(const MessageIndex &) = delete;
+
+    /**
+     * Message <seq> is written, every <stride>-th one gets a record.
+     * Called by several readers, records going backwards are skipped:
+     * with parallel readers a later stride may be recorded first, then
+     * the earlier one is lost and the index has a wider gap there.
+     * Search stays correct, it only checks more files around the gap.
+     */
+    void add(uint64_t seq, uint64_t time_ns);
+
+    uint64_t stride() const { return stride_; }
+
+    static uint64_t now();
+
+    /**
+     * Write index of message files of <dir> anew by their modification time.
+     * Return number of records.
+     */
+    static size_t rebuild(const std::string & dir, size_t stride = 64);
+
+private:
+    int fd_;
+    uint64_t stride_;
+    std::mutex lock_;
+    bool empty_ = true;
+    MessageIndexRecord last_ = {};
+};
+
+/**
+ * Index mapped for search.
+ */
+class MessageIndexView
+{
+public:
+    explicit MessageIndexView(const std::string & file_name);
+    ~MessageIndexView();
+
+    MessageIndexView(const MessageIndexView &) = delete;
+    MessageIndexView & operator=(const MessageIndexView &) = delete;
+
+    std::span<const MessageIndexRecord> records() const { return records_; }
+    uint64_t stride() const { return stride_; }
+
+    /**
+     * Number from which messages written at <time_ns> or later are
+     * searched: seq of the last record before <time_ns>, 0 if none.
+     */
+    uint64_t seq_before(uint64_t time_ns) const;
+
+    /**
+     * Number of the first record after <time_ns>, messages from it on
+     * are later. UINT64_MAX if there is no such record.
+     */
+    uint64_t seq_after(uint64_t time_ns) const;
+
+    /**
+     * Narrow numbers from <first> to <last> down to strides around
+     * messages written from <from_ns> to <to_ns>, messages at the ends
+     * still have to be checked by time of their files.
+     */
+    std::pair<uint64_t, uint64_t> narrow(uint64_t first, uint64_t last, uint64_t from_ns, uint64_t to_ns) const;
+
+private:
+    void * map_ = nullptr;
+    size_t size_ = 0;
+    uint64_t stride_ = 0;
+    std::span<const MessageIndexRecord> records_;
+};
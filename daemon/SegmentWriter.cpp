@@ -0,0 +1,174 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "SegmentWriter.h"
+#include "BufferPool.h"
+
+OutputDir OutputDir::parse(const std::string & spec)
+{
+    OutputDir output;
+    output.path = spec;
+
+    auto strip = [&output](const std::string & suffix)
+    {
+        auto & path = output.path;
+        if (path.size() <= suffix.size() || path.compare(path.size() - suffix.size(), suffix.size(), suffix) != 0)
+            return false;
+        path.resize(path.size() - suffix.size());
+        return true;
+    };
+
+    // options go in any order
+    while (true)
+    {
+        if (strip(":direct"))
+            output.direct = true;
+        else if (strip(":fast"))
+            output.compress = 1;
+        else if (strip(":ratio"))
+            output.compress = 9;
+        else
+            break;
+    }
+    return output;
+}
+
+SegmentWriter::SegmentWriter(const std::string & prefix, size_t segment_size, BufferPool * pool)
+    : prefix_(prefix)
+    , segment_size_(segment_size)
+    , pool_(pool)
+{
+    if (pool_)
+    {
+        buffer_ = pool_->acquire();
+        if (buffer_ == nullptr)
+            throw std::runtime_error(prefix_ + " no free buffer for direct I/O");
+    }
+}
+
+SegmentWriter::~SegmentWriter()
+{
+    try
+    {
+        close();
+    }
+    catch (...)
+    {
+    }
+
+    if (buffer_)
+        pool_->release(buffer_);
+}
+
+void SegmentWriter::write(const Batch & batch)
+{
+    auto data = batch.data();
+
+    // segment is opened by the first batch, idle writer leaves no empty files
+    if (fd_ == -1 || segment_written_ >= segment_size_)
+        open_segment();
+
+    if (pool_ == nullptr)
+    {
+        write_all(data.data(), data.size());
+    }
+    else
+    {
+        // only full buffers are written, so file offset stays aligned
+        for (size_t offset = 0; offset < data.size(); )
+        {
+            size_t length = std::min(data.size() - offset, pool_->buffer_size() - buffered_);
+
+            memcpy(buffer_ + buffered_, data.data() + offset, length);
+            buffered_ += length;
+            offset    += length;
+
+            if (buffered_ == pool_->buffer_size())
+            {
+                write_all(buffer_, buffered_);
+                buffered_ = 0;
+            }
+        }
+    }
+
+    segment_written_ += data.size();
+    bytes_           += data.size();
+}
+
+void SegmentWriter::close()
+{
+    if (fd_ == -1)
+        return;
+
+    int fd = fd_;
+
+    if (buffered_ != 0)
+    {
+        // direct write needs whole blocks, padding is cut off after it
+        size_t block = pool_->alignment();
+        size_t padded = (buffered_ + block - 1) / block * block;
+
+        memset(buffer_ + buffered_, 0, padded - buffered_);
+        write_all(buffer_, padded);
+        buffered_ = 0;
+
+        if (ftruncate(fd, segment_written_) == -1)
+        {
+            fd_ = -1;
+            ::close(fd);
+            throw std::runtime_error(prefix_ + std::to_string(counter_) + " truncate failed with error " + std::to_string(errno));
+        }
+    }
+
+    fd_ = -1;
+    ::close(fd);
+    counter_++;
+}
+
+void SegmentWriter::write_all(const std::byte * data, size_t length)
+{
+    for (size_t offset = 0; offset < length; )
+    {
+        ssize_t n_bytes = ::write(fd_, data + offset, length - offset);
+        if (n_bytes == -1 && errno == EINTR)
+            continue;
+        if (n_bytes <= 0)
+            throw std::runtime_error(prefix_ + std::to_string(counter_) + " write failed with error " + std::to_string(errno));
+        offset += n_bytes;
+    }
+}
+
+void SegmentWriter::open_segment()
+{
+    int flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+
+    if (pool_)
+        flags |= O_DIRECT;
+
+    close();
+
+    while (true)
+    {
+        auto file_name = prefix_ + std::to_string(counter_);
+
+        fd_ = open(file_name.c_str(), flags, 0644);
+        if (fd_ != -1)
+            break;
+        if (errno == EINVAL && pool_)
+            throw std::runtime_error(file_name + " file system doesn't support direct I/O");
+        if (errno != EEXIST)
+            throw std::runtime_error(file_name + " open failed with error " + std::to_string(errno));
+        counter_++;
+    }
+
+    segment_written_ = 0;
+}
@@ -0,0 +1,79 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "Source.h"
+
+class BufferPool;
+
+/**
+ * Directory for segments with options added as suffixes: "<path>:direct"
+ * selects direct I/O, ":fast" or ":ratio" compress batches into frames
+ * by deflate of level 1 or 9.
+ */
+struct OutputDir
+{
+    std::string path;
+    bool direct = false;
+    // deflate level, 0 - batches are written as is
+    int compress = 0;
+
+    static OutputDir parse(const std::string & spec);
+};
+
+/**
+ * Writer of batches into segment files <prefix><counter>. Batch is never
+ * split between segments, so every segment holds whole length-prefixed
+ * messages. Existing segments are skipped, not overwritten.
+ *
+ * With <pool> segments are opened with O_DIRECT and batches are packed
+ * into a buffer of the pool, which is written when it's full. The tail
+ * of segment is padded to a block on close and cut off by ftruncate.
+ */
+class SegmentWriter
+{
+public:
+    explicit SegmentWriter(const std::string & prefix, size_t segment_size = 64 << 20, BufferPool * pool = nullptr);
+    ~SegmentWriter();
+
+    SegmentWriter(const SegmentWriter &) = delete;
+    SegmentWriter & operator=(const SegmentWriter &) = delete;
+
+    void write(const Batch & batch);
+
+    /**
+     * Write buffered tail and close current segment, the next batch
+     * opens a new one. Errors of destructor are lost, so owner calls it.
+     */
+    void close();
+
+    /**
+     * Bytes written by this writer into all segments.
+     */
+    size_t bytes() const { return bytes_; }
+
+    /**
+     * Counter and length of current segment, the last batch ends there.
+     */
+    size_t segment() const { return counter_; }
+    size_t segment_bytes() const { return segment_written_; }
+
+private:
+    void open_segment();
+    void write_all(const std::byte * data, size_t length);
+
+    std::string prefix_;
+    size_t segment_size_;
+    BufferPool * pool_;
+    std::byte * buffer_ = nullptr;
+    size_t buffered_ = 0;
+    size_t counter_ = 0;
+    int fd_ = -1;
+    size_t segment_written_ = 0;
+    size_t bytes_ = 0;
+};
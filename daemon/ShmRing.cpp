@@ -0,0 +1,257 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include "ShmRing.h"
+
+// length of record which marks the end of ring, the next record is at its start
+static constexpr size_t wrap_marker = ~size_t(0);
+
+static std::string fifo_path(const std::string & name)
+{
+    return "/dev/shm/" + name + ".notify";
+}
+
+ShmRing::ShmRing(const std::string & name, size_t size)
+    : name_(name)
+    , fd_(-1)
+    , notify_fd_(-1)
+    , size_(0)
+    , header_(nullptr)
+    , data_(nullptr)
+{
+    if (name.empty() || name.find('/') != std::string::npos)
+        throw std::invalid_argument("ring name " + name + " must be a file name");
+
+    std::string path = "/" + name;
+    bool created = true;
+
+    fd_ = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd_ == -1 && errno == EEXIST)
+    {
+        created = false;
+        fd_ = shm_open(path.c_str(), O_RDWR | O_CLOEXEC, 0600);
+    }
+    if (fd_ == -1)
+        throw std::runtime_error("ring " + name + " open failed with error " + std::to_string(errno));
+
+    struct stat status = {};
+
+    if (created)
+    {
+        size_ = 4096;
+        while (size_ < size)
+            size_ <<= 1;
+        if (ftruncate(fd_, data_offset + size_) == -1)
+        {
+            int error = errno;
+            close(fd_);
+            shm_unlink(path.c_str());
+            throw std::runtime_error("ring " + name + " resize failed with error " + std::to_string(error));
+        }
+    }
+    else
+    {
+        // creator sizes the ring right after it is created
+        for (int attempt = 0; attempt < 1000 && fstat(fd_, &status) == 0 && status.st_size == 0; attempt++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (static_cast<size_t>(status.st_size) <= data_offset)
+        {
+            close(fd_);
+            throw std::runtime_error("ring " + name + " isn't initialized");
+        }
+        size_ = status.st_size - data_offset;
+    }
+
+    void * memory = mmap(nullptr, data_offset + size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (memory == MAP_FAILED)
+    {
+        int error = errno;
+        close(fd_);
+        throw std::runtime_error("ring " + name + " mmap failed with error " + std::to_string(error));
+    }
+    header_ = static_cast<ShmRingHeader *>(memory);
+    data_   = static_cast<std::byte *>(memory) + data_offset;
+
+    if (created)
+    {
+        new (header_) ShmRingHeader {};
+        header_->size = size_;
+        header_->magic.store(ShmRingHeader::ring_magic, std::memory_order_release);
+    }
+    else
+    {
+        for (int attempt = 0; attempt < 1000 && header_->magic.load(std::memory_order_acquire) != ShmRingHeader::ring_magic; attempt++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (header_->magic.load(std::memory_order_acquire) != ShmRingHeader::ring_magic || header_->size != size_)
+        {
+            munmap(header_, data_offset + size_);
+            close(fd_);
+            throw std::runtime_error("ring " + name + " has wrong header");
+        }
+    }
+
+    // fifo is opened for reading and writing, so opening it doesn't wait for the other side
+    if (mkfifo(fifo_path(name).c_str(), 0600) == -1 && errno != EEXIST)
+    {
+        int error = errno;
+        munmap(header_, data_offset + size_);
+        close(fd_);
+        throw std::runtime_error("ring " + name + " fifo failed with error " + std::to_string(error));
+    }
+    notify_fd_ = open(fifo_path(name).c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (notify_fd_ == -1)
+    {
+        int error = errno;
+        munmap(header_, data_offset + size_);
+        close(fd_);
+        throw std::runtime_error("ring " + name + " fifo open failed with error " + std::to_string(error));
+    }
+}
+
+ShmRing::~ShmRing()
+{
+    munmap(header_, data_offset + size_);
+    close(notify_fd_);
+    close(fd_);
+}
+
+void ShmRing::remove(const std::string & name)
+{
+    shm_unlink(("/" + name).c_str());
+    unlink(fifo_path(name).c_str());
+}
+
+void ShmRing::lock_consumer()
+{
+    if (flock(fd_, LOCK_EX | LOCK_NB) == -1)
+        throw std::runtime_error("ring " + name_ + " is read by another consumer");
+}
+
+bool ShmRing::try_push(std::span<const std::byte> message)
+{
+    size_t record = sizeof(size_t) + message.size();
+    if (record > size_ / 2)
+        throw std::runtime_error("message of " + std::to_string(message.size()) + " bytes doesn't fit into ring " + name_);
+
+    for (int spins = 0; header_->lock.test_and_set(std::memory_order_acquire); spins++)
+    {
+        if (spins >= 64)
+            std::this_thread::yield();
+    }
+
+    uint64_t start  = header_->head.load(std::memory_order_relaxed);
+    uint64_t head   = start;
+    uint64_t tail   = header_->tail.load(std::memory_order_acquire);
+    size_t offset   = head & (size_ - 1);
+    size_t to_end   = size_ - offset;
+    size_t wrapped  = record > to_end ? to_end : 0;
+
+    if (head + wrapped + record - tail > size_)
+    {
+        header_->lock.clear(std::memory_order_release);
+        return false;
+    }
+
+    // record isn't split by the end of ring, the rest of it is skipped,
+    // consumer knows a tail shorter than length prefix is skipped
+    if (wrapped != 0)
+    {
+        if (to_end >= sizeof(size_t))
+            memcpy(data_ + offset, &wrap_marker, sizeof(size_t));
+        head  += wrapped;
+        offset = 0;
+    }
+
+    size_t length = message.size();
+    memcpy(data_ + offset, &length, sizeof(size_t));
+    memcpy(data_ + offset + sizeof(size_t), message.data(), length);
+
+    // pairs with consumer storing tail before it loads head: either it sees
+    // this message or this producer sees it drained the ring and wakes it
+    header_->head.store(head + record, std::memory_order_seq_cst);
+    tail = header_->tail.load(std::memory_order_seq_cst);
+    header_->lock.clear(std::memory_order_release);
+
+    if (tail == start)
+        notify();
+    return true;
+}
+
+size_t ShmRing::read_batch(std::vector<std::byte> & buffer)
+{
+    uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    uint64_t head = header_->head.load(std::memory_order_seq_cst);
+    uint64_t pos  = tail;
+    uint64_t run  = tail;
+    size_t length = 0;
+
+    // messages are copied by contiguous runs, a run ends at the end of ring
+    auto copy_run = [&]()
+    {
+        memcpy(buffer.data() + length, data_ + (run & (size_ - 1)), pos - run);
+        length += pos - run;
+    };
+
+    while (pos != head)
+    {
+        size_t offset = pos & (size_ - 1);
+        size_t to_end = size_ - offset;
+        size_t message = wrap_marker;
+
+        if (to_end >= sizeof(size_t))
+            memcpy(&message, data_ + offset, sizeof(size_t));
+
+        if (message == wrap_marker)
+        {
+            copy_run();
+            pos += to_end;
+            run  = pos;
+            continue;
+        }
+
+        size_t record = sizeof(size_t) + message;
+        if (length + (pos - run) + record > buffer.size())
+        {
+            if (length + (pos - run) != 0)
+                break;
+            buffer.resize(record);
+        }
+        pos += record;
+    }
+    copy_run();
+
+    if (pos != tail)
+        header_->tail.store(pos, std::memory_order_seq_cst);
+    return length;
+}
+
+void ShmRing::notify()
+{
+    char signal = 0;
+
+    // fifo which is full already wakes consumer
+    if (write(notify_fd_, &signal, 1) == -1 && errno != EAGAIN)
+        throw std::runtime_error("ring " + name_ + " notify failed with error " + std::to_string(errno));
+}
+
+void ShmRing::clear_notify()
+{
+    char signals[256];
+
+    while (read(notify_fd_, signals, sizeof(signals)) == sizeof(signals))
+        ;
+}
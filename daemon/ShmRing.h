@@ -0,0 +1,95 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+/**
+ * Header of ring in shared memory, data starts at ShmRing::data_offset.
+ * Positions only grow, offset of position is position % size.
+ */
+struct ShmRingHeader
+{
+    static constexpr uint32_t ring_magic = 0x524d514d;
+
+    std::atomic<uint32_t> magic;
+    uint64_t size;
+
+    // written by producers under lock
+    alignas(64) std::atomic<uint64_t> head;
+    // written by consumer
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) std::atomic_flag lock;
+};
+
+/**
+ * Ring of messages in shared memory "/dev/shm/<name>", written by
+ * producers of any process and read by one consumer. Messages are
+ * stored prefixed by length as in Batch, so a run of them is passed
+ * to consumer by one memcpy. Producers serialize on a spin lock in
+ * the header, consumer doesn't take it. Producer killed while holding
+ * the lock stops the other ones, ring has to be removed then.
+ * Producer which finds the ring drained writes a byte into fifo
+ * "/dev/shm/<name>.notify", consumer waits on its descriptor.
+ * Ring outlives processes, messages left by a stopped consumer
+ * are read by the next one.
+ */
+class ShmRing
+{
+public:
+    static constexpr size_t data_offset = 4096;
+
+    /**
+     * Open ring <name>, it is created of <size> bytes rounded up
+     * to power of two if it doesn't exist yet.
+     */
+    explicit ShmRing(const std::string & name, size_t size = 64 << 20);
+    ~ShmRing();
+
+    ShmRing(const ShmRing &) = delete;
+    ShmRing & operator=(const ShmRing &) = delete;
+
+    /**
+     * Remove ring <name> and its fifo, processes which opened it keep it.
+     */
+    static void remove(const std::string & name);
+
+    /**
+     * Return false if ring is full. Message longer than half of ring
+     * can never be written and is an error.
+     */
+    bool try_push(std::span<const std::byte> message);
+
+    /**
+     * Make this process the only consumer of ring, it is released on close.
+     */
+    void lock_consumer();
+
+    /**
+     * Read whole messages up to size of <buffer> into it, the buffer
+     * is grown for a longer message. Return length of batch.
+     */
+    size_t read_batch(std::vector<std::byte> & buffer);
+
+    int notify_fd() const { return notify_fd_; }
+    void clear_notify();
+
+    size_t size() const { return size_; }
+
+private:
+    void notify();
+
+    std::string name_;
+    int fd_;
+    int notify_fd_;
+    size_t size_;
+    ShmRingHeader * header_;
+    std::byte * data_;
+};
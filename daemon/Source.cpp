@@ -0,0 +1,96 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <stdexcept>
+
+#include "Source.h"
+#include "../include/queue.h"
+#include "../include/memqueue_ioctl.h"
+
+DeviceSource::DeviceSource(const std::string & path, unsigned long long partitions)
+    : path_(path)
+{
+    fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ == -1)
+        throw std::runtime_error(path + " open failed with error " + std::to_string(errno));
+
+    if (ioctl(fd_, MEMQUEUE_IOC_SET_FRAMED, 1) == -1 ||
+        ioctl(fd_, MEMQUEUE_IOC_SET_PARTITIONS, &partitions) == -1)
+    {
+        int error = errno;
+        close(fd_);
+        throw std::runtime_error(path + " setup failed with error " + std::to_string(error));
+    }
+}
+
+DeviceSource::~DeviceSource()
+{
+    close(fd_);
+}
+
+size_t DeviceSource::read_batch(std::vector<std::byte> & buffer)
+{
+    while (true)
+    {
+        ssize_t n_bytes = read(fd_, buffer.data(), buffer.size());
+        if (n_bytes >= 0)
+            return n_bytes;
+
+        if (errno != EMSGSIZE)
+            throw std::runtime_error(path_ + " read failed with error " + std::to_string(errno));
+
+        // message with its prefix doesn't fit into buffer, grow it
+        unsigned long next_length = 0;
+        if (ioctl(fd_, MEMQUEUE_IOC_NEXT_LEN, &next_length) == -1)
+            throw std::runtime_error(path_ + " next length failed with error " + std::to_string(errno));
+        buffer.resize(next_length + sizeof(size_t));
+    }
+}
+
+size_t MemorySource::read_batch(std::vector<std::byte> & buffer)
+{
+    size_t length = 0;
+
+    queue_.consume_batch([&buffer, &length](std::span<const std::byte> message)
+    {
+        size_t size = message.size();
+        if (buffer.size() < length + sizeof(size_t) + size)
+            buffer.resize(length + sizeof(size_t) + size);
+        memcpy(buffer.data() + length, &size, sizeof(size_t));
+        memcpy(buffer.data() + length + sizeof(size_t), message.data(), size);
+        length += sizeof(size_t) + size;
+    }, 64);
+    return length;
+}
+
+void MemorySource::clear_notify()
+{
+    eventfd_t value = 0;
+
+    if (notify_fd_ != -1)
+        eventfd_read(notify_fd_, &value);
+}
+
+ShmSource::ShmSource(const std::string & name, size_t size)
+    : ring_(name, size)
+{
+    ring_.lock_consumer();
+}
+
+std::unique_ptr<Source> open_source(const std::string & spec, unsigned long long partitions)
+{
+    const std::string shm_prefix = "shm:";
+
+    if (spec.compare(0, shm_prefix.size(), shm_prefix) != 0)
+        return std::make_unique<DeviceSource>(spec, partitions);
+
+    if (partitions != ~0ULL)
+        throw std::runtime_error(spec + " can't be read by partitions");
+    return std::make_unique<ShmSource>(spec.substr(shm_prefix.size()));
+}
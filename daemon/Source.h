@@ -0,0 +1,154 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <string.h>
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "ShmRing.h"
+
+namespace memqueue
+{
+class Queue;
+}
+
+/**
+ * Whole messages read by one call, each prefixed by its length as size_t.
+ * It is valid till the next batch is read into the same buffer.
+ */
+class Batch
+{
+public:
+    class iterator
+    {
+    public:
+        explicit iterator(const std::byte * pos) : pos_(pos) {}
+
+        std::span<const std::byte> operator*() const
+        {
+            size_t length = 0;
+            memcpy(&length, pos_, sizeof(size_t));
+            return std::span<const std::byte>(pos_ + sizeof(size_t), length);
+        }
+
+        iterator & operator++()
+        {
+            pos_ += sizeof(size_t) + (**this).size();
+            return *this;
+        }
+
+        bool operator!=(const iterator & other) const { return pos_ != other.pos_; }
+
+    private:
+        const std::byte * pos_;
+    };
+
+    explicit Batch(std::span<const std::byte> data) : data_(data) {}
+
+    iterator begin() const { return iterator(data_.data()); }
+    iterator end() const { return iterator(data_.data() + data_.size()); }
+
+    std::span<const std::byte> data() const { return data_; }
+    size_t bytes() const { return data_.size(); }
+    bool empty() const { return data_.empty(); }
+
+private:
+    std::span<const std::byte> data_;
+};
+
+/**
+ * Queue drained by daemon.
+ */
+class Source
+{
+public:
+    virtual ~Source() = default;
+
+    /**
+     * Descriptor which is readable when source may have messages.
+     */
+    virtual int fd() const = 0;
+
+    /**
+     * Read batch into <buffer>, it can be grown for a long message.
+     * Return length of batch, 0 if source is empty.
+     */
+    virtual size_t read_batch(std::vector<std::byte> & buffer) = 0;
+
+    /**
+     * Reset notification of descriptor before source is read after wake up.
+     */
+    virtual void clear_notify() {}
+};
+
+/**
+ * memqueue device in framed mode, reading partitions set in <partitions>.
+ */
+class DeviceSource : public Source
+{
+public:
+    explicit DeviceSource(const std::string & path, unsigned long long partitions = ~0ULL);
+    ~DeviceSource() override;
+
+    DeviceSource(const DeviceSource &) = delete;
+    DeviceSource & operator=(const DeviceSource &) = delete;
+
+    int fd() const override { return fd_; }
+    size_t read_batch(std::vector<std::byte> & buffer) override;
+
+private:
+    std::string path_;
+    int fd_;
+};
+
+/**
+ * Memory queue of this process, producer signals <notify_fd> (non-blocking
+ * eventfd) after writing, -1 if it doesn't. Batch holds up to 64 messages.
+ */
+class MemorySource : public Source
+{
+public:
+    MemorySource(memqueue::Queue & queue, int notify_fd = -1)
+        : queue_(queue), notify_fd_(notify_fd)
+    {
+    }
+
+    int fd() const override { return notify_fd_; }
+    size_t read_batch(std::vector<std::byte> & buffer) override;
+    void clear_notify() override;
+
+private:
+    memqueue::Queue & queue_;
+    int notify_fd_;
+};
+
+/**
+ * Ring in shared memory fed by producers of other processes,
+ * source is its only consumer.
+ */
+class ShmSource : public Source
+{
+public:
+    explicit ShmSource(const std::string & name, size_t size = 64 << 20);
+
+    int fd() const override { return ring_.notify_fd(); }
+    size_t read_batch(std::vector<std::byte> & buffer) override { return ring_.read_batch(buffer); }
+    void clear_notify() override { ring_.clear_notify(); }
+
+private:
+    ShmRing ring_;
+};
+
+/**
+ * Source named by <spec>: "shm:<name>" is ShmSource, anything else
+ * is path of memqueue device reading <partitions>.
+ * Shared memory ring has no partitions, so it is taken only with all of them.
+ */
+std::unique_ptr<Source> open_source(const std::string & spec, unsigned long long partitions = ~0ULL);
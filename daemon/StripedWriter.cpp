@@ -0,0 +1,277 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/statvfs.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include "StripedWriter.h"
+#include "BufferPool.h"
+
+// batches queued per target before writer waits
+static const size_t max_queued = 8;
+// manifest records kept in memory before they are appended
+static const size_t max_pending = 256;
+
+static const char * manifest_name = "/memqueue_manifest";
+
+static void write_manifest(int fd, const std::vector<ManifestEntry> & entries)
+{
+    const char * data = reinterpret_cast<const char *>(entries.data());
+    size_t length = entries.size() * sizeof(ManifestEntry);
+
+    for (size_t offset = 0; offset < length; )
+    {
+        ssize_t n_bytes = ::write(fd, data + offset, length - offset);
+        if (n_bytes == -1 && errno == EINTR)
+            continue;
+        if (n_bytes <= 0)
+            throw std::runtime_error("manifest write failed with error " + std::to_string(errno));
+        offset += n_bytes;
+    }
+}
+
+StripedWriter::StripedWriter(const std::vector<OutputDir> & targets, Policy policy, size_t segment_size)
+    : policy_(policy)
+    , refresh_bytes_(segment_size)
+{
+    std::vector<std::string> dirs;
+
+    if (targets.empty())
+        throw std::invalid_argument("striped writer needs targets");
+
+    for (auto & output : targets)
+    {
+        auto target = std::make_unique<Target>();
+
+        target->output = output;
+        if (output.direct)
+            target->buffers = std::make_unique<BufferPool>(1, 1 << 20);
+        target->writer = std::make_unique<SegmentWriter>(output.path + "/memqueue_seg_", segment_size, target->buffers.get());
+
+        auto file_name = output.path + manifest_name;
+        target->manifest_fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (target->manifest_fd == -1)
+            throw std::runtime_error(file_name + " open failed with error " + std::to_string(errno));
+
+        // record cut by crash is dropped, so records appended after it stay aligned
+        off_t size = lseek(target->manifest_fd, 0, SEEK_END);
+        if (size == -1 || ftruncate(target->manifest_fd, size / sizeof(ManifestEntry) * sizeof(ManifestEntry)) == -1)
+            throw std::runtime_error(file_name + " truncate failed with error " + std::to_string(errno));
+
+        dirs.push_back(output.path);
+        targets_.push_back(std::move(target));
+    }
+
+    auto records = read_manifests(dirs);
+    if (records.empty() == false)
+        seq_ = records.back().entry.seq + 1;
+
+    refresh_free_space();
+
+    for (auto & target : targets_)
+    {
+        Target * pointer = target.get();
+        target->thread = std::thread([this, pointer]() { run(*pointer); });
+    }
+}
+
+StripedWriter::~StripedWriter()
+{
+    try
+    {
+        close();
+    }
+    catch (...)
+    {
+    }
+
+    for (auto & target : targets_)
+    {
+        if (target->manifest_fd != -1)
+            ::close(target->manifest_fd);
+    }
+}
+
+void StripedWriter::write(uint64_t seq, const Batch & batch)
+{
+    Target & target = *targets_[pick(batch.bytes())];
+    std::unique_lock<std::mutex> guard(target.lock);
+
+    target.changed.wait(guard, [this, &target]()
+    {
+        return target.queue.size() < max_queued || failed_;
+    });
+
+    if (failed_)
+    {
+        std::lock_guard<std::mutex> error_guard(error_lock_);
+        std::rethrow_exception(error_);
+    }
+
+    std::vector<std::byte> data;
+    if (target.spare.empty() == false)
+    {
+        data.swap(target.spare.back());
+        target.spare.pop_back();
+    }
+    data.assign(batch.data().begin(), batch.data().end());
+
+    target.queue.push_back({ seq, std::move(data) });
+    target.changed.notify_all();
+}
+
+void StripedWriter::close()
+{
+    for (auto & target : targets_)
+    {
+        std::lock_guard<std::mutex> guard(target->lock);
+        target->stop = true;
+        target->changed.notify_all();
+    }
+
+    for (auto & target : targets_)
+    {
+        if (target->thread.joinable())
+            target->thread.join();
+    }
+
+    std::lock_guard<std::mutex> guard(error_lock_);
+    if (error_)
+        std::rethrow_exception(std::exchange(error_, nullptr));
+}
+
+size_t StripedWriter::pick(size_t length)
+{
+    std::lock_guard<std::mutex> guard(pick_lock_);
+
+    if (policy_ == Policy::round_robin)
+        return next_++ % targets_.size();
+
+    picked_bytes_ += length;
+    if (picked_bytes_ >= refresh_bytes_)
+        refresh_free_space();
+
+    size_t best = 0;
+    for (size_t index = 1; index < targets_.size(); index++)
+    {
+        if (targets_[index]->free_space > targets_[best]->free_space)
+            best = index;
+    }
+
+    targets_[best]->free_space -= length;
+    return best;
+}
+
+void StripedWriter::refresh_free_space()
+{
+    for (auto & target : targets_)
+    {
+        struct statvfs stats = {};
+        if (statvfs(target->output.path.c_str(), &stats) == 0)
+            target->free_space = static_cast<int64_t>(stats.f_bavail * stats.f_frsize);
+    }
+    picked_bytes_ = 0;
+}
+
+void StripedWriter::run(Target & target)
+{
+    std::vector<ManifestEntry> pending;
+
+    try
+    {
+        while (true)
+        {
+            Item item;
+            {
+                std::unique_lock<std::mutex> guard(target.lock);
+                target.changed.wait(guard, [&target]() { return target.queue.empty() == false || target.stop; });
+                if (target.queue.empty())
+                    break;
+                item = std::move(target.queue.front());
+                target.queue.pop_front();
+            }
+
+            target.writer->write(Batch(item.data));
+            pending.push_back({ item.seq, target.writer->segment(), target.writer->segment_bytes() - item.data.size(), item.data.size() });
+            target.written += item.data.size();
+
+            bool idle = false;
+            {
+                std::lock_guard<std::mutex> guard(target.lock);
+                target.spare.push_back(std::move(item.data));
+                idle = target.queue.empty();
+                target.changed.notify_all();
+            }
+
+            // manifest is appended by records, not by every batch
+            if (idle || pending.size() >= max_pending)
+            {
+                write_manifest(target.manifest_fd, pending);
+                pending.clear();
+            }
+        }
+
+        target.writer->close();
+        write_manifest(target.manifest_fd, pending);
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> error_guard(error_lock_);
+        if (error_ == nullptr)
+            error_ = std::current_exception();
+        failed_ = true;
+
+        // wake writers waiting for this queue
+        std::lock_guard<std::mutex> guard(target.lock);
+        target.changed.notify_all();
+    }
+}
+
+std::vector<StripedWriter::Record> StripedWriter::read_manifests(const std::vector<std::string> & dirs)
+{
+    std::vector<Record> records;
+
+    for (size_t target = 0; target < dirs.size(); target++)
+    {
+        auto file_name = dirs[target] + manifest_name;
+        int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            if (errno == ENOENT)
+                continue;
+            throw std::runtime_error(file_name + " open failed with error " + std::to_string(errno));
+        }
+
+        ManifestEntry entries[256];
+        while (true)
+        {
+            ssize_t n_bytes = read(fd, entries, sizeof(entries));
+            if (n_bytes == -1 && errno == EINTR)
+                continue;
+            if (n_bytes == -1)
+            {
+                ::close(fd);
+                throw std::runtime_error(file_name + " read failed with error " + std::to_string(errno));
+            }
+            // record cut by crash is dropped
+            for (ssize_t index = 0; index < n_bytes / static_cast<ssize_t>(sizeof(ManifestEntry)); index++)
+                records.push_back({ target, entries[index] });
+            if (n_bytes < static_cast<ssize_t>(sizeof(entries)))
+                break;
+        }
+        ::close(fd);
+    }
+
+    std::sort(records.begin(), records.end(), [](const Record & left, const Record & right)
+    {
+        return left.entry.seq < right.entry.seq;
+    });
+    return records;
+}
@@ -0,0 +1,132 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BatchSink.h"
+#include "SegmentWriter.h"
+
+class BufferPool;
+
+/**
+ * Record of manifest "memqueue_manifest" of every target: batch <seq>
+ * is at <offset> of segment "memqueue_seg_<segment>" of this target.
+ * Records of a target are appended in order of writing, which can differ
+ * from order of <seq> a bit, so reader sorts records of all targets by it.
+ */
+struct ManifestEntry
+{
+    uint64_t seq;
+    uint64_t segment;
+    uint64_t offset;
+    uint64_t length;
+};
+
+/**
+ * Writer spreading batches over several directories, one per disk,
+ * with a thread per directory. Every batch gets a global sequence number,
+ * manifests of directories restore the order of batches.
+ */
+class StripedWriter : public BatchSink
+{
+public:
+    enum class Policy
+    {
+        // targets take batches in turn
+        round_robin,
+        // batch goes to the target with most free space
+        free_space,
+    };
+
+    /**
+     * Numbers continue after the largest one found in manifests.
+     */
+    StripedWriter(const std::vector<OutputDir> & targets, Policy policy, size_t segment_size = 64 << 20);
+    ~StripedWriter() override;
+
+    StripedWriter(const StripedWriter &) = delete;
+    StripedWriter & operator=(const StripedWriter &) = delete;
+
+    uint64_t reserve() override { return seq_.fetch_add(1, std::memory_order_relaxed); }
+
+    /**
+     * Copy <batch> into queue of a target, wait while the queue is full.
+     */
+    void write(uint64_t seq, const Batch & batch) override;
+
+    /**
+     * Write queued batches, stop target threads and rethrow their error.
+     */
+    void close() override;
+
+    size_t targets() const { return targets_.size(); }
+    size_t bytes(size_t target) const { return targets_[target]->written; }
+
+    /**
+     * Read records of manifests in <dirs> sorted by sequence number,
+     * <target> of record is index of its directory.
+     */
+    struct Record
+    {
+        size_t target;
+        ManifestEntry entry;
+    };
+    static std::vector<Record> read_manifests(const std::vector<std::string> & dirs);
+
+private:
+    struct Item
+    {
+        uint64_t seq;
+        std::vector<std::byte> data;
+    };
+
+    struct Target
+    {
+        OutputDir output;
+        std::unique_ptr<BufferPool> buffers;
+        std::unique_ptr<SegmentWriter> writer;
+        int manifest_fd = -1;
+
+        std::mutex lock;
+        std::condition_variable changed;
+        std::deque<Item> queue;
+        // vectors of written items, they are reused by next batches
+        std::vector<std::vector<std::byte>> spare;
+        bool stop = false;
+
+        // free bytes of file system minus bytes queued since it was read
+        int64_t free_space = 0;
+        std::atomic<size_t> written{0};
+        std::thread thread;
+    };
+
+    size_t pick(size_t length);
+    void run(Target & target);
+    void refresh_free_space();
+
+    std::vector<std::unique_ptr<Target>> targets_;
+    Policy policy_;
+    std::atomic<uint64_t> seq_{0};
+
+    std::mutex pick_lock_;
+    size_t next_ = 0;
+    size_t picked_bytes_ = 0;
+    size_t refresh_bytes_;
+
+    std::atomic_bool failed_{false};
+    std::mutex error_lock_;
+    std::exception_ptr error_;
+};
@@ -0,0 +1,84 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <errno.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "WaitStrategy.h"
+
+WaitStrategy::WaitStrategy(const WaitParams & params, short events)
+    : params_(params)
+    , events_(events)
+{
+}
+
+WaitParams WaitStrategy::for_latency(std::chrono::microseconds latency)
+{
+    using namespace std::chrono;
+
+    // spin covers gaps inside a burst, sleep is bounded by latency,
+    // reader blocks after it had nothing for many sleeps.
+    // On single CPU spinning reader only delays producer, so it sleeps at once
+    bool single_cpu = std::thread::hardware_concurrency() <= 1;
+
+    return WaitParams
+    {
+        single_cpu ? microseconds(0) : std::min<microseconds>(latency, microseconds(100)),
+        std::max<microseconds>(latency, microseconds(1)),
+        std::max<microseconds>(latency * 10, milliseconds(1)),
+        milliseconds(100),
+    };
+}
+
+void WaitStrategy::wait(std::span<const int> fds)
+{
+    using namespace std::chrono;
+
+    auto now = clock::now();
+
+    if (idle_ == false)
+    {
+        idle_       = true;
+        idle_since_ = now;
+        sleep_      = microseconds(1);
+    }
+
+    auto idle = now - idle_since_;
+
+    if (idle < params_.spin)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        stats_.spins++;
+        stats_.spin_ns += duration_cast<nanoseconds>(clock::now() - now).count();
+        return;
+    }
+
+    bool can_block = std::any_of(fds.begin(), fds.end(), [](int fd) { return fd >= 0; });
+
+    if (idle < params_.block_after || can_block == false)
+    {
+        std::this_thread::sleep_for(sleep_);
+        sleep_ = std::min(sleep_ * 2, params_.max_sleep);
+        stats_.sleeps++;
+        stats_.backoff_ns += duration_cast<nanoseconds>(clock::now() - now).count();
+        return;
+    }
+
+    poll_fds_.clear();
+    for (auto fd : fds)
+        poll_fds_.push_back({ fd, events_, 0 });
+
+    if (poll(poll_fds_.data(), poll_fds_.size(), params_.block_timeout.count()) == -1 && errno != EINTR)
+        throw std::runtime_error("poll failed with error " + std::to_string(errno));
+
+    // reader checks queue after wake up, but keeps blocking if it's empty
+    stats_.blocks++;
+    stats_.block_ns += duration_cast<nanoseconds>(clock::now() - now).count();
+}
@@ -0,0 +1,83 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <poll.h>
+
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/**
+ * Limits of phases of waiting for messages.
+ */
+struct WaitParams
+{
+    // busy poll while queue is empty for this time
+    std::chrono::microseconds spin;
+    // then sleep 1, 2, 4, ... us, but not longer than this
+    std::chrono::microseconds max_sleep;
+    // then block in poll when queue is empty for this time
+    std::chrono::microseconds block_after;
+    // blocked reader wakes up at least this often to check stop
+    std::chrono::milliseconds block_timeout;
+};
+
+/**
+ * Time spent in every phase and number of waits in it.
+ */
+struct WaitStats
+{
+    uint64_t spin_ns     = 0;
+    uint64_t backoff_ns  = 0;
+    uint64_t block_ns    = 0;
+    uint64_t spins       = 0;
+    uint64_t sleeps      = 0;
+    uint64_t blocks      = 0;
+};
+
+/**
+ * Waiting of reader which found queue empty: busy poll first, so
+ * burst after a short pause is read without delay, then exponential
+ * backoff, then blocking in poll on descriptors of queue, so idle
+ * reader doesn't wake up. Without descriptors backoff goes on.
+ * Writer of full queue waits the same way for POLLOUT.
+ */
+class WaitStrategy
+{
+public:
+    explicit WaitStrategy(const WaitParams & params, short events = POLLIN);
+
+    /**
+     * Parameters adding at most <latency> to the first message
+     * after pause while reader isn't blocked.
+     */
+    static WaitParams for_latency(std::chrono::microseconds latency);
+
+    /**
+     * Reader got messages, the next wait starts from busy poll.
+     */
+    void reset() { idle_ = false; }
+
+    /**
+     * Wait once after empty read, <fds> are readable when queue may
+     * have messages (or writable for POLLOUT), negative ones are ignored.
+     */
+    void wait(std::span<const int> fds);
+
+    const WaitStats & stats() const { return stats_; }
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    WaitParams params_;
+    short events_;
+    WaitStats stats_;
+    bool idle_ = false;
+    clock::time_point idle_since_;
+    std::chrono::microseconds sleep_{1};
+    std::vector<struct pollfd> poll_fds_;
+};
@@ -0,0 +1,160 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <stdexcept>
+#include <thread>
+
+#include "WorkerPool.h"
+#include "BufferPool.h"
+#include "BatchSink.h"
+#include "Affinity.h"
+
+WorkerPool::WorkerPool(const std::vector<Source *> & sources, size_t workers, const OutputDir & output, 
+                       const std::vector<int> & cpus, const WaitParams & wait, BatchSink * sink)
+    : slots_(new Slot[sources.size()])
+    , slots_count_(sources.size())
+    , workers_(workers)
+    , path_(output.path)
+    , sink_(sink)
+    , cpus_(cpus)
+    , wait_(wait)
+    , stats_(new WorkerStats[workers])
+{
+    if (sources.empty() || workers == 0)
+        throw std::invalid_argument("worker pool needs sources and workers");
+
+    for (size_t index = 0; index < sources.size(); index++)
+        slots_[index].source = sources[index];
+
+    // batch of 1 MB read buffer fills a write buffer in one or two copies
+    if (output.direct && sink_ == nullptr)
+        buffers_ = std::make_unique<BufferPool>(workers, 1 << 20);
+}
+
+WorkerPool::~WorkerPool() = default;
+
+void WorkerPool::run(const std::atomic_bool & stop)
+{
+    std::vector<std::thread> threads;
+
+    for (size_t worker = 0; worker < workers_; worker++)
+    {
+        threads.emplace_back([this, worker, &stop]()
+        {
+            try
+            {
+                work(worker, stop);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> guard(error_lock_);
+                if (error_ == nullptr)
+                    error_ = std::current_exception();
+                failed_ = true;
+            }
+        });
+    }
+
+    for (auto & thread : threads)
+        thread.join();
+
+    if (error_)
+        std::rethrow_exception(error_);
+}
+
+void WorkerPool::work(size_t worker, const std::atomic_bool & stop)
+{
+    std::unique_ptr<SegmentWriter> writer;
+    std::vector<std::byte> buffer(1 << 20);
+    size_t victim = worker;
+    WaitStrategy wait(wait_);
+    std::vector<int> fds;
+
+    for (size_t index = worker; index < slots_count_; index += workers_)
+        fds.push_back(slots_[index].source->fd());
+
+    if (sink_ == nullptr)
+        writer = std::make_unique<SegmentWriter>(path_ + "/memqueue_seg_" + std::to_string(worker) + "_", 64 << 20, buffers_.get());
+
+    if (cpus_.empty() == false)
+        Affinity::pin_to_cpus({ cpus_[worker % cpus_.size()] });
+
+    while (stop == false && failed_ == false)
+    {
+        bool drained = false;
+
+        for (size_t index = worker; index < slots_count_; index += workers_)
+            drained = drain(index, worker, writer.get(), buffer) || drained;
+
+        // own sources are empty, help the first busy one of others,
+        // search starts after the last victim so victims take turns
+        for (size_t step = 1; drained == false && step <= slots_count_; step++)
+        {
+            size_t index = (victim + step) % slots_count_;
+            if (index % workers_ == worker)
+                continue;
+            if (drain(index, worker, writer.get(), buffer))
+            {
+                stats_[worker].stolen++;
+                victim  = index;
+                drained = true;
+            }
+        }
+
+        if (drained)
+        {
+            wait.reset();
+            continue;
+        }
+
+        // notification which woke blocked worker is reset before sources are read again
+        auto blocks = wait.stats().blocks;
+        wait.wait(fds);
+        if (wait.stats().blocks != blocks)
+        {
+            for (size_t index = worker; index < slots_count_; index += workers_)
+                slots_[index].source->clear_notify();
+        }
+    }
+
+    if (writer)
+        writer->close();
+    stats_[worker].wait = wait.stats();
+}
+
+bool WorkerPool::drain(size_t index, size_t worker, SegmentWriter * writer, std::vector<std::byte> & buffer)
+{
+    Slot & slot = slots_[index];
+    size_t length = 0;
+    uint64_t seq = 0;
+
+    // source is read by one worker at a time, writing the batch isn't serialized
+    if (slot.busy.test_and_set(std::memory_order_acquire))
+        return false;
+    try
+    {
+        length = slot.source->read_batch(buffer);
+        // batches of a source are numbered in order they are read
+        if (length != 0 && sink_)
+            seq = sink_->reserve();
+    }
+    catch (...)
+    {
+        slot.busy.clear(std::memory_order_release);
+        throw;
+    }
+    slot.busy.clear(std::memory_order_release);
+
+    if (length == 0)
+        return false;
+
+    Batch batch(std::span<const std::byte>(buffer.data(), length));
+    if (sink_)
+        sink_->write(seq, batch);
+    else
+        writer->write(batch);
+    stats_[worker].batches++;
+    stats_[worker].bytes += length;
+    return true;
+}
@@ -0,0 +1,93 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Source.h"
+#include "SegmentWriter.h"
+#include "WaitStrategy.h"
+
+class BufferPool;
+class BatchSink;
+
+/**
+ * Counters of one worker, they are read while workers run.
+ */
+struct alignas(64) WorkerStats
+{
+    std::atomic<size_t> batches{0};
+    std::atomic<size_t> bytes{0};
+    // batches taken from sources of other workers
+    std::atomic<size_t> stolen{0};
+    // set when worker stops
+    WaitStats wait;
+};
+
+/**
+ * Threads draining sources into their own segments.
+ * Source N belongs to worker N % workers. Worker which finds its sources
+ * empty takes a batch from a source of another worker, so a hot source
+ * is drained by several workers. One batch of a source is read at a time,
+ * order of messages is kept inside a batch and a segment.
+ */
+class WorkerPool
+{
+public:
+    /**
+     * Worker N writes segments <output>/memqueue_seg_<N>_<counter> and runs
+     * on CPU cpus[N % cpus.size()], empty <cpus> - workers aren't pinned.
+     * Worker with empty sources waits by <wait>, blocking on its own sources.
+     * Direct <output> gets a buffer pool with one buffer per worker.
+     * With <sink> workers pass batches to it instead, <output> isn't used.
+     */
+    WorkerPool(const std::vector<Source *> & sources, size_t workers, const OutputDir & output, 
+               const std::vector<int> & cpus, const WaitParams & wait, BatchSink * sink = nullptr);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool & operator=(const WorkerPool &) = delete;
+
+    /**
+     * Run workers until <stop> is set. Exception of worker stops others 
+     * and is rethrown.
+     */
+    void run(const std::atomic_bool & stop);
+
+    const WorkerStats & stats(size_t worker) const { return stats_[worker]; }
+
+    size_t workers() const { return workers_; }
+
+private:
+    struct alignas(64) Slot
+    {
+        Source * source = nullptr;
+        // set while a worker reads batch of the source
+        std::atomic_flag busy = ATOMIC_FLAG_INIT;
+    };
+
+    void work(size_t worker, const std::atomic_bool & stop);
+    bool drain(size_t index, size_t worker, SegmentWriter * writer, std::vector<std::byte> & buffer);
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t slots_count_;
+    size_t workers_;
+    std::string path_;
+    std::unique_ptr<BufferPool> buffers_;
+    BatchSink * sink_;
+    std::vector<int> cpus_;
+    WaitParams wait_;
+    std::unique_ptr<WorkerStats[]> stats_;
+
+    std::atomic_bool failed_{false};
+    std::mutex error_lock_;
+    std::exception_ptr error_;
+};
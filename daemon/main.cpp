@@ -10,16 +10,29 @@
 #include <unistd.h>
 
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <sstream>
-#include <array>
-#include <limits>
+#include <vector>
+#include <thread>
 #include <atomic>
+#include <memory>
+#include <algorithm>
 
 #include "Daemon.h"
+#include "Affinity.h"
+#include "EventLoop.h"
+#include "AsyncQueue.h"
+#include "WorkerPool.h"
+#include "StripedWriter.h"
+#include "CompressedWriter.h"
+#include "MessageIndex.h"
+#include "WaitStrategy.h"
+#include "../include/memqueue_ioctl.h"
 
 static std::atomic_bool stop_flag(false);
+static std::atomic<size_t> elem_counter(0);
+static std::unique_ptr<MessageIndex> elem_index;
+static WaitParams wait_params = WaitStrategy::for_latency(std::chrono::microseconds(1000));
 
 #define make_str(x) (((std::stringstream::__stringbuf_type*)(std::stringstream() << x).rdbuf())->str())
 
@@ -42,62 +55,358 @@ size_t count_files(const std::string& path)
     return 0;
 }
 
-void read_memqueue_device(const std::string& path)
+void log_wait_stats(const WaitStats& stats)
 {
-    const auto max_buffer_size = std::numeric_limits<unsigned short>::max();
-    std::array<char, max_buffer_size> buffer;
+    ::syslog(LOG_USER | LOG_INFO, "wait: spin %llu ms (%llu), backoff %llu ms (%llu), block %llu ms (%llu)",
+        (unsigned long long)stats.spin_ns / 1000000, (unsigned long long)stats.spins,
+        (unsigned long long)stats.backoff_ns / 1000000, (unsigned long long)stats.sleeps,
+        (unsigned long long)stats.block_ns / 1000000, (unsigned long long)stats.blocks);
+}
+
+void write_elem(const std::string& prefix, const char * data, size_t length)
+{
+    size_t seq = elem_counter++;
+    auto file_name = prefix + std::to_string(seq);
+
+    int fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+        throw std::runtime_error(make_str(file_name << " open failed with error " << errno));
+
+    for (size_t offset = 0; offset < length; )
+    {
+        ssize_t n_bytes = write(fd, data + offset, length - offset);
+        if (n_bytes == -1 && errno == EINTR)
+            continue;
+        if (n_bytes <= 0)
+        {
+            close(fd);
+            throw std::runtime_error(make_str(file_name << " write failed with error " << errno));
+        }
+        offset += n_bytes;
+    }
+
+    close(fd);
+    elem_index->add(seq, MessageIndex::now());
+}
+
+/**
+ * Reader of partitions set in <partitions> mask of <source_spec>, several
+ * readers drain disjoint partitions in parallel.
+ */
+void read_memqueue_device(const std::string& path, const std::string& source_spec, unsigned long long partitions)
+{
+    // grows up to the longest message met, messages aren't truncated
+    std::vector<std::byte> buffer(64 * 1024);
     const auto prefix = path + "/memqueue_elem_";
+    WaitStrategy wait(wait_params);
+
+    auto source = open_source(source_spec, partitions);
+    int fd = source->fd();
+
+    ::syslog(LOG_USER | LOG_INFO, "started, source %s, partitions %llx", source_spec.c_str(), partitions);
+
+    while (stop_flag == false)
+    {
+        size_t length = source->read_batch(buffer);
 
-    int fd = open("/dev/memqueue", O_RDONLY);
+        if (length > 0)
+        {
+            for (auto message : Batch(std::span<const std::byte>(buffer.data(), length)))
+                write_elem(prefix, reinterpret_cast<const char *>(message.data()), message.size());
+            wait.reset();
+        }
+        else
+        {
+            auto blocks = wait.stats().blocks;
+            wait.wait({ &fd, 1 });
+            if (wait.stats().blocks != blocks)
+                source->clear_notify();
+        }
+    }
+
+    log_wait_stats(wait.stats());
+
+    ::syslog(LOG_USER | LOG_INFO, "done");
+}
+
+/**
+ * Same as read_memqueue_device, but as coroutine waiting in <loop> 
+ * while its partitions are empty, so readers of all partitions 
+ * share one thread. Batches of whole messages are read by one call.
+ */
+Task drain_memqueue_device(EventLoop& loop, std::string path, std::string source_spec, unsigned long long partitions)
+{
+    const auto prefix = path + "/memqueue_elem_";
+    auto source = open_source(source_spec, partitions);
+    AsyncQueue queue(loop, *source);
+
+    ::syslog(LOG_USER | LOG_INFO, "started as coroutine, partitions %llx", partitions);
+
+    while (true)
+    {
+        Batch batch = co_await queue.next_batch();
+
+        for (auto message : batch)
+            write_elem(prefix, reinterpret_cast<const char *>(message.data()), message.size());
+    }
+}
+
+int open_segment(const std::string& prefix, size_t counter)
+{
+    auto file_name = prefix + std::to_string(counter);
+
+    int fd = open(file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
     if (fd == -1)
-        throw std::runtime_error(make_str("/dev/memqueue open failed with error " << errno));
+        throw std::runtime_error(make_str(file_name << " open failed with error " << errno));
+
+    return fd;
+}
+
+/**
+ * Move batches of length-prefixed messages from device into segment files
+ * through a pipe, data doesn't pass through user space. Batch is never split 
+ * between segments, so every segment holds whole messages.
+ */
+void splice_memqueue_device(const std::string& path, const std::string& device)
+{
+    const size_t segment_size = 64 << 20;
+    const auto prefix = path + "/memqueue_seg_";
+    int pipe_fd[2];
+
+    int fd = open(device.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw std::runtime_error(make_str(device << " open failed with error " << errno));
+    if (ioctl(fd, MEMQUEUE_IOC_SET_FRAMED, 1) == -1)
+        throw std::runtime_error(make_str(device << " framed mode failed with error " << errno));
+    if (pipe(pipe_fd) == -1)
+        throw std::runtime_error(make_str("pipe failed with error " << errno));
+
+    // big pipe takes big batches, if it can't be resized default one is used
+    ssize_t pipe_size = fcntl(pipe_fd[1], F_SETPIPE_SZ, 1 << 20);
+    if (pipe_size == -1)
+        pipe_size = fcntl(pipe_fd[1], F_GETPIPE_SZ);
 
     auto counter = count_files(path);
+    int segment_fd = open_segment(prefix, counter);
+    size_t segment_written = 0;
+    WaitStrategy wait(wait_params);
 
-    ::syslog(LOG_USER | LOG_INFO, "started");
+    ::syslog(LOG_USER | LOG_INFO, "started in splice mode");
 
     while (stop_flag == false)
     {
-        ssize_t n_bytes = read(fd, buffer.data(), max_buffer_size);
+        ssize_t n_bytes = splice(fd, NULL, pipe_fd[1], NULL, pipe_size, SPLICE_F_MOVE);
 
         if (n_bytes > 0)
         {
-            auto file_name = prefix + std::to_string(counter);
-            // ::syslog(LOG_USER | LOG_DEBUG, "n_bytes = %lu, counter = %lu, file = %s", n_bytes, counter, file_name.c_str());
+            if (segment_written >= segment_size)
+            {
+                close(segment_fd);
+                segment_fd = open_segment(prefix, ++counter);
+                segment_written = 0;
+            }
 
-            std::ofstream tmp_file;
-            tmp_file.open(file_name);
-            tmp_file.write(buffer.data(), n_bytes);
-            tmp_file.close();
+            for (ssize_t left = n_bytes; left > 0; )
+            {
+                ssize_t moved = splice(pipe_fd[0], NULL, segment_fd, NULL, left, SPLICE_F_MOVE);
+                if (moved <= 0)
+                    throw std::runtime_error(make_str("splice to segment failed with error " << errno));
+                left -= moved;
+            }
+            segment_written += n_bytes;
+            wait.reset();
+        }
+        else if (n_bytes == -1 && errno == EMSGSIZE)
+        {
+            // message with its prefix doesn't fit into pipe, grow it
+            unsigned long next_length = 0;
+            if (ioctl(fd, MEMQUEUE_IOC_NEXT_LEN, &next_length) == -1)
+                throw std::runtime_error(make_str(device << " next length failed with error " << errno));
 
-            counter++;
+            pipe_size = fcntl(pipe_fd[1], F_SETPIPE_SZ, next_length + sizeof(size_t));
+            if (pipe_size == -1)
+                throw std::runtime_error(make_str("message of " << next_length << " bytes doesn't fit into pipe"));
         }
         else
         {
-            usleep(1000);
+            wait.wait({ &fd, 1 });
         }
     }
 
+    close(segment_fd);
+    close(pipe_fd[0]);
+    close(pipe_fd[1]);
     close(fd);
 
+    log_wait_stats(wait.stats());
+    ::syslog(LOG_USER | LOG_INFO, "done");
+}
+
+/**
+ * Drain every source of <devices> (memqueue minors or shared memory rings) by a pool of
+ * <workers> pinned to CPUs of <numa_node> or of all nodes, each worker
+ * writes its own segments "memqueue_seg_<worker>_<counter>".
+ * With several <outputs> batches are striped over them by <policy>,
+ * compressed output gets <compressors> threads.
+ */
+void drain_memqueue_devices(const std::vector<OutputDir>& outputs, const std::vector<std::string>& devices, int workers, 
+                            int numa_node, StripedWriter::Policy policy, int compressors)
+{
+    std::unique_ptr<StripedWriter> striped;
+    std::unique_ptr<CompressedWriter> compressed;
+    BatchSink * sink = nullptr;
+    std::vector<std::unique_ptr<Source>> sources;
+    std::vector<Source *> pointers;
+    std::vector<int> cpus;
+
+    for (auto & device : devices)
+    {
+        sources.push_back(open_source(device));
+        pointers.push_back(sources.back().get());
+    }
+
+    // taskset or cpuset of container may leave only some of CPUs
+    cpus = Affinity::allowed_cpus(numa_node);
+    if (cpus.empty())
+        throw std::runtime_error("NUMA node " + std::to_string(numa_node) + " has no CPUs allowed to process");
+
+    if (outputs.size() > 1)
+    {
+        striped = std::make_unique<StripedWriter>(outputs, policy);
+        sink = striped.get();
+    }
+    else if (outputs[0].compress)
+    {
+        compressed = std::make_unique<CompressedWriter>(outputs[0], compressors);
+        sink = compressed.get();
+    }
+
+    WorkerPool pool(pointers, workers, outputs[0], cpus, wait_params, sink);
+
+    ::syslog(LOG_USER | LOG_INFO, "started, devices %zu, workers %d, outputs %zu", devices.size(), workers, outputs.size());
+
+    pool.run(stop_flag);
+
+    for (size_t worker = 0; worker < pool.workers(); worker++)
+    {
+        auto & stats = pool.stats(worker);
+        ::syslog(LOG_USER | LOG_INFO, "worker %zu: batches %zu, bytes %zu, stolen %zu",
+            worker, stats.batches.load(), stats.bytes.load(), stats.stolen.load());
+        log_wait_stats(stats.wait);
+    }
+
+    if (striped)
+    {
+        striped->close();
+        for (size_t target = 0; target < striped->targets(); target++)
+            ::syslog(LOG_USER | LOG_INFO, "output %s: bytes %zu", outputs[target].path.c_str(), striped->bytes(target));
+    }
+
+    if (compressed)
+    {
+        compressed->close();
+        double raw_gb = compressed->raw_bytes() / 1e9;
+        ::syslog(LOG_USER | LOG_INFO, "compressed: raw %zu, frames %zu, ratio %.2f, cpu %.2f s/GB",
+            compressed->raw_bytes(), compressed->frame_bytes(),
+            compressed->frame_bytes() ? (double)compressed->raw_bytes() / compressed->frame_bytes() : 0.0,
+            raw_gb > 0 ? compressed->cpu_ns() / 1e9 / raw_gb : 0.0);
+    }
+
     ::syslog(LOG_USER | LOG_INFO, "done");
 }
 
 void print_usage(const char * appName)
 {
-    std::cout << "usage: " << appName << " <path to dir>" << std::endl;
+    std::cout << "usage: " << appName << " [-n <numa node>] [-s] [-p <readers>] [-c] [-w <workers>] [-d <device>|shm:<ring>]... [-l <latency us>] [-f] [-z <compressors>] <path to dir>[:direct][:fast|:ratio]..." << std::endl;
 }
 
 int main(int argc, char** argv)
 {
     try
     {
-        if (argc < 2)
+        int numa_node = -1;
+        bool splice_mode = false;
+        bool coroutine_mode = false;
+        int workers = 0;
+        std::vector<std::string> devices;
+        int readers = 1;
+        auto policy = StripedWriter::Policy::round_robin;
+        int compressors = 2;
+        int option = 0;
+
+        while ((option = getopt(argc, argv, "n:sp:cw:d:l:fz:")) != -1)
+        {
+            switch (option)
+            {
+            case 'n':
+                numa_node = std::stoi(optarg);
+                break;
+            case 's':
+                splice_mode = true;
+                break;
+            case 'p':
+                readers = std::stoi(optarg);
+                break;
+            case 'c':
+                coroutine_mode = true;
+                break;
+            case 'w':
+                workers = std::stoi(optarg);
+                break;
+            case 'd':
+                devices.push_back(optarg);
+                break;
+            case 'l':
+                wait_params = WaitStrategy::for_latency(std::chrono::microseconds(std::stoi(optarg)));
+                break;
+            case 'f':
+                policy = StripedWriter::Policy::free_space;
+                break;
+            case 'z':
+                compressors = std::stoi(optarg);
+                break;
+            default:
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+
+        if (optind >= argc || readers < 1 || readers > 64 || workers < 0 || compressors < 1)
         {
             print_usage(argv[0]);
             return 1;
         }
 
+        // direct I/O, striping and compression are done by worker pool only
+        std::vector<OutputDir> outputs;
+        for (int index = optind; index < argc; index++)
+            outputs.push_back(OutputDir::parse(argv[index]));
+
+        if ((outputs.size() > 1 || outputs[0].compress) && workers == 0)
+            workers = 1;
+        if (outputs[0].direct && workers == 0)
+        {
+            std::cout << "direct output needs -w <workers>" << std::endl;
+            return 1;
+        }
+        if (outputs.size() > 1 && std::any_of(outputs.begin(), outputs.end(), [](const OutputDir & output) { return output.compress; }))
+        {
+            std::cout << "striped output can't be compressed" << std::endl;
+            return 1;
+        }
+        if (devices.empty())
+            devices.push_back("/dev/memqueue");
+        if (workers == 0 && devices.size() > 1)
+        {
+            std::cout << "several sources need -w <workers>" << std::endl;
+            return 1;
+        }
+        if (splice_mode && devices[0].compare(0, 4, "shm:") == 0)
+        {
+            std::cout << "shared memory ring can't be spliced" << std::endl;
+            return 1;
+        }
+
         ::openlog("memqueue_daemon", LOG_PID, 0);
 
         Daemon::daemonize([&]()
@@ -105,7 +414,66 @@ int main(int argc, char** argv)
             stop_flag = true;
         });
 
-        read_memqueue_device(argv[1]);
+        // consumer runs on the node where queue memory is
+        if (numa_node >= 0 && workers == 0)
+            Affinity::pin_to_node(numa_node);
+
+        // reader N takes partitions N, N + readers, ...
+        auto reader_partitions = [readers](int index)
+        {
+            unsigned long long partitions = 0;
+            for (int partition = index; partition < 64; partition += readers)
+                partitions |= 1ULL << partition;
+            return partitions;
+        };
+
+        if (workers > 0)
+        {
+            drain_memqueue_devices(outputs, devices, workers, numa_node, policy, compressors);
+        }
+        else if (splice_mode)
+        {
+            splice_memqueue_device(argv[optind], devices[0]);
+        }
+        else if (coroutine_mode)
+        {
+            EventLoop loop;
+            elem_counter = count_files(argv[optind]);
+            elem_index   = std::make_unique<MessageIndex>(std::string(argv[optind]) + "/memqueue_index");
+
+            for (int index = 0; index < readers; index++)
+                loop.spawn(drain_memqueue_device(loop, argv[optind], devices[0], reader_partitions(index)));
+
+            loop.run(stop_flag);
+            ::syslog(LOG_USER | LOG_INFO, "done");
+        }
+        else
+        {
+            std::vector<std::thread> threads;
+            elem_counter = count_files(argv[optind]);
+            elem_index   = std::make_unique<MessageIndex>(std::string(argv[optind]) + "/memqueue_index");
+
+            for (int index = 0; index < readers; index++)
+            {
+                unsigned long long partitions = reader_partitions(index);
+
+                threads.emplace_back([=]()
+                {
+                    try
+                    {
+                        read_memqueue_device(argv[optind], devices[0], partitions);
+                    }
+                    catch (std::exception & ex)
+                    {
+                        ::syslog(LOG_USER | LOG_ERR, "%s", ex.what());
+                        stop_flag = true;
+                    }
+                });
+            }
+
+            for (auto & thread : threads)
+                thread.join();
+        }
     }
     catch (std::exception & ex)
     {
@@ -8,12 +8,20 @@
 extern "C" {
 #endif
 
+/**
+ * Create file without allocating its blocks and punch holes 
+ * in parts of file which were passed by read position.
+ */
+#define FILEQUEUE_SPARSE 0x1
+
 /**
  * On success, 0 is returned. 
  * On error, the number of error.
  */
 int filequeue_open(const char * path, size_t _queue_size);
 
+int filequeue_open_flags(const char * path, size_t _queue_size, unsigned int flags);
+
 int filequeue_close(void);
 
 /**
@@ -24,6 +32,18 @@ int filequeue_close(void);
  */
 ssize_t filequeue_read(char * data, size_t size);
 
+/**
+ * Same as filequeue_read, but message longer than <size> is returned 
+ * by parts. <left> gets number of still unread bytes of the message.
+ */
+ssize_t filequeue_read_part(char * data, size_t size, size_t * left);
+
+/**
+ * Return number of unread bytes of partly read message or 
+ * length of the next message, 0 if queue is empty.
+ */
+ssize_t filequeue_next_length(void);
+
 /**
   * Write <length> bytes into queue from a <data> array.
   * Return number of bytes written.
@@ -32,6 +52,27 @@ ssize_t filequeue_read(char * data, size_t size);
  */
 ssize_t filequeue_write(const char * data, size_t length);
 
+/**
+ * Queue instance. filequeue_* functions work with the default instance,
+ * fq_* functions with the one given.
+ */
+struct fq_queue;
+
+/**
+ * Open queue file <path> into <queue>.
+ * On success, 0 is returned. 
+ * On error, the number of error.
+ */
+int fq_open(struct fq_queue ** queue, const char * path, size_t size, unsigned int flags);
+
+int fq_close(struct fq_queue * queue);
+
+ssize_t fq_read(struct fq_queue * queue, char * data, size_t size, size_t * left);
+
+ssize_t fq_next_length(struct fq_queue * queue);
+
+ssize_t fq_write(struct fq_queue * queue, const char * data, size_t length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,219 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <type_traits>
+
+namespace memqueue
+{
+
+/**
+ * Capacity of FixedRing given to constructor instead of template argument.
+ */
+constexpr size_t dynamic_capacity = 0;
+
+// both indices are on their own cache lines, so producer and consumer
+// don't invalidate each other's line on every message
+constexpr size_t cache_line_size = 64;
+
+namespace detail
+{
+
+template <typename T, size_t Capacity>
+class FixedRingStorage
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be power of two");
+
+public:
+    static constexpr size_t capacity() { return Capacity; }
+    static constexpr size_t mask() { return Capacity - 1; }
+
+    T * slots() { return slots_; }
+
+private:
+    T slots_[Capacity];
+};
+
+template <typename T>
+class FixedRingStorage<T, dynamic_capacity>
+{
+public:
+    explicit FixedRingStorage(size_t capacity)
+        : capacity_(round_up(capacity))
+        , slots_(new T[capacity_])
+    {
+    }
+
+    size_t capacity() const { return capacity_; }
+    size_t mask() const { return capacity_ - 1; }
+
+    T * slots() { return slots_.get(); }
+
+private:
+    static size_t round_up(size_t capacity)
+    {
+        size_t result = 1;
+        while (result < capacity)
+            result <<= 1;
+        return result;
+    }
+
+    size_t capacity_;
+    std::unique_ptr<T[]> slots_;
+};
+
+} // namespace detail
+
+/**
+ * Ring of fixed-size messages for one producer and one consumer thread.
+ * Slot size is sizeof(T), so there are no length headers, indices of slots
+ * replace byte positions and every copy has constant size the compiler
+ * can vectorize. Capacity is rounded up to a power of two,
+ * <Capacity> == dynamic_capacity means it is given to constructor.
+ */
+template <typename T, size_t Capacity = dynamic_capacity>
+class FixedRing : private detail::FixedRingStorage<T, Capacity>
+{
+    static_assert(std::is_trivially_copyable<T>::value, "message must be trivially copyable");
+
+    using Storage = detail::FixedRingStorage<T, Capacity>;
+
+public:
+    FixedRing() = default;
+
+    explicit FixedRing(size_t capacity)
+        : Storage(capacity)
+    {
+    }
+
+    FixedRing(const FixedRing &) = delete;
+    FixedRing & operator=(const FixedRing &) = delete;
+
+    using Storage::capacity;
+
+    /**
+     * Return false if ring is full.
+     */
+    bool try_push(const T & value)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+
+        if (tail - head_cached_ == capacity())
+        {
+            head_cached_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cached_ == capacity())
+                return false;
+        }
+
+        memcpy(&this->slots()[tail & this->mask()], &value, sizeof(T));
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Return false if ring is empty.
+     */
+    bool try_pop(T & value)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+
+        if (head == tail_cached_)
+        {
+            tail_cached_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cached_)
+                return false;
+        }
+
+        memcpy(&value, &this->slots()[head & this->mask()], sizeof(T));
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Push up to <count> messages, index is published once for the batch.
+     * Return number of pushed messages.
+     */
+    size_t push(const T * values, size_t count)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+
+        if (capacity() - (tail - head_cached_) < count)
+            head_cached_ = head_.load(std::memory_order_acquire);
+        if (count > capacity() - (tail - head_cached_))
+            count = capacity() - (tail - head_cached_);
+
+        copy_in(values, tail, count);
+        tail_.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    /**
+     * Pop up to <count> messages, index is published once for the batch.
+     * Return number of popped messages.
+     */
+    size_t pop(T * values, size_t count)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+
+        if (tail_cached_ - head < count)
+            tail_cached_ = tail_.load(std::memory_order_acquire);
+        if (count > tail_cached_ - head)
+            count = tail_cached_ - head;
+
+        copy_out(values, head, count);
+        head_.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    /**
+     * Number of messages, exact only when called by producer or consumer
+     * while the other one is idle.
+     */
+    size_t size() const
+    {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+private:
+    // batch is copied by at most two runs of slots, before and after wrap
+    size_t first_run(size_t index, size_t count) const
+    {
+        size_t tail_slots = capacity() - (index & this->mask());
+        return count < tail_slots ? count : tail_slots;
+    }
+
+    void copy_in(const T * values, size_t index, size_t count)
+    {
+        size_t first = first_run(index, count);
+        memcpy(&this->slots()[index & this->mask()], values, first * sizeof(T));
+        memcpy(&this->slots()[0], values + first, (count - first) * sizeof(T));
+    }
+
+    void copy_out(T * values, size_t index, size_t count)
+    {
+        size_t first = first_run(index, count);
+        memcpy(values, &this->slots()[index & this->mask()], first * sizeof(T));
+        memcpy(values + first, &this->slots()[0], (count - first) * sizeof(T));
+    }
+
+    // indices run free and are masked on access, so full and empty differ
+    alignas(cache_line_size) std::atomic<size_t> head_{0};
+    size_t tail_cached_ = 0;    // consumer's copy of tail_
+
+    alignas(cache_line_size) std::atomic<size_t> tail_{0};
+    size_t head_cached_ = 0;    // producer's copy of head_
+};
+
+} // namespace memqueue
@@ -6,13 +6,21 @@
 
 #ifdef __KERNEL__
     #include <linux/stddef.h>
+    #include <linux/types.h>
     #include <linux/errno.h>
     
     #define PRINTF(_level_, _fmt_, ...) printk(_level_ _fmt_, ##__VA_ARGS__)
 #else
+    #ifndef _GNU_SOURCE
+        #define _GNU_SOURCE
+    #endif
     #include <stdbool.h>
+    #include <stdint.h>
     #include <errno.h>
     #include <stdio.h>
 
+    typedef uint32_t u32;
+    typedef uint64_t u64;
+
     #define PRINTF(_level_, _fmt_, ...) printf(_fmt_, ##__VA_ARGS__)
 #endif
@@ -6,8 +6,29 @@
 
 #ifdef __KERNEL__
     #include <linux/mm.h>
+    #include <linux/cache.h>
 #else
     #include <stdlib.h>
+    #include <string.h>
+
+    #define GFP_KERNEL 0
+    #define SMP_CACHE_BYTES 64
+    #define ____cacheline_aligned_in_smp __attribute__((aligned(SMP_CACHE_BYTES)))
+
     #define kvmalloc(size, flags) malloc(size)
     #define kvfree(ptr) free(ptr)
+
+    // zeroed and cache line aligned like kmalloc of big structures
+    static inline void * kvzalloc(size_t size, int flags)
+    {
+        size_t aligned_size = (size + SMP_CACHE_BYTES - 1) & ~(size_t)(SMP_CACHE_BYTES - 1);
+        void * ptr = aligned_alloc(SMP_CACHE_BYTES, aligned_size);
+        (void)flags;
+        if (ptr)
+            memset(ptr, 0, aligned_size);
+        return ptr;
+    }
+
+    // small structures come from heap, they are placed by first touch
+    #define kvzalloc_node(size, flags, node) kvzalloc(size, flags)
 #endif
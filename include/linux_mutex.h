@@ -0,0 +1,22 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#ifdef __KERNEL__
+    #include <linux/mutex.h>
+    #define INIT_MUTEX(lock) mutex_init(&lock)
+    #define DESTROY_MUTEX(lock) mutex_destroy(&lock)
+#else
+    #include <pthread.h>
+    struct mutex
+    {
+        pthread_mutex_t handle;
+    };
+    #define INIT_MUTEX(lock) pthread_mutex_init(&(lock).handle, 0)
+    #define DESTROY_MUTEX(lock) pthread_mutex_destroy(&(lock).handle)
+
+    #define mutex_lock(lock) pthread_mutex_lock(&(lock)->handle)
+    #define mutex_unlock(lock) pthread_mutex_unlock(&(lock)->handle)
+#endif
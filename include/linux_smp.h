@@ -0,0 +1,49 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#ifdef __KERNEL__
+    #include <linux/smp.h>
+    #include <linux/topology.h>
+    #include <linux/nodemask.h>
+
+    // caller only needs a hint, it's fine to be migrated right after
+    #define current_cpu() raw_smp_processor_id()
+    #define current_node() numa_node_id()
+#else
+    #include <sched.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+
+    #define nr_cpu_ids ((unsigned int)sysconf(_SC_NPROCESSORS_CONF))
+    #define nr_node_ids user_nr_node_ids()
+
+    static inline unsigned int current_cpu(void)
+    {
+        int cpu = sched_getcpu();
+        return cpu < 0 ? 0 : cpu;
+    }
+
+    static inline unsigned int current_node(void)
+    {
+        unsigned int cpu = 0, node = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, 0) != 0)
+            return 0;
+        return node;
+    }
+
+    static inline unsigned int user_nr_node_ids(void)
+    {
+        // "0" or "0-N"
+        unsigned int first = 0, last = 0;
+        int n = 0;
+        FILE * f = fopen("/sys/devices/system/node/possible", "r");
+        if (f == NULL)
+            return 1;
+        n = fscanf(f, "%u-%u", &first, &last);
+        fclose(f);
+        return n == 2 ? last + 1 : first + 1;
+    }
+#endif
@@ -6,14 +6,15 @@
 
 #ifdef __KERNEL__
     #include <linux/spinlock.h>
-    #define INIT_SPINLOCK(spin) 
+    #define INIT_SPINLOCK(spin) spin_lock_init(&spin)
     #define DESTROY_SPINLOCK(spin) 
 #else
     #include <pthread.h>
+    typedef pthread_spinlock_t spinlock_t;
     #define DEFINE_SPINLOCK(spin) pthread_spinlock_t spin
     #define INIT_SPINLOCK(spin) pthread_spin_init(&spin, 0)
     #define DESTROY_SPINLOCK(spin) pthread_spin_destroy(&spin)
 
     #define spin_lock(spin) pthread_spin_lock(spin)
     #define spin_unlock(spin) pthread_spin_unlock(spin)
-#endif
\ No newline at end of file
+#endif
@@ -6,7 +6,9 @@
 
 #ifdef __KERNEL__
     #include <linux/syscalls.h>
+    #include <linux/falloc.h>
     #define file_descriptor struct file *
+    #define vfs_ftruncate(fd, size) vfs_truncate(&(fd)->f_path, size)
 #else
     #include <fcntl.h>
     #include <unistd.h>
@@ -19,7 +21,9 @@
     #define filp_open(filename, flags, mode) open(filename, flags, mode)
     #define filp_close(fd, NULL) close(fd)
     #define IS_ERR(fd) (fd == -1)
-    #define vfs_fallocate(fd, mode, offset, size) posix_fallocate(fd, offset, size)
+    #define vfs_fallocate(fd, mode, offset, size) \
+        ((mode) ? fallocate(fd, mode, offset, size) : posix_fallocate(fd, offset, size))
+    #define vfs_ftruncate(fd, size) ftruncate(fd, size)
     #define vfs_read(fd, buf, count, offset) pread(fd, buf, count, *offset)
     #define vfs_write(fd, buf, count, offset) pwrite(fd, buf, count, *offset)
     #define vfs_llseek(fd, offset, whence) lseek(fd, offset, whence)
@@ -0,0 +1,21 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#ifdef __KERNEL__
+    #include <linux/ktime.h>
+    #include <linux/timekeeping.h>
+#else
+    #include <time.h>
+
+    static inline u64 ktime_get_ns(void)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+#endif
+
+#define MSEC_TO_NSEC(ms) ((u64)(ms) * 1000000ULL)
@@ -0,0 +1,37 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+/**
+ * Static probes of queues: tracepoints "memqueue:memqueue_<name>" in module,
+ * USDT probes "memqueue:<name>" in library built with MEMQUEUE_USDT.
+ * Disabled probe is a nop, so arguments which take work to compute
+ * are computed under MQ_TRACE_ENABLED(name) only.
+ * Every probe of USDT build has a semaphore set by attached tracer,
+ * source file defines semaphores of its probes by MQ_TRACE_SEMAPHORE.
+ * Probe compiled out still takes its arguments in dead code, so values
+ * computed only for it aren't reported as set but not used.
+ */
+#ifdef __KERNEL__
+    #include "memqueue_trace.h"
+
+    #define MQ_TRACE(_name_, ...) trace_memqueue_##_name_(__VA_ARGS__)
+    #define MQ_TRACE_ENABLED(_name_) trace_memqueue_##_name_##_enabled()
+    #define MQ_TRACE_SEMAPHORE(_name_)
+#elif defined(MEMQUEUE_USDT)
+    #define _SDT_HAS_SEMAPHORES 1
+    #include <sys/sdt.h>
+
+    #define MQ_TRACE(_name_, ...) STAP_PROBEV(memqueue, _name_, __VA_ARGS__)
+    #define MQ_TRACE_ENABLED(_name_) __builtin_expect(memqueue_##_name_##_semaphore != 0, 0)
+    #define MQ_TRACE_SEMAPHORE(_name_) \
+        __extension__ unsigned short memqueue_##_name_##_semaphore __attribute__((unused)) __attribute__((section(".probes")))
+#else
+    static inline void mq_trace_unused(int unused, ...) { (void)unused; }
+
+    #define MQ_TRACE(_name_, ...) do { if (0) mq_trace_unused(0, __VA_ARGS__); } while (0)
+    #define MQ_TRACE_ENABLED(_name_) 0
+    #define MQ_TRACE_SEMAPHORE(_name_)
+#endif
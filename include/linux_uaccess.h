@@ -6,6 +6,14 @@
 
 #ifdef __KERNEL__
     #include <linux/uaccess.h>
+    #include <linux/version.h>
+
+    // access_ok lost its type argument in 5.0
+    #if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
+        #define mq_access_ok(from, n) access_ok(from, n)
+    #else
+        #define mq_access_ok(from, n) access_ok(VERIFY_READ, from, n)
+    #endif
 #else
     #include <string.h>
     #define copy_to_user(to, from, n) (memcpy(to, from, n), 0)
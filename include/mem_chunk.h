@@ -0,0 +1,46 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include "linux_base.h"
+
+/**
+ * Piece of ring memory which can be populated and released independently.
+ * In kernel a released chunk is freed, in user-mode its mapping is kept
+ * and only pages are given back (MADV_DONTNEED).
+ * Functions below may sleep, they are never called under a spinlock.
+ */
+struct memchunk
+{
+    char * data;
+    size_t size;
+    bool   resident;
+    u64    touched;
+    unsigned char kind;
+};
+
+/**
+ * Try to back chunk by one huge page, fall back to regular pages.
+ */
+#define MEMCHUNK_HUGEPAGES 0x1
+
+#define MEMCHUNK_HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+// any node
+#define MEMCHUNK_NO_NODE (-1)
+
+// how memory of chunk was obtained
+#define MEMCHUNK_KIND_REGULAR 0
+#define MEMCHUNK_KIND_HUGE    1
+
+/**
+ * Populate <chunk->size> bytes of chunk on NUMA <node>.
+ * On success, 0 is returned. On error, -ENOMEM.
+ */
+int memchunk_alloc(struct memchunk * chunk, unsigned int flags, int node);
+
+void memchunk_release(struct memchunk * chunk);
+
+void memchunk_free(struct memchunk * chunk);
@@ -0,0 +1,63 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Messages of at least this size are copied into ring 
+ * by non-temporal stores, so they don't evict producer's cache.
+ */
+#define MEMCOPY_NT_THRESHOLD ((size_t)64 << 10)
+
+// copy strategies, memcopy_strategy() returns the one for large copies
+#define MEMCOPY_PLAIN   0
+#define MEMCOPY_SSE2_NT 1
+#define MEMCOPY_AVX_NT  2
+
+/**
+ * Copy settings of one queue.
+ */
+struct memcopy
+{
+    size_t nt_threshold;
+    int strategy;
+};
+
+/**
+ * Select copy strategy by CPU features.
+ * <nt_threshold> 0 means MEMCOPY_NT_THRESHOLD, (size_t)-1 disables streaming.
+ */
+void memcopy_init(struct memcopy * copy, size_t nt_threshold);
+
+int memcopy_strategy(const struct memcopy * copy);
+
+/**
+ * Copy <n> bytes from caller's (user in kernel) buffer into ring.
+ * Return number of bytes which could not be copied like copy_from_user.
+ */
+unsigned long memcopy_to_ring(const struct memcopy * copy, void * to, const void * from, size_t n);
+
+/**
+ * Copy <n> bytes from ring into caller's (user in kernel) buffer.
+ * Return number of bytes which could not be copied like copy_to_user.
+ */
+unsigned long memcopy_from_ring(void * to, const void * from, size_t n);
+
+/**
+ * Copy between kernel buffers, used for headers of records.
+ */
+void memcopy_kern(void * to, const void * from, size_t n);
+
+/**
+ * Hint to bring first <n> bytes at <ptr> into cache.
+ */
+void memcopy_prefetch(const void * ptr, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
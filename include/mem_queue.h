@@ -8,14 +8,227 @@
 extern "C" {
 #endif
 
+/**
+ * Populate ring memory only when write position reaches it.
+ */
+#define MEMQUEUE_LAZY_ALLOC 0x1
+
+/**
+ * Back ring by 2MB huge pages where possible, regular pages otherwise.
+ */
+#define MEMQUEUE_HUGEPAGES 0x2
+
+/**
+ * Split queue into <shards> sub-rings, producer writes into the sub-ring 
+ * of its CPU and spills into the next ones when it is full. 
+ * Reader drains sub-rings by batches of MEMQUEUE_SHARD_BATCH messages.
+ */
+#define MEMQUEUE_SHARDED 0x4
+
+/**
+ * One sub-ring per NUMA node instead of per CPU.
+ */
+#define MEMQUEUE_SHARD_BY_NODE 0x8
+
+/**
+ * Stamp every message with time of write and read sub-rings 
+ * in order of stamps instead of batches.
+ */
+#define MEMQUEUE_SHARD_ORDERED 0x10
+
+/**
+ * Allocate ring and its positions on NUMA node <numa_node>.
+ * With MEMQUEUE_SHARD_BY_NODE and without this flag 
+ * every sub-ring is placed on its own node.
+ */
+#define MEMQUEUE_NUMA_NODE 0x20
+
+/**
+ * Prefetch next message into cache after read.
+ */
+#define MEMQUEUE_PREFETCH 0x40
+
+/**
+ * Split queue into <partitions> sub-rings, message goes to the partition
+ * chosen by hash of its key (MEMQUEUE_WRITE_KEY), so messages with 
+ * the same key keep their order. Readers can drain disjoint sets of 
+ * partitions in parallel. Can't be used together with MEMQUEUE_SHARDED.
+ */
+#define MEMQUEUE_PARTITIONED 0x80
+
+/**
+ * Split queue into <lanes> sub-rings by priority of message 
+ * (MEMQUEUE_WRITE_PRIORITY), higher lane is more urgent and is read first.
+ * Lower lanes are protected from starvation by <lane_aging_ms> 
+ * and <lane_burst>. Can't be used together with MEMQUEUE_SHARDED
+ * and MEMQUEUE_PARTITIONED.
+ */
+#define MEMQUEUE_PRIORITY_LANES 0x100
+
+/**
+ * Writer which doesn't find space in ring drops expired messages 
+ * (MEMQUEUE_WRITE_EXPIRE) from its head to make room.
+ */
+#define MEMQUEUE_EXPIRE_RECLAIM 0x200
+
+#define MEMQUEUE_SHARD_BATCH 64
+
+#define MEMQUEUE_LANES_MAX 8
+
+// partitions are selected by 64-bit mask
+#define MEMQUEUE_PARTITIONS_MAX 64
+#define MEMQUEUE_PARTITIONS_ALL (~0ULL)
+
+// tags are selected by 64-bit mask too
+#define MEMQUEUE_TAGS_MAX 64
+#define MEMQUEUE_TAGS_ALL (~0ULL)
+
+struct memqueue_params
+{
+    size_t       queue_size;
+    unsigned int flags;
+    /**
+     * With MEMQUEUE_LAZY_ALLOC chunks which were passed by read position
+     * and not used for <release_idle_ms> are given back to the system.
+     * 0 means never.
+     */
+    unsigned int release_idle_ms;
+    /**
+     * Number of sub-rings for MEMQUEUE_SHARDED, each gets equal part 
+     * of <queue_size>. 0 means one per CPU (or NUMA node).
+     */
+    unsigned int shards;
+    /**
+     * NUMA node for MEMQUEUE_NUMA_NODE.
+     */
+    int          numa_node;
+    /**
+     * Messages of this size and bigger are written by non-temporal stores
+     * where CPU has them. 0 means MEMCOPY_NT_THRESHOLD, (size_t)-1 never.
+     */
+    size_t       copy_nt_threshold;
+    /**
+     * Number of partitions for MEMQUEUE_PARTITIONED, each gets equal part
+     * of <queue_size>, up to MEMQUEUE_PARTITIONS_MAX.
+     */
+    unsigned int partitions;
+    /**
+     * Number of priority lanes for MEMQUEUE_PRIORITY_LANES, up to MEMQUEUE_LANES_MAX.
+     * Every lane above 0 gets <lane_size> bytes, lane 0 (bulk) gets the rest
+     * of <queue_size>. 0 means equal parts.
+     */
+    unsigned int lanes;
+    size_t       lane_size;
+    /**
+     * Lower lane is read first when its first message waited this time.
+     * Messages get time stamp for it. 0 means never.
+     */
+    unsigned int lane_aging_ms;
+    /**
+     * Lower lane gets one message after this number of messages 
+     * in a row were read from upper lanes. 0 means strict priority.
+     */
+    unsigned int lane_burst;
+};
+
+/**
+ * Write options, fields are used when their flag is set.
+ */
+#define MEMQUEUE_WRITE_KEY      0x1
+#define MEMQUEUE_WRITE_PRIORITY 0x2
+#define MEMQUEUE_WRITE_DELIVER  0x4
+#define MEMQUEUE_WRITE_EXPIRE   0x8
+#define MEMQUEUE_WRITE_TAG      0x10
+
+struct memqueue_write_opts
+{
+    unsigned int flags;
+    // messages with the same key go to the same partition,
+    // messages without key go to the partition of key 0
+    unsigned long long key;
+    // lane of message, 0 is bulk, messages without priority go there
+    unsigned int priority;
+    // message isn't readable before this time of memqueue_now_ns clock,
+    // till then it waits out of ring, but its space in ring is taken
+    unsigned long long deliver_ns;
+    // message isn't read after this time of memqueue_now_ns clock,
+    // readers skip it without copying and it is counted in <expired>
+    unsigned long long expire_ns;
+    // type of message for readers filtering by tags, 0 <= tag < MEMQUEUE_TAGS_MAX,
+    // messages without tag have tag 0
+    unsigned int tag;
+};
+
+/**
+ * Read options, fields are used when their flag is set.
+ */
+#define MEMQUEUE_READ_PARTITIONS 0x1
+#define MEMQUEUE_READ_TAGS       0x2
+
+struct memqueue_read_opts
+{
+    unsigned int flags;
+    // partitions to read (bit N is partition N), 
+    // without MEMQUEUE_PARTITIONED the mask is ignored
+    unsigned long long partitions;
+    // tags to read (bit N is tag N), other messages at the head of queue
+    // are dropped without copying and counted in <filtered>
+    unsigned long long tags;
+};
+
+struct memqueue_stats
+{
+    size_t rings;
+    size_t chunks_total;
+    size_t chunks_resident;
+    size_t chunks_huge;
+    size_t resident_bytes;
+    // messages waiting for delivery time and ones lost on the way into ring
+    size_t delayed;
+    size_t delayed_dropped;
+    // messages skipped by readers or writers since their time was over
+    size_t expired;
+    // messages dropped by readers since their tags were filtered out
+    size_t filtered;
+};
+
+/**
+ * Depth of one sub-ring (shard or partition).
+ */
+struct memqueue_depth
+{
+    size_t messages;
+    size_t bytes;
+};
+
 /**
  * On success, 0 is returned. 
  * On error, the number of error.
  */
 int memqueue_open(size_t _queue_size);
 
+int memqueue_open_params(const struct memqueue_params * params);
+
 void memqueue_close(void);
 
+void memqueue_get_stats(struct memqueue_stats * stats);
+
+/**
+ * Get depth of sub-ring <index>, 0 <= index < memqueue_stats.rings.
+ * Return 0 or -EINVAL.
+ */
+int memqueue_get_depth(size_t index, struct memqueue_depth * depth);
+
+/**
+ * Monotonic clock of delivery time, CLOCK_MONOTONIC in user-mode.
+ */
+unsigned long long memqueue_now_ns(void);
+
+/**
+ * Return partition of messages with <key>, -EINVAL if queue isn't partitioned.
+ */
+int memqueue_key_partition(unsigned long long key);
+
 /**
  * Read max <size> bytes from queue into a <data> array.
  * Return number of bytes read. 
@@ -24,6 +237,44 @@ void memqueue_close(void);
  */
 ssize_t memqueue_read(char * data, size_t size);
 
+/**
+ * Same as memqueue_read, but message longer than <size> is returned 
+ * by parts in subsequent calls. <left> gets number of bytes of the message
+ * which are still unread, 0 when the message is complete.
+ * memqueue_read behaves the same way, it just doesn't report <left>.
+ */
+ssize_t memqueue_read_part(char * data, size_t size, size_t * left);
+
+/**
+ * Return number of unread bytes of partly read message or 
+ * length of the next message, 0 if queue is empty.
+ * Consumer can size its buffer exactly before memqueue_read.
+ */
+ssize_t memqueue_next_length(void);
+
+/**
+ * Same as memqueue_read_part, but only partitions set in <mask> are read
+ * (bit N is partition N). Partitions are visited round robin, 
+ * partly read message is continued first.
+ * Without MEMQUEUE_PARTITIONED the mask is ignored.
+ */
+ssize_t memqueue_read_partitions(char * data, size_t size, unsigned long long mask, size_t * left);
+
+/**
+ * Same as memqueue_next_length for partitions set in <mask>.
+ */
+ssize_t memqueue_next_length_partitions(unsigned long long mask);
+
+/**
+ * Same as memqueue_read_part with options <opts>, which can be NULL.
+ */
+ssize_t memqueue_read_ex(char * data, size_t size, const struct memqueue_read_opts * opts, size_t * left);
+
+/**
+ * Same as memqueue_next_length with options <opts>, which can be NULL.
+ */
+ssize_t memqueue_next_length_ex(const struct memqueue_read_opts * opts);
+
 /**
   * Write <length> bytes into queue from a <data> array.
   * Return number of bytes written.
@@ -32,6 +283,98 @@ ssize_t memqueue_read(char * data, size_t size);
  */
 ssize_t memqueue_write(const char * data, size_t length);
 
+/**
+ * Same as memqueue_write with options <opts>, which can be NULL.
+ */
+ssize_t memqueue_write_ex(const char * data, size_t length, const struct memqueue_write_opts * opts);
+
+/**
+ * Write messages of <batch> prefixed by size_t length in order until one
+ * doesn't fit, all of them with options <opts>, which can be NULL.
+ * This is the write of memqueue device in framed mode.
+ * Return number of bytes of written messages with prefixes.
+ * If the first message isn't written, its error is returned: -ENOSPC
+ * if it doesn't fit, -EINVAL if <batch> is cut inside its prefix or data.
+ */
+ssize_t memqueue_write_framed(const char * batch, size_t size, const struct memqueue_write_opts * opts);
+
+/**
+ * Callback getting message in place by contiguous segments. <offset> is 
+ * position of <segment> in the message, <message_length> is its length
+ * (of the unread rest for partly read message).
+ * Return 0 or negative errno to stop.
+ */
+typedef int (*memqueue_consume_fn)(void * context, const char * segment, size_t length, 
+                                   size_t offset, size_t message_length);
+
+/**
+ * Callback filling message in place by contiguous segments.
+ * Return 0 or negative errno to cancel the message.
+ */
+typedef int (*memqueue_fill_fn)(void * context, char * segment, size_t length);
+
+/**
+ * Pass whole messages to <consume> without copying them out of queue
+ * while their lengths together with a size_t prefix per message fit
+ * into <size>, so consumer can write them as length-prefixed batch.
+ * Message is removed from queue when all its segments are consumed.
+ * Return number of bytes of the batch with prefixes, 0 if queue is empty,
+ * -EMSGSIZE if the first message doesn't fit into <size>.
+ */
+ssize_t memqueue_consume(memqueue_consume_fn consume, void * context, size_t size);
+
+/**
+ * Same as memqueue_consume for partitions set in <mask>.
+ */
+ssize_t memqueue_consume_partitions(memqueue_consume_fn consume, void * context, size_t size, unsigned long long mask);
+
+/**
+ * Same as memqueue_consume with options <opts>, which can be NULL.
+ */
+ssize_t memqueue_consume_ex(memqueue_consume_fn consume, void * context, size_t size, const struct memqueue_read_opts * opts);
+
+/**
+ * Write message of <length> bytes filled in place by <fill>
+ * with options <opts>, which can be NULL.
+ * Message becomes visible to reader only if <fill> succeeds for all segments.
+ * Return values are the same as of memqueue_write.
+ */
+ssize_t memqueue_produce(size_t length, memqueue_fill_fn fill, void * context, const struct memqueue_write_opts * opts);
+
+/**
+ * Queue instance. memqueue_* functions work with the default instance,
+ * mq_* functions with the one given, so one process can have several
+ * independent queues.
+ */
+struct mq_queue;
+
+/**
+ * Open queue into <queue>.
+ * On success, 0 is returned. 
+ * On error, the number of error.
+ */
+int mq_open(struct mq_queue ** queue, const struct memqueue_params * params);
+
+void mq_close(struct mq_queue * queue);
+
+void mq_get_stats(struct mq_queue * queue, struct memqueue_stats * stats);
+
+int mq_get_depth(struct mq_queue * queue, size_t index, struct memqueue_depth * depth);
+
+int mq_key_partition(struct mq_queue * queue, unsigned long long key);
+
+ssize_t mq_read(struct mq_queue * queue, char * data, size_t size, const struct memqueue_read_opts * opts, size_t * left);
+
+ssize_t mq_next_length(struct mq_queue * queue, const struct memqueue_read_opts * opts);
+
+ssize_t mq_write(struct mq_queue * queue, const char * data, size_t length, const struct memqueue_write_opts * opts);
+
+ssize_t mq_write_framed(struct mq_queue * queue, const char * batch, size_t size, const struct memqueue_write_opts * opts);
+
+ssize_t mq_consume(struct mq_queue * queue, memqueue_consume_fn consume, void * context, size_t size, const struct memqueue_read_opts * opts);
+
+ssize_t mq_produce(struct mq_queue * queue, size_t length, memqueue_fill_fn fill, void * context, const struct memqueue_write_opts * opts);
+
 #ifdef __cplusplus
 }
 #endif
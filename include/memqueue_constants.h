@@ -5,3 +5,6 @@
 #pragma once
 
 #define DEVICE_NAME "memqueue"
+
+// ring memory is allocated and released by chunks of this size
+#define MEMQUEUE_CHUNK_SIZE ((size_t)2 << 20)
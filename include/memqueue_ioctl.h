@@ -0,0 +1,53 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#ifdef __KERNEL__
+    #include <linux/ioctl.h>
+#else
+    #include <sys/ioctl.h>
+#endif
+
+#define MEMQUEUE_IOC_MAGIC 'q'
+
+// length of the next message (or of its unread part), 0 if queue is empty
+#define MEMQUEUE_IOC_NEXT_LEN _IOR(MEMQUEUE_IOC_MAGIC, 1, unsigned long)
+
+// switch read of this file descriptor into batches of whole messages, 
+// each prefixed by its length as size_t (arg: 0 - off, 1 - on).
+// splice from device works in this mode only. Write takes batches
+// of the same format and returns bytes of messages which fit
+#define MEMQUEUE_IOC_SET_FRAMED _IO(MEMQUEUE_IOC_MAGIC, 2)
+
+// read only partitions set in 64-bit mask (arg: pointer to unsigned long long)
+#define MEMQUEUE_IOC_SET_PARTITIONS _IOW(MEMQUEUE_IOC_MAGIC, 3, unsigned long long)
+
+// key of next writes of this file descriptor (arg: pointer to unsigned long long)
+#define MEMQUEUE_IOC_SET_KEY _IOW(MEMQUEUE_IOC_MAGIC, 4, unsigned long long)
+
+struct memqueue_ioc_depth
+{
+    unsigned long long index;    // sub-ring, set by caller
+    unsigned long long messages;
+    unsigned long long bytes;
+};
+
+// depth of sub-ring (partition or shard)
+#define MEMQUEUE_IOC_GET_DEPTH _IOWR(MEMQUEUE_IOC_MAGIC, 5, struct memqueue_ioc_depth)
+
+// priority lane of next writes of this file descriptor (arg: unsigned int value)
+#define MEMQUEUE_IOC_SET_PRIORITY _IO(MEMQUEUE_IOC_MAGIC, 6)
+
+// delay of next writes of this file descriptor in ms, 0 - none (arg: unsigned long value)
+#define MEMQUEUE_IOC_SET_DELAY _IO(MEMQUEUE_IOC_MAGIC, 7)
+
+// time to live of next writes of this file descriptor in ms, 0 - forever (arg: unsigned long value)
+#define MEMQUEUE_IOC_SET_TTL _IO(MEMQUEUE_IOC_MAGIC, 8)
+
+// tags read by this file descriptor, bit N is tag N (arg: pointer to unsigned long long)
+#define MEMQUEUE_IOC_SET_TAGS _IOW(MEMQUEUE_IOC_MAGIC, 9, unsigned long long)
+
+// tag of next writes of this file descriptor, 0 - 63 (arg: unsigned int value)
+#define MEMQUEUE_IOC_SET_TAG _IO(MEMQUEUE_IOC_MAGIC, 10)
@@ -0,0 +1,148 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM memqueue
+
+#if !defined(_MEMQUEUE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MEMQUEUE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/**
+ * Message of <length> bytes and positions of ring (or queue file)
+ * seen by writer or reader before it moves them.
+ */
+DECLARE_EVENT_CLASS(memqueue_positions,
+    TP_PROTO(const void * ring, size_t length, long long pos_read, long long pos_write),
+    TP_ARGS(ring, length, pos_read, pos_write),
+    TP_STRUCT__entry(
+        __field(const void *, ring)
+        __field(size_t,       length)
+        __field(long long,    pos_read)
+        __field(long long,    pos_write)
+    ),
+    TP_fast_assign(
+        __entry->ring      = ring;
+        __entry->length    = length;
+        __entry->pos_read  = pos_read;
+        __entry->pos_write = pos_write;
+    ),
+    TP_printk("ring=%p length=%zu pos_read=%lld pos_write=%lld",
+        __entry->ring, __entry->length, __entry->pos_read, __entry->pos_write)
+);
+
+DEFINE_EVENT(memqueue_positions, memqueue_write_start,
+    TP_PROTO(const void * ring, size_t length, long long pos_read, long long pos_write),
+    TP_ARGS(ring, length, pos_read, pos_write));
+
+// message is rejected with -ENOSPC
+DEFINE_EVENT(memqueue_positions, memqueue_write_full,
+    TP_PROTO(const void * ring, size_t length, long long pos_read, long long pos_write),
+    TP_ARGS(ring, length, pos_read, pos_write));
+
+DEFINE_EVENT(memqueue_positions, memqueue_fq_write,
+    TP_PROTO(const void * ring, size_t length, long long pos_read, long long pos_write),
+    TP_ARGS(ring, length, pos_read, pos_write));
+
+DEFINE_EVENT(memqueue_positions, memqueue_fq_full,
+    TP_PROTO(const void * ring, size_t length, long long pos_read, long long pos_write),
+    TP_ARGS(ring, length, pos_read, pos_write));
+
+DEFINE_EVENT(memqueue_positions, memqueue_fq_read,
+    TP_PROTO(const void * ring, size_t length, long long pos_read, long long pos_write),
+    TP_ARGS(ring, length, pos_read, pos_write));
+
+/**
+ * Message is written or read, <pos> is the new position,
+ * <messages> is number of messages left in ring.
+ */
+DECLARE_EVENT_CLASS(memqueue_move,
+    TP_PROTO(const void * ring, size_t length, long long pos, size_t messages),
+    TP_ARGS(ring, length, pos, messages),
+    TP_STRUCT__entry(
+        __field(const void *, ring)
+        __field(size_t,       length)
+        __field(long long,    pos)
+        __field(size_t,       messages)
+    ),
+    TP_fast_assign(
+        __entry->ring     = ring;
+        __entry->length   = length;
+        __entry->pos      = pos;
+        __entry->messages = messages;
+    ),
+    TP_printk("ring=%p length=%zu pos=%lld messages=%zu",
+        __entry->ring, __entry->length, __entry->pos, __entry->messages)
+);
+
+DEFINE_EVENT(memqueue_move, memqueue_write_commit,
+    TP_PROTO(const void * ring, size_t length, long long pos, size_t messages),
+    TP_ARGS(ring, length, pos, messages));
+
+DEFINE_EVENT(memqueue_move, memqueue_read,
+    TP_PROTO(const void * ring, size_t length, long long pos, size_t messages),
+    TP_ARGS(ring, length, pos, messages));
+
+/**
+ * Record written from <pos_from> crossed the end of ring.
+ */
+TRACE_EVENT(memqueue_wrap,
+    TP_PROTO(const void * ring, long long pos_from, long long pos_to),
+    TP_ARGS(ring, pos_from, pos_to),
+    TP_STRUCT__entry(
+        __field(const void *, ring)
+        __field(long long,    pos_from)
+        __field(long long,    pos_to)
+    ),
+    TP_fast_assign(
+        __entry->ring     = ring;
+        __entry->pos_from = pos_from;
+        __entry->pos_to   = pos_to;
+    ),
+    TP_printk("ring=%p pos_from=%lld pos_to=%lld",
+        __entry->ring, __entry->pos_from, __entry->pos_to)
+);
+
+/**
+ * One vfs_read or vfs_write call of file queue, <ret> is its result.
+ */
+DECLARE_EVENT_CLASS(memqueue_io,
+    TP_PROTO(const void * queue, size_t length, long long pos, long ret, u64 duration_ns),
+    TP_ARGS(queue, length, pos, ret, duration_ns),
+    TP_STRUCT__entry(
+        __field(const void *, queue)
+        __field(size_t,       length)
+        __field(long long,    pos)
+        __field(long,         ret)
+        __field(u64,          duration_ns)
+    ),
+    TP_fast_assign(
+        __entry->queue       = queue;
+        __entry->length      = length;
+        __entry->pos         = pos;
+        __entry->ret         = ret;
+        __entry->duration_ns = duration_ns;
+    ),
+    TP_printk("queue=%p length=%zu pos=%lld ret=%ld duration_ns=%llu",
+        __entry->queue, __entry->length, __entry->pos, __entry->ret, __entry->duration_ns)
+);
+
+DEFINE_EVENT(memqueue_io, memqueue_vfs_read,
+    TP_PROTO(const void * queue, size_t length, long long pos, long ret, u64 duration_ns),
+    TP_ARGS(queue, length, pos, ret, duration_ns));
+
+DEFINE_EVENT(memqueue_io, memqueue_vfs_write,
+    TP_PROTO(const void * queue, size_t length, long long pos, long ret, u64 duration_ns),
+    TP_ARGS(queue, length, pos, ret, duration_ns));
+
+#endif
+
+// out of tree module: header is found by -I of src/Makefile
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE memqueue_trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1,400 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include <cstddef>
+#include <exception>
+#include <span>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "mem_queue.h"
+#include "file_queue.h"
+#include "memqueue_ioctl.h"
+
+namespace memqueue
+{
+
+/**
+ * Initial size of buffer for messages which can't be passed in place.
+ */
+constexpr size_t default_scratch_size = 64 * 1024;
+
+/**
+ * Queue owning its instance: memory queue of this process, queue file
+ * or memqueue device. Messages are passed as spans, memory queue passes
+ * them to consumer right from its memory, others through a buffer owned
+ * by Queue. Buffer grows only when a longer message is met, so pushing
+ * and consuming don't allocate memory.
+ * Errors other than full or empty queue are thrown as std::system_error.
+ */
+class Queue
+{
+public:
+    static Queue memory(const memqueue_params & params)
+    {
+        Queue queue(Backend::memory);
+        check_open(mq_open(&queue.memory_, &params), "mq_open");
+        return queue;
+    }
+
+    static Queue file(const char * path, size_t size, unsigned int flags = 0)
+    {
+        Queue queue(Backend::file);
+        check_open(fq_open(&queue.file_, path, size, flags), "fq_open");
+        return queue;
+    }
+
+    static Queue device(const char * path)
+    {
+        Queue queue(Backend::device);
+        queue.device_ = ::open(path, O_RDWR);
+        if (queue.device_ < 0)
+            throw std::system_error(errno, std::generic_category(), "open");
+        return queue;
+    }
+
+    Queue(Queue && other) noexcept
+        : backend_(other.backend_)
+        , memory_(std::exchange(other.memory_, nullptr))
+        , file_(std::exchange(other.file_, nullptr))
+        , device_(std::exchange(other.device_, -1))
+        , scratch_(std::move(other.scratch_))
+    {
+    }
+
+    Queue & operator=(Queue && other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            backend_ = other.backend_;
+            memory_  = std::exchange(other.memory_, nullptr);
+            file_    = std::exchange(other.file_, nullptr);
+            device_  = std::exchange(other.device_, -1);
+            scratch_ = std::move(other.scratch_);
+        }
+        return *this;
+    }
+
+    Queue(const Queue &) = delete;
+    Queue & operator=(const Queue &) = delete;
+
+    ~Queue()
+    {
+        close();
+    }
+
+    /**
+     * Return false if queue is full. <opts> are used by memory queue only,
+     * device takes them by ioctl.
+     */
+    bool try_push(std::span<const std::byte> message, const memqueue_write_opts * opts = nullptr)
+    {
+        const char * data = reinterpret_cast<const char *>(message.data());
+        ssize_t ret_code = 0;
+
+        switch (backend_)
+        {
+        case Backend::memory:
+            ret_code = mq_write(memory_, data, message.size(), opts);
+            break;
+        case Backend::file:
+            ret_code = fq_write(file_, data, message.size());
+            break;
+        case Backend::device:
+            ret_code = ::write(device_, data, message.size());
+            if (ret_code < 0)
+                ret_code = -errno;
+            break;
+        }
+
+        if (ret_code == -ENOSPC)
+            return false;
+        check(ret_code, "write");
+        return true;
+    }
+
+    /**
+     * Push messages in order until one doesn't fit.
+     * Return number of pushed messages.
+     */
+    size_t try_push_batch(std::span<const std::span<const std::byte>> messages, const memqueue_write_opts * opts = nullptr)
+    {
+        size_t count = 0;
+
+        while (count < messages.size() && try_push(messages[count], opts))
+            count++;
+
+        return count;
+    }
+
+    /**
+     * Push messages of <batch> prefixed by size_t length in order until
+     * one doesn't fit, device has to be in MEMQUEUE_IOC_SET_FRAMED mode.
+     * Return bytes of pushed messages with prefixes, 0 if queue is full.
+     * Batch cut inside a message is thrown when nothing before it is pushed.
+     */
+    size_t try_push_framed(std::span<const std::byte> batch, const memqueue_write_opts * opts = nullptr)
+    {
+        const char * data = reinterpret_cast<const char *>(batch.data());
+        ssize_t ret_code = 0;
+
+        switch (backend_)
+        {
+        case Backend::memory:
+            ret_code = mq_write_framed(memory_, data, batch.size(), opts);
+            break;
+        case Backend::file:
+            ret_code = file_write_framed(data, batch.size());
+            break;
+        case Backend::device:
+            ret_code = ::write(device_, data, batch.size());
+            if (ret_code < 0)
+                ret_code = -errno;
+            break;
+        }
+
+        if (ret_code == -ENOSPC)
+            return 0;
+        check(ret_code, "write");
+        return ret_code;
+    }
+
+    /**
+     * Call <fn> with the next message as std::span<const std::byte>,
+     * the span is valid during the call only.
+     * Return false if queue is empty.
+     */
+    template <typename F>
+    bool consume(F && fn)
+    {
+        return consume_batch(std::forward<F>(fn), 1) != 0;
+    }
+
+    /**
+     * Call <fn> for up to <max> messages.
+     * Return number of consumed messages.
+     */
+    template <typename F>
+    size_t consume_batch(F && fn, size_t max)
+    {
+        size_t count = 0;
+
+        if (max == 0)
+            return 0;
+
+        if (backend_ == Backend::memory)
+            return consume_memory(fn, max);
+
+        for (; count < max; count++)
+        {
+            std::span<const std::byte> message = read_next();
+            if (message.empty())
+                break;
+            fn(message);
+        }
+
+        return count;
+    }
+
+private:
+    enum class Backend { memory, file, device };
+
+    // state of one mq_consume call, messages split by ring wrap are
+    // assembled in scratch, whole ones are passed in place
+    template <typename F>
+    struct ConsumeContext
+    {
+        F & fn;
+        std::vector<std::byte> & scratch;
+        size_t count;
+        size_t max;
+        std::exception_ptr error;
+    };
+
+    explicit Queue(Backend backend)
+        : backend_(backend)
+        , scratch_(default_scratch_size)
+    {
+    }
+
+    void close() noexcept
+    {
+        if (memory_)
+            mq_close(memory_);
+        if (file_)
+            fq_close(file_);
+        if (device_ >= 0)
+            ::close(device_);
+
+        memory_ = nullptr;
+        file_   = nullptr;
+        device_ = -1;
+    }
+
+    static void check_open(int ret_code, const char * what)
+    {
+        if (ret_code != 0)
+            throw std::system_error(ret_code < 0 ? -ret_code : ret_code, std::generic_category(), what);
+    }
+
+    static void check(ssize_t ret_code, const char * what)
+    {
+        if (ret_code < 0)
+            throw std::system_error(static_cast<int>(-ret_code), std::generic_category(), what);
+    }
+
+    template <typename F>
+    size_t consume_memory(F & fn, size_t max)
+    {
+        ConsumeContext<F> context = { fn, scratch_, 0, max, nullptr };
+
+        // batch is limited by count of messages, not by bytes
+        ssize_t ret_code = mq_consume(memory_, consume_segment<F>, &context, static_cast<size_t>(-1) / 2, nullptr);
+
+        if (context.error)
+            std::rethrow_exception(context.error);
+        if (ret_code != -ECANCELED)
+            check(ret_code, "mq_consume");
+        return context.count;
+    }
+
+    // consumer callback must not let exceptions through C code, so they
+    // are kept and rethrown after mq_consume, next message stops the batch
+    template <typename F>
+    static int consume_segment(void * context, const char * segment, size_t length, size_t offset, size_t message_length)
+    {
+        ConsumeContext<F> & state = *static_cast<ConsumeContext<F> *>(context);
+        const std::byte * data = reinterpret_cast<const std::byte *>(segment);
+
+        if (offset == 0)
+        {
+            if (state.count == state.max || state.error)
+                return -ECANCELED;
+
+            if (length == message_length)
+                return deliver(state, std::span<const std::byte>(data, length));
+
+            try
+            {
+                if (state.scratch.size() < message_length)
+                    state.scratch.resize(message_length);
+            }
+            catch (...)
+            {
+                return -ENOMEM;
+            }
+        }
+
+        memcpy(state.scratch.data() + offset, data, length);
+
+        if (offset + length == message_length)
+            return deliver(state, std::span<const std::byte>(state.scratch.data(), message_length));
+        return 0;
+    }
+
+    template <typename F>
+    static int deliver(ConsumeContext<F> & state, std::span<const std::byte> message)
+    {
+        state.count++;
+        try
+        {
+            state.fn(message);
+        }
+        catch (...)
+        {
+            state.error = std::current_exception();
+        }
+        return 0;
+    }
+
+    // queue file has no framed write, batch is split the way mq_write_framed does
+    ssize_t file_write_framed(const char * batch, size_t size)
+    {
+        ssize_t ret_code = size == 0 ? -EINVAL : 0;
+        size_t length = 0;
+        size_t offset = 0;
+
+        while (offset < size)
+        {
+            if (size - offset < sizeof(size_t))
+            {
+                ret_code = -EINVAL;
+                break;
+            }
+            memcpy(&length, batch + offset, sizeof(size_t));
+            if (length > size - offset - sizeof(size_t))
+            {
+                ret_code = -EINVAL;
+                break;
+            }
+
+            ret_code = fq_write(file_, batch + offset + sizeof(size_t), length);
+            if (ret_code < 0)
+                break;
+            offset += sizeof(size_t) + length;
+        }
+
+        return offset != 0 ? static_cast<ssize_t>(offset) : ret_code;
+    }
+
+    /**
+     * Read next message of file or device into scratch.
+     * Return empty span if queue is empty.
+     */
+    std::span<const std::byte> read_next()
+    {
+        char * data = nullptr;
+        ssize_t length = 0;
+        ssize_t ret_code = 0;
+
+        if (backend_ == Backend::file)
+        {
+            length = fq_next_length(file_);
+        }
+        else
+        {
+            unsigned long next = 0;
+            length = ::ioctl(device_, MEMQUEUE_IOC_NEXT_LEN, &next) < 0 ? -errno : static_cast<ssize_t>(next);
+        }
+        check(length, "next_length");
+        if (length == 0)
+            return {};
+
+        if (scratch_.size() < static_cast<size_t>(length))
+            scratch_.resize(length);
+        data = reinterpret_cast<char *>(scratch_.data());
+
+        if (backend_ == Backend::file)
+        {
+            ret_code = fq_read(file_, data, length, nullptr);
+        }
+        else
+        {
+            ret_code = ::read(device_, data, length);
+            if (ret_code < 0)
+                ret_code = -errno;
+        }
+        check(ret_code, "read");
+
+        return std::span<const std::byte>(scratch_.data(), ret_code);
+    }
+
+    Backend backend_;
+    mq_queue * memory_ = nullptr;
+    fq_queue * file_   = nullptr;
+    int device_        = -1;
+    std::vector<std::byte> scratch_;
+};
+
+} // namespace memqueue
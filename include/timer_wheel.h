@@ -0,0 +1,69 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include "linux_base.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Hierarchical timing wheel. Level L has 64 slots of 64^L ticks each,
+ * entry is put into the lowest level which covers its delay and is moved
+ * down (cascaded) when time reaches its slot. Insert and expiry are O(1),
+ * bitmaps of occupied slots let advance jump over empty time instead of 
+ * visiting every tick. Wheel isn't locked, caller does it.
+ */
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SLOTS  (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 5
+
+/**
+ * Entry is embedded into the timed object.
+ */
+struct timer_entry
+{
+    struct timer_entry * next;
+    u64 expires;    // tick of expiry
+    u64 placed;     // tick the entry is placed for, less than expires if it is too far
+};
+
+struct timer_slot
+{
+    struct timer_entry * head;
+    struct timer_entry * tail;
+};
+
+struct timer_wheel
+{
+    u64    tick_ns;
+    u64    now;     // first tick not processed yet
+    size_t count;
+    u64    occupied[TIMER_WHEEL_LEVELS];
+    struct timer_slot slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+void timer_wheel_init(struct timer_wheel * wheel, u64 tick_ns, u64 now_ns);
+
+/**
+ * Add <entry> to expire not before <expires_ns>.
+ */
+void timer_wheel_add(struct timer_wheel * wheel, struct timer_entry * entry, u64 expires_ns);
+
+/**
+ * Move time to <now_ns> and return list of expired entries 
+ * in order of expiry, entries of the same tick in order of adding.
+ */
+struct timer_entry * timer_wheel_advance(struct timer_wheel * wheel, u64 now_ns);
+
+/**
+ * Remove all entries and return them as list in no particular order.
+ */
+struct timer_entry * timer_wheel_drain(struct timer_wheel * wheel);
+
+#ifdef __cplusplus
+}
+#endif
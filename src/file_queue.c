@@ -6,8 +6,12 @@
 // #include <linux/fcntl.h>
 
 #include "../include/linux_base.h"
+#include "../include/linux_mm.h"
+#include "../include/linux_mutex.h"
 #include "../include/linux_spinlock.h"
 #include "../include/linux_syscalls.h"
+#include "../include/linux_time.h"
+#include "../include/linux_trace.h"
 
 #include "../include/memqueue_constants.h"
 #include "../include/file_queue.h"
@@ -16,6 +20,12 @@
 #define HEADER_READ_OFFSET  0
 #define HEADER_WRITE_OFFSET sizeof(loff_t)
 
+MQ_TRACE_SEMAPHORE(fq_write);
+MQ_TRACE_SEMAPHORE(fq_full);
+MQ_TRACE_SEMAPHORE(fq_read);
+MQ_TRACE_SEMAPHORE(vfs_read);
+MQ_TRACE_SEMAPHORE(vfs_write);
+
 //TODO: try this functions
 // Since version 4.14 of Linux kernel, vfs_read and vfs_write 
 // functions are no longer exported for use in modules. 
@@ -27,223 +37,311 @@
 // # Write the file from the kernel space.
 // ssize_t kernel_write(struct file *file, const void *buf, size_t count,loff_t *pos);
 
-// ========== internal variables ========== 
-static file_descriptor queue = 0;
-static size_t queue_size = 0;
-static size_t file_size = 0;
-static mm_segment_t oldfs;
+/**
+ * Queue instance: file and positions in it.
+ */
+struct fq_queue
+{
+    file_descriptor file;
+    size_t size;
+    size_t file_size;
+    unsigned int flags;
+    mm_segment_t oldfs;
+
+    loff_t pos_begin;
+    loff_t pos_end;
+    loff_t pos_read;
+    loff_t pos_write;
+    // bytes of the first message already returned to reader
+    size_t read_partial;
+
+    spinlock_t lock_pos;
+    // file I/O and punching holes of passed chunks sleep
+    struct mutex lock_read;
+    struct mutex lock_write;
+};
 
-static loff_t queue_pos_begin = 0;
-static loff_t queue_pos_end   = 0;
-static loff_t queue_pos_read  = 0;
-static loff_t queue_pos_write = 0;
+// ========== internal variables ========== 
 
-static DEFINE_SPINLOCK(lock_pos);
-static DEFINE_SPINLOCK(lock_read);
-static DEFINE_SPINLOCK(lock_write);
+// queue of filequeue_* functions
+static struct fq_queue * default_queue = 0;
 
 // ========== prototypes for internal functions ========== 
 
-static ssize_t read_block(loff_t pos_read, char * data, size_t size);
-static loff_t  read_data (loff_t pos_read, char * data, size_t length);
-static loff_t  read_bytes(loff_t pos_read, char * data, size_t length);
+static ssize_t read_block(struct fq_queue * queue, loff_t pos_read, char * data, size_t size, size_t * left);
+static loff_t  read_data (struct fq_queue * queue, loff_t pos_read, char * data, size_t length);
+static loff_t  read_bytes(struct fq_queue * queue, loff_t pos_read, char * data, size_t length);
+
+static ssize_t write_block(struct fq_queue * queue, loff_t pos_write, const char * data, size_t length);
+static loff_t  write_data (struct fq_queue * queue, loff_t pos_write, const char * data, size_t length);
+static loff_t  write_bytes(struct fq_queue * queue, loff_t pos_write,       char * data, size_t length);
 
-static ssize_t write_block(loff_t pos_write, const char * data, size_t length);
-static loff_t  write_data (loff_t pos_write, const char * data, size_t length);
-static loff_t  write_bytes(loff_t pos_write,       char * data, size_t length);
+static void release_passed_chunks(struct fq_queue * queue, loff_t pos_from);
+static void release_file         (struct fq_queue * queue);
 
-static bool check_empty_space (loff_t pos_read, loff_t pos_write, size_t length);
+static bool check_empty_space (struct fq_queue * queue, loff_t pos_read, loff_t pos_write, size_t length);
 static bool check_filled_space(loff_t pos_read, loff_t pos_write);
+static bool check_chunk_used  (struct fq_queue * queue, size_t index, loff_t pos_read, loff_t pos_write);
 
 // ========== base functions ==========
 
-int filequeue_open(const char * path, size_t _queue_size)
+int fq_open(struct fq_queue ** result, const char * path, size_t size, unsigned int flags)
 {
+    struct fq_queue * queue = 0;
     int ret_code = 0;
 
-    queue_size      = _queue_size;
-    file_size       = HEADER_SIZE + queue_size;
-    queue_pos_begin = HEADER_SIZE;
-    queue_pos_end   = HEADER_SIZE + queue_size;
-    queue_pos_read  = HEADER_SIZE;
-    queue_pos_write = HEADER_SIZE;    
+    if (result == 0 || path == 0)
+        return EINVAL;
+
+    queue = kvzalloc(sizeof(struct fq_queue), GFP_KERNEL);
+    if (queue == 0)
+        return ENOMEM;
+
+    queue->size         = size;
+    queue->flags        = flags;
+    queue->file_size    = HEADER_SIZE + size;
+    queue->pos_begin    = HEADER_SIZE;
+    queue->pos_end      = HEADER_SIZE + size;
+    queue->pos_read     = HEADER_SIZE;
+    queue->pos_write    = HEADER_SIZE;    
+    queue->read_partial = 0;
 
-    oldfs = get_fs();
+    queue->oldfs = get_fs();
     set_fs(get_ds());
-    queue = filp_open(path, O_RDWR, 0600);
-    set_fs(oldfs);
+    queue->file = filp_open(path, O_RDWR, 0600);
+    set_fs(queue->oldfs);
 
-    if (IS_ERR(queue))
+    if (IS_ERR(queue->file))
     {
-        oldfs = get_fs();
+        queue->oldfs = get_fs();
         set_fs(get_ds());
-        queue = filp_open(path, O_RDWR | O_CREAT, 0600);
-        set_fs(oldfs);
+        queue->file = filp_open(path, O_RDWR | O_CREAT, 0600);
+        set_fs(queue->oldfs);
 
-        if (IS_ERR(queue))
+        if (IS_ERR(queue->file))
+        {
+            kvfree(queue);
             return -EIO;
+        }
 
-        ret_code = vfs_fallocate(queue, 0, 0, file_size);
-        if (ret_code != 0)
-            return ret_code;
+        if (queue->flags & FILEQUEUE_SPARSE)
+            ret_code = vfs_ftruncate(queue->file, queue->file_size);
+        else
+            ret_code = vfs_fallocate(queue->file, 0, 0, queue->file_size);
     }
     else
     {
-        ret_code = read_bytes(HEADER_READ_OFFSET, (char*)&queue_pos_read, sizeof(loff_t));
-        if (ret_code < 0)
-            return ret_code;
-
-        ret_code = read_bytes(HEADER_WRITE_OFFSET, (char*)&queue_pos_write, sizeof(loff_t));
-        if (ret_code < 0)
-            return ret_code;
+        ret_code = read_bytes(queue, HEADER_READ_OFFSET, (char*)&queue->pos_read, sizeof(loff_t));
+        if (ret_code >= 0)
+            ret_code = read_bytes(queue, HEADER_WRITE_OFFSET, (char*)&queue->pos_write, sizeof(loff_t));
+        if (ret_code > 0)
+            ret_code = 0;
     }
 
+    if (ret_code == 0 && vfs_llseek(queue->file, 0L, SEEK_END) != queue->file_size)
+        ret_code = -EINVAL;
+
+    // header isn't written back, file is left as it was found
+    if (ret_code != 0)
     {
-        loff_t size = vfs_llseek(queue, 0L, SEEK_END);
-        if (size != file_size)
-            return -EINVAL;
+        release_file(queue);
+        kvfree(queue);
+        return ret_code;
     }
 
-    INIT_SPINLOCK(lock_pos);
-    INIT_SPINLOCK(lock_read);
-    INIT_SPINLOCK(lock_write);
+    INIT_SPINLOCK(queue->lock_pos);
+    INIT_MUTEX(queue->lock_read);
+    INIT_MUTEX(queue->lock_write);
 
+    *result = queue;
     return 0;
 }
 
-int filequeue_close(void)
+int fq_close(struct fq_queue * queue)
 {
     int ret_code = 0;
 
-    if (IS_ERR(queue) == false)
-    {
-        ret_code = write_bytes(HEADER_READ_OFFSET, (char*)&queue_pos_read, sizeof(loff_t));
-        if (ret_code < 0)
-            return ret_code;
+    if (queue == 0)
+        return 0;
 
-        ret_code = write_bytes(HEADER_WRITE_OFFSET, (char*)&queue_pos_write, sizeof(loff_t));
-        if (ret_code < 0)
-            return ret_code;
+    ret_code = write_bytes(queue, HEADER_READ_OFFSET, (char*)&queue->pos_read, sizeof(loff_t));
+    if (ret_code < 0)
+        return ret_code;
 
-        oldfs = get_fs();
-        set_fs(get_ds());
-        filp_close(queue, NULL);
-        set_fs(oldfs);
-        queue = 0;
-    }
+    ret_code = write_bytes(queue, HEADER_WRITE_OFFSET, (char*)&queue->pos_write, sizeof(loff_t));
+    if (ret_code < 0)
+        return ret_code;
 
-    queue_size      = 0;
-    queue_pos_begin = 0;
-    queue_pos_end   = 0;
-    queue_pos_read  = 0;
-    queue_pos_write = 0;
+    release_file(queue);
 
-    DESTROY_SPINLOCK(lock_pos);
-    DESTROY_SPINLOCK(lock_read);
-    DESTROY_SPINLOCK(lock_write);
+    DESTROY_SPINLOCK(queue->lock_pos);
+    DESTROY_MUTEX(queue->lock_read);
+    DESTROY_MUTEX(queue->lock_write);
 
+    kvfree(queue);
     return 0;
 }
 
+static void release_file(struct fq_queue * queue)
+{
+    queue->oldfs = get_fs();
+    set_fs(get_ds());
+    filp_close(queue->file, NULL);
+    set_fs(queue->oldfs);
+    queue->file = 0;
+}
+
 // ========== read functions ==========
 
-ssize_t filequeue_read(char * data, size_t size)
+ssize_t fq_read(struct fq_queue * queue, char * data, size_t size, size_t * left)
 {
     ssize_t ret_code = 0;
     loff_t pos_read  = 0;
     loff_t pos_write = 0;
+    size_t left_tmp  = 0;
 
     if (data == 0 || size == 0)
         return -EINVAL;
 
-    spin_lock(&lock_read);
+    if (left == 0)
+        left = &left_tmp;
+    *left = 0;
+
+    mutex_lock(&queue->lock_read);
 
-    spin_lock(&lock_pos);
-    pos_read  = queue_pos_read;
-    pos_write = queue_pos_write;
-    spin_unlock(&lock_pos);
+    spin_lock(&queue->lock_pos);
+    pos_read  = queue->pos_read;
+    pos_write = queue->pos_write;
+    spin_unlock(&queue->lock_pos);
 
-    PRINTF(KERN_DEBUG, "filequeue positions before read %lli %lli\n", 
-        pos_read - queue_pos_begin, 
-        pos_write - queue_pos_begin
-    );
+    MQ_TRACE(fq_read, queue, size, pos_read - queue->pos_begin, pos_write - queue->pos_begin);
 
     if (check_filled_space(pos_read, pos_write))
     {
-        ret_code = read_block(pos_read, data, size);
+        ret_code = read_block(queue, pos_read, data, size, left);
     }
 
-    spin_unlock(&lock_read);
+    mutex_unlock(&queue->lock_read);
+
+    if (ret_code > 0 && *left == 0 && (queue->flags & FILEQUEUE_SPARSE))
+        release_passed_chunks(queue, pos_read);
+
     return ret_code;
 }
 
-static ssize_t read_block(loff_t pos_read, char * data, size_t size)
+ssize_t fq_next_length(struct fq_queue * queue)
 {
+    ssize_t ret_code = 0;
     size_t length = 0;
+    bool filled = false;
 
-    pos_read = read_data(pos_read, (char*)&length, sizeof(size_t));
+    mutex_lock(&queue->lock_read);
+
+    spin_lock(&queue->lock_pos);
+    filled = check_filled_space(queue->pos_read, queue->pos_write);
+    spin_unlock(&queue->lock_pos);
+
+    if (filled)
+    {
+        ret_code = read_data(queue, queue->pos_read, (char*)&length, sizeof(size_t));
+        if (ret_code >= 0)
+            ret_code = length - queue->read_partial;
+    }
+
+    mutex_unlock(&queue->lock_read);
+    return ret_code;
+}
+
+/**
+ * Message which doesn't fit into <size> is returned by parts,
+ * read position is moved when its last part is read.
+ * Partial state isn't saved in file header, so after reopen 
+ * the message is read from its beginning.
+ */
+static ssize_t read_block(struct fq_queue * queue, loff_t pos_read, char * data, size_t size, size_t * left)
+{
+    size_t length = 0;
+
+    pos_read = read_data(queue, pos_read, (char*)&length, sizeof(size_t));
     if (pos_read < 0)
         return pos_read;
-    if (length > size)
-        return -ENOSPC;
+    if (size > length - queue->read_partial)
+        size = length - queue->read_partial;
 
-    pos_read = read_data(pos_read, data, length);
+    pos_read += queue->read_partial;
+    if (pos_read >= queue->pos_end)
+        pos_read -= queue->pos_end - queue->pos_begin;
+
+    pos_read = read_data(queue, pos_read, data, size);
     if (pos_read < 0)
         return pos_read;
 
-    spin_lock(&lock_pos);
-    queue_pos_read = pos_read;
-    spin_unlock(&lock_pos);
+    queue->read_partial += size;
+    *left = length - queue->read_partial;
+    if (*left)
+        return size;
 
-    return length;
+    queue->read_partial = 0;
+
+    spin_lock(&queue->lock_pos);
+    queue->pos_read = pos_read;
+    spin_unlock(&queue->lock_pos);
+
+    return size;
 }
 
-static loff_t read_data(loff_t pos_read, char * data, size_t length)
+static loff_t read_data(struct fq_queue * queue, loff_t pos_read, char * data, size_t length)
 {
-    size_t length_tail = queue_pos_end - pos_read;
+    size_t length_tail = queue->pos_end - pos_read;
 
     if (length_tail < length)
     {
         size_t length_head = length - length_tail;
 
-        pos_read = read_bytes(pos_read, data, length_tail);
+        pos_read = read_bytes(queue, pos_read, data, length_tail);
         if (pos_read < 0)
             return pos_read;
 
-        return read_bytes(queue_pos_begin, data + length_tail, length_head);
+        return read_bytes(queue, queue->pos_begin, data + length_tail, length_head);
     }
     else
     {
-        return read_bytes(pos_read, data, length);
+        return read_bytes(queue, pos_read, data, length);
     }
 }
 
-static loff_t read_bytes(loff_t pos_read, char * data, size_t length)
+static loff_t read_bytes(struct fq_queue * queue, loff_t pos_read, char * data, size_t length)
 {
     ssize_t n_bytes = 0;
     size_t offset = 0;
+    u64 start = 0;
 
-    oldfs = get_fs();
+    queue->oldfs = get_fs();
     set_fs(get_ds());
     while (length)
     {
-        n_bytes = vfs_read(queue, data + offset, length, &pos_read);
+        // clock is read only while probe is enabled
+        if (MQ_TRACE_ENABLED(vfs_read))
+            start = ktime_get_ns();
+        n_bytes = vfs_read(queue->file, data + offset, length, &pos_read);
+        if (MQ_TRACE_ENABLED(vfs_read))
+            MQ_TRACE(vfs_read, queue, length, pos_read, n_bytes, ktime_get_ns() - start);
         if (n_bytes < 0)
             break;
         length   -= n_bytes;
         offset   += n_bytes;
         pos_read += n_bytes;
     }
-    set_fs(oldfs);
+    set_fs(queue->oldfs);
 
     if (n_bytes < 0)
         return n_bytes;
-    return pos_read == queue_pos_end ? queue_pos_begin : pos_read;
+    return pos_read == queue->pos_end ? queue->pos_begin : pos_read;
 }
 
 // ========== write functions ==========
 
-ssize_t filequeue_write(const char * data, size_t length)
+ssize_t fq_write(struct fq_queue * queue, const char * data, size_t length)
 {
     ssize_t ret_code = 0;
     loff_t pos_read  = 0;
@@ -252,105 +350,141 @@ ssize_t filequeue_write(const char * data, size_t length)
     if (data == 0 || length == 0)
         return -EINVAL;
 
-    spin_lock(&lock_write);
+    mutex_lock(&queue->lock_write);
+
+    spin_lock(&queue->lock_pos);
+    pos_read  = queue->pos_read;
+    pos_write = queue->pos_write;
+    spin_unlock(&queue->lock_pos);
 
-    spin_lock(&lock_pos);
-    pos_read  = queue_pos_read;
-    pos_write = queue_pos_write;
-    spin_unlock(&lock_pos);
+    MQ_TRACE(fq_write, queue, length, pos_read - queue->pos_begin, pos_write - queue->pos_begin);
 
-    PRINTF(KERN_DEBUG, "filequeue positions before write %lli %lli\n", 
-        pos_read - queue_pos_begin, 
-        pos_write - queue_pos_begin
-    );
-    
-    if (check_empty_space(pos_read, pos_write, length))
+    if (check_empty_space(queue, pos_read, pos_write, length))
     {
-        ret_code = write_block(pos_write, data, length);
+        ret_code = write_block(queue, pos_write, data, length);
     }
     else
     {
+        MQ_TRACE(fq_full, queue, length, pos_read - queue->pos_begin, pos_write - queue->pos_begin);
         ret_code = -ENOSPC;
     }
 
-    spin_unlock(&lock_write);
+    mutex_unlock(&queue->lock_write);
     return ret_code;
 }
 
-static ssize_t write_block(loff_t pos_write, const char * data, size_t length)
+static ssize_t write_block(struct fq_queue * queue, loff_t pos_write, const char * data, size_t length)
 {
-    pos_write = write_data(pos_write, (char*)&length, sizeof(size_t));
+    pos_write = write_data(queue, pos_write, (char*)&length, sizeof(size_t));
     if (pos_write < 0)
         return pos_write;
 
-    pos_write = write_data(pos_write, data, length);
+    pos_write = write_data(queue, pos_write, data, length);
     if (pos_write < 0)
         return pos_write;
 
-    spin_lock(&lock_pos);
-    queue_pos_write = pos_write;
-    spin_unlock(&lock_pos);
+    spin_lock(&queue->lock_pos);
+    queue->pos_write = pos_write;
+    spin_unlock(&queue->lock_pos);
 
     return length;
 }
 
-static loff_t write_data(loff_t pos_write, const char * data, size_t length)
+static loff_t write_data(struct fq_queue * queue, loff_t pos_write, const char * data, size_t length)
 {
-    size_t length_tail = queue_pos_end - pos_write;
+    size_t length_tail = queue->pos_end - pos_write;
 
     if (length_tail < length)
     {
         size_t length_head = length - length_tail;
 
-        pos_write = write_bytes(pos_write, (char*)data, length_tail);
+        pos_write = write_bytes(queue, pos_write, (char*)data, length_tail);
         if (pos_write < 0)
             return pos_write;
         
-        return write_bytes(queue_pos_begin, (char*)(data + length_tail), length_head);
+        return write_bytes(queue, queue->pos_begin, (char*)(data + length_tail), length_head);
     }
     else
     {
-        return write_bytes(pos_write, (char*)data, length);
+        return write_bytes(queue, pos_write, (char*)data, length);
     }
 }
 
-static loff_t write_bytes(loff_t pos_write, char * data, size_t length)
+static loff_t write_bytes(struct fq_queue * queue, loff_t pos_write, char * data, size_t length)
 {
     ssize_t n_bytes = 0;
     size_t offset = 0;
+    u64 start = 0;
 
-    oldfs = get_fs();
+    queue->oldfs = get_fs();
     set_fs(get_ds());
     while (length)
     {
-        n_bytes = vfs_write(queue, data + offset, length, &pos_write);
+        if (MQ_TRACE_ENABLED(vfs_write))
+            start = ktime_get_ns();
+        n_bytes = vfs_write(queue->file, data + offset, length, &pos_write);
+        if (MQ_TRACE_ENABLED(vfs_write))
+            MQ_TRACE(vfs_write, queue, length, pos_write, n_bytes, ktime_get_ns() - start);
         if (n_bytes < 0)
             break;
         length    -= n_bytes;
         offset    += n_bytes;
         pos_write += n_bytes;
     }
-    set_fs(oldfs);
+    set_fs(queue->oldfs);
 
     if (n_bytes < 0)
         return n_bytes;
-    return pos_write == queue_pos_end ? queue_pos_begin : pos_write;
+    return pos_write == queue->pos_end ? queue->pos_begin : pos_write;
+}
+
+// ========== sparse file functions ==========
+
+static void release_passed_chunks(struct fq_queue * queue, loff_t pos_from)
+{
+    loff_t pos_read  = 0;
+    loff_t pos_write = 0;
+    size_t index = (pos_from - queue->pos_begin) / MEMQUEUE_CHUNK_SIZE;
+    size_t count = (queue->size + MEMQUEUE_CHUNK_SIZE - 1) / MEMQUEUE_CHUNK_SIZE;
+
+    // writer could wrap around into passed chunks, so keep it away
+    mutex_lock(&queue->lock_write);
+
+    spin_lock(&queue->lock_pos);
+    pos_read  = queue->pos_read;
+    pos_write = queue->pos_write;
+    spin_unlock(&queue->lock_pos);
+
+    while (check_chunk_used(queue, index, pos_read, pos_write) == false)
+    {
+        size_t offset = index * MEMQUEUE_CHUNK_SIZE;
+        size_t length = queue->size - offset;
+        if (length > MEMQUEUE_CHUNK_SIZE)
+            length = MEMQUEUE_CHUNK_SIZE;
+
+        // it's only a hint, data of passed chunk isn't needed anymore
+        vfs_fallocate(queue->file, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, queue->pos_begin + offset, length);
+
+        index = (index + 1) % count;
+    }
+
+    mutex_unlock(&queue->lock_write);
 }
 
 // ========== check functions ==========
 
-static bool check_empty_space(loff_t pos_read, loff_t pos_write, size_t length)
+static bool check_empty_space(struct fq_queue * queue, loff_t pos_read, loff_t pos_write, size_t length)
 {
     size_t empty_space = 0;
 
     if (pos_read == pos_write)
     {
-        empty_space = queue_size;
+        empty_space = queue->size;
     }
     else if (pos_read < pos_write)
     {// --------------================----------------X
      //               ^pos_read       ^pos_write      ^pos_end
-        empty_space = (pos_read - queue_pos_begin) + (queue_pos_end - pos_write);
+        empty_space = (pos_read - queue->pos_begin) + (queue->pos_end - pos_write);
     }
     else if (pos_read > pos_write)
     {// ==============----------------================X
@@ -378,3 +512,71 @@ static bool check_filled_space(loff_t pos_read, loff_t pos_write)
         return true;
     }
 }
+
+/**
+ * Chunks from the one with read position up to the one with write position
+ * hold messages or will be written next, they can't be released.
+ */
+static bool check_chunk_used(struct fq_queue * queue, size_t index, loff_t pos_read, loff_t pos_write)
+{
+    size_t index_read  = (pos_read  - queue->pos_begin) / MEMQUEUE_CHUNK_SIZE;
+    size_t index_write = (pos_write - queue->pos_begin) / MEMQUEUE_CHUNK_SIZE;
+
+    if (pos_read <= pos_write)
+        return index >= index_read && index <= index_write;
+    else
+        return index >= index_read || index <= index_write;
+}
+
+// ========== default queue functions ==========
+
+int filequeue_open(const char * path, size_t _queue_size)
+{
+    return filequeue_open_flags(path, _queue_size, 0);
+}
+
+int filequeue_open_flags(const char * path, size_t _queue_size, unsigned int flags)
+{
+    int ret_code = filequeue_close();
+    if (ret_code != 0)
+        return ret_code;
+
+    return fq_open(&default_queue, path, _queue_size, flags);
+}
+
+int filequeue_close(void)
+{
+    int ret_code = fq_close(default_queue);
+    if (ret_code == 0)
+        default_queue = 0;
+    return ret_code;
+}
+
+ssize_t filequeue_read(char * data, size_t size)
+{
+    return filequeue_read_part(data, size, 0);
+}
+
+ssize_t filequeue_read_part(char * data, size_t size, size_t * left)
+{
+    if (default_queue == 0)
+        return data == 0 || size == 0 ? -EINVAL : -EBADF;
+
+    return fq_read(default_queue, data, size, left);
+}
+
+ssize_t filequeue_next_length(void)
+{
+    if (default_queue == 0)
+        return -EBADF;
+
+    return fq_next_length(default_queue);
+}
+
+ssize_t filequeue_write(const char * data, size_t length)
+{
+    if (default_queue == 0)
+        return data == 0 || length == 0 ? -EINVAL : -EBADF;
+
+    return fq_write(default_queue, data, length);
+}
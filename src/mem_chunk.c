@@ -0,0 +1,206 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include "../include/linux_base.h"
+#include "../include/linux_mm.h"
+
+#include "../include/mem_chunk.h"
+
+#ifndef __KERNEL__
+    #include <stdint.h>
+    #include <string.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+
+    #ifndef MAP_HUGE_2MB
+        #define MAP_HUGE_2MB (21 << 26)
+    #endif
+    #ifndef MADV_POPULATE_WRITE
+        #define MADV_POPULATE_WRITE 23
+    #endif
+    #ifndef MPOL_PREFERRED
+        #define MPOL_PREFERRED 1
+    #endif
+#endif
+
+#ifdef __KERNEL__
+
+// ========== kernel allocation ==========
+
+static char * alloc_huge(size_t size, int node)
+{
+    // compound high-order page, don't try hard if memory is fragmented
+    struct page * page = alloc_pages_node(node, GFP_KERNEL | __GFP_COMP | __GFP_NOWARN | __GFP_NORETRY, get_order(size));
+    return page ? page_address(page) : 0;
+}
+
+int memchunk_alloc(struct memchunk * chunk, unsigned int flags, int node)
+{
+    // order 9 allocation may reclaim and compact, ring's writer holds a mutex
+    might_sleep();
+
+    if (chunk->resident)
+        return 0;
+
+    chunk->kind = MEMCHUNK_KIND_REGULAR;
+    chunk->data = 0;
+
+    if ((flags & MEMCHUNK_HUGEPAGES) && chunk->size == MEMCHUNK_HUGE_PAGE_SIZE)
+    {
+        chunk->data = alloc_huge(chunk->size, node);
+        if (chunk->data)
+            chunk->kind = MEMCHUNK_KIND_HUGE;
+    }
+
+    if (chunk->data == 0)
+        chunk->data = kvmalloc_node(chunk->size, GFP_KERNEL, node);
+    if (chunk->data == 0)
+        return -ENOMEM;
+
+    chunk->resident = true;
+    return 0;
+}
+
+void memchunk_release(struct memchunk * chunk)
+{
+    memchunk_free(chunk);
+}
+
+void memchunk_free(struct memchunk * chunk)
+{
+    // kvfree of vmalloc'ed chunk may sleep
+    might_sleep();
+
+    if (chunk->data)
+    {
+        if (chunk->kind == MEMCHUNK_KIND_HUGE)
+            __free_pages(virt_to_page(chunk->data), get_order(chunk->size));
+        else
+            kvfree(chunk->data);
+    }
+
+    chunk->data     = 0;
+    chunk->resident = false;
+}
+
+#else
+
+// ========== user-mode allocation ==========
+
+static char * map_regular(size_t size)
+{
+    void * data = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return data == MAP_FAILED ? 0 : data;
+}
+
+static char * map_hugetlb(size_t size)
+{
+    void * data = mmap(0, size, PROT_READ | PROT_WRITE, 
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+    return data == MAP_FAILED ? 0 : data;
+}
+
+/**
+ * Transparent huge page needs 2MB aligned address, 
+ * so map twice as much and trim both ends.
+ */
+static char * map_transparent(size_t size)
+{
+    size_t head = 0;
+    char * aligned = 0;
+    char * data = mmap(0, size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        return 0;
+
+    aligned = (char*)(((uintptr_t)data + size - 1) & ~(uintptr_t)(size - 1));
+    head = aligned - data;
+    if (head)
+        munmap(data, head);
+    munmap(aligned + size, size - head);
+
+    if (madvise(aligned, size, MADV_HUGEPAGE) != 0)
+    {
+        munmap(aligned, size);
+        return 0;
+    }
+
+    return aligned;
+}
+
+/**
+ * Pages are placed when they are touched first time,
+ * so policy is set before populating. 
+ * Preferred, not bound: other node is better than no memory.
+ */
+static int place_and_populate(char * data, size_t size, int node)
+{
+    if (node >= 0)
+    {
+        unsigned long nodemask[4] = { 0 };
+        if (node >= (int)(sizeof(nodemask) * 8))
+            return -EINVAL;
+        nodemask[node / (sizeof(unsigned long) * 8)] = 1UL << (node % (sizeof(unsigned long) * 8));
+        syscall(SYS_mbind, data, size, MPOL_PREFERRED, nodemask, sizeof(nodemask) * 8, 0);
+    }
+
+    if (madvise(data, size, MADV_POPULATE_WRITE) != 0)
+        memset(data, 0, size);
+    return 0;
+}
+
+int memchunk_alloc(struct memchunk * chunk, unsigned int flags, int node)
+{
+    if (chunk->resident)
+        return 0;
+
+    if (chunk->data == 0)
+    {
+        chunk->kind = MEMCHUNK_KIND_REGULAR;
+
+        if ((flags & MEMCHUNK_HUGEPAGES) && chunk->size == MEMCHUNK_HUGE_PAGE_SIZE)
+        {
+            chunk->data = map_hugetlb(chunk->size);
+            if (chunk->data == 0)
+                chunk->data = map_transparent(chunk->size);
+            if (chunk->data)
+                chunk->kind = MEMCHUNK_KIND_HUGE;
+        }
+
+        if (chunk->data == 0)
+            chunk->data = map_regular(chunk->size);
+        if (chunk->data == 0)
+            return -ENOMEM;
+
+        if (place_and_populate(chunk->data, chunk->size, node) != 0)
+        {
+            memchunk_free(chunk);
+            return -ENOMEM;
+        }
+    }
+    // mapping of released chunk is still valid with its policy, 
+    // pages come back on first touch
+
+    chunk->resident = true;
+    return 0;
+}
+
+void memchunk_release(struct memchunk * chunk)
+{
+    if (chunk->resident)
+        madvise(chunk->data, chunk->size, MADV_DONTNEED);
+
+    chunk->resident = false;
+}
+
+void memchunk_free(struct memchunk * chunk)
+{
+    if (chunk->data)
+        munmap(chunk->data, chunk->size);
+
+    chunk->data     = 0;
+    chunk->resident = false;
+}
+
+#endif
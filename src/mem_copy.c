@@ -0,0 +1,224 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include "../include/linux_base.h"
+#include "../include/linux_uaccess.h"
+
+#include "../include/mem_copy.h"
+
+#ifdef __KERNEL__
+    #include <linux/string.h>
+    #include <linux/prefetch.h>
+    #include <linux/cache.h>
+    #ifdef CONFIG_X86_64
+        #include <asm/cpufeature.h>
+    #endif
+#else
+    #include <stdint.h>
+    #include <string.h>
+    #if defined(__x86_64__)
+        #include <immintrin.h>
+    #endif
+
+    #define SMP_CACHE_BYTES 64
+    #define prefetch(ptr) __builtin_prefetch(ptr, 0, 3)
+#endif
+
+// ========== prototypes for internal functions ==========
+
+static inline void copy_small(char * to, const char * from, size_t n);
+
+#if !defined(__KERNEL__) && defined(__x86_64__)
+static void copy_sse2_nt(char * to, const char * from, size_t n);
+static void copy_avx_nt (char * to, const char * from, size_t n);
+#endif
+
+// ========== base functions ==========
+
+void memcopy_init(struct memcopy * copy, size_t nt_threshold)
+{
+    copy->nt_threshold = nt_threshold ? nt_threshold : MEMCOPY_NT_THRESHOLD;
+    copy->strategy = MEMCOPY_PLAIN;
+
+#ifdef __KERNEL__
+    #ifdef CONFIG_X86_64
+    if (boot_cpu_has(X86_FEATURE_XMM2))
+        copy->strategy = MEMCOPY_SSE2_NT;
+    #endif
+#elif defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+        copy->strategy = MEMCOPY_AVX_NT;
+    else if (__builtin_cpu_supports("sse2"))
+        copy->strategy = MEMCOPY_SSE2_NT;
+#endif
+}
+
+int memcopy_strategy(const struct memcopy * copy)
+{
+    return copy->strategy;
+}
+
+// ========== copy functions ==========
+
+unsigned long memcopy_to_ring(const struct memcopy * copy, void * to, const void * from, size_t n)
+{
+#ifdef __KERNEL__
+    #ifdef CONFIG_X86_64
+    // cache bypassing copy falls back to regular one for faulted tail,
+    // unlike copy_from_user it doesn't check the user range itself
+    if (n >= copy->nt_threshold && copy->strategy == MEMCOPY_SSE2_NT)
+    {
+        unsigned long left;
+
+        if (!mq_access_ok(from, n))
+            return n;
+
+        left = __copy_from_user_inatomic_nocache(to, from, n);
+        if (left == 0)
+            return 0;
+        return copy_from_user((char*)to + n - left, (const char*)from + n - left, left);
+    }
+    #endif
+    return copy_from_user(to, from, n);
+#else
+    if (n <= 64)
+        copy_small(to, from, n);
+    else if (n < copy->nt_threshold || copy->strategy == MEMCOPY_PLAIN)
+        memcpy(to, from, n);
+    #if defined(__x86_64__)
+    else if (copy->strategy == MEMCOPY_AVX_NT)
+        copy_avx_nt(to, from, n);
+    else
+        copy_sse2_nt(to, from, n);
+    #endif
+    return 0;
+#endif
+}
+
+unsigned long memcopy_from_ring(void * to, const void * from, size_t n)
+{
+#ifdef __KERNEL__
+    return copy_to_user(to, from, n);
+#else
+    // reader uses message right away, so it's copied into cache
+    if (n <= 64)
+        copy_small(to, from, n);
+    else
+        memcpy(to, from, n);
+    return 0;
+#endif
+}
+
+void memcopy_kern(void * to, const void * from, size_t n)
+{
+    if (n <= 64)
+        copy_small(to, from, n);
+    else
+        memcpy(to, from, n);
+}
+
+void memcopy_prefetch(const void * ptr, size_t n)
+{
+    const char * pos = ptr;
+    const char * end = pos + n;
+
+    for (; pos < end; pos += SMP_CACHE_BYTES)
+        prefetch(pos);
+}
+
+// ========== strategies ==========
+
+/**
+ * Up to 64 bytes by two overlapping copies of constant size,
+ * compiler turns each of them into one or two register moves.
+ */
+static inline void copy_small(char * to, const char * from, size_t n)
+{
+    if (n >= 32) {
+        char head[32], tail[32];
+        memcpy(head, from, 32);
+        memcpy(tail, from + n - 32, 32);
+        memcpy(to, head, 32);
+        memcpy(to + n - 32, tail, 32);
+    } else if (n >= 16) {
+        u64 h0, h1, t0, t1;
+        memcpy(&h0, from, 8);
+        memcpy(&h1, from + 8, 8);
+        memcpy(&t0, from + n - 16, 8);
+        memcpy(&t1, from + n - 8, 8);
+        memcpy(to, &h0, 8);
+        memcpy(to + 8, &h1, 8);
+        memcpy(to + n - 16, &t0, 8);
+        memcpy(to + n - 8, &t1, 8);
+    } else if (n >= 8) {
+        u64 h, t;
+        memcpy(&h, from, 8);
+        memcpy(&t, from + n - 8, 8);
+        memcpy(to, &h, 8);
+        memcpy(to + n - 8, &t, 8);
+    } else if (n >= 4) {
+        u32 h, t;
+        memcpy(&h, from, 4);
+        memcpy(&t, from + n - 4, 4);
+        memcpy(to, &h, 4);
+        memcpy(to + n - 4, &t, 4);
+    } else {
+        while (n--)
+            *to++ = *from++;
+    }
+}
+
+#if !defined(__KERNEL__) && defined(__x86_64__)
+
+/**
+ * Destination is aligned by regular copy of head, 
+ * then whole cache lines are streamed around the cache.
+ */
+static void copy_sse2_nt(char * to, const char * from, size_t n)
+{
+    size_t head = (16 - ((uintptr_t)to & 15)) & 15;
+
+    memcpy(to, from, head);
+    to += head; from += head; n -= head;
+
+    for (; n >= 64; n -= 64, to += 64, from += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(from + 0));
+        __m128i b = _mm_loadu_si128((const __m128i*)(from + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(from + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(from + 48));
+        _mm_stream_si128((__m128i*)(to + 0),  a);
+        _mm_stream_si128((__m128i*)(to + 16), b);
+        _mm_stream_si128((__m128i*)(to + 32), c);
+        _mm_stream_si128((__m128i*)(to + 48), d);
+    }
+    // streamed stores must be visible before position of writer is moved
+    _mm_sfence();
+
+    memcpy(to, from, n);
+}
+
+__attribute__((target("avx")))
+static void copy_avx_nt(char * to, const char * from, size_t n)
+{
+    size_t head = (32 - ((uintptr_t)to & 31)) & 31;
+
+    memcpy(to, from, head);
+    to += head; from += head; n -= head;
+
+    for (; n >= 64; n -= 64, to += 64, from += 64)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(from + 0));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(from + 32));
+        _mm256_stream_si256((__m256i*)(to + 0),  a);
+        _mm256_stream_si256((__m256i*)(to + 32), b);
+    }
+    // streamed stores must be visible before position of writer is moved
+    _mm_sfence();
+
+    memcpy(to, from, n);
+}
+
+#endif
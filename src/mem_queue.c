@@ -6,280 +6,1690 @@
 #include "../include/linux_mm.h"
 #include "../include/linux_uaccess.h"
 #include "../include/linux_spinlock.h"
+#include "../include/linux_mutex.h"
+#include "../include/linux_time.h"
+#include "../include/linux_smp.h"
+#include "../include/linux_trace.h"
 
 #include "../include/memqueue_constants.h"
+#include "../include/mem_chunk.h"
+#include "../include/mem_copy.h"
+#include "../include/timer_wheel.h"
 #include "../include/mem_queue.h"
 
+// bytes of the next message to prefetch after read
+#define PREFETCH_SIZE 256
+
+// headers of skipped messages are prefetched this number of messages ahead
+#define SKIP_PREFETCH_RECORDS 4
+
+// delayed messages are moved into ring with this precision
+#define DELAY_TICK_NS MSEC_TO_NSEC(1)
+
+// record header is size_t with length of message in low bits and
+// flags of optional fields in high byte, optional fields follow it
+#define RECORD_LENGTH_MASK  (((size_t)1 << 56) - 1)
+#define RECORD_FLAGS_SHIFT  56
+#define RECORD_STAMP        0x1
+#define RECORD_EXPIRE       0x2
+#define RECORD_TAG          0x4
+
+MQ_TRACE_SEMAPHORE(write_start);
+MQ_TRACE_SEMAPHORE(write_commit);
+MQ_TRACE_SEMAPHORE(write_full);
+MQ_TRACE_SEMAPHORE(wrap);
+MQ_TRACE_SEMAPHORE(read);
+
+/**
+ * Ring buffer with its own memory and locks.
+ * Queue consists of one ring or of several sub-rings (shards).
+ */
+struct mem_ring
+{
+    struct mq_queue * queue;
+    size_t size;
+    struct memchunk * chunks;
+    size_t chunks_count;
+    int    node;
+    u64    release_scan_time;
+
+    size_t pos_read;
+    size_t pos_write;
+    // bytes of the first message already returned to reader
+    size_t read_partial;
+    // number of messages in ring, changed under lock_pos
+    size_t messages;
+    // bytes promised to delayed messages, changed under lock_write
+    size_t reserved;
+    // number of messages skipped as expired or not matching 
+    // reader's tags, changed under lock_pos
+    size_t expired;
+    size_t filtered;
+
+    spinlock_t lock_pos;
+    // reader may sleep copying into user memory
+    struct mutex lock_read;
+    // writer may sleep populating or releasing chunks and copying from user
+    struct mutex lock_write;
+} ____cacheline_aligned_in_smp;
+
+/**
+ * Payload of message being written: user (or kernel) buffer or fill callback.
+ */
+struct write_source
+{
+    const char * data;
+    memqueue_fill_fn fill;
+    void * context;
+    bool kern;
+    // space for message was reserved when it was delayed
+    bool reserved;
+    // expiry time of message with RECORD_EXPIRE
+    u64 expire_ns;
+    // tag of message with RECORD_TAG
+    u64 tag;
+};
+
+/**
+ * Message waiting for its delivery time out of ring,
+ * space for it is reserved in its ring.
+ */
+struct delayed_message
+{
+    struct timer_entry entry;   // first, so entry and message have the same address
+    size_t ring;
+    unsigned int flags;
+    u64 expire_ns;
+    u64 tag;
+    size_t length;
+    char data[];
+};
+
+/**
+ * Queue instance: its rings and state shared by them.
+ */
+struct mq_queue
+{
+    size_t size;
+    unsigned int flags;
+    unsigned int chunk_flags;
+    u64 release_idle_ns;
+
+    // strategy and threshold of non-temporal copy into rings
+    struct memcopy copy;
+
+    struct mem_ring * rings;
+    size_t rings_count;
+
+    // sub-ring drained by reader now and number of messages left in its batch
+    size_t shard_read;
+    size_t shard_batch;
+
+    // taken over read of sub-ring, which may sleep
+    struct mutex lock_shards;
+
+    // lanes policy against starvation of lower lanes and number of messages 
+    // taken from upper lanes in a row while lower ones wait
+    u64 lane_aging_ns;
+    unsigned int lane_burst;
+    unsigned int lane_burst_count;
+
+    // delayed messages, the wheel is allocated with queue
+    struct timer_wheel * wheel;
+    size_t delayed_dropped;
+    // due messages are written into rings under it
+    struct mutex lock_wheel;
+
+    // set when the first message with expiry is written, till then
+    // readers don't look for expired messages
+    bool expire_written;
+
+    // partition to start the next read from, it is only a hint for fairness
+    // between partitions, so it is changed without lock
+    size_t partition_next;
+};
+
 // ========== internal variables ==========
 
-static size_t queue_size = 0;
-static char * queue = 0;
+// queue of memqueue_* functions
+static struct mq_queue * default_queue = 0;
+
+// ========== prototypes for internal functions ==========
+
+static int  ring_open (struct mem_ring * ring, size_t size, int node);
+static void ring_close(struct mem_ring * ring);
+
+static ssize_t ring_read       (struct mem_ring * ring,       char * data, size_t size, size_t * left, u64 tags);
+static ssize_t ring_write      (struct mem_ring * ring, const struct write_source * source, size_t length, unsigned int flags);
+static ssize_t ring_consume    (struct mem_ring * ring, memqueue_consume_fn consume, void * context, size_t size, size_t * count, u64 tags);
+static ssize_t ring_next_length(struct mem_ring * ring, u64 tags);
+static bool    ring_filled     (struct mem_ring * ring);
+static bool    ring_stamp      (struct mem_ring * ring, u64 * stamp, u64 tags);
+static bool    ring_ready      (struct mem_ring * ring, u64 tags);
+static size_t  ring_skip       (struct mem_ring * ring, u64 tags);
+
+static int     shards_select     (struct mq_queue * queue, bool move, u64 tags);
+static int     lanes_select      (struct mq_queue * queue, bool move, u64 tags);
+static ssize_t shards_read       (struct mq_queue * queue, char * data, size_t size, size_t * left, u64 tags);
+static ssize_t shards_write      (struct mq_queue * queue, const struct write_source * source, size_t length, unsigned int flags);
+static ssize_t shards_consume    (struct mq_queue * queue, memqueue_consume_fn consume, void * context, size_t size, u64 tags);
+static ssize_t shards_next_length(struct mq_queue * queue, u64 tags);
+
+static int     partitions_partial    (struct mq_queue * queue, u64 mask);
+static ssize_t partitions_read       (struct mq_queue * queue, char * data, size_t size, u64 mask, size_t * left, u64 tags);
+static ssize_t partitions_consume    (struct mq_queue * queue, memqueue_consume_fn consume, void * context, size_t size, u64 mask, u64 tags);
+static ssize_t partitions_next_length(struct mq_queue * queue, u64 mask, u64 tags);
+static size_t  key_partition         (struct mq_queue * queue, u64 key);
+
+static ssize_t queue_write(struct mq_queue * queue, const struct write_source * source, size_t length, const struct memqueue_write_opts * opts);
+static size_t  shards_home(struct mq_queue * queue);
+
+static ssize_t delay_write  (struct mq_queue * queue, size_t ring_index, const struct write_source * source, size_t length, unsigned int flags, u64 deliver_ns);
+static void    delay_advance(struct mq_queue * queue);
+static void    delay_free   (struct mq_queue * queue);
+
+static ssize_t  read_block(struct mem_ring * ring, size_t pos_read,        char * data, size_t size, size_t * left);
+static ssize_t write_block(struct mem_ring * ring, size_t pos_write, const struct write_source * source, size_t length, unsigned int flags);
+
+static ssize_t copy_kern_bytes(struct mem_ring * ring, char * data, size_t pos, size_t length, bool to_queue);
+static ssize_t copy_user_bytes(struct mem_ring * ring, char * data, size_t pos, size_t length, bool to_queue);
+static ssize_t fill_bytes     (struct mem_ring * ring, memqueue_fill_fn fill, void * context, size_t pos, size_t length);
+static ssize_t consume_bytes  (struct mem_ring * ring, memqueue_consume_fn consume, void * context, size_t pos, size_t length);
+
+static char * ring_segment(struct mem_ring * ring, size_t pos, size_t length, size_t * segment_length);
+static size_t ring_next   (struct mem_ring * ring, size_t pos, size_t length);
+
+static int  populate_chunks    (struct mem_ring * ring, size_t pos, size_t length);
+static void touch_chunks       (struct mem_ring * ring, size_t pos_from, size_t pos_to, u64 now);
+static void release_idle_chunks(struct mem_ring * ring, size_t pos_read, size_t pos_write);
+
+static size_t record_header_size(unsigned int flags);
+
+static bool check_empty_space (struct mem_ring * ring, size_t pos_read, size_t pos_write, size_t length);
+static bool check_filled_space(size_t pos_read, size_t pos_write);
+static bool check_chunk_used  (size_t index, size_t pos_read, size_t pos_write);
+
+// ========== base functions ==========
+
+int mq_open(struct mq_queue ** result, const struct memqueue_params * params)
+{
+    struct mq_queue * queue = 0;
+    size_t index = 0;
+    int node = params && (params->flags & MEMQUEUE_NUMA_NODE) ? params->numa_node : MEMCHUNK_NO_NODE;
+
+    if (result == 0 || params == 0 || params->queue_size == 0)
+        return EINVAL;
+    if (node != MEMCHUNK_NO_NODE && (node < 0 || node >= (int)nr_node_ids))
+        return EINVAL;
+    if ((params->flags & MEMQUEUE_PARTITIONED) && 
+        ((params->flags & MEMQUEUE_SHARDED) || params->partitions == 0 || params->partitions > MEMQUEUE_PARTITIONS_MAX))
+        return EINVAL;
+    if ((params->flags & MEMQUEUE_PRIORITY_LANES) && 
+        ((params->flags & (MEMQUEUE_SHARDED | MEMQUEUE_PARTITIONED)) || params->lanes == 0 || params->lanes > MEMQUEUE_LANES_MAX))
+        return EINVAL;
+    // bulk lane gets what is left from upper lanes
+    if ((params->flags & MEMQUEUE_PRIORITY_LANES) && (params->lanes - 1) * params->lane_size >= params->queue_size)
+        return EINVAL;
+
+    queue = kvzalloc_node(sizeof(struct mq_queue), GFP_KERNEL, node);
+    if (queue == 0)
+        return ENOMEM;
+
+    INIT_MUTEX(queue->lock_shards);
+    INIT_MUTEX(queue->lock_wheel);
+
+    memcopy_init(&queue->copy, params->copy_nt_threshold);
+
+    queue->rings_count = 1;
+    if (params->flags & MEMQUEUE_SHARDED)
+    {
+        queue->rings_count = params->shards;
+        if (queue->rings_count == 0)
+            queue->rings_count = params->flags & MEMQUEUE_SHARD_BY_NODE ? nr_node_ids : nr_cpu_ids;
+    }
+    if (params->flags & MEMQUEUE_PARTITIONED)
+        queue->rings_count = params->partitions;
+    if (params->flags & MEMQUEUE_PRIORITY_LANES)
+        queue->rings_count = params->lanes;
+
+    queue->rings = kvzalloc_node(queue->rings_count * sizeof(struct mem_ring), GFP_KERNEL, node);
+    queue->wheel = kvzalloc_node(sizeof(struct timer_wheel), GFP_KERNEL, node);
+    if (queue->rings == 0 || queue->wheel == 0)
+    {
+        mq_close(queue);
+        return ENOMEM;
+    }
+    timer_wheel_init(queue->wheel, DELAY_TICK_NS, ktime_get_ns());
+
+    queue->size             = params->queue_size;
+    queue->flags            = params->flags;
+    queue->chunk_flags      = params->flags & MEMQUEUE_HUGEPAGES ? MEMCHUNK_HUGEPAGES : 0;
+    queue->release_idle_ns  = queue->flags & MEMQUEUE_LAZY_ALLOC ? MSEC_TO_NSEC(params->release_idle_ms) : 0;
+    queue->shard_read       = 0;
+    queue->shard_batch      = MEMQUEUE_SHARD_BATCH;
+    queue->partition_next   = 0;
+    queue->lane_aging_ns    = queue->flags & MEMQUEUE_PRIORITY_LANES ? MSEC_TO_NSEC(params->lane_aging_ms) : 0;
+    queue->lane_burst       = params->lane_burst;
+    queue->lane_burst_count = 0;
+    queue->delayed_dropped  = 0;
+    queue->expire_written   = false;
+
+    // memory budget is split between shards (partitions, lanes) equally,
+    // shards by node live on their nodes unless node is given
+    for (index = 0; index < queue->rings_count; index++)
+    {
+        int ring_node = node;
+        int ret_code  = 0;
+        size_t ring_size = queue->size / queue->rings_count;
+
+        if ((queue->flags & MEMQUEUE_SHARD_BY_NODE) && (queue->flags & MEMQUEUE_NUMA_NODE) == 0)
+            ring_node = index;
+        if ((queue->flags & MEMQUEUE_PRIORITY_LANES) && params->lane_size)
+            ring_size = index ? params->lane_size : queue->size - (queue->rings_count - 1) * params->lane_size;
+
+        queue->rings[index].queue = queue;
+        ret_code = ring_open(&queue->rings[index], ring_size, ring_node);
+        if (ret_code != 0)
+        {
+            mq_close(queue);
+            return ret_code;
+        }
+    }
+
+    *result = queue;
+    return 0;
+}
+
+void mq_close(struct mq_queue * queue)
+{
+    size_t index = 0;
+
+    if (queue == 0)
+        return;
+
+    if (queue->wheel)
+    {
+        delay_free(queue);
+        kvfree(queue->wheel);
+    }
+
+    if (queue->rings)
+    {
+        for (index = 0; index < queue->rings_count; index++)
+            ring_close(&queue->rings[index]);
+        kvfree(queue->rings);
+    }
+
+    DESTROY_MUTEX(queue->lock_shards);
+    DESTROY_MUTEX(queue->lock_wheel);
+
+    kvfree(queue);
+}
+
+void mq_get_stats(struct mq_queue * queue, struct memqueue_stats * stats)
+{
+    size_t index = 0;
+    size_t ring_index = 0;
+
+    stats->rings           = queue->rings_count;
+    stats->chunks_total    = 0;
+    stats->chunks_resident = 0;
+    stats->chunks_huge     = 0;
+    stats->resident_bytes  = 0;
+    stats->delayed         = queue->wheel ? queue->wheel->count : 0;
+    stats->delayed_dropped = queue->delayed_dropped;
+    stats->expired         = 0;
+    stats->filtered        = 0;
+
+    for (ring_index = 0; ring_index < queue->rings_count; ring_index++)
+    {
+        struct mem_ring * ring = &queue->rings[ring_index];
+
+        stats->chunks_total += ring->chunks_count;
+        stats->expired      += ring->expired;
+        stats->filtered     += ring->filtered;
+
+        for (index = 0; index < ring->chunks_count; index++)
+        {
+            if (ring->chunks[index].resident)
+            {
+                stats->chunks_resident++;
+                if (ring->chunks[index].kind == MEMCHUNK_KIND_HUGE)
+                    stats->chunks_huge++;
+                stats->resident_bytes += ring->chunks[index].size;
+            }
+        }
+    }
+}
+
+int mq_get_depth(struct mq_queue * queue, size_t index, struct memqueue_depth * depth)
+{
+    struct mem_ring * ring = 0;
+
+    if (index >= queue->rings_count || depth == 0)
+        return -EINVAL;
+
+    ring = &queue->rings[index];
+
+    spin_lock(&ring->lock_pos);
+    depth->messages = ring->messages;
+    depth->bytes    = ring->pos_write >= ring->pos_read ? 
+        ring->pos_write - ring->pos_read : 
+        ring->size - ring->pos_read + ring->pos_write;
+    spin_unlock(&ring->lock_pos);
+
+    return 0;
+}
+
+int mq_key_partition(struct mq_queue * queue, unsigned long long key)
+{
+    if ((queue->flags & MEMQUEUE_PARTITIONED) == 0)
+        return -EINVAL;
+
+    return key_partition(queue, key);
+}
+
+// ========== ring functions ==========
+
+static int ring_open(struct mem_ring * ring, size_t size, int node)
+{
+    size_t index = 0;
+
+    INIT_SPINLOCK(ring->lock_pos);
+    INIT_MUTEX(ring->lock_read);
+    INIT_MUTEX(ring->lock_write);
+
+    if (size == 0)
+        return EINVAL;
+
+    ring->chunks_count = (size + MEMQUEUE_CHUNK_SIZE - 1) / MEMQUEUE_CHUNK_SIZE;
+    ring->chunks = kvzalloc_node(ring->chunks_count * sizeof(struct memchunk), GFP_KERNEL, node);
+    if (ring->chunks == 0)
+        return ENOMEM;
+
+    ring->node = node;
+
+    for (index = 0; index < ring->chunks_count; index++)
+    {
+        size_t offset = index * MEMQUEUE_CHUNK_SIZE;
+        size_t length = size - offset;
+        ring->chunks[index].size = length < MEMQUEUE_CHUNK_SIZE ? length : MEMQUEUE_CHUNK_SIZE;
+
+        if ((ring->queue->flags & MEMQUEUE_LAZY_ALLOC) == 0 && memchunk_alloc(&ring->chunks[index], ring->queue->chunk_flags, node) != 0)
+            return ENOMEM;
+    }
+
+    ring->size              = size;
+    ring->release_scan_time = 0;
+    ring->pos_read          = 0;
+    ring->pos_write         = 0;
+    ring->read_partial      = 0;
+    ring->messages          = 0;
+    ring->reserved          = 0;
+
+    return 0;
+}
+
+static void ring_close(struct mem_ring * ring)
+{
+    size_t index = 0;
+
+    if (ring->chunks)
+    {
+        for (index = 0; index < ring->chunks_count; index++)
+            memchunk_free(&ring->chunks[index]);
+        kvfree(ring->chunks);
+        ring->chunks = 0;
+    }
+
+    ring->size         = 0;
+    ring->chunks_count = 0;
+    ring->pos_read     = 0;
+    ring->pos_write    = 0;
+
+    DESTROY_SPINLOCK(ring->lock_pos);
+    DESTROY_MUTEX(ring->lock_read);
+    DESTROY_MUTEX(ring->lock_write);
+}
+
+// ========== read functions ==========
+
+ssize_t mq_read(struct mq_queue * queue, char * data, size_t size, const struct memqueue_read_opts * opts, size_t * left)
+{
+    u64 mask = opts && (opts->flags & MEMQUEUE_READ_PARTITIONS) ? opts->partitions : MEMQUEUE_PARTITIONS_ALL;
+    u64 tags = opts && (opts->flags & MEMQUEUE_READ_TAGS) ? opts->tags : MEMQUEUE_TAGS_ALL;
+    size_t left_tmp = 0;
+
+    if (data == 0 || size == 0)
+        return -EINVAL;
+    if (queue->rings_count == 0)
+        return -EBADF;
+
+    delay_advance(queue);
+
+    if (left == 0)
+        left = &left_tmp;
+    *left = 0;
+
+    if (queue->flags & MEMQUEUE_PARTITIONED)
+        return partitions_read(queue, data, size, mask, left, tags);
+    if (queue->rings_count > 1)
+        return shards_read(queue, data, size, left, tags);
+
+    return ring_read(&queue->rings[0], data, size, left, tags);
+}
+
+ssize_t mq_next_length(struct mq_queue * queue, const struct memqueue_read_opts * opts)
+{
+    u64 mask = opts && (opts->flags & MEMQUEUE_READ_PARTITIONS) ? opts->partitions : MEMQUEUE_PARTITIONS_ALL;
+    u64 tags = opts && (opts->flags & MEMQUEUE_READ_TAGS) ? opts->tags : MEMQUEUE_TAGS_ALL;
+
+    if (queue->rings_count == 0)
+        return -EBADF;
+
+    delay_advance(queue);
+
+    if (queue->flags & MEMQUEUE_PARTITIONED)
+        return partitions_next_length(queue, mask, tags);
+    if (queue->rings_count > 1)
+        return shards_next_length(queue, tags);
+
+    return ring_next_length(&queue->rings[0], tags);
+}
+
+static ssize_t ring_read(struct mem_ring * ring, char * data, size_t size, size_t * left, u64 tags)
+{
+    ssize_t ret_code = 0;
+    size_t pos_read  = 0;
+    size_t pos_write = 0;
+
+    mutex_lock(&ring->lock_read);
+
+    ring_skip(ring, tags);
+
+    spin_lock(&ring->lock_pos);
+    pos_read  = ring->pos_read;
+    pos_write = ring->pos_write;
+    spin_unlock(&ring->lock_pos);
+
+    if (check_filled_space(pos_read, pos_write))
+    {
+        ret_code = read_block(ring, pos_read, data, size, left);
+
+        // only this reader moves read position, so it can be read without lock_pos
+        if (ret_code > 0 && *left == 0 && (ring->queue->flags & MEMQUEUE_PREFETCH) && ring->pos_read != pos_write)
+        {
+            size_t segment_length = 0;
+            char * segment = ring_segment(ring, ring->pos_read, PREFETCH_SIZE, &segment_length);
+            memcopy_prefetch(segment, segment_length);
+        }
+    }
+
+    mutex_unlock(&ring->lock_read);
+    return ret_code;
+}
+
+/**
+ * Return number of bytes left in partly read message 
+ * or length of the next message, 0 if ring is empty.
+ */
+static ssize_t ring_next_length(struct mem_ring * ring, u64 tags)
+{
+    ssize_t ret_code = 0;
+    size_t header = 0;
+
+    mutex_lock(&ring->lock_read);
+
+    ring_skip(ring, tags);
+
+    if (ring_filled(ring))
+    {
+        copy_kern_bytes(ring, (char*)&header, ring->pos_read, sizeof(size_t), false);
+        ret_code = (header & RECORD_LENGTH_MASK) - ring->read_partial;
+    }
+
+    mutex_unlock(&ring->lock_read);
+    return ret_code;
+}
+
+static bool ring_filled(struct mem_ring * ring)
+{
+    bool ret_code = false;
+
+    spin_lock(&ring->lock_pos);
+    ret_code = check_filled_space(ring->pos_read, ring->pos_write);
+    spin_unlock(&ring->lock_pos);
+
+    return ret_code;
+}
+
+/**
+ * Return stamp of the first message in ring.
+ * False if ring is empty or message has no stamp.
+ */
+static bool ring_stamp(struct mem_ring * ring, u64 * stamp, u64 tags)
+{
+    bool ret_code = false;
+    size_t header = 0;
+    size_t pos    = 0;
+
+    mutex_lock(&ring->lock_read);
+
+    ring_skip(ring, tags);
+
+    if (ring_filled(ring))
+    {
+        pos = copy_kern_bytes(ring, (char*)&header, ring->pos_read, sizeof(size_t), false);
+        ret_code = (header >> RECORD_FLAGS_SHIFT) & RECORD_STAMP;
+        if (ret_code)
+            copy_kern_bytes(ring, (char*)stamp, pos, sizeof(u64), false);
+    }
+
+    mutex_unlock(&ring->lock_read);
+    return ret_code;
+}
+
+/**
+ * Same as ring_filled, but expired messages and ones not matching <tags>
+ * are dropped first, so ring without messages for reader isn't selected.
+ */
+static bool ring_ready(struct mem_ring * ring, u64 tags)
+{
+    if (ring->queue->expire_written || tags != MEMQUEUE_TAGS_ALL)
+    {
+        mutex_lock(&ring->lock_read);
+        ring_skip(ring, tags);
+        mutex_unlock(&ring->lock_read);
+    }
+
+    return ring_filled(ring);
+}
+
+/**
+ * Move read position over run of messages at the head of ring which are
+ * expired or have tag out of <tags>. Single read position is shared by
+ * all readers, so filtered messages are dropped for everybody.
+ * Only headers are read, payloads aren't copied, and read position
+ * is moved once for the whole run. Called under lock_read.
+ * Return number of skipped messages.
+ */
+static size_t ring_skip(struct mem_ring * ring, u64 tags)
+{
+    size_t expired   = 0;
+    size_t filtered  = 0;
+    size_t pos_read  = 0;
+    size_t pos_write = 0;
+    size_t header    = 0;
+    size_t flags     = 0;
+    size_t pos       = 0;
+    size_t ahead     = 0;
+    size_t segment_length = 0;
+    u64 expire = 0;
+    u64 tag    = 0;
+    u64 now    = 0;
+
+    // partly read message is finished whatever its time and tag are
+    if ((!ring->queue->expire_written && tags == MEMQUEUE_TAGS_ALL) || ring->read_partial)
+        return 0;
+
+    spin_lock(&ring->lock_pos);
+    pos_read  = ring->pos_read;
+    pos_write = ring->pos_write;
+    spin_unlock(&ring->lock_pos);
+
+    while (check_filled_space(pos_read, pos_write))
+    {
+        pos = copy_kern_bytes(ring, (char*)&header, pos_read, sizeof(size_t), false);
+        flags = header >> RECORD_FLAGS_SHIFT;
+
+        if (flags & RECORD_STAMP)
+            pos = ring_next(ring, pos, sizeof(u64));
+        if (flags & RECORD_EXPIRE)
+        {
+            pos = copy_kern_bytes(ring, (char*)&expire, pos, sizeof(u64), false);
+            if (now == 0)
+                now = ktime_get_ns();
+        }
+        tag = 0;
+        if (flags & RECORD_TAG)
+            copy_kern_bytes(ring, (char*)&tag, pos, sizeof(u64), false);
+
+        if ((flags & RECORD_EXPIRE) && expire <= now)
+            expired++;
+        else if ((tags & ((u64)1 << tag)) == 0)
+            filtered++;
+        else
+            break;
+
+        pos_read = ring_next(ring, pos_read, record_header_size(flags) + (header & RECORD_LENGTH_MASK));
+
+        // headers are a chain of dependent loads, the next ones are 
+        // prefetched on guess that messages of a run have the same size
+        ahead = SKIP_PREFETCH_RECORDS * (record_header_size(flags) + (header & RECORD_LENGTH_MASK));
+        if (ahead < (pos_write + ring->size - pos_read) % ring->size)
+            memcopy_prefetch(ring_segment(ring, ring_next(ring, pos_read, ahead), sizeof(size_t), &segment_length), 1);
+    }
+
+    if (expired + filtered == 0)
+        return 0;
+
+    if (ring->queue->release_idle_ns)
+        touch_chunks(ring, ring->pos_read, pos_read, now ? now : ktime_get_ns());
+
+    spin_lock(&ring->lock_pos);
+    ring->pos_read  = pos_read;
+    ring->messages -= expired + filtered;
+    ring->expired  += expired;
+    ring->filtered += filtered;
+    spin_unlock(&ring->lock_pos);
+
+    return expired + filtered;
+}
+
+static ssize_t read_block(struct mem_ring * ring, size_t pos_read, char * data, size_t size, size_t * left)
+{
+    size_t header   = 0;
+    size_t length   = 0;
+    size_t messages = 0;
+    ssize_t pos     = 0;
+
+    copy_kern_bytes(ring, (char*)&header, pos_read, sizeof(size_t), false);
+    length = header & RECORD_LENGTH_MASK;
+    if (size > length - ring->read_partial)
+        size = length - ring->read_partial;
+
+    // optional fields aren't returned to reader
+    pos = ring_next(ring, pos_read, record_header_size(header >> RECORD_FLAGS_SHIFT) + ring->read_partial);
+
+    pos = copy_user_bytes(ring, data, pos, size, false);
+    if (pos < 0)
+        return pos;
+
+    ring->read_partial += size;
+    *left = length - ring->read_partial;
+    if (*left)
+        return size;
+
+    ring->read_partial = 0;
+
+    if (ring->queue->release_idle_ns)
+        touch_chunks(ring, pos_read, pos, ktime_get_ns());
+
+    spin_lock(&ring->lock_pos);
+    ring->pos_read = pos;
+    messages = --ring->messages;
+    spin_unlock(&ring->lock_pos);
+
+    MQ_TRACE(read, ring, length, pos, messages);
+    return size;
+}
+
+/**
+ * Return shard to read from, -1 if all are empty. 
+ * Unordered mode: drain one shard by batch then go to the next one.
+ * Ordered mode: take message with the least stamp among shards heads.
+ * Message can be stamped a bit earlier than committed, so the order
+ * between shards is as good as clocks of writers are.
+ * Selection is remembered only if <move> is set.
+ */
+static int shards_select(struct mq_queue * queue, bool move, u64 tags)
+{
+    size_t index = 0;
+    size_t shard = queue->shard_read;
+    size_t batch = queue->shard_batch;
+
+    // partly read message is continued whatever the mode is
+    if (queue->rings[shard].read_partial)
+        return shard;
+
+    if (queue->flags & MEMQUEUE_PRIORITY_LANES)
+        return lanes_select(queue, move, tags);
+
+    if (queue->flags & MEMQUEUE_SHARD_ORDERED)
+    {
+        int found = -1;
+        u64 stamp_min = 0;
+        u64 stamp = 0;
+
+        for (index = 0; index < queue->rings_count; index++)
+        {
+            if (ring_stamp(&queue->rings[index], &stamp, tags) && (found < 0 || stamp < stamp_min))
+            {
+                found     = index;
+                stamp_min = stamp;
+            }
+        }
+
+        if (found >= 0 && move)
+            queue->shard_read = found;
+        return found;
+    }
+
+    for (index = 0; index <= queue->rings_count; index++)
+    {
+        if (batch && ring_ready(&queue->rings[shard], tags))
+        {
+            if (move)
+            {
+                queue->shard_read  = shard;
+                queue->shard_batch = batch;
+            }
+            return shard;
+        }
+
+        shard = (shard + 1) % queue->rings_count;
+        batch = MEMQUEUE_SHARD_BATCH;
+    }
+
+    return -1;
+}
+
+/**
+ * The most urgent non-empty lane is read first. Lower lane is read before it
+ * when its first message has waited <lane_aging_ns> or when <lane_burst>
+ * messages in a row were taken from upper lanes while it waited.
+ */
+static int lanes_select(struct mq_queue * queue, bool move, u64 tags)
+{
+    int lane = 0;
+    int top = -1;
+    int lower = -1;
+    int selected = -1;
+    u64 stamp = 0;
+    u64 now = 0;
+
+    for (lane = queue->rings_count - 1; lane >= 0 && lower < 0; lane--)
+    {
+        if (ring_ready(&queue->rings[lane], tags))
+        {
+            if (top < 0)
+                top = lane;
+            else
+                lower = lane;
+        }
+    }
+
+    if (top < 0)
+        return -1;
+    selected = top;
+
+    if (lower >= 0 && queue->lane_aging_ns)
+    {
+        // the lowest lane is checked first, it waits longest usually
+        now = ktime_get_ns();
+        for (lane = 0; lane <= lower; lane++)
+        {
+            if (ring_stamp(&queue->rings[lane], &stamp, tags) && now - stamp >= queue->lane_aging_ns)
+            {
+                selected = lane;
+                break;
+            }
+        }
+    }
+
+    if (lower >= 0 && selected == top && queue->lane_burst && queue->lane_burst_count >= queue->lane_burst)
+        selected = lower;
+
+    if (move)
+    {
+        queue->shard_read = selected;
+        queue->lane_burst_count = lower >= 0 && selected == top ? queue->lane_burst_count + 1 : 0;
+    }
+
+    return selected;
+}
+
+static ssize_t shards_read(struct mq_queue * queue, char * data, size_t size, size_t * left, u64 tags)
+{
+    ssize_t ret_code = 0;
+    int shard = 0;
+
+    mutex_lock(&queue->lock_shards);
+
+    shard = shards_select(queue, true, tags);
+    if (shard >= 0)
+    {
+        ret_code = ring_read(&queue->rings[shard], data, size, left, tags);
+        if (ret_code > 0 && *left == 0 && queue->shard_batch)
+            queue->shard_batch--;
+    }
+
+    mutex_unlock(&queue->lock_shards);
+    return ret_code;
+}
+
+static ssize_t shards_next_length(struct mq_queue * queue, u64 tags)
+{
+    ssize_t ret_code = 0;
+    int shard = 0;
+
+    mutex_lock(&queue->lock_shards);
+
+    shard = shards_select(queue, false, tags);
+    if (shard >= 0)
+        ret_code = ring_next_length(&queue->rings[shard], tags);
+
+    mutex_unlock(&queue->lock_shards);
+    return ret_code;
+}
+
+/**
+ * Return partition in <mask> with partly read message, -1 if there is none.
+ */
+static int partitions_partial(struct mq_queue * queue, u64 mask)
+{
+    size_t index = 0;
+
+    for (index = 0; index < queue->rings_count; index++)
+    {
+        if ((mask & ((u64)1 << index)) && queue->rings[index].read_partial)
+            return index;
+    }
+
+    return -1;
+}
+
+/**
+ * Every partition has its own locks, so readers of disjoint 
+ * partitions don't wait for each other.
+ */
+static ssize_t partitions_read(struct mq_queue * queue, char * data, size_t size, u64 mask, size_t * left, u64 tags)
+{
+    ssize_t ret_code = 0;
+    size_t start = queue->partition_next;
+    size_t index = 0;
+    size_t partition = 0;
+    int partial = partitions_partial(queue, mask);
+
+    if (partial >= 0)
+    {
+        ret_code = ring_read(&queue->rings[partial], data, size, left, tags);
+        if (ret_code != 0)
+            return ret_code;
+    }
+
+    for (index = 0; index < queue->rings_count; index++)
+    {
+        partition = (start + index) % queue->rings_count;
+        if ((mask & ((u64)1 << partition)) == 0)
+            continue;
+
+        ret_code = ring_read(&queue->rings[partition], data, size, left, tags);
+        if (ret_code != 0)
+        {
+            queue->partition_next = (partition + 1) % queue->rings_count;
+            break;
+        }
+    }
+
+    return ret_code;
+}
+
+static ssize_t partitions_next_length(struct mq_queue * queue, u64 mask, u64 tags)
+{
+    ssize_t ret_code = 0;
+    size_t start = queue->partition_next;
+    size_t index = 0;
+    size_t partition = 0;
+    int partial = partitions_partial(queue, mask);
+
+    if (partial >= 0)
+    {
+        ret_code = ring_next_length(&queue->rings[partial], tags);
+        if (ret_code != 0)
+            return ret_code;
+    }
+
+    for (index = 0; index < queue->rings_count; index++)
+    {
+        partition = (start + index) % queue->rings_count;
+        if ((mask & ((u64)1 << partition)) == 0)
+            continue;
+
+        ret_code = ring_next_length(&queue->rings[partition], tags);
+        if (ret_code != 0)
+            break;
+    }
+
+    return ret_code;
+}
+
+/**
+ * Multiplicative hash, top bits of product are mixed best.
+ */
+static size_t key_partition(struct mq_queue * queue, u64 key)
+{
+    return ((key * 0x61C8864680B583EBULL) >> 32) % queue->rings_count;
+}
+
+ssize_t mq_consume(struct mq_queue * queue, memqueue_consume_fn consume, void * context, size_t size, const struct memqueue_read_opts * opts)
+{
+    u64 mask = opts && (opts->flags & MEMQUEUE_READ_PARTITIONS) ? opts->partitions : MEMQUEUE_PARTITIONS_ALL;
+    u64 tags = opts && (opts->flags & MEMQUEUE_READ_TAGS) ? opts->tags : MEMQUEUE_TAGS_ALL;
+    size_t count = (size_t)-1;
+
+    if (consume == 0 || size == 0)
+        return -EINVAL;
+    if (queue->rings_count == 0)
+        return -EBADF;
+
+    delay_advance(queue);
+
+    if (queue->flags & MEMQUEUE_PARTITIONED)
+        return partitions_consume(queue, consume, context, size, mask, tags);
+    if (queue->rings_count > 1)
+        return shards_consume(queue, consume, context, size, tags);
+
+    return ring_consume(&queue->rings[0], consume, context, size, &count, tags);
+}
+
+/**
+ * Consume up to <count> messages which fit into <size> with their prefixes.
+ * <count> gets number of consumed messages.
+ */
+static ssize_t ring_consume(struct mem_ring * ring, memqueue_consume_fn consume, void * context, size_t size, size_t * count, u64 tags)
+{
+    size_t count_max = *count;
+    ssize_t ret_code = 0;
+    size_t consumed  = 0;
+    size_t pos_read  = 0;
+    size_t pos_write = 0;
+    size_t header    = 0;
+    size_t length    = 0;
+    size_t messages  = 0;
+    ssize_t pos      = 0;
+
+    mutex_lock(&ring->lock_read);
+
+    spin_lock(&ring->lock_pos);
+    pos_read  = ring->pos_read;
+    pos_write = ring->pos_write;
+    spin_unlock(&ring->lock_pos);
+
+    for (*count = 0; *count < count_max; (*count)++)
+    {
+        if (ring_skip(ring, tags))
+        {
+            spin_lock(&ring->lock_pos);
+            pos_read  = ring->pos_read;
+            pos_write = ring->pos_write;
+            spin_unlock(&ring->lock_pos);
+        }
+
+        if (!check_filled_space(pos_read, pos_write))
+            break;
+
+        copy_kern_bytes(ring, (char*)&header, pos_read, sizeof(size_t), false);
+        length = (header & RECORD_LENGTH_MASK) - ring->read_partial;
+
+        if (consumed + sizeof(size_t) + length > size)
+        {
+            if (consumed == 0)
+                ret_code = -EMSGSIZE;
+            break;
+        }
+
+        pos = ring_next(ring, pos_read, record_header_size(header >> RECORD_FLAGS_SHIFT) + ring->read_partial);
+        pos = consume_bytes(ring, consume, context, pos, length);
+        if (pos < 0)
+        {
+            if (consumed == 0)
+                ret_code = pos;
+            break;
+        }
+
+        ring->read_partial = 0;
+        consumed += sizeof(size_t) + length;
+
+        if (ring->queue->release_idle_ns)
+            touch_chunks(ring, pos_read, pos, ktime_get_ns());
+
+        // writers get space back message by message, not after whole batch
+        pos_read = pos;
+        spin_lock(&ring->lock_pos);
+        ring->pos_read = pos_read;
+        messages = --ring->messages;
+        spin_unlock(&ring->lock_pos);
+
+        MQ_TRACE(read, ring, length, pos_read, messages);
+    }
+
+    mutex_unlock(&ring->lock_read);
+    return consumed ? consumed : ret_code;
+}
+
+/**
+ * Batch is collected from shards in the same order as shards_read gives it.
+ */
+static ssize_t shards_consume(struct mq_queue * queue, memqueue_consume_fn consume, void * context, size_t size, u64 tags)
+{
+    ssize_t ret_code = 0;
+    size_t consumed = 0;
+    size_t count = 0;
+    int shard = 0;
+
+    mutex_lock(&queue->lock_shards);
+
+    while (consumed < size)
+    {
+        shard = shards_select(queue, true, tags);
+        if (shard < 0)
+            break;
+
+        // lanes are selected again after every message, 
+        // so urgent message can get into the middle of batch
+        count = queue->flags & (MEMQUEUE_SHARD_ORDERED | MEMQUEUE_PRIORITY_LANES) ? 1 : queue->shard_batch;
+        ret_code = ring_consume(&queue->rings[shard], consume, context, size - consumed, &count, tags);
+        if (ret_code <= 0)
+            break;
+
+        consumed += ret_code;
+        if ((queue->flags & (MEMQUEUE_SHARD_ORDERED | MEMQUEUE_PRIORITY_LANES)) == 0)
+            queue->shard_batch -= count;
+    }
+
+    mutex_unlock(&queue->lock_shards);
+    return consumed ? consumed : ret_code;
+}
+
+/**
+ * Batch is collected from partitions round robin, each one 
+ * gives all its messages which fit.
+ */
+static ssize_t partitions_consume(struct mq_queue * queue, memqueue_consume_fn consume, void * context, size_t size, u64 mask, u64 tags)
+{
+    ssize_t ret_code = 0;
+    size_t consumed = 0;
+    size_t count = 0;
+    size_t start = queue->partition_next;
+    size_t index = 0;
+    size_t partition = 0;
+    int partial = partitions_partial(queue, mask);
+
+    // partly read message is finished first
+    if (partial >= 0)
+        start = partial;
 
-static char * queue_pos_begin = 0;
-static char * queue_pos_end   = 0;
-static char * queue_pos_read  = 0;
-static char * queue_pos_write = 0;
+    for (index = 0; index < queue->rings_count && consumed < size; index++)
+    {
+        partition = (start + index) % queue->rings_count;
+        if ((mask & ((u64)1 << partition)) == 0)
+            continue;
 
-static DEFINE_SPINLOCK(lock_pos);
-static DEFINE_SPINLOCK(lock_read);
-static DEFINE_SPINLOCK(lock_write);
+        count = (size_t)-1;
+        ret_code = ring_consume(&queue->rings[partition], consume, context, size - consumed, &count, tags);
+        if (ret_code < 0)
+            break;
 
-// ========== prototypes for internal functions ========== 
+        consumed += ret_code;
+        queue->partition_next = (partition + 1) % queue->rings_count;
+    }
 
-static ssize_t  read_block(char * pos_read,        char * data, size_t size);
-static ssize_t write_block(char * pos_write, const char * data, size_t length);
+    return consumed ? consumed : ret_code;
+}
 
-static char * copy_kern_bytes(char * data, char * pos_read, char * pos_write, size_t length);
-static char * copy_user_bytes(char * data, char * pos_read, char * pos_write, size_t length);
+// ========== write functions ==========
 
-static bool check_empty_space (char * pos_read, char * pos_write, size_t length);
-static bool check_filled_space(char * pos_read, char * pos_write);
+ssize_t mq_write(struct mq_queue * queue, const char * data, size_t length, const struct memqueue_write_opts * opts)
+{
+    struct write_source source = { data, 0, 0, false, false, 0, 0 };
 
-// ========== base functions ==========
+    if (data == 0 || length == 0)
+        return -EINVAL;
 
-int memqueue_open(size_t _queue_size)
+    return queue_write(queue, &source, length, opts);
+}
+
+/**
+ * In module <batch> is user memory, its prefixes are copied from user
+ * as payloads are.
+ */
+ssize_t mq_write_framed(struct mq_queue * queue, const char * batch, size_t size, const struct memqueue_write_opts * opts)
 {
-    queue = kvmalloc(_queue_size, GFP_KERNEL);
-    if (queue == 0)
-        return ENOMEM;
+    ssize_t ret_code = 0;
+    size_t length = 0;
+    size_t offset = 0;
 
-    queue_size      = _queue_size;
-    queue_pos_begin = queue;
-    queue_pos_end   = queue_pos_begin + queue_size;
-    queue_pos_read  = queue_pos_begin;
-    queue_pos_write = queue_pos_begin;    
+    if (batch == 0 || size == 0)
+        return -EINVAL;
 
-    INIT_SPINLOCK(lock_pos);
-    INIT_SPINLOCK(lock_read);
-    INIT_SPINLOCK(lock_write);
+    while (offset < size)
+    {
+        if (size - offset < sizeof(size_t))
+        {
+            ret_code = -EINVAL;
+            break;
+        }
+        if (copy_from_user(&length, batch + offset, sizeof(size_t)) != 0)
+        {
+            ret_code = -EFAULT;
+            break;
+        }
+        if (length > size - offset - sizeof(size_t))
+        {
+            ret_code = -EINVAL;
+            break;
+        }
 
-    return 0;
+        ret_code = mq_write(queue, batch + offset + sizeof(size_t), length, opts);
+        if (ret_code < 0)
+            break;
+        offset += sizeof(size_t) + length;
+    }
+
+    return offset != 0 ? (ssize_t)offset : ret_code;
 }
 
-void memqueue_close(void)
+ssize_t mq_produce(struct mq_queue * queue, size_t length, memqueue_fill_fn fill, void * context, const struct memqueue_write_opts * opts)
+{
+    struct write_source source = { 0, fill, context, false, false, 0, 0 };
+
+    if (fill == 0 || length == 0)
+        return -EINVAL;
+
+    return queue_write(queue, &source, length, opts);
+}
+
+static ssize_t queue_write(struct mq_queue * queue, const struct write_source * source, size_t length, const struct memqueue_write_opts * opts)
 {
-    if (queue)
+    u64 key = opts && (opts->flags & MEMQUEUE_WRITE_KEY) ? opts->key : 0;
+    unsigned int priority = opts && (opts->flags & MEMQUEUE_WRITE_PRIORITY) ? opts->priority : 0;
+    u64 deliver_ns = opts && (opts->flags & MEMQUEUE_WRITE_DELIVER) ? opts->deliver_ns : 0;
+    struct write_source record = *source;
+    size_t ring = 0;
+    unsigned int flags = 0;
+
+    if (queue->rings_count == 0)
+        return -EBADF;
+
+    if (queue->flags & MEMQUEUE_PRIORITY_LANES)
+    {
+        if (priority >= queue->rings_count)
+            return -EINVAL;
+        ring  = priority;
+        flags = queue->lane_aging_ns ? RECORD_STAMP : 0;
+    }
+    else if (queue->flags & MEMQUEUE_PARTITIONED)
+    {
+        ring = key_partition(queue, key);
+    }
+    else if (queue->rings_count > 1)
+    {
+        ring  = shards_home(queue);
+        flags = queue->flags & MEMQUEUE_SHARD_ORDERED ? RECORD_STAMP : 0;
+    }
+
+    if (opts && (opts->flags & MEMQUEUE_WRITE_TAG) && opts->tag)
     {
-        kvfree(queue);
-        queue = 0;
+        if (opts->tag >= MEMQUEUE_TAGS_MAX)
+            return -EINVAL;
+        flags |= RECORD_TAG;
+        record.tag = opts->tag;
     }
 
-    queue_size      = 0;
-    queue_pos_begin = 0;
-    queue_pos_end   = 0;
-    queue_pos_read  = 0;
-    queue_pos_write = 0;
+    if (opts && (opts->flags & MEMQUEUE_WRITE_EXPIRE))
+    {
+        flags |= RECORD_EXPIRE;
+        record.expire_ns = opts->expire_ns;
+        queue->expire_written = true;
+    }
 
-    DESTROY_SPINLOCK(lock_pos);
-    DESTROY_SPINLOCK(lock_read);
-    DESTROY_SPINLOCK(lock_write);
-}
+    if (deliver_ns && deliver_ns > ktime_get_ns())
+        return delay_write(queue, ring, &record, length, flags, deliver_ns);
 
-// ========== read functions ==========
+    if (queue->flags & MEMQUEUE_SHARDED)
+        return shards_write(queue, &record, length, flags);
 
-ssize_t memqueue_read(char * data, size_t size)
+    return ring_write(&queue->rings[ring], &record, length, flags);
+}
+
+static ssize_t ring_write(struct mem_ring * ring, const struct write_source * source, size_t length, unsigned int flags)
 {
     ssize_t ret_code = 0;
-    char * pos_read  = 0;
-    char * pos_write = 0;
+    size_t pos_read  = 0;
+    size_t pos_write = 0;
 
-    if (data == 0 || size == 0)
-        return -EINVAL;
+    mutex_lock(&ring->lock_write);
 
-    spin_lock(&lock_read);
+    // delayed message gives back space reserved for it and takes it again
+    if (source->reserved)
+        ring->reserved -= record_header_size(flags) + length;
 
-    spin_lock(&lock_pos);
-    pos_read  = queue_pos_read;
-    pos_write = queue_pos_write;
-    spin_unlock(&lock_pos);
+    spin_lock(&ring->lock_pos);
+    pos_read  = ring->pos_read;
+    pos_write = ring->pos_write;
+    spin_unlock(&ring->lock_pos);
 
-    // PRINTF(KERN_DEBUG, "memqueue positions before read %lu %lu\n", 
-    //     pos_read  - queue_pos_begin, 
-    //     pos_write - queue_pos_begin
-    // );
+    MQ_TRACE(write_start, ring, length, pos_read, pos_write);
 
-    if (check_filled_space(pos_read, pos_write))
+    if ((ring->queue->flags & MEMQUEUE_EXPIRE_RECLAIM) && 
+        !check_empty_space(ring, pos_read, pos_write, record_header_size(flags) + length))
+    {
+        // writer takes reader's lock only when ring is full
+        mutex_lock(&ring->lock_read);
+        if (ring_skip(ring, MEMQUEUE_TAGS_ALL))
+            pos_read = ring->pos_read;
+        mutex_unlock(&ring->lock_read);
+    }
+
+    if (check_empty_space(ring, pos_read, pos_write, record_header_size(flags) + length))
+    {
+        ret_code = populate_chunks(ring, pos_write, record_header_size(flags) + length);
+        if (ret_code == 0)
+            ret_code = write_block(ring, pos_write, source, length, flags);
+
+        // only this writer moves write position, so it can be read without lock_pos
+        if (ret_code > 0 && ring->queue->release_idle_ns)
+            release_idle_chunks(ring, pos_read, ring->pos_write);
+    }
+    else
     {
-        ret_code = read_block(pos_read, data, size);
+        MQ_TRACE(write_full, ring, length, pos_read, pos_write);
+        ret_code = -ENOSPC;
     }
 
-    spin_unlock(&lock_read);
+    mutex_unlock(&ring->lock_write);
     return ret_code;
 }
 
-static ssize_t read_block(char * pos_read, char * data, size_t size)
+static ssize_t write_block(struct mem_ring * ring, size_t pos_write, const struct write_source * source, size_t length, unsigned int flags)
 {
-    size_t length = 0;
+    size_t header = length | ((size_t)flags << RECORD_FLAGS_SHIFT);
+    size_t messages = 0;
+    ssize_t pos = 0;
+
+    pos = copy_kern_bytes(ring, (char*)&header, pos_write, sizeof(size_t), true);
+
+    if (flags & RECORD_STAMP)
+    {
+        u64 stamp = ktime_get_ns();
+        pos = copy_kern_bytes(ring, (char*)&stamp, pos, sizeof(u64), true);
+    }
+
+    if (flags & RECORD_EXPIRE)
+        pos = copy_kern_bytes(ring, (char*)&source->expire_ns, pos, sizeof(u64), true);
+
+    if (flags & RECORD_TAG)
+        pos = copy_kern_bytes(ring, (char*)&source->tag, pos, sizeof(u64), true);
+
+    if (source->fill)
+        pos = fill_bytes(ring, source->fill, source->context, pos, length);
+    else if (source->kern)
+        pos = copy_kern_bytes(ring, (char*)source->data, pos, length, true);
+    else
+        pos = copy_user_bytes(ring, (char*)source->data, pos, length, true);
+    if (pos < 0)
+        return pos;
+
+    if (MQ_TRACE_ENABLED(wrap) && (size_t)pos <= pos_write)
+        MQ_TRACE(wrap, ring, pos_write, pos);
+
+    spin_lock(&ring->lock_pos);
+    ring->pos_write = pos;
+    messages = ++ring->messages;
+    spin_unlock(&ring->lock_pos);
+
+    MQ_TRACE(write_commit, ring, length, pos, messages);
+    return length;
+}
 
-    pos_read = copy_kern_bytes((char*)&length, pos_read, 0, sizeof(size_t));
-    if (length > size)
-        return -ENOSPC;
+/**
+ * Write into the shard of current CPU (or node) to keep positions
+ * in local cache, spill into the next shards when it is full.
+ */
+static ssize_t shards_write(struct mq_queue * queue, const struct write_source * source, size_t length, unsigned int flags)
+{
+    ssize_t ret_code = 0;
+    size_t index = 0;
+    size_t shard = 0;
 
-    pos_read = copy_user_bytes(data, pos_read, 0, length);
+    shard = shards_home(queue);
 
-    if (pos_read)
+    for (index = 0; index < queue->rings_count; index++)
     {
-        spin_lock(&lock_pos);
-        queue_pos_read = pos_read;
-        spin_unlock(&lock_pos);
-        return length;
+        ret_code = ring_write(&queue->rings[(shard + index) % queue->rings_count], source, length, flags);
+        if (ret_code != -ENOSPC)
+            break;
     }
 
-    return 0;
+    return ret_code;
 }
 
-// ========== write functions ==========
+static size_t shards_home(struct mq_queue * queue)
+{
+    return (queue->flags & MEMQUEUE_SHARD_BY_NODE ? current_node() : current_cpu()) % queue->rings_count;
+}
 
-ssize_t memqueue_write(const char * data, size_t length)
+// ========== delay functions ==========
+
+unsigned long long memqueue_now_ns(void)
+{
+    return ktime_get_ns();
+}
+
+/**
+ * Message is kept out of ring till <deliver_ns>, but space for it 
+ * is reserved in ring now, so it surely fits when it is due.
+ */
+static ssize_t delay_write(struct mq_queue * queue, size_t ring_index, const struct write_source * source, size_t length, unsigned int flags, u64 deliver_ns)
 {
+    struct mem_ring * ring = &queue->rings[ring_index];
+    struct delayed_message * message = 0;
+    size_t record_size = record_header_size(flags) + length;
     ssize_t ret_code = 0;
-    char * pos_read  = 0;
-    char * pos_write = 0;
+    size_t pos_read  = 0;
+    size_t pos_write = 0;
 
-    if (data == 0 || length == 0)
-        return -EINVAL;
+    message = kvmalloc(sizeof(struct delayed_message) + length, GFP_KERNEL);
+    if (message == 0)
+        return -ENOMEM;
+
+    if (source->fill)
+        ret_code = source->fill(source->context, message->data, length);
+    else if (copy_from_user(message->data, source->data, length) != 0)
+        ret_code = -EFAULT;
+    if (ret_code != 0)
+    {
+        kvfree(message);
+        return ret_code < 0 ? ret_code : -EIO;
+    }
 
-    spin_lock(&lock_write);
+    message->ring   = ring_index;
+    message->flags  = flags;
+    message->expire_ns = source->expire_ns;
+    message->tag       = source->tag;
+    message->length = length;
 
-    spin_lock(&lock_pos);
-    pos_read  = queue_pos_read;
-    pos_write = queue_pos_write;
-    spin_unlock(&lock_pos);
+    mutex_lock(&ring->lock_write);
 
-    // PRINTF(KERN_DEBUG, "memqueue positions before write %lu %lu\n", 
-    //     pos_read  - queue_pos_begin, 
-    //     pos_write - queue_pos_begin
-    // );
+    spin_lock(&ring->lock_pos);
+    pos_read  = ring->pos_read;
+    pos_write = ring->pos_write;
+    spin_unlock(&ring->lock_pos);
 
-    if (check_empty_space(pos_read, pos_write, length))
+    if (check_empty_space(ring, pos_read, pos_write, record_size))
     {
-        ret_code = write_block(pos_write, data, length);
+        ring->reserved += record_size;
     }
     else
     {
+        MQ_TRACE(write_full, ring, length, pos_read, pos_write);
         ret_code = -ENOSPC;
     }
 
-    spin_unlock(&lock_write);
-    return ret_code;
+    mutex_unlock(&ring->lock_write);
+
+    if (ret_code != 0)
+    {
+        kvfree(message);
+        return ret_code;
+    }
+
+    mutex_lock(&queue->lock_wheel);
+    timer_wheel_add(queue->wheel, &message->entry, deliver_ns);
+    mutex_unlock(&queue->lock_wheel);
+
+    return length;
 }
 
-static ssize_t write_block(char * pos_write, const char * data, size_t length)
+/**
+ * Move due messages into their rings. It is called by readers before
+ * they take lock_read. Messages are written under lock_wheel, 
+ * so messages due at the same time keep order of writing.
+ */
+static void delay_advance(struct mq_queue * queue)
 {
-    pos_write = copy_kern_bytes((char*)&length, 0, pos_write, sizeof(size_t));
+    struct timer_entry * entry = 0;
+    struct timer_entry * next  = 0;
+
+    // count is a hint here, message delayed concurrently is moved next time
+    if (queue->wheel->count == 0)
+        return;
 
-    pos_write = copy_user_bytes((char*)data, 0, pos_write, length);
+    mutex_lock(&queue->lock_wheel);
 
-    if (pos_write)
+    for (entry = timer_wheel_advance(queue->wheel, ktime_get_ns()); entry; entry = next)
     {
-        spin_lock(&lock_pos);
-        queue_pos_write = pos_write;
-        spin_unlock(&lock_pos);
-        return length;
+        struct delayed_message * message = (struct delayed_message *)entry;
+        struct mem_ring * ring = &queue->rings[message->ring];
+        struct write_source source = { message->data, 0, 0, true, true, message->expire_ns, message->tag };
+
+        next = entry->next;
+
+        if ((message->flags & RECORD_EXPIRE) && message->expire_ns <= ktime_get_ns())
+        {
+            // message expired before delivery, its space is given back
+            mutex_lock(&ring->lock_write);
+            ring->reserved -= record_header_size(message->flags) + message->length;
+            mutex_unlock(&ring->lock_write);
+
+            spin_lock(&ring->lock_pos);
+            ring->expired++;
+            spin_unlock(&ring->lock_pos);
+        }
+        // only lazy allocation can fail here, space is reserved
+        else if (ring_write(ring, &source, message->length, message->flags) < 0)
+        {
+            queue->delayed_dropped++;
+        }
+
+        kvfree(message);
     }
 
-    return 0;
+    mutex_unlock(&queue->lock_wheel);
+}
+
+static void delay_free(struct mq_queue * queue)
+{
+    struct timer_entry * entry = 0;
+    struct timer_entry * next  = 0;
+
+    for (entry = timer_wheel_drain(queue->wheel); entry; entry = next)
+    {
+        next = entry->next;
+        kvfree(entry);
+    }
 }
 
 // ========== copy bytes functions ==========
 
-static char * copy_kern_bytes(char * data, char * pos_read, char * pos_write, size_t length)
+static ssize_t copy_kern_bytes(struct mem_ring * ring, char * data, size_t pos, size_t length, bool to_queue)
 {
-    size_t length_tail = queue_pos_end - (pos_read > 0 ? pos_read : pos_write);
+    size_t segment_length = 0;
 
-    if (pos_read != 0 && pos_write != 0)
-        return 0;
-    if (pos_read == 0 && pos_write == 0)
-        return 0;
+    while (length)
+    {
+        char * segment = ring_segment(ring, pos, length, &segment_length);
+        if (to_queue)
+            memcopy_kern(segment, data, segment_length);
+        else
+            memcopy_kern(data, segment, segment_length);
+
+        data   += segment_length;
+        length -= segment_length;
+        pos     = ring_next(ring, pos, segment_length);
+    }
+
+    return pos;
+}
 
-    if (length_tail < length)
+static ssize_t copy_user_bytes(struct mem_ring * ring, char * data, size_t pos, size_t length, bool to_queue)
+{
+    size_t segment_length = 0;
+
+    while (length)
     {
-        size_t length_head = length - length_tail;
-        if (pos_read) {
-            memcpy(data,               pos_read,        length_tail);
-            memcpy(data + length_tail, queue_pos_begin, length_head);
+        char * segment = ring_segment(ring, pos, length, &segment_length);
+        if (to_queue) {
+            if (memcopy_to_ring(&ring->queue->copy, segment, data, segment_length) != 0) return -EFAULT;
         } else {
-            memcpy(pos_write,       data,               length_tail);
-            memcpy(queue_pos_begin, data + length_tail, length_head);
+            if (memcopy_from_ring(data, segment, segment_length) != 0) return -EFAULT;
         }
-        return queue_pos_begin + length_head;
+
+        data   += segment_length;
+        length -= segment_length;
+        pos     = ring_next(ring, pos, segment_length);
     }
-    else
+
+    return pos;
+}
+
+static ssize_t fill_bytes(struct mem_ring * ring, memqueue_fill_fn fill, void * context, size_t pos, size_t length)
+{
+    size_t segment_length = 0;
+    int ret_code = 0;
+
+    while (length)
     {
-        char * tmp_pos = 0;
-        if (pos_read) {
-            memcpy(data, pos_read, length);
-            tmp_pos = pos_read + length;
-        } else {
-            memcpy(pos_write, data, length);
-            tmp_pos = pos_write + length;
-        }
-        return tmp_pos == queue_pos_end ? queue_pos_begin : tmp_pos;
+        char * segment = ring_segment(ring, pos, length, &segment_length);
+        ret_code = fill(context, segment, segment_length);
+        if (ret_code != 0)
+            return ret_code < 0 ? ret_code : -EIO;
+
+        length -= segment_length;
+        pos     = ring_next(ring, pos, segment_length);
     }
+
+    return pos;
 }
 
-static char * copy_user_bytes(char * data, char * pos_read, char * pos_write, size_t length)
+static ssize_t consume_bytes(struct mem_ring * ring, memqueue_consume_fn consume, void * context, size_t pos, size_t length)
 {
-    size_t length_tail = queue_pos_end - (pos_read > 0 ? pos_read : pos_write);
+    size_t segment_length = 0;
+    size_t offset = 0;
+    int ret_code = 0;
 
-    if (pos_read != 0 && pos_write != 0)
-        return 0;
-    if (pos_read == 0 && pos_write == 0)
+    while (offset < length)
+    {
+        char * segment = ring_segment(ring, pos, length - offset, &segment_length);
+        ret_code = consume(context, segment, segment_length, offset, length);
+        if (ret_code != 0)
+            return ret_code < 0 ? ret_code : -EIO;
+
+        offset += segment_length;
+        pos     = ring_next(ring, pos, segment_length);
+    }
+
+    return pos;
+}
+
+/**
+ * Return address of <pos> and length of contiguous memory available there,
+ * but not more than <length>. Chunk boundaries and the end of ring
+ * split copies the same way.
+ */
+static char * ring_segment(struct mem_ring * ring, size_t pos, size_t length, size_t * segment_length)
+{
+    struct memchunk * chunk = &ring->chunks[pos / MEMQUEUE_CHUNK_SIZE];
+    size_t offset = pos % MEMQUEUE_CHUNK_SIZE;
+    size_t length_tail = chunk->size - offset;
+
+    *segment_length = length_tail < length ? length_tail : length;
+    return chunk->data + offset;
+}
+
+static size_t ring_next(struct mem_ring * ring, size_t pos, size_t length)
+{
+    pos += length;
+    return pos >= ring->size ? pos - ring->size : pos;
+}
+
+// ========== chunk functions ==========
+
+static int populate_chunks(struct mem_ring * ring, size_t pos, size_t length)
+{
+    size_t index = pos / MEMQUEUE_CHUNK_SIZE;
+    size_t last  = ((pos + length - 1) % ring->size) / MEMQUEUE_CHUNK_SIZE;
+
+    if ((ring->queue->flags & MEMQUEUE_LAZY_ALLOC) == 0)
         return 0;
 
-    if (length_tail < length)
+    while (true)
     {
-        size_t length_head = length - length_tail;
-        if (pos_read) {
-            if (copy_to_user(data,               pos_read,        length_tail) != 0) return 0;
-            if (copy_to_user(data + length_tail, queue_pos_begin, length_head) != 0) return 0;
-        } else {
-            if (copy_from_user(pos_write,       data,               length_tail) != 0) return 0;
-            if (copy_from_user(queue_pos_begin, data + length_tail, length_head) != 0) return 0;
-        }
-        return queue_pos_begin + length_head;
+        if (memchunk_alloc(&ring->chunks[index], ring->queue->chunk_flags, ring->node) != 0)
+            return -ENOMEM;
+        if (index == last)
+            return 0;
+        index = (index + 1) % ring->chunks_count;
     }
-    else
+}
+
+static void touch_chunks(struct mem_ring * ring, size_t pos_from, size_t pos_to, u64 now)
+{
+    size_t index = pos_from / MEMQUEUE_CHUNK_SIZE;
+    size_t last  = pos_to   / MEMQUEUE_CHUNK_SIZE;
+
+    ring->chunks[index].touched = now;
+    while (index != last)
     {
-        char * tmp_pos = 0;
-        if (pos_read) {
-            if (copy_to_user(data, pos_read, length) != 0) return 0;
-            tmp_pos = pos_read + length;
-        } else {
-            if (copy_from_user(pos_write, data, length) != 0) return 0;
-            tmp_pos = pos_write + length;
+        index = (index + 1) % ring->chunks_count;
+        ring->chunks[index].touched = now;
+    }
+}
+
+static void release_idle_chunks(struct mem_ring * ring, size_t pos_read, size_t pos_write)
+{
+    size_t index = 0;
+    u64 now = ktime_get_ns();
+
+    // scanning all chunks on every write is too expensive for big rings
+    if (now - ring->release_scan_time < ring->queue->release_idle_ns / 2)
+        return;
+    ring->release_scan_time = now;
+
+    for (index = 0; index < ring->chunks_count; index++)
+    {
+        struct memchunk * chunk = &ring->chunks[index];
+
+        if (chunk->resident &&
+            now - chunk->touched >= ring->queue->release_idle_ns &&
+            check_chunk_used(index, pos_read, pos_write) == false)
+        {
+            memchunk_release(chunk);
         }
-        return tmp_pos == queue_pos_end ? queue_pos_begin : tmp_pos;
     }
 }
 
+// ========== record functions ==========
+
+static size_t record_header_size(unsigned int flags)
+{
+    return sizeof(size_t) + 
+        (flags & RECORD_STAMP  ? sizeof(u64) : 0) + 
+        (flags & RECORD_EXPIRE ? sizeof(u64) : 0) + 
+        (flags & RECORD_TAG    ? sizeof(u64) : 0);
+}
+
 // ========== check functions ==========
 
-static bool check_empty_space(char * pos_read, char * pos_write, size_t length)
+/**
+ * Space reserved for delayed messages isn't empty.
+ */
+static bool check_empty_space(struct mem_ring * ring, size_t pos_read, size_t pos_write, size_t length)
 {
     size_t empty_space = 0;
 
     if (pos_read == pos_write)
     {
-        empty_space = queue_size;
+        empty_space = ring->size;
     }
     else if (pos_read < pos_write)
     {// --------------================----------------X
-     //               ^pos_read       ^pos_write      ^pos_end
-        empty_space = (pos_read - queue_pos_begin) + (queue_pos_end - pos_write);
+     //               ^pos_read       ^pos_write      ^ring->size
+        empty_space = pos_read + (ring->size - pos_write);
     }
     else if (pos_read > pos_write)
     {// ==============----------------================X
-     //               ^pos_write      ^pos_read       ^pos_end
+     //               ^pos_write      ^pos_read       ^ring->size
         empty_space = pos_read - pos_write;
     }
 
     // pos_write always be less pos_read if writing more frequently then reading
     // otherwise condition "if (pos_read == pos_write)" (see above) will be wrong
-    return empty_space > (sizeof(size_t) + length);
+    return empty_space > length + ring->reserved;
 }
 
-static bool check_filled_space(char * pos_read, char * pos_write)
+static bool check_filled_space(size_t pos_read, size_t pos_write)
 {
     if (pos_read == pos_write)
     {
@@ -287,10 +1697,163 @@ static bool check_filled_space(char * pos_read, char * pos_write)
     }
     else
     {// --------------================----------------X
-     //               ^pos_read       ^pos_write      ^pos_end
+     //               ^pos_read       ^pos_write      ^ring->size
      // or
      // ==============----------------================X
-     //               ^pos_write      ^pos_read       ^pos_end
+     //               ^pos_write      ^pos_read       ^ring->size
         return true;
     }
 }
+
+/**
+ * Chunks from the one with read position up to the one with write position
+ * hold messages or will be written next, they can't be released.
+ */
+static bool check_chunk_used(size_t index, size_t pos_read, size_t pos_write)
+{
+    size_t index_read  = pos_read  / MEMQUEUE_CHUNK_SIZE;
+    size_t index_write = pos_write / MEMQUEUE_CHUNK_SIZE;
+
+    if (pos_read <= pos_write)
+        return index >= index_read && index <= index_write;
+    else
+        return index >= index_read || index <= index_write;
+}
+
+// ========== default queue functions ==========
+
+int memqueue_open(size_t _queue_size)
+{
+    struct memqueue_params params = { _queue_size, 0, 0, 0, 0, 0 };
+    return memqueue_open_params(&params);
+}
+
+int memqueue_open_params(const struct memqueue_params * params)
+{
+    memqueue_close();
+    return mq_open(&default_queue, params);
+}
+
+void memqueue_close(void)
+{
+    mq_close(default_queue);
+    default_queue = 0;
+}
+
+void memqueue_get_stats(struct memqueue_stats * stats)
+{
+    if (default_queue == 0)
+    {
+        memset(stats, 0, sizeof(struct memqueue_stats));
+        return;
+    }
+
+    mq_get_stats(default_queue, stats);
+}
+
+int memqueue_get_depth(size_t index, struct memqueue_depth * depth)
+{
+    if (default_queue == 0)
+        return -EINVAL;
+
+    return mq_get_depth(default_queue, index, depth);
+}
+
+int memqueue_key_partition(unsigned long long key)
+{
+    if (default_queue == 0)
+        return -EINVAL;
+
+    return mq_key_partition(default_queue, key);
+}
+
+ssize_t memqueue_read(char * data, size_t size)
+{
+    return memqueue_read_ex(data, size, 0, 0);
+}
+
+ssize_t memqueue_read_part(char * data, size_t size, size_t * left)
+{
+    return memqueue_read_ex(data, size, 0, left);
+}
+
+ssize_t memqueue_read_partitions(char * data, size_t size, unsigned long long mask, size_t * left)
+{
+    struct memqueue_read_opts opts = { MEMQUEUE_READ_PARTITIONS, mask, 0 };
+    return memqueue_read_ex(data, size, &opts, left);
+}
+
+ssize_t memqueue_read_ex(char * data, size_t size, const struct memqueue_read_opts * opts, size_t * left)
+{
+    if (default_queue == 0)
+        return data == 0 || size == 0 ? -EINVAL : -EBADF;
+
+    return mq_read(default_queue, data, size, opts, left);
+}
+
+ssize_t memqueue_next_length(void)
+{
+    return memqueue_next_length_ex(0);
+}
+
+ssize_t memqueue_next_length_partitions(unsigned long long mask)
+{
+    struct memqueue_read_opts opts = { MEMQUEUE_READ_PARTITIONS, mask, 0 };
+    return memqueue_next_length_ex(&opts);
+}
+
+ssize_t memqueue_next_length_ex(const struct memqueue_read_opts * opts)
+{
+    if (default_queue == 0)
+        return -EBADF;
+
+    return mq_next_length(default_queue, opts);
+}
+
+ssize_t memqueue_consume(memqueue_consume_fn consume, void * context, size_t size)
+{
+    return memqueue_consume_ex(consume, context, size, 0);
+}
+
+ssize_t memqueue_consume_partitions(memqueue_consume_fn consume, void * context, size_t size, unsigned long long mask)
+{
+    struct memqueue_read_opts opts = { MEMQUEUE_READ_PARTITIONS, mask, 0 };
+    return memqueue_consume_ex(consume, context, size, &opts);
+}
+
+ssize_t memqueue_consume_ex(memqueue_consume_fn consume, void * context, size_t size, const struct memqueue_read_opts * opts)
+{
+    if (default_queue == 0)
+        return consume == 0 || size == 0 ? -EINVAL : -EBADF;
+
+    return mq_consume(default_queue, consume, context, size, opts);
+}
+
+ssize_t memqueue_write(const char * data, size_t length)
+{
+    return memqueue_write_ex(data, length, 0);
+}
+
+ssize_t memqueue_write_ex(const char * data, size_t length, const struct memqueue_write_opts * opts)
+{
+    if (default_queue == 0)
+        return data == 0 || length == 0 ? -EINVAL : -EBADF;
+
+    return mq_write(default_queue, data, length, opts);
+}
+
+ssize_t memqueue_write_framed(const char * batch, size_t size, const struct memqueue_write_opts * opts)
+{
+    if (default_queue == 0)
+        return batch == 0 || size == 0 ? -EINVAL : -EBADF;
+
+    return mq_write_framed(default_queue, batch, size, opts);
+}
+
+ssize_t memqueue_produce(size_t length, memqueue_fill_fn fill, void * context, const struct memqueue_write_opts * opts)
+{
+    if (default_queue == 0)
+        return fill == 0 || length == 0 ? -EINVAL : -EBADF;
+
+    return mq_produce(default_queue, length, fill, context, opts);
+}
@@ -6,9 +6,23 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/fs.h>
+#include <linux/moduleparam.h>
+#include <linux/numa.h>
+#include <linux/uaccess.h>
+#include <linux/ioctls.h>
+#include <linux/uio.h>
+#include <linux/slab.h>
+#include <linux/version.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
 
 #include "../include/memqueue_constants.h"
 #include "../include/mem_queue.h"
+#include "../include/memqueue_ioctl.h"
+
+// tracepoints of library files are defined here, once per module
+#define CREATE_TRACE_POINTS
+#include "../include/memqueue_trace.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Alexander Chuprynov <achuprynov@gmail.com>");
@@ -22,36 +36,410 @@ static int device_open(struct inode *, struct file *);
 static int device_release(struct inode *, struct file *);
 static ssize_t device_read(struct file *, char *, size_t, loff_t *);
 static ssize_t device_write(struct file *, const char *, size_t, loff_t *);
+static ssize_t device_read_iter(struct kiocb *, struct iov_iter *);
+static ssize_t device_write_iter(struct kiocb *, struct iov_iter *);
+static long device_ioctl(struct file *, unsigned int, unsigned long);
+static __poll_t device_poll(struct file *, poll_table *);
+static void close_queues(void);
+
+struct device_file;
+static ssize_t read_framed(struct device_file *state, struct iov_iter *to);
+static struct memqueue_write_opts write_opts(struct device_file *state);
+static int consume_to_iter(void * context, const char * segment, size_t length, size_t offset, size_t message_length);
+static int fill_from_iter(void * context, char * segment, size_t length);
+static ssize_t wake_readers(struct device_file *state, ssize_t ret_code);
+static ssize_t wake_writers(struct device_file *state, ssize_t ret_code);
+static ssize_t track_full(struct device_file *state, unsigned int reads, ssize_t ret_code);
+
+/**
+ * State of opened device file.
+ */
+struct device_file
+{
+    // queue of device minor
+    struct mq_queue * queue;
+    unsigned int minor;
+    // read returns batches of whole messages prefixed by size_t length
+    bool framed;
+    // partitions and tags read by this file
+    struct memqueue_read_opts read_opts;
+    struct memqueue_write_opts write_opts;
+    // delay of every write, 0 - none
+    unsigned long long delay_ns;
+    // time to live of every write, 0 - forever
+    unsigned long long ttl_ns;
+    // reads of queue seen by the last write which didn't fit
+    unsigned int full_reads;
+    bool full;
+};
 
 static int major_num;
 
+// queue of every minor and readers waiting in poll for its messages,
+// writers of full queue wait in poll for reads freeing space
+#define QUEUES_MAX 64
+static struct mq_queue * queue_list[QUEUES_MAX];
+static wait_queue_head_t readers_wait[QUEUES_MAX];
+static wait_queue_head_t writers_wait[QUEUES_MAX];
+static atomic_t queue_reads[QUEUES_MAX];
+
+static uint queues = 1;
+module_param(queues, uint, 0444);
+MODULE_PARM_DESC(queues, "Number of independent queues, minor N is queue N (1 - 64)");
+
+static ulong queue_size = 10240;
+module_param(queue_size, ulong, 0444);
+MODULE_PARM_DESC(queue_size, "Max size of memory used by every queue in bytes");
+
+static bool lazy_alloc = false;
+module_param(lazy_alloc, bool, 0444);
+MODULE_PARM_DESC(lazy_alloc, "Allocate queue memory when it's reached by write position");
+
+static bool hugepages = false;
+module_param(hugepages, bool, 0444);
+MODULE_PARM_DESC(hugepages, "Back queue memory by 2MB pages where possible");
+
+static bool sharded = false;
+module_param(sharded, bool, 0444);
+MODULE_PARM_DESC(sharded, "Split queue into sub-rings written by producers of their CPUs");
+
+static uint shards = 0;
+module_param(shards, uint, 0444);
+MODULE_PARM_DESC(shards, "Number of sub-rings (0 - one per CPU or NUMA node)");
+
+static bool shard_by_node = false;
+module_param(shard_by_node, bool, 0444);
+MODULE_PARM_DESC(shard_by_node, "One sub-ring per NUMA node instead of per CPU");
+
+static bool shard_ordered = false;
+module_param(shard_ordered, bool, 0444);
+MODULE_PARM_DESC(shard_ordered, "Read sub-rings in order of write time instead of batches");
+
+static int numa_node = NUMA_NO_NODE;
+module_param(numa_node, int, 0444);
+MODULE_PARM_DESC(numa_node, "NUMA node for queue memory (-1 - any)");
+
+static bool prefetch = false;
+module_param(prefetch, bool, 0444);
+MODULE_PARM_DESC(prefetch, "Prefetch next message into cache after read");
+
+static ulong copy_nt_threshold = 0;
+module_param(copy_nt_threshold, ulong, 0444);
+MODULE_PARM_DESC(copy_nt_threshold, "Write messages of this size and bigger bypassing cache (0 - default)");
+
+static uint partitions = 0;
+module_param(partitions, uint, 0444);
+MODULE_PARM_DESC(partitions, "Split queue into partitions by key of message (0 - off)");
+
+static uint lanes = 0;
+module_param(lanes, uint, 0444);
+MODULE_PARM_DESC(lanes, "Split queue into priority lanes, higher lane is read first (0 - off)");
+
+static ulong lane_size = 0;
+module_param(lane_size, ulong, 0444);
+MODULE_PARM_DESC(lane_size, "Size of every lane above bulk lane 0 (0 - equal parts)");
+
+static uint lane_aging_ms = 0;
+module_param(lane_aging_ms, uint, 0444);
+MODULE_PARM_DESC(lane_aging_ms, "Read lower lane first when its message waited this time (0 - never)");
+
+static uint lane_burst = 0;
+module_param(lane_burst, uint, 0444);
+MODULE_PARM_DESC(lane_burst, "Read one message of lower lane after this number from upper lanes (0 - strict priority)");
+
+static bool expire_reclaim = false;
+module_param(expire_reclaim, bool, 0444);
+MODULE_PARM_DESC(expire_reclaim, "Writer drops expired messages to make room in full queue");
+
+static uint release_idle_ms = 0;
+module_param(release_idle_ms, uint, 0444);
+MODULE_PARM_DESC(release_idle_ms, "Free lazily allocated memory passed by reader after this idle time (0 - never)");
+
 // This structure points to all of the device functions
 static struct file_operations file_ops =
 {
     .read    = device_read,
     .write   = device_write,
+    .read_iter  = device_read_iter,
+    .write_iter = device_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read  = copy_splice_read,
+#else
+    .splice_read  = generic_file_splice_read,
+#endif
+    .splice_write = iter_file_splice_write,
+    .unlocked_ioctl = device_ioctl,
+    .poll    = device_poll,
     .open    = device_open,
     .release = device_release
 };
 
 static ssize_t device_read(struct file *flip, char *dest, size_t len, loff_t *offset)
 {
-    return memqueue_read(dest, len);
+    struct device_file * state = flip->private_data;
+    struct iovec iov = { .iov_base = dest, .iov_len = len };
+    struct iov_iter iter;
+
+    if (state->framed == false)
+        return wake_writers(state, mq_read(state->queue, dest, len, &state->read_opts, NULL));
+
+    iov_iter_init(&iter, READ, &iov, 1, len);
+    return wake_writers(state, read_framed(state, &iter));
+}
+
+/**
+ * Used by splice and readv. Pipe pages are filled right from ring memory,
+ * data doesn't pass through user space. Plain stream of messages 
+ * would lose their boundaries, so framed mode is required.
+ */
+static ssize_t device_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct device_file * state = iocb->ki_filp->private_data;
+
+    if (state->framed == false)
+        return -EINVAL;
+
+    return wake_writers(state, read_framed(state, to));
+}
+
+/**
+ * Used by splice and writev, whole data of the call is one message.
+ */
+static ssize_t device_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct device_file * state = iocb->ki_filp->private_data;
+
+    struct memqueue_write_opts opts = write_opts(state);
+    unsigned int reads = atomic_read(&queue_reads[state->minor]);
+
+    return wake_readers(state, track_full(state, reads, mq_produce(state->queue, iov_iter_count(from), fill_from_iter, from, &opts)));
+}
+
+/**
+ * Message longer than the whole buffer isn't split, -EMSGSIZE is returned,
+ * its length can be got by MEMQUEUE_IOC_NEXT_LEN.
+ */
+static ssize_t read_framed(struct device_file *state, struct iov_iter *to)
+{
+    return mq_consume(state->queue, consume_to_iter, to, iov_iter_count(to), &state->read_opts);
+}
+
+static int consume_to_iter(void * context, const char * segment, size_t length, size_t offset, size_t message_length)
+{
+    struct iov_iter * to = context;
+
+    if (offset == 0 && copy_to_iter(&message_length, sizeof(size_t), to) != sizeof(size_t))
+        return -EFAULT;
+    if (copy_to_iter(segment, length, to) != length)
+        return -EFAULT;
+    return 0;
+}
+
+static int fill_from_iter(void * context, char * segment, size_t length)
+{
+    struct iov_iter * from = context;
+
+    if (copy_from_iter(segment, length, from) != length)
+        return -EFAULT;
+    return 0;
 }
 
 static ssize_t device_write(struct file *flip, const char *src, size_t len, loff_t *offset)
 {
-    return memqueue_write(src, len);
+    struct device_file * state = flip->private_data;
+    struct memqueue_write_opts opts;
+    unsigned int reads = atomic_read(&queue_reads[state->minor]);
+    ssize_t ret_code = 0;
+
+    // delay and time to live of batch are counted from the call
+    opts = write_opts(state);
+    if (state->framed)
+        ret_code = mq_write_framed(state->queue, src, len, &opts);
+    else
+        ret_code = mq_write(state->queue, src, len, &opts);
+
+    return wake_readers(state, track_full(state, reads, ret_code));
+}
+
+/**
+ * Readable when the next message for partitions and tags of this file
+ * is in queue. Readers are woken by writes, message delayed by
+ * MEMQUEUE_IOC_SET_DELAY is seen by poll when it's called after its time.
+ * Writable unless the last write of this file didn't fit and queue
+ * wasn't read since, writers are woken by reads.
+ */
+static __poll_t device_poll(struct file *flip, poll_table *wait)
+{
+    struct device_file * state = flip->private_data;
+    __poll_t mask = 0;
+
+    poll_wait(flip, &readers_wait[state->minor], wait);
+    poll_wait(flip, &writers_wait[state->minor], wait);
+
+    if (mq_next_length(state->queue, &state->read_opts) != 0)
+        mask |= EPOLLIN | EPOLLRDNORM;
+
+    if (state->full == false || atomic_read(&queue_reads[state->minor]) != state->full_reads)
+        mask |= EPOLLOUT | EPOLLWRNORM;
+
+    return mask;
+}
+
+static ssize_t wake_readers(struct device_file *state, ssize_t ret_code)
+{
+    wait_queue_head_t * wait = &readers_wait[state->minor];
+
+    // writers don't pay for wake up while nobody polls
+    if (ret_code > 0 && wq_has_sleeper(wait))
+        wake_up_interruptible_poll(wait, EPOLLIN | EPOLLRDNORM);
+    return ret_code;
+}
+
+/**
+ * Poll of writer waits for a read after the write which didn't fit,
+ * <reads> are counted before the write, so a read during it isn't lost.
+ */
+static ssize_t track_full(struct device_file *state, unsigned int reads, ssize_t ret_code)
+{
+    state->full       = ret_code == -ENOSPC;
+    state->full_reads = reads;
+    return ret_code;
+}
+
+static ssize_t wake_writers(struct device_file *state, ssize_t ret_code)
+{
+    wait_queue_head_t * wait = &writers_wait[state->minor];
+
+    if (ret_code > 0)
+    {
+        atomic_inc(&queue_reads[state->minor]);
+        if (wq_has_sleeper(wait))
+            wake_up_interruptible_poll(wait, EPOLLOUT | EPOLLWRNORM);
+    }
+    return ret_code;
+}
+
+static struct memqueue_write_opts write_opts(struct device_file *state)
+{
+    struct memqueue_write_opts opts = state->write_opts;
+
+    if (state->delay_ns)
+    {
+        opts.flags     |= MEMQUEUE_WRITE_DELIVER;
+        opts.deliver_ns = memqueue_now_ns() + state->delay_ns;
+    }
+
+    // time to live is counted from write, not from delivery
+    if (state->ttl_ns)
+    {
+        opts.flags    |= MEMQUEUE_WRITE_EXPIRE;
+        opts.expire_ns = memqueue_now_ns() + state->ttl_ns;
+    }
+
+    return opts;
+}
+
+static long device_ioctl(struct file *flip, unsigned int cmd, unsigned long arg)
+{
+    struct device_file * state = flip->private_data;
+    struct memqueue_ioc_depth ioc_depth;
+    struct memqueue_depth depth;
+    unsigned long long mask = 0;
+    unsigned long long key  = 0;
+    ssize_t length = 0;
+
+    switch (cmd)
+    {
+    case MEMQUEUE_IOC_SET_FRAMED:
+        state->framed = arg != 0;
+        return 0;
+    case MEMQUEUE_IOC_SET_PARTITIONS:
+        if (get_user(mask, (unsigned long long __user *)arg))
+            return -EFAULT;
+        // mask has to select at least one existing partition
+        if (mask == 0 || (partitions && partitions < MEMQUEUE_PARTITIONS_MAX && (mask & ((1ULL << partitions) - 1)) == 0))
+            return -EINVAL;
+        state->read_opts.flags     |= MEMQUEUE_READ_PARTITIONS;
+        state->read_opts.partitions = mask;
+        return 0;
+    case MEMQUEUE_IOC_SET_TAGS:
+        if (get_user(mask, (unsigned long long __user *)arg))
+            return -EFAULT;
+        state->read_opts.flags |= MEMQUEUE_READ_TAGS;
+        state->read_opts.tags   = mask;
+        return 0;
+    case MEMQUEUE_IOC_SET_TAG:
+        if (arg >= MEMQUEUE_TAGS_MAX)
+            return -EINVAL;
+        state->write_opts.flags |= MEMQUEUE_WRITE_TAG;
+        state->write_opts.tag    = arg;
+        return 0;
+    case MEMQUEUE_IOC_SET_KEY:
+        if (get_user(key, (unsigned long long __user *)arg))
+            return -EFAULT;
+        state->write_opts.flags |= MEMQUEUE_WRITE_KEY;
+        state->write_opts.key    = key;
+        return 0;
+    case MEMQUEUE_IOC_SET_PRIORITY:
+        // queue without lanes has the only one
+        if (arg >= (lanes ? lanes : 1))
+            return -EINVAL;
+        state->write_opts.flags   |= MEMQUEUE_WRITE_PRIORITY;
+        state->write_opts.priority = arg;
+        return 0;
+    case MEMQUEUE_IOC_SET_DELAY:
+        state->delay_ns = (unsigned long long)arg * NSEC_PER_MSEC;
+        return 0;
+    case MEMQUEUE_IOC_SET_TTL:
+        state->ttl_ns = (unsigned long long)arg * NSEC_PER_MSEC;
+        return 0;
+    case MEMQUEUE_IOC_GET_DEPTH:
+        if (copy_from_user(&ioc_depth, (void __user *)arg, sizeof(ioc_depth)))
+            return -EFAULT;
+        length = mq_get_depth(state->queue, ioc_depth.index, &depth);
+        if (length < 0)
+            return length;
+        ioc_depth.messages = depth.messages;
+        ioc_depth.bytes    = depth.bytes;
+        return copy_to_user((void __user *)arg, &ioc_depth, sizeof(ioc_depth)) ? -EFAULT : 0;
+    case MEMQUEUE_IOC_NEXT_LEN:
+        length = mq_next_length(state->queue, &state->read_opts);
+        if (length < 0)
+            return length;
+        return put_user((unsigned long)length, (unsigned long __user *)arg);
+    case FIONREAD:
+        length = mq_next_length(state->queue, &state->read_opts);
+        if (length < 0)
+            return length;
+        return put_user((int)min_t(ssize_t, length, INT_MAX), (int __user *)arg);
+    default:
+        return -ENOTTY;
+    }
 }
 
 static int device_open(struct inode *inode, struct file *file)
 {
+    struct device_file * state = 0;
+    unsigned int minor = iminor(inode);
+
+    if (minor >= queues)
+        return -ENXIO;
+
+    state = kzalloc(sizeof(struct device_file), GFP_KERNEL);
+    if (state == NULL)
+        return -ENOMEM;
+
+    state->queue = queue_list[minor];
+    state->minor = minor;
+    file->private_data = state;
+
     try_module_get(THIS_MODULE);
     return 0;
 }
 
 static int device_release(struct inode *inode, struct file *file)
 {
+    kfree(file->private_data);
     module_put(THIS_MODULE);
     return 0;
 }
@@ -59,7 +447,33 @@ static int device_release(struct inode *inode, struct file *file)
 static int __init memqueue_module_init(void)
 {
     int ret_code = 0;
-    size_t queue_size = 10240;
+    uint index = 0;
+    struct memqueue_params params = 
+    {
+        .queue_size      = queue_size,
+        .flags           = (lazy_alloc    ? MEMQUEUE_LAZY_ALLOC    : 0) | 
+                           (hugepages     ? MEMQUEUE_HUGEPAGES     : 0) |
+                           (sharded       ? MEMQUEUE_SHARDED       : 0) |
+                           (shard_by_node ? MEMQUEUE_SHARD_BY_NODE : 0) |
+                           (shard_ordered ? MEMQUEUE_SHARD_ORDERED : 0) |
+                           (prefetch      ? MEMQUEUE_PREFETCH      : 0) |
+                           (partitions    ? MEMQUEUE_PARTITIONED   : 0) |
+                           (lanes         ? MEMQUEUE_PRIORITY_LANES : 0) |
+                           (expire_reclaim ? MEMQUEUE_EXPIRE_RECLAIM : 0) |
+                           (numa_node != NUMA_NO_NODE ? MEMQUEUE_NUMA_NODE : 0),
+        .release_idle_ms = release_idle_ms,
+        .shards          = shards,
+        .numa_node         = numa_node,
+        .copy_nt_threshold = copy_nt_threshold,
+        .partitions        = partitions,
+        .lanes             = lanes,
+        .lane_size         = lane_size,
+        .lane_aging_ms     = lane_aging_ms,
+        .lane_burst        = lane_burst
+    };
+
+    if (queues == 0 || queues > QUEUES_MAX)
+        return -EINVAL;
 
     major_num = register_chrdev(0, DEVICE_NAME, &file_ops);
     if (major_num < 0)
@@ -70,18 +484,42 @@ static int __init memqueue_module_init(void)
 
     printk(KERN_INFO "%s module registered with device major number %d\n", DEVICE_NAME, major_num);
 
-    ret_code = memqueue_open(queue_size);
+    for (index = 0; index < queues && ret_code == 0; index++)
+    {
+        init_waitqueue_head(&readers_wait[index]);
+        init_waitqueue_head(&writers_wait[index]);
+        ret_code = mq_open(&queue_list[index], &params);
+    }
+
     if (ret_code == 0)
-        printk(KERN_INFO "%s module opened. Queue size %lu.\n", DEVICE_NAME, queue_size);
+    {
+        printk(KERN_INFO "%s module opened. Queues %u, queue size %lu.\n", DEVICE_NAME, queues, queue_size);
+    }
     else
+    {
         printk(KERN_INFO "%s module failed with code %d\n", DEVICE_NAME, ret_code);
+        close_queues();
+        unregister_chrdev(major_num, DEVICE_NAME);
+    }
 
-    return ret_code;
+    // queue returns positive number of error
+    return -ret_code;
+}
+
+static void close_queues(void)
+{
+    uint index = 0;
+
+    for (index = 0; index < QUEUES_MAX; index++)
+    {
+        mq_close(queue_list[index]);
+        queue_list[index] = 0;
+    }
 }
 
 static void __exit memqueue_module_exit(void)
 {
-    memqueue_close();
+    close_queues();
     printk(KERN_INFO "%s module closed\n", DEVICE_NAME);
 
     unregister_chrdev(major_num, DEVICE_NAME);
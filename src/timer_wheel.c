@@ -0,0 +1,222 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include "../include/linux_base.h"
+
+#include "../include/timer_wheel.h"
+
+#define LEVEL_SHIFT(level)  ((level) * TIMER_WHEEL_BITS)
+#define SLOT_MASK           (TIMER_WHEEL_SLOTS - 1)
+// the farthest tick wheel can hold from now
+#define MAX_DELTA           (((u64)1 << LEVEL_SHIFT(TIMER_WHEEL_LEVELS)) - 1)
+
+// ========== prototypes for internal functions ==========
+
+static void place(struct timer_wheel * wheel, struct timer_entry * entry);
+static void cascade(struct timer_wheel * wheel, size_t level, size_t index);
+static struct timer_entry * take_slot(struct timer_wheel * wheel, size_t level, size_t index);
+static u64  next_event(struct timer_wheel * wheel);
+
+// ========== base functions ==========
+
+void timer_wheel_init(struct timer_wheel * wheel, u64 tick_ns, u64 now_ns)
+{
+    size_t level = 0;
+    size_t index = 0;
+
+    wheel->tick_ns = tick_ns;
+    wheel->now     = now_ns / tick_ns;
+    wheel->count   = 0;
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        wheel->occupied[level] = 0;
+        for (index = 0; index < TIMER_WHEEL_SLOTS; index++)
+        {
+            wheel->slots[level][index].head = 0;
+            wheel->slots[level][index].tail = 0;
+        }
+    }
+}
+
+void timer_wheel_add(struct timer_wheel * wheel, struct timer_entry * entry, u64 expires_ns)
+{
+    // rounded up, entry never expires before its time
+    entry->expires = (expires_ns + wheel->tick_ns - 1) / wheel->tick_ns;
+    if (entry->expires < wheel->now)
+        entry->expires = wheel->now;
+
+    place(wheel, entry);
+    wheel->count++;
+}
+
+struct timer_entry * timer_wheel_advance(struct timer_wheel * wheel, u64 now_ns)
+{
+    struct timer_entry * expired_head = 0;
+    struct timer_entry * expired_tail = 0;
+    struct timer_entry * entry = 0;
+    struct timer_entry * next  = 0;
+    u64 target = now_ns / wheel->tick_ns;
+    u64 event  = 0;
+    size_t level = 0;
+
+    while (wheel->now <= target)
+    {
+        event = next_event(wheel);
+        if (event > target)
+            break;
+
+        // slots between now and event are empty, time jumps over them
+        wheel->now = event;
+
+        // upper levels first, what they give lands below
+        for (level = TIMER_WHEEL_LEVELS - 1; level > 0; level--)
+        {
+            if ((event & (((u64)1 << LEVEL_SHIFT(level)) - 1)) == 0)
+                cascade(wheel, level, (event >> LEVEL_SHIFT(level)) & SLOT_MASK);
+        }
+
+        for (entry = take_slot(wheel, 0, event & SLOT_MASK); entry; entry = next)
+        {
+            next = entry->next;
+
+            // entry which was too far is placed again
+            if (entry->expires > event)
+            {
+                place(wheel, entry);
+                continue;
+            }
+
+            entry->next = 0;
+            if (expired_tail)
+                expired_tail->next = entry;
+            else
+                expired_head = entry;
+            expired_tail = entry;
+            wheel->count--;
+        }
+
+        wheel->now = event + 1;
+    }
+
+    if (wheel->now <= target)
+        wheel->now = target + 1;
+
+    return expired_head;
+}
+
+struct timer_entry * timer_wheel_drain(struct timer_wheel * wheel)
+{
+    struct timer_entry * drained = 0;
+    struct timer_entry * entry = 0;
+    struct timer_entry * next  = 0;
+    size_t level = 0;
+    size_t index = 0;
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for (index = 0; index < TIMER_WHEEL_SLOTS; index++)
+        {
+            for (entry = take_slot(wheel, level, index); entry; entry = next)
+            {
+                next = entry->next;
+                entry->next = drained;
+                drained = entry;
+            }
+        }
+    }
+
+    wheel->count = 0;
+    return drained;
+}
+
+// ========== slot functions ==========
+
+static void place(struct timer_wheel * wheel, struct timer_entry * entry)
+{
+    u64 delta = entry->expires - wheel->now;
+    size_t level = 0;
+    size_t index = 0;
+    struct timer_slot * slot = 0;
+
+    entry->placed = delta > MAX_DELTA ? wheel->now + MAX_DELTA : entry->expires;
+    delta = entry->placed - wheel->now;
+
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >> LEVEL_SHIFT(level + 1))
+        level++;
+
+    index = (entry->placed >> LEVEL_SHIFT(level)) & SLOT_MASK;
+    slot  = &wheel->slots[level][index];
+
+    entry->next = 0;
+    if (slot->tail)
+        slot->tail->next = entry;
+    else
+        slot->head = entry;
+    slot->tail = entry;
+
+    wheel->occupied[level] |= (u64)1 << index;
+}
+
+static void cascade(struct timer_wheel * wheel, size_t level, size_t index)
+{
+    struct timer_entry * entry = take_slot(wheel, level, index);
+    struct timer_entry * next  = 0;
+
+    for (; entry; entry = next)
+    {
+        next = entry->next;
+        place(wheel, entry);
+    }
+}
+
+static struct timer_entry * take_slot(struct timer_wheel * wheel, size_t level, size_t index)
+{
+    struct timer_slot * slot = &wheel->slots[level][index];
+    struct timer_entry * entry = slot->head;
+
+    slot->head = 0;
+    slot->tail = 0;
+    wheel->occupied[level] &= ~((u64)1 << index);
+
+    return entry;
+}
+
+/**
+ * Return the nearest tick from now when a slot of level 0 expires 
+ * or a slot of upper level is cascaded, (u64)-1 if wheel is empty.
+ */
+static u64 next_event(struct timer_wheel * wheel)
+{
+    u64 event = (u64)-1;
+    size_t level = 0;
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        u64 occupied = wheel->occupied[level];
+        u64 block    = wheel->now >> LEVEL_SHIFT(level);
+        size_t current = block & SLOT_MASK;
+        u64 rotated  = 0;
+        u64 distance = 0;
+        u64 candidate = 0;
+
+        if (occupied == 0)
+            continue;
+
+        // distance in slots from current one to the next occupied
+        rotated  = current ? (occupied >> current) | (occupied << (TIMER_WHEEL_SLOTS - current)) : occupied;
+        distance = __builtin_ctzll(rotated);
+
+        // current slot of upper level is cascaded at the start of its block,
+        // inside the block what is there belongs to the next rotation
+        if (level > 0 && distance == 0 && (wheel->now & (((u64)1 << LEVEL_SHIFT(level)) - 1)))
+            distance = TIMER_WHEEL_SLOTS;
+
+        candidate = level == 0 ? wheel->now + distance : (block + distance) << LEVEL_SHIFT(level);
+        if (candidate < event)
+            event = candidate;
+    }
+
+    return event;
+}
@@ -0,0 +1,950 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#define BOOST_TEST_MODULE DaemonTestModule
+#include <boost/test/included/unit_test.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+#include "../daemon/AsyncQueue.h"
+#include "../daemon/BufferPool.h"
+#include "../daemon/CompressedWriter.h"
+#include "../daemon/EventLoop.h"
+#include "../daemon/Frame.h"
+#include "../daemon/MessageIndex.h"
+#include "../daemon/SegmentWriter.h"
+#include "../daemon/ShmRing.h"
+#include "../daemon/Source.h"
+#include "../daemon/StripedWriter.h"
+#include "../daemon/WaitStrategy.h"
+#include "../daemon/WorkerPool.h"
+#include "../include/queue.h"
+
+using namespace std::chrono;
+
+/**
+ * Directory "/var/tmp/memqueue_test_XXXXXX" removed with its files.
+ */
+struct TempDir
+{
+    std::string path;
+
+    TempDir()
+    {
+        char name[] = "/var/tmp/memqueue_test_XXXXXX";
+        BOOST_REQUIRE(mkdtemp(name) != nullptr);
+        path = name;
+    }
+
+    ~TempDir() { std::filesystem::remove_all(path); }
+};
+
+// messages prefixed by length as in Batch
+static std::vector<std::byte> make_batch(const std::vector<std::string> & messages)
+{
+    std::vector<std::byte> batch;
+
+    for (auto & message : messages)
+    {
+        size_t length = message.size();
+        auto prefix = reinterpret_cast<const std::byte *>(&length);
+        batch.insert(batch.end(), prefix, prefix + sizeof(size_t));
+        batch.insert(batch.end(), reinterpret_cast<const std::byte *>(message.data()), reinterpret_cast<const std::byte *>(message.data()) + message.size());
+    }
+    return batch;
+}
+
+static std::vector<std::byte> read_file(const std::string & file_name)
+{
+    std::ifstream file(file_name, std::ios::binary);
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    auto bytes = reinterpret_cast<const std::byte *>(data.data());
+    return std::vector<std::byte>(bytes, bytes + data.size());
+}
+
+// messages of all batches of segments <prefix><counter>
+static std::vector<std::string> read_segments(const std::string & prefix)
+{
+    std::vector<std::string> messages;
+
+    for (size_t counter = 0; std::filesystem::exists(prefix + std::to_string(counter)); counter++)
+    {
+        auto data = read_file(prefix + std::to_string(counter));
+        for (auto message : Batch(data))
+            messages.emplace_back(reinterpret_cast<const char *>(message.data()), message.size());
+    }
+    return messages;
+}
+
+/**
+ * Source of prepared batches, it remembers the first thread reading it
+ * and whether another thread read it after that.
+ */
+class ListSource : public Source
+{
+public:
+    void push(std::vector<std::byte> batch) { batches_.push_back(std::move(batch)); remaining_++; }
+
+    int fd() const override { return -1; }
+
+    size_t read_batch(std::vector<std::byte> & buffer) override
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        if (batches_.empty())
+            return 0;
+
+        if (first_reader_ == std::thread::id())
+            first_reader_ = std::this_thread::get_id();
+        else if (first_reader_ != std::this_thread::get_id())
+            shared_ = true;
+        changed_.notify_all();
+
+        size_t length = batches_.front().size();
+        std::copy(batches_.front().begin(), batches_.front().end(), buffer.begin());
+        batches_.pop_front();
+        remaining_--;
+        return length;
+    }
+
+    size_t remaining() const { return remaining_; }
+
+    /**
+     * Wait until the source is read by two threads, if the caller is the first of them.
+     */
+    void wait_shared()
+    {
+        std::unique_lock<std::mutex> guard(lock_);
+        if (first_reader_ == std::this_thread::get_id())
+            changed_.wait_for(guard, seconds(5), [this]() { return shared_; });
+    }
+
+private:
+    std::mutex lock_;
+    std::condition_variable changed_;
+    std::deque<std::vector<std::byte>> batches_;
+    std::atomic<size_t> remaining_{0};
+    std::thread::id first_reader_;
+    bool shared_ = false;
+};
+
+/**
+ * Empty source which stops the first reader of <hot> until another
+ * worker takes a batch of <hot> as well.
+ */
+class GateSource : public Source
+{
+public:
+    explicit GateSource(ListSource & hot) : hot_(hot) {}
+
+    int fd() const override { return -1; }
+
+    size_t read_batch(std::vector<std::byte> &) override
+    {
+        hot_.wait_shared();
+        return 0;
+    }
+
+private:
+    ListSource & hot_;
+};
+
+static std::span<const std::byte> as_bytes(const std::string & text)
+{
+    return std::span<const std::byte>(reinterpret_cast<const std::byte *>(text.data()), text.size());
+}
+
+static std::vector<std::string> batch_messages(const std::vector<std::byte> & buffer, size_t length)
+{
+    std::vector<std::string> messages;
+    for (auto message : Batch(std::span<const std::byte>(buffer.data(), length)))
+        messages.emplace_back(reinterpret_cast<const char *>(message.data()), message.size());
+    return messages;
+}
+
+static bool readable(int fd)
+{
+    struct pollfd poll_fd = { fd, POLLIN, 0 };
+    return poll(&poll_fd, 1, 0) == 1;
+}
+
+/**
+ * Name of shared memory ring of this test process, removed with its fifo.
+ */
+struct TempRing
+{
+    std::string name = "memqueue_test_" + std::to_string(getpid());
+
+    TempRing() { ShmRing::remove(name); }
+    ~TempRing() { ShmRing::remove(name); }
+};
+
+BOOST_AUTO_TEST_SUITE(DaemonTest)
+
+BOOST_AUTO_TEST_CASE(WaitStrategySpinTest)
+{
+    WaitStrategy wait({ seconds(10), microseconds(1), seconds(10), milliseconds(1) });
+
+    for (int i = 0; i < 100; i++)
+        wait.wait({});
+
+    BOOST_CHECK_EQUAL(wait.stats().spins, 100);
+    BOOST_CHECK_EQUAL(wait.stats().sleeps, 0);
+    BOOST_CHECK_EQUAL(wait.stats().blocks, 0);
+}
+
+BOOST_AUTO_TEST_CASE(WaitStrategyBackoffTest)
+{
+    WaitStrategy wait({ microseconds(0), microseconds(1000), seconds(10), milliseconds(1) });
+
+    // sleeps 1, 2, 4, ... 512, then 1000 us
+    auto start = steady_clock::now();
+    for (int i = 0; i < 12; i++)
+        wait.wait({});
+    auto elapsed = steady_clock::now() - start;
+
+    BOOST_CHECK_EQUAL(wait.stats().spins, 0);
+    BOOST_CHECK_EQUAL(wait.stats().sleeps, 12);
+    BOOST_CHECK(elapsed >= microseconds(1023 + 2000));
+    BOOST_CHECK(wait.stats().backoff_ns >= 3023000);
+}
+
+BOOST_AUTO_TEST_CASE(WaitStrategyResetTest)
+{
+    WaitStrategy wait({ milliseconds(20), microseconds(1), seconds(10), milliseconds(1) });
+
+    wait.wait({});
+    std::this_thread::sleep_for(milliseconds(30));
+    wait.wait({});
+    BOOST_CHECK_EQUAL(wait.stats().spins, 1);
+    BOOST_CHECK_EQUAL(wait.stats().sleeps, 1);
+
+    // reader got messages, idle time starts again
+    wait.reset();
+    wait.wait({});
+    BOOST_CHECK_EQUAL(wait.stats().spins, 2);
+    BOOST_CHECK_EQUAL(wait.stats().sleeps, 1);
+}
+
+BOOST_AUTO_TEST_CASE(WaitStrategyBlockTest)
+{
+    std::array<int, 2> fds;
+    BOOST_REQUIRE_EQUAL(pipe(fds.data()), 0);
+
+    WaitStrategy wait({ microseconds(0), microseconds(1), microseconds(0), milliseconds(50) });
+
+    // without descriptors reader can't block, backoff goes on
+    std::array<int, 2> none = { -1, -1 };
+    wait.wait(none);
+    BOOST_CHECK_EQUAL(wait.stats().sleeps, 1);
+    BOOST_CHECK_EQUAL(wait.stats().blocks, 0);
+
+    // empty pipe: poll times out
+    std::array<int, 2> readable = { -1, fds[0] };
+    auto start = steady_clock::now();
+    wait.wait(readable);
+    BOOST_CHECK(steady_clock::now() - start >= milliseconds(40));
+    BOOST_CHECK_EQUAL(wait.stats().blocks, 1);
+
+    // written pipe wakes reader at once
+    BOOST_REQUIRE_EQUAL(write(fds[1], "x", 1), 1);
+    start = steady_clock::now();
+    wait.wait(readable);
+    BOOST_CHECK(steady_clock::now() - start < milliseconds(40));
+    BOOST_CHECK_EQUAL(wait.stats().blocks, 2);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(WaitStrategyWritableTest)
+{
+    std::array<int, 2> fds;
+    BOOST_REQUIRE_EQUAL(pipe(fds.data()), 0);
+
+    // writer of full queue waits for POLLOUT, empty pipe is writable
+    WaitStrategy wait({ microseconds(0), microseconds(1), microseconds(0), seconds(10) }, POLLOUT);
+
+    auto start = steady_clock::now();
+    wait.wait(std::span<const int>(&fds[1], 1));
+    BOOST_CHECK(steady_clock::now() - start < seconds(1));
+    BOOST_CHECK_EQUAL(wait.stats().blocks, 1);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(WaitStrategyForLatencyTest)
+{
+    auto params = WaitStrategy::for_latency(microseconds(1000));
+    BOOST_CHECK(params.spin <= microseconds(100));
+    BOOST_CHECK(params.max_sleep == microseconds(1000));
+    BOOST_CHECK(params.block_after == microseconds(10000));
+
+    // reader blocks not earlier than 1 ms of idle, sleep is at least 1 us
+    params = WaitStrategy::for_latency(microseconds(0));
+    BOOST_CHECK(params.spin == microseconds(0));
+    BOOST_CHECK(params.max_sleep == microseconds(1));
+    BOOST_CHECK(params.block_after == milliseconds(1));
+}
+
+BOOST_AUTO_TEST_CASE(FrameRoundTripTest)
+{
+    std::vector<std::string> messages;
+    for (int i = 0; i < 100; i++)
+        messages.push_back("message number " + std::to_string(i));
+    auto batch = make_batch(messages);
+
+    FrameEncoder encoder(1);
+    std::vector<std::byte> frame;
+    std::vector<std::byte> decoded;
+
+    size_t length = encoder.encode(7, batch, frame);
+    FrameHeader header;
+    memcpy(&header, frame.data(), sizeof(header));
+    BOOST_CHECK_EQUAL(header.magic, frame_magic);
+    BOOST_CHECK_EQUAL(header.codec, frame_deflate);
+    BOOST_CHECK_EQUAL(header.seq, 7);
+    BOOST_CHECK_EQUAL(header.raw_length, batch.size());
+    BOOST_CHECK_EQUAL(sizeof(header) + header.length, length);
+    BOOST_CHECK(length < batch.size());
+
+    decode_frame(std::span<const std::byte>(frame.data(), length), decoded);
+    BOOST_CHECK(decoded == batch);
+
+    // random bytes don't shrink and are stored as is
+    std::mt19937 random(1);
+    std::vector<std::byte> noise(4096);
+    for (auto & byte : noise)
+        byte = std::byte(random());
+
+    length = encoder.encode(8, noise, frame);
+    memcpy(&header, frame.data(), sizeof(header));
+    BOOST_CHECK_EQUAL(header.codec, frame_stored);
+    BOOST_CHECK_EQUAL(header.length, noise.size());
+
+    decode_frame(std::span<const std::byte>(frame.data(), length), decoded);
+    BOOST_CHECK(decoded == noise);
+
+    // damaged frames are thrown
+    frame[0] = ~frame[0];
+    BOOST_CHECK_THROW(decode_frame(std::span<const std::byte>(frame.data(), length), decoded), std::runtime_error);
+    frame[0] = ~frame[0];
+    BOOST_CHECK_THROW(decode_frame(std::span<const std::byte>(frame.data(), length - 1), decoded), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(CompressedWriterOrderTest)
+{
+    const size_t batches = 16;
+    TempDir dir;
+    std::vector<std::vector<std::byte>> data;
+    size_t total = 0;
+
+    for (size_t seq = 0; seq < batches; seq++)
+    {
+        data.push_back(make_batch({ "batch " + std::to_string(seq), std::string(seq * 100, 'a' + seq) }));
+        total += data.back().size();
+    }
+
+    {
+        // one compressing thread takes at most 4 jobs
+        CompressedWriter writer({ dir.path, false, 1 }, 1);
+        for (size_t seq = 0; seq < batches; seq++)
+            BOOST_CHECK_EQUAL(writer.reserve(), seq);
+
+        // later batches take every job, the first one still gets in
+        for (size_t seq = 1; seq < 5; seq++)
+            writer.write(seq, Batch(data[seq]));
+        writer.write(0, Batch(data[0]));
+
+        // the rest arrive in reverse order from own threads
+        std::vector<std::thread> threads;
+        for (size_t seq = batches - 1; seq >= 5; seq--)
+            threads.emplace_back([&writer, &data, seq]() { writer.write(seq, Batch(data[seq])); });
+        for (auto & thread : threads)
+            thread.join();
+
+        writer.close();
+        BOOST_CHECK_EQUAL(writer.raw_bytes(), total);
+    }
+
+    auto segment = read_file(dir.path + "/memqueue_zseg_0");
+    auto index   = read_file(dir.path + "/memqueue_zseg_0.idx");
+    BOOST_REQUIRE_EQUAL(index.size(), batches * sizeof(FrameIndexEntry));
+
+    size_t offset = 0;
+    std::vector<std::byte> decoded;
+    for (size_t seq = 0; seq < batches; seq++)
+    {
+        FrameIndexEntry record;
+        memcpy(&record, index.data() + seq * sizeof(record), sizeof(record));
+        BOOST_CHECK_EQUAL(record.seq, seq);
+        BOOST_CHECK_EQUAL(record.offset, offset);
+        BOOST_CHECK_EQUAL(record.raw_length, data[seq].size());
+
+        decode_frame(std::span<const std::byte>(segment.data() + record.offset, record.length), decoded);
+        BOOST_CHECK(decoded == data[seq]);
+        offset += record.length;
+    }
+    BOOST_CHECK_EQUAL(offset, segment.size());
+
+    // numbers continue after restart
+    CompressedWriter writer({ dir.path, false, 1 }, 1);
+    BOOST_CHECK_EQUAL(writer.reserve(), batches);
+    writer.write(batches, Batch(data[0]));
+    writer.close();
+}
+
+BOOST_AUTO_TEST_CASE(StripedWriterManifestTest)
+{
+    TempDir first;
+    TempDir second;
+    std::vector<std::string> dirs = { first.path, second.path };
+    std::vector<std::vector<std::byte>> data;
+
+    for (size_t seq = 0; seq < 10; seq++)
+        data.push_back(make_batch({ "batch " + std::to_string(seq), std::string(seq * 10, 'a' + seq) }));
+
+    auto check = [&dirs, &data](size_t count)
+    {
+        auto records = StripedWriter::read_manifests(dirs);
+        BOOST_REQUIRE_EQUAL(records.size(), count);
+
+        for (size_t seq = 0; seq < count; seq++)
+        {
+            auto & entry = records[seq].entry;
+            BOOST_CHECK_EQUAL(entry.seq, seq);
+            BOOST_REQUIRE_EQUAL(entry.length, data[seq].size());
+
+            auto segment = read_file(dirs[records[seq].target] + "/memqueue_seg_" + std::to_string(entry.segment));
+            BOOST_REQUIRE(entry.offset + entry.length <= segment.size());
+            BOOST_CHECK(std::equal(data[seq].begin(), data[seq].end(), segment.begin() + entry.offset));
+        }
+    };
+
+    {
+        StripedWriter writer({ OutputDir::parse(first.path), OutputDir::parse(second.path) }, StripedWriter::Policy::round_robin);
+        for (size_t seq = 0; seq < 6; seq++)
+            writer.write(writer.reserve(), Batch(data[seq]));
+        writer.close();
+        BOOST_CHECK(writer.bytes(0) != 0 && writer.bytes(1) != 0);
+    }
+    check(6);
+
+    // crash in the middle of record
+    {
+        std::ofstream manifest(first.path + "/memqueue_manifest", std::ios::binary | std::ios::app);
+        manifest.write("torn", 4);
+    }
+    check(6);
+
+    // numbers continue, records appended after the torn one are read
+    {
+        StripedWriter writer({ OutputDir::parse(first.path), OutputDir::parse(second.path) }, StripedWriter::Policy::round_robin);
+        for (size_t seq = 6; seq < 10; seq++)
+        {
+            uint64_t reserved = writer.reserve();
+            BOOST_CHECK_EQUAL(reserved, seq);
+            writer.write(reserved, Batch(data[seq]));
+        }
+        writer.close();
+    }
+    check(10);
+    BOOST_CHECK_EQUAL(std::filesystem::file_size(first.path + "/memqueue_manifest") % sizeof(ManifestEntry), 0);
+}
+
+BOOST_AUTO_TEST_CASE(WorkerPoolStealingTest)
+{
+    const size_t batches = 20;
+    TempDir dir;
+    ListSource hot;
+    ListSource idle;
+    GateSource gate(hot);
+
+    for (size_t seq = 0; seq < batches; seq++)
+        hot.push(make_batch({ std::to_string(seq * 2), std::to_string(seq * 2 + 1) }));
+
+    // worker 0 owns the hot source and the gate, worker 1 has nothing but steals
+    WorkerPool pool({ &hot, &idle, &gate }, 2, OutputDir::parse(dir.path), {}, { microseconds(0), microseconds(100), seconds(10), milliseconds(10) });
+    std::atomic_bool stop{false};
+    std::thread runner([&pool, &stop]() { pool.run(stop); });
+
+    for (int attempt = 0; attempt < 5000 && hot.remaining() != 0; attempt++)
+        std::this_thread::sleep_for(milliseconds(1));
+    // batch which was read is written before worker checks stop
+    stop = true;
+    runner.join();
+
+    BOOST_CHECK_EQUAL(hot.remaining(), 0);
+    BOOST_CHECK(pool.stats(0).stolen + pool.stats(1).stolen != 0);
+
+    std::vector<std::string> all;
+    for (size_t worker = 0; worker < 2; worker++)
+    {
+        auto messages = read_segments(dir.path + "/memqueue_seg_" + std::to_string(worker) + "_");
+        BOOST_CHECK_EQUAL(messages.size(), pool.stats(worker).batches * 2);
+        BOOST_CHECK(messages.empty() == false);
+
+        // batches of a worker follow order of source
+        for (size_t index = 1; index < messages.size(); index++)
+            BOOST_CHECK(std::stoi(messages[index - 1]) < std::stoi(messages[index]));
+        all.insert(all.end(), messages.begin(), messages.end());
+    }
+
+    std::sort(all.begin(), all.end(), [](const std::string & left, const std::string & right) { return std::stoi(left) < std::stoi(right); });
+    BOOST_REQUIRE_EQUAL(all.size(), batches * 2);
+    for (size_t index = 0; index < all.size(); index++)
+        BOOST_CHECK_EQUAL(all[index], std::to_string(index));
+}
+
+BOOST_AUTO_TEST_CASE(SegmentWriterDirectTest)
+{
+    TempDir dir;
+    BufferPool pool(1, 64 << 10);
+    std::vector<std::vector<std::byte>> data;
+    std::vector<std::byte> expected;
+
+    for (size_t index = 0; index < 3; index++)
+    {
+        data.push_back(make_batch({ std::string(33333, 'a' + index) }));
+        expected.insert(expected.end(), data.back().begin(), data.back().end());
+    }
+
+    {
+        SegmentWriter writer(dir.path + "/memqueue_seg_", 64 << 20, &pool);
+        BOOST_CHECK(pool.acquire() == nullptr);
+
+        for (auto & batch : data)
+            writer.write(Batch(batch));
+
+        // only whole buffers reach the file while segment is open
+        BOOST_CHECK_EQUAL(std::filesystem::file_size(dir.path + "/memqueue_seg_0"), 64 << 10);
+        BOOST_CHECK_EQUAL(writer.segment_bytes(), expected.size());
+
+        // tail is padded to a block for O_DIRECT and the padding is cut off
+        writer.close();
+        BOOST_CHECK_EQUAL(std::filesystem::file_size(dir.path + "/memqueue_seg_0"), expected.size());
+        BOOST_CHECK(read_file(dir.path + "/memqueue_seg_0") == expected);
+
+        // segment opened after close continues after the tail
+        writer.write(Batch(data[0]));
+        writer.close();
+        BOOST_CHECK(read_file(dir.path + "/memqueue_seg_1") == data[0]);
+    }
+
+    // buffer is given back with writer
+    std::byte * buffer = pool.acquire();
+    BOOST_CHECK(buffer != nullptr);
+    pool.release(buffer);
+
+    // a segment is rotated after it reaches its size, each one is cut to its batches
+    {
+        SegmentWriter writer(dir.path + "/memqueue_rot_", 50000, &pool);
+        for (auto & batch : data)
+            writer.write(Batch(batch));
+        writer.close();
+    }
+    BOOST_CHECK_EQUAL(std::filesystem::file_size(dir.path + "/memqueue_rot_0"), data[0].size() + data[1].size());
+    BOOST_CHECK(read_file(dir.path + "/memqueue_rot_1") == data[2]);
+}
+
+BOOST_AUTO_TEST_CASE(MessageIndexSearchTest)
+{
+    TempDir dir;
+    const std::string file_name = dir.path + "/memqueue_index";
+
+    {
+        MessageIndex index(file_name, 4);
+        for (uint64_t seq = 0; seq <= 20; seq++)
+            index.add(seq, 1000 * seq);
+        // record going backwards by number or time is skipped
+        index.add(16, 30000);
+        index.add(24, 19000);
+    }
+
+    // crash in the middle of record, it is overwritten, stride is kept
+    {
+        std::ofstream file(file_name, std::ios::binary | std::ios::app);
+        file.write("torn", 4);
+    }
+    {
+        MessageIndex index(file_name, 8);
+        BOOST_CHECK_EQUAL(index.stride(), 4);
+        index.add(24, 24000);
+    }
+
+    MessageIndexView view(file_name);
+    BOOST_CHECK_EQUAL(view.stride(), 4);
+    BOOST_REQUIRE_EQUAL(view.records().size(), 7);
+    for (size_t record = 0; record < view.records().size(); record++)
+    {
+        BOOST_CHECK_EQUAL(view.records()[record].seq, record * 4);
+        BOOST_CHECK_EQUAL(view.records()[record].time_ns, record * 4000);
+    }
+
+    // search starts at the last record before time and ends at the first one after it
+    BOOST_CHECK_EQUAL(view.seq_before(0), 0);
+    BOOST_CHECK_EQUAL(view.seq_before(8000), 4);
+    BOOST_CHECK_EQUAL(view.seq_before(9000), 8);
+    BOOST_CHECK_EQUAL(view.seq_before(100000), 24);
+    BOOST_CHECK_EQUAL(view.seq_after(9000), 12);
+    BOOST_CHECK_EQUAL(view.seq_after(12000), 16);
+    BOOST_CHECK_EQUAL(view.seq_after(24000), UINT64_MAX);
+
+    // range of memqueue_cat: time narrows numbers, numbers given by user narrow it more
+    BOOST_CHECK(view.narrow(0, UINT64_MAX, 9000, 14500) == std::make_pair(uint64_t(8), uint64_t(16)));
+    BOOST_CHECK(view.narrow(10, 13, 9000, 14500) == std::make_pair(uint64_t(10), uint64_t(13)));
+    BOOST_CHECK(view.narrow(0, UINT64_MAX, 0, UINT64_MAX) == std::make_pair(uint64_t(0), UINT64_MAX));
+    BOOST_CHECK(view.narrow(0, UINT64_MAX, 30000, UINT64_MAX) == std::make_pair(uint64_t(24), UINT64_MAX));
+}
+
+BOOST_AUTO_TEST_CASE(MessageIndexRebuildTest)
+{
+    TempDir dir;
+    const uint64_t base_ns = 1700000000ULL * 1000000000ULL;
+
+    // message 8 is stamped before message 4, its record would go backwards
+    for (uint64_t seq = 0; seq < 20; seq++)
+    {
+        auto file_name = dir.path + "/memqueue_elem_" + std::to_string(seq);
+        std::ofstream(file_name) << seq;
+
+        uint64_t time_ns = base_ns + (seq == 8 ? 3 : seq) * 1000000000ULL;
+        struct timespec times[2] = { { 0, UTIME_OMIT }, { time_t(time_ns / 1000000000ULL), long(time_ns % 1000000000ULL) } };
+        BOOST_REQUIRE_EQUAL(utimensat(AT_FDCWD, file_name.c_str(), times, 0), 0);
+    }
+    std::ofstream(dir.path + "/memqueue_elem_x") << "not a message";
+
+    BOOST_CHECK_EQUAL(MessageIndex::rebuild(dir.path, 4), 4);
+
+    MessageIndexView view(dir.path + "/memqueue_index");
+    BOOST_CHECK_EQUAL(view.stride(), 4);
+    BOOST_REQUIRE_EQUAL(view.records().size(), 4);
+
+    std::vector<uint64_t> seqs = { 0, 4, 12, 16 };
+    for (size_t record = 0; record < seqs.size(); record++)
+    {
+        BOOST_CHECK_EQUAL(view.records()[record].seq, seqs[record]);
+        BOOST_CHECK_EQUAL(view.records()[record].time_ns, base_ns + seqs[record] * 1000000000ULL);
+    }
+
+    BOOST_CHECK(view.narrow(0, UINT64_MAX, base_ns + 5000000000ULL, base_ns + 12000000000ULL) == std::make_pair(uint64_t(4), uint64_t(16)));
+
+    // daemon appends to rebuilt index
+    {
+        MessageIndex index(dir.path + "/memqueue_index");
+        index.add(20, base_ns + 20000000000ULL);
+    }
+    MessageIndexView appended(dir.path + "/memqueue_index");
+    BOOST_CHECK_EQUAL(appended.records().size(), 5);
+}
+
+BOOST_AUTO_TEST_CASE(ShmRingTest)
+{
+    TempRing temp;
+    ShmRing producer(temp.name, 5000);
+    // the second process attaches to the ring of the size it was created with
+    ShmRing consumer(temp.name, 64 << 20);
+    std::vector<std::byte> buffer(1024);
+
+    BOOST_CHECK_EQUAL(producer.size(), 8192);
+    BOOST_CHECK_EQUAL(consumer.size(), 8192);
+    BOOST_CHECK_EQUAL(consumer.read_batch(buffer), 0);
+    BOOST_CHECK_THROW(producer.try_push(std::vector<std::byte>(4096)), std::runtime_error);
+
+    // producer which finds the ring drained wakes consumer, the next one doesn't
+    BOOST_CHECK(producer.try_push(as_bytes("first")));
+    BOOST_CHECK(readable(consumer.notify_fd()));
+    consumer.clear_notify();
+    BOOST_CHECK(producer.try_push(as_bytes("second")));
+    BOOST_CHECK(readable(consumer.notify_fd()) == false);
+
+    size_t length = consumer.read_batch(buffer);
+    BOOST_CHECK_EQUAL(length, 2 * sizeof(size_t) + 11);
+    BOOST_CHECK(batch_messages(buffer, length) == std::vector<std::string>({ "first", "second" }));
+
+    // full ring refuses messages until consumer reads them
+    size_t pushed = 0;
+    while (producer.try_push(std::vector<std::byte>(1000, std::byte(pushed))))
+        pushed++;
+    BOOST_CHECK_EQUAL(pushed, 8);
+
+    // batch holds whole messages which fit into buffer, small buffer is grown
+    std::vector<std::byte> small(16);
+    std::vector<std::string> messages;
+    length = consumer.read_batch(small);
+    BOOST_CHECK_EQUAL(length, 1000 + sizeof(size_t));
+    messages = batch_messages(small, length);
+    length = consumer.read_batch(buffer);
+    BOOST_CHECK_EQUAL(length, 1000 + sizeof(size_t));
+    auto batch = batch_messages(buffer, length);
+    messages.insert(messages.end(), batch.begin(), batch.end());
+    BOOST_CHECK(producer.try_push(as_bytes("after")));
+
+    std::vector<std::byte> large(16 << 10);
+    while ((length = consumer.read_batch(large)) != 0)
+    {
+        batch = batch_messages(large, length);
+        messages.insert(messages.end(), batch.begin(), batch.end());
+    }
+    BOOST_REQUIRE_EQUAL(messages.size(), 9);
+    for (size_t index = 0; index < 8; index++)
+        BOOST_CHECK(messages[index] == std::string(1000, char(index)));
+    BOOST_CHECK(messages[8] == "after");
+
+    // messages of every size cross the end of ring in order
+    std::string expected;
+    std::string received;
+    for (size_t index = 0; index < 2000; index++)
+    {
+        std::string message(index % 301, char('a' + index % 26));
+        while (producer.try_push(as_bytes(message)) == false)
+        {
+            length = consumer.read_batch(large);
+            for (auto & text : batch_messages(large, length))
+                received += text + "|";
+        }
+        expected += message + "|";
+    }
+    while ((length = consumer.read_batch(large)) != 0)
+    {
+        for (auto & text : batch_messages(large, length))
+            received += text + "|";
+    }
+    BOOST_CHECK(received == expected);
+}
+
+BOOST_AUTO_TEST_CASE(ShmSourceTest)
+{
+    TempRing temp;
+
+    BOOST_CHECK_THROW(open_source("shm:" + temp.name, 1), std::runtime_error);
+    BOOST_CHECK_THROW(open_source("shm:a/b"), std::invalid_argument);
+
+    auto source = open_source("shm:" + temp.name);
+    std::vector<std::byte> buffer(1024);
+
+    // ring has one consumer
+    BOOST_CHECK_THROW(open_source("shm:" + temp.name), std::runtime_error);
+
+    ShmRing producer(temp.name);
+    BOOST_CHECK_EQUAL(producer.size(), 64 << 20);
+    BOOST_CHECK(producer.try_push(as_bytes("one")));
+    BOOST_CHECK(producer.try_push(as_bytes("two")));
+
+    BOOST_CHECK(readable(source->fd()));
+    source->clear_notify();
+    BOOST_CHECK(readable(source->fd()) == false);
+
+    size_t length = source->read_batch(buffer);
+    BOOST_CHECK(batch_messages(buffer, length) == std::vector<std::string>({ "one", "two" }));
+    BOOST_CHECK_EQUAL(source->read_batch(buffer), 0);
+
+    // messages left by stopped consumer are read by the next one
+    BOOST_CHECK(producer.try_push(as_bytes("three")));
+    source.reset();
+    source = open_source("shm:" + temp.name);
+    length = source->read_batch(buffer);
+    BOOST_CHECK(batch_messages(buffer, length) == std::vector<std::string>({ "three" }));
+}
+
+BOOST_AUTO_TEST_CASE(MemorySourceTest)
+{
+    memqueue_params params = {};
+    params.queue_size = 1 << 20;
+    auto queue = memqueue::Queue::memory(params);
+    int notify = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    BOOST_REQUIRE(notify != -1);
+
+    MemorySource source(queue, notify);
+    std::vector<std::byte> buffer(16);
+    BOOST_CHECK_EQUAL(source.fd(), notify);
+    BOOST_CHECK_EQUAL(source.read_batch(buffer), 0);
+
+    for (size_t index = 0; index < 100; index++)
+        BOOST_REQUIRE(queue.try_push(as_bytes(std::to_string(index))));
+    eventfd_write(notify, 1);
+
+    BOOST_CHECK(readable(source.fd()));
+    source.clear_notify();
+    BOOST_CHECK(readable(source.fd()) == false);
+
+    // batch holds up to 64 messages, buffer grows for them
+    size_t length = source.read_batch(buffer);
+    auto messages = batch_messages(buffer, length);
+    BOOST_REQUIRE_EQUAL(messages.size(), 64);
+    length = source.read_batch(buffer);
+    auto rest = batch_messages(buffer, length);
+    BOOST_REQUIRE_EQUAL(rest.size(), 36);
+    messages.insert(messages.end(), rest.begin(), rest.end());
+    for (size_t index = 0; index < messages.size(); index++)
+        BOOST_CHECK_EQUAL(messages[index], std::to_string(index));
+    BOOST_CHECK_EQUAL(source.read_batch(buffer), 0);
+
+    // source without descriptor isn't notified
+    MemorySource polled(queue);
+    BOOST_CHECK_EQUAL(polled.fd(), -1);
+    polled.clear_notify();
+
+    close(notify);
+}
+
+
+static Task wake_on(EventLoop & loop, int fd, int next_fd, std::string name, std::vector<std::string> & order)
+{
+    order.push_back(name + " started");
+    co_await loop.readable(fd);
+    eventfd_t value = 0;
+    eventfd_read(fd, &value);
+    order.push_back(name + " woken");
+    if (next_fd != -1)
+        eventfd_write(next_fd, 1);
+}
+
+static Task fail_on(EventLoop & loop, int fd)
+{
+    co_await loop.readable(fd);
+    throw std::runtime_error("failed");
+}
+
+static Task drain(AsyncQueue & queue, size_t count, std::vector<std::string> & messages)
+{
+    while (messages.size() < count)
+    {
+        auto batch = co_await queue.next_batch();
+        for (auto message : batch)
+            messages.emplace_back(reinterpret_cast<const char *>(message.data()), message.size());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(EventLoopReadableTest)
+{
+    int first = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int second = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    BOOST_REQUIRE(first != -1 && second != -1);
+
+    // tasks start in spawn order, then wake in order of their descriptors
+    std::vector<std::string> order;
+    std::atomic_bool stop = false;
+    EventLoop loop;
+    loop.spawn(wake_on(loop, first, -1, "first", order));
+    loop.spawn(wake_on(loop, second, first, "second", order));
+    eventfd_write(second, 1);
+    loop.run(stop);
+
+    BOOST_CHECK(order == std::vector<std::string>({ "first started", "second started", "second woken", "first woken" }));
+
+    // exception of coroutine is rethrown by the loop
+    loop.spawn(fail_on(loop, first));
+    eventfd_write(first, 1);
+    BOOST_CHECK_THROW(loop.run(stop), std::runtime_error);
+
+    close(first);
+    close(second);
+}
+
+BOOST_AUTO_TEST_CASE(EventLoopStopTest)
+{
+    int never = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    BOOST_REQUIRE(never != -1);
+
+    std::vector<std::string> order;
+    std::atomic_bool stop = true;
+    {
+        // stopped loop doesn't start coroutines
+        EventLoop loop;
+        loop.spawn(wake_on(loop, never, -1, "never", order));
+        loop.run(stop);
+        BOOST_CHECK(order.empty());
+    }
+
+    // waiting coroutine is left suspended when stop is set and destroyed with the loop
+    stop = false;
+    {
+        EventLoop loop;
+        loop.spawn(wake_on(loop, never, -1, "never", order));
+        std::thread stopper([&stop]
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            stop = true;
+        });
+        loop.run(stop, 10);
+        stopper.join();
+        BOOST_CHECK(order == std::vector<std::string>({ "never started" }));
+    }
+
+    close(never);
+}
+
+BOOST_AUTO_TEST_CASE(AsyncQueueTest)
+{
+    memqueue_params params = {};
+    params.queue_size = 1 << 20;
+    auto queue = memqueue::Queue::memory(params);
+    int notify = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    BOOST_REQUIRE(notify != -1);
+
+    auto produce = [&queue](size_t from, size_t count, int notify_fd)
+    {
+        for (size_t index = from; index < from + count; index++)
+        {
+            while (queue.try_push(as_bytes(std::to_string(index))) == false)
+                std::this_thread::yield();
+            if (notify_fd != -1)
+                eventfd_write(notify_fd, 1);
+        }
+    };
+
+    // notified source, first wake up is spurious as queue is empty
+    std::atomic_bool stop = false;
+    std::vector<std::string> messages;
+    {
+        MemorySource source(queue, notify);
+        EventLoop loop;
+        AsyncQueue async(loop, source);
+        loop.spawn(drain(async, 200, messages));
+        eventfd_write(notify, 1);
+        std::thread producer(produce, 0, 200, notify);
+        loop.run(stop);
+        producer.join();
+    }
+
+    // source without descriptor is polled
+    {
+        MemorySource source(queue);
+        EventLoop loop;
+        AsyncQueue async(loop, source);
+        loop.spawn(drain(async, 400, messages));
+        std::thread producer(produce, 200, 200, -1);
+        loop.run(stop);
+        producer.join();
+    }
+
+    BOOST_REQUIRE_EQUAL(messages.size(), 400);
+    for (size_t index = 0; index < messages.size(); index++)
+        BOOST_CHECK_EQUAL(messages[index], std::to_string(index));
+
+    close(notify);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
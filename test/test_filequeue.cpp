@@ -5,11 +5,15 @@
 #define BOOST_TEST_MODULE FileQueueTestModule
 #include <boost/test/included/unit_test.hpp>
 #include <string>
+#include <array>
 #include <list>
 #include <stack>
+#include <vector>
 #include <stdio.h>
+#include <sys/stat.h>
 
 #include "../include/file_queue.h"
+#include "../include/queue.h"
 
 static const char * path = "/var/tmp/filequeue";
 
@@ -211,4 +215,122 @@ BOOST_AUTO_TEST_CASE(FileQueueWriteReadMaxPlusTest)
     remove(path);
 }
 
+BOOST_AUTO_TEST_CASE(FileQueueSparseTest)
+{
+    const size_t chunk_size  = 2 << 20;
+    const size_t queue_size  = 4 * chunk_size;
+    const size_t buffer_size = chunk_size;
+    std::vector<char> r_buffer(buffer_size);
+    std::vector<char> w_buffer(buffer_size, 'a');
+    struct stat st;
+
+    remove(path);
+    auto result = filequeue_open_flags(path, queue_size, FILEQUEUE_SPARSE);
+    BOOST_CHECK_EQUAL(result, 0);
+
+    BOOST_CHECK_EQUAL(stat(path, &st), 0);
+    BOOST_CHECK(size_t(st.st_blocks) * 512 < chunk_size);
+
+    for (auto i = 0; i < 10; i++)
+    {
+        auto n_bytes = filequeue_write(w_buffer.data(), buffer_size);
+        BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+
+        r_buffer.assign(buffer_size, 0);
+        n_bytes = filequeue_read(r_buffer.data(), buffer_size);
+        BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+        BOOST_TEST(r_buffer == w_buffer);
+    }
+
+    // only chunks around positions keep their blocks
+    BOOST_CHECK_EQUAL(stat(path, &st), 0);
+    BOOST_CHECK(size_t(st.st_blocks) * 512 <= 2 * chunk_size + 4096);
+
+    filequeue_close();
+    remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(FileQueueStreamingReadTest)
+{
+    const size_t queue_size   = 100000;
+    const size_t message_size = 10000;
+    const size_t part_size    = 3000;
+    std::vector<char> w_buffer(message_size);
+    std::vector<char> r_buffer;
+    std::vector<char> part(part_size);
+    size_t left = 0;
+
+    for (size_t i = 0; i < message_size; i++)
+        w_buffer[i] = char(i % 251);
+
+    remove(path);
+    auto result = filequeue_open(path, queue_size);
+    BOOST_CHECK_EQUAL(result, 0);
+
+    BOOST_CHECK_EQUAL(filequeue_next_length(), 0);
+
+    // messages wrap around the end of queue
+    for (auto i = 0; i < 30; i++)
+    {
+        auto n_bytes = filequeue_write(w_buffer.data(), message_size);
+        BOOST_CHECK_EQUAL(n_bytes, message_size);
+
+        BOOST_CHECK_EQUAL(filequeue_next_length(), message_size);
+
+        r_buffer.clear();
+        do
+        {
+            n_bytes = filequeue_read_part(part.data(), part_size, &left);
+            BOOST_CHECK(n_bytes > 0);
+            r_buffer.insert(r_buffer.end(), part.begin(), part.begin() + n_bytes);
+            if (left)
+                BOOST_CHECK_EQUAL(filequeue_next_length(), left);
+        }
+        while (left);
+
+        BOOST_TEST(r_buffer == w_buffer);
+    }
+
+    BOOST_CHECK_EQUAL(filequeue_read(part.data(), part_size), 0);
+
+    filequeue_close();
+    remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(FileQueueInstanceTest)
+{
+    const char * path_second = "/var/tmp/filequeue_second";
+    std::string text = "message";
+    auto message = std::as_bytes(std::span<const char>(text.data(), text.size()));
+    size_t count = 0;
+    auto check = [&text, &count](std::span<const std::byte> data)
+    {
+        BOOST_CHECK_EQUAL(std::string(reinterpret_cast<const char *>(data.data()), data.size()), text);
+        count++;
+    };
+
+    remove(path);
+    remove(path_second);
+    {
+        memqueue::Queue first  = memqueue::Queue::file(path, 1000);
+        memqueue::Queue second = memqueue::Queue::file(path_second, 1000);
+
+        for (auto i = 0; i < 3; i++)
+            BOOST_CHECK(first.try_push(message));
+        BOOST_CHECK(second.consume(check) == false);
+        BOOST_CHECK(first.consume(check));
+    }
+    {
+        // positions are kept in file by destructor
+        memqueue::Queue first = memqueue::Queue::file(path, 1000);
+        BOOST_CHECK_EQUAL(first.consume_batch(check, 10), 2);
+        BOOST_CHECK_EQUAL(count, 3);
+    }
+    // size of existing file differs
+    BOOST_CHECK_THROW(memqueue::Queue::file(path, 2000), std::system_error);
+
+    remove(path);
+    remove(path_second);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -5,10 +5,20 @@
 #define BOOST_TEST_MODULE MemQueueTestModule
 #include <boost/test/included/unit_test.hpp>
 #include <string>
+#include <array>
 #include <list>
 #include <stack>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
 
 #include "../include/mem_queue.h"
+#include "../include/mem_copy.h"
+#include "../include/timer_wheel.h"
+#include "../include/fixed_ring.h"
+#include "../include/queue.h"
 
 BOOST_AUTO_TEST_SUITE(MemQueueTest)
 
@@ -169,4 +179,1083 @@ BOOST_AUTO_TEST_CASE(MemQueueWriteReadMaxPlusTest)
     memqueue_close();
 }
 
+BOOST_AUTO_TEST_CASE(MemQueueLazyAllocTest)
+{
+    const size_t chunk_size  = 2 << 20;
+    const size_t queue_size  = 4 * chunk_size;
+    const size_t buffer_size = chunk_size / 2;
+    std::vector<char> r_buffer(buffer_size);
+    std::vector<char> w_buffer(buffer_size, 'a');
+    memqueue_stats stats;
+
+    memqueue_params params = { queue_size, 0, 0 };
+    auto result = memqueue_open_params(&params);
+    BOOST_CHECK_EQUAL(result, 0);
+    memqueue_get_stats(&stats);
+    BOOST_CHECK_EQUAL(stats.chunks_total, 4);
+    BOOST_CHECK_EQUAL(stats.chunks_resident, 4);
+    memqueue_close();
+
+    params.flags = MEMQUEUE_LAZY_ALLOC;
+    result = memqueue_open_params(&params);
+    BOOST_CHECK_EQUAL(result, 0);
+    memqueue_get_stats(&stats);
+    BOOST_CHECK_EQUAL(stats.chunks_resident, 0);
+    BOOST_CHECK_EQUAL(stats.resident_bytes, 0);
+
+    auto n_bytes = memqueue_write(w_buffer.data(), buffer_size);
+    BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+    memqueue_get_stats(&stats);
+    BOOST_CHECK_EQUAL(stats.chunks_resident, 1);
+
+    // second message crosses chunk boundary
+    n_bytes = memqueue_write(w_buffer.data(), buffer_size);
+    BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+    memqueue_get_stats(&stats);
+    BOOST_CHECK_EQUAL(stats.chunks_resident, 2);
+
+    for (auto i = 0; i < 2; i++)
+    {
+        n_bytes = memqueue_read(r_buffer.data(), buffer_size);
+        BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+        BOOST_TEST(r_buffer == w_buffer);
+    }
+
+    memqueue_close();
+}
+
+BOOST_AUTO_TEST_CASE(MemQueueReleaseIdleTest)
+{
+    const size_t chunk_size  = 2 << 20;
+    const size_t queue_size  = 4 * chunk_size;
+    const size_t buffer_size = chunk_size - 100;
+    std::vector<char> r_buffer(buffer_size);
+    std::vector<char> w_buffer(buffer_size, 'a');
+    memqueue_stats stats;
+
+    memqueue_params params = { queue_size, MEMQUEUE_LAZY_ALLOC, 10 };
+    auto result = memqueue_open_params(&params);
+    BOOST_CHECK_EQUAL(result, 0);
+
+    for (auto i = 0; i < 3; i++)
+    {
+        auto n_bytes = memqueue_write(w_buffer.data(), buffer_size);
+        BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+        n_bytes = memqueue_read(r_buffer.data(), buffer_size);
+        BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+    }
+    memqueue_get_stats(&stats);
+    BOOST_CHECK_EQUAL(stats.chunks_resident, 3);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // chunks passed by reader are released, the one with positions is kept
+    auto n_bytes = memqueue_write(w_buffer.data(), 1);
+    BOOST_CHECK_EQUAL(n_bytes, 1);
+    memqueue_get_stats(&stats);
+    BOOST_CHECK_EQUAL(stats.chunks_resident, 1);
+
+    n_bytes = memqueue_read(r_buffer.data(), buffer_size);
+    BOOST_CHECK_EQUAL(n_bytes, 1);
+
+    // released memory is populated again when writer comes back
+    for (auto i = 0; i < 4; i++)
+    {
+        n_bytes = memqueue_write(w_buffer.data(), buffer_size);
+        BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+        r_buffer.assign(buffer_size, 0);
+        n_bytes = memqueue_read(r_buffer.data(), buffer_size);
+        BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+        BOOST_TEST(r_buffer == w_buffer);
+    }
+
+    memqueue_close();
+}
+
+BOOST_AUTO_TEST_CASE(MemQueueHugePagesTest)
+{
+    const size_t chunk_size  = 2 << 20;
+    const size_t queue_size  = 2 * chunk_size + 1000;
+    const size_t buffer_size = chunk_size / 3;
+    std::vector<char> r_buffer(buffer_size);
+    std::vector<char> w_buffer(buffer_size, 'a');
+    memqueue_stats stats;
+
+    // huge pages may be unavailable, queue has to work anyway
+    memqueue_params params = { queue_size, MEMQUEUE_HUGEPAGES, 0 };
+    auto result = memqueue_open_params(&params);
+    BOOST_CHECK_EQUAL(result, 0);
+    memqueue_get_stats(&stats);
+    BOOST_CHECK_EQUAL(stats.chunks_resident, 3);
+    BOOST_CHECK(stats.chunks_huge <= 2);
+
+    for (auto i = 0; i < 100; i++)
+    {
+        auto n_bytes = memqueue_write(w_buffer.data(), buffer_size);
+        BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+
+        r_buffer.assign(buffer_size, 0);
+        n_bytes = memqueue_read(r_buffer.data(), buffer_size);
+        BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+        BOOST_TEST(r_buffer == w_buffer);
+    }
+
+    memqueue_close();
+}
+
+BOOST_AUTO_TEST_CASE(MemQueueShardedTest)
+{
+    const size_t shards      = 4;
+    const size_t queue_size  = shards * 1000;
+    const size_t buffer_size = sizeof(int);
+    memqueue_stats stats;
+
+    for (unsigned int flags : { MEMQUEUE_SHARDED, MEMQUEUE_SHARDED | MEMQUEUE_SHARD_ORDERED })
+    {
+        memqueue_params params = { queue_size, flags, 0, shards };
+        auto result = memqueue_open_params(&params);
+        BOOST_CHECK_EQUAL(result, 0);
+        memqueue_get_stats(&stats);
+        BOOST_CHECK_EQUAL(stats.rings, shards);
+
+        // producer fills its own shard first and then spills into the others
+        int counter = 0;
+        while (memqueue_write((const char*)&counter, buffer_size) == buffer_size)
+            counter++;
+
+        size_t header_size = sizeof(size_t) + (flags & MEMQUEUE_SHARD_ORDERED ? sizeof(uint64_t) : 0);
+        BOOST_CHECK_EQUAL(counter, shards * ((queue_size / shards - 1) / (header_size + buffer_size)));
+
+        std::vector<int> values;
+        int value = 0;
+        while (memqueue_read((char*)&value, buffer_size) == buffer_size)
+            values.push_back(value);
+        BOOST_CHECK_EQUAL(values.size(), counter);
+
+        if ((flags & MEMQUEUE_SHARD_ORDERED) == 0)
+            std::sort(values.begin(), values.end());
+        for (int i = 0; i < counter; i++)
+            BOOST_CHECK_EQUAL(values[i], i);
+
+        memqueue_close();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MemQueueNumaNodeTest)
+{
+    const size_t queue_size  = 1000;
+    const size_t buffer_size = 100;
+    std::array<char, buffer_size> r_buffer;
+    std::array<char, buffer_size> w_buffer;
+
+    memqueue_params params = { queue_size, MEMQUEUE_NUMA_NODE, 0, 0, 1 << 20 };
+    auto result = memqueue_open_params(&params);
+    BOOST_CHECK_EQUAL(result, EINVAL);
+
+    // node 0 exists everywhere
+    params.numa_node = 0;
+    result = memqueue_open_params(&params);
+    BOOST_CHECK_EQUAL(result, 0);
+
+    w_buffer.fill('a');
+    auto n_bytes = memqueue_write(w_buffer.data(), buffer_size);
+    BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+
+    r_buffer.fill(0);
+    n_bytes = memqueue_read(r_buffer.data(), buffer_size);
+    BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+    BOOST_TEST(r_buffer == w_buffer);
+
+    memqueue_close();
+}
+
+BOOST_AUTO_TEST_CASE(MemCopyTest)
+{
+    const size_t max_size = 300000;
+    std::vector<char> from(max_size + 64);
+    std::vector<char> to(max_size + 64);
+
+    for (size_t i = 0; i < from.size(); i++)
+        from[i] = char(i * 7 + 3);
+
+    struct memcopy copy;
+    memcopy_init(&copy, 1024);
+
+    std::vector<size_t> sizes = { 0, 1, 3, 4, 7, 8, 15, 16, 31, 32, 33, 63, 64, 65, 1000, 1023, 1024, 4099, max_size };
+
+    for (size_t n : sizes)
+    {
+        for (size_t offset : { 0, 1, 13 })
+        {
+            std::fill(to.begin(), to.end(), 0);
+            BOOST_CHECK_EQUAL(memcopy_to_ring(&copy, to.data() + offset, from.data() + 5, n), 0);
+            BOOST_CHECK(std::equal(from.begin() + 5, from.begin() + 5 + n, to.begin() + offset));
+            BOOST_CHECK_EQUAL(to[offset + n], 0);
+
+            std::fill(to.begin(), to.end(), 0);
+            BOOST_CHECK_EQUAL(memcopy_from_ring(to.data() + offset, from.data() + 5, n), 0);
+            BOOST_CHECK(std::equal(from.begin() + 5, from.begin() + 5 + n, to.begin() + offset));
+            BOOST_CHECK_EQUAL(to[offset + n], 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MemQueueLargeMessagePrefetchTest)
+{
+    const size_t queue_size  = 1 << 20;
+    const size_t buffer_size = 200000;
+    std::vector<char> r_buffer(buffer_size);
+    std::vector<char> w_buffer(buffer_size);
+
+    for (size_t i = 0; i < buffer_size; i++)
+        w_buffer[i] = char(i);
+
+    // streamed stores for every message bigger than 4KB
+    memqueue_params params = { queue_size, MEMQUEUE_PREFETCH, 0, 0, 0, 4096 };
+    auto result = memqueue_open_params(&params);
+    BOOST_CHECK_EQUAL(result, 0);
+
+    for (auto i = 0; i < 100; i++)
+    {
+        auto n_bytes = memqueue_write(w_buffer.data(), buffer_size);
+        BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+        n_bytes = memqueue_write(w_buffer.data(), 1000);
+        BOOST_CHECK_EQUAL(n_bytes, 1000);
+
+        r_buffer.assign(buffer_size, 0);
+        n_bytes = memqueue_read(r_buffer.data(), buffer_size);
+        BOOST_CHECK_EQUAL(n_bytes, buffer_size);
+        BOOST_TEST(r_buffer == w_buffer);
+
+        n_bytes = memqueue_read(r_buffer.data(), buffer_size);
+        BOOST_CHECK_EQUAL(n_bytes, 1000);
+        BOOST_CHECK(std::equal(w_buffer.begin(), w_buffer.begin() + 1000, r_buffer.begin()));
+    }
+
+    memqueue_close();
+}
+
+BOOST_AUTO_TEST_CASE(MemQueueStreamingReadTest)
+{
+    const size_t shards      = 2;
+    const size_t queue_size  = shards * 100000;
+    const size_t message_size = 10000;
+    const size_t part_size   = 3000;
+    std::vector<char> w_buffer(message_size);
+    std::vector<char> r_buffer;
+    std::vector<char> part(part_size);
+    size_t left = 0;
+
+    for (size_t i = 0; i < message_size; i++)
+        w_buffer[i] = char(i % 251);
+
+    for (unsigned int flags : { 0, MEMQUEUE_SHARDED, MEMQUEUE_SHARDED | MEMQUEUE_SHARD_ORDERED })
+    {
+        memqueue_params params = { queue_size, flags, 0, shards };
+        auto result = memqueue_open_params(&params);
+        BOOST_CHECK_EQUAL(result, 0);
+
+        BOOST_CHECK_EQUAL(memqueue_next_length(), 0);
+
+        for (auto i = 0; i < 3; i++)
+        {
+            auto n_bytes = memqueue_write(w_buffer.data(), message_size);
+            BOOST_CHECK_EQUAL(n_bytes, message_size);
+        }
+
+        for (auto i = 0; i < 3; i++)
+        {
+            BOOST_CHECK_EQUAL(memqueue_next_length(), message_size);
+
+            // message is returned by parts, the last one is shorter
+            r_buffer.clear();
+            do
+            {
+                auto n_bytes = memqueue_read_part(part.data(), part_size, &left);
+                BOOST_CHECK(n_bytes > 0);
+                r_buffer.insert(r_buffer.end(), part.begin(), part.begin() + n_bytes);
+                if (left)
+                    BOOST_CHECK_EQUAL(memqueue_next_length(), left);
+            }
+            while (left);
+
+            BOOST_TEST(r_buffer == w_buffer);
+        }
+
+        BOOST_CHECK_EQUAL(memqueue_next_length(), 0);
+        BOOST_CHECK_EQUAL(memqueue_read(part.data(), part_size), 0);
+
+        memqueue_close();
+    }
+
+    BOOST_CHECK_EQUAL(memqueue_next_length(), -EBADF);
+}
+
+BOOST_AUTO_TEST_CASE(MemQueueConsumeProduceTest)
+{
+    const size_t chunk_size = 2 << 20;
+    const size_t shards     = 2;
+    const size_t queue_size = shards * 3 * chunk_size;
+    // message lengths are chosen to cross chunk boundaries
+    const std::vector<size_t> lengths = { 100, chunk_size + chunk_size / 2, 1, 5000, chunk_size };
+
+    auto fill = [](void * context, char * segment, size_t length) -> int
+    {
+        auto counter = static_cast<size_t*>(context);
+        for (size_t i = 0; i < length; i++)
+            segment[i] = char((*counter)++ % 251);
+        return 0;
+    };
+    auto fail = [](void *, char *, size_t) -> int { return -EFAULT; };
+    auto consume = [](void * context, const char * segment, size_t length, size_t offset, size_t message_length) -> int
+    {
+        auto batch = static_cast<std::vector<char>*>(context);
+        if (offset == 0)
+            batch->insert(batch->end(), (const char*)&message_length, (const char*)&message_length + sizeof(size_t));
+        batch->insert(batch->end(), segment, segment + length);
+        return 0;
+    };
+
+    for (unsigned int flags : { 0, MEMQUEUE_SHARDED })
+    {
+        memqueue_params params = { queue_size, flags, 0, shards };
+        auto result = memqueue_open_params(&params);
+        BOOST_CHECK_EQUAL(result, 0);
+
+        std::vector<char> batch;
+        BOOST_CHECK_EQUAL(memqueue_consume(consume, &batch, queue_size), 0);
+
+        size_t counter = 0;
+        for (auto length : lengths)
+        {
+            BOOST_CHECK_EQUAL(memqueue_produce(length, fill, &counter, 0), length);
+            // failed fill doesn't leave message in queue
+            BOOST_CHECK_EQUAL(memqueue_produce(length, fail, 0, 0), -EFAULT);
+        }
+
+        // batch doesn't fit the first message
+        BOOST_CHECK_EQUAL(memqueue_consume(consume, &batch, lengths[0] + sizeof(size_t) - 1), -EMSGSIZE);
+        BOOST_CHECK(batch.empty());
+
+        // batch takes two first messages only
+        auto n_bytes = memqueue_consume(consume, &batch, lengths[0] + lengths[1] + 2 * sizeof(size_t) + 5);
+        BOOST_CHECK_EQUAL(n_bytes, lengths[0] + lengths[1] + 2 * sizeof(size_t));
+
+        n_bytes = memqueue_consume(consume, &batch, queue_size);
+        BOOST_CHECK_EQUAL(n_bytes, lengths[2] + lengths[3] + lengths[4] + 3 * sizeof(size_t));
+        BOOST_CHECK_EQUAL(memqueue_next_length(), 0);
+
+        // every message is prefixed by its length and keeps its content
+        size_t pos = 0;
+        counter = 0;
+        for (auto length : lengths)
+        {
+            size_t prefix = 0;
+            memcpy(&prefix, batch.data() + pos, sizeof(size_t));
+            BOOST_CHECK_EQUAL(prefix, length);
+            pos += sizeof(size_t);
+
+            bool same = true;
+            for (size_t i = 0; i < length; i++)
+                same = same && batch[pos + i] == char(counter++ % 251);
+            BOOST_CHECK(same);
+            pos += length;
+        }
+        BOOST_CHECK_EQUAL(pos, batch.size());
+
+        memqueue_close();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MemQueuePartitionedTest)
+{
+    const unsigned int partitions = 4;
+    const size_t queue_size = partitions * 100000;
+    const int keys = 10;
+    const int messages = 1000;
+    struct record { int key; int seq; };
+    memqueue_depth depth;
+
+    memqueue_params params = { queue_size, MEMQUEUE_PARTITIONED, 0, 0 };
+    BOOST_CHECK_EQUAL(memqueue_open_params(&params), EINVAL);
+    params.partitions = MEMQUEUE_PARTITIONS_MAX + 1;
+    BOOST_CHECK_EQUAL(memqueue_open_params(&params), EINVAL);
+    params.partitions = partitions;
+    params.flags = MEMQUEUE_PARTITIONED | MEMQUEUE_SHARDED;
+    BOOST_CHECK_EQUAL(memqueue_open_params(&params), EINVAL);
+
+    params.flags = MEMQUEUE_PARTITIONED;
+    BOOST_CHECK_EQUAL(memqueue_open_params(&params), 0);
+
+    std::vector<size_t> expected(partitions);
+    for (int i = 0; i < messages; i++)
+    {
+        record value = { i % keys, i / keys };
+        memqueue_write_opts opts = { MEMQUEUE_WRITE_KEY, (unsigned long long)value.key };
+        BOOST_CHECK_EQUAL(memqueue_write_ex((const char*)&value, sizeof(value), &opts), sizeof(value));
+        expected[memqueue_key_partition(value.key)]++;
+    }
+
+    for (unsigned int index = 0; index < partitions; index++)
+    {
+        BOOST_CHECK_EQUAL(memqueue_get_depth(index, &depth), 0);
+        BOOST_CHECK_EQUAL(depth.messages, expected[index]);
+        BOOST_CHECK_EQUAL(depth.bytes, expected[index] * (sizeof(size_t) + sizeof(record)));
+    }
+    BOOST_CHECK_EQUAL(memqueue_get_depth(partitions, &depth), -EINVAL);
+
+    // reader of partition 0 gets only its keys, every key in order
+    std::vector<int> next_seq(keys);
+    record value;
+    size_t counter = 0;
+    while (memqueue_read_partitions((char*)&value, sizeof(value), 1, 0) == sizeof(value))
+    {
+        BOOST_CHECK_EQUAL(memqueue_key_partition(value.key), 0);
+        BOOST_CHECK_EQUAL(value.seq, next_seq[value.key]++);
+        counter++;
+    }
+    BOOST_CHECK_EQUAL(counter, expected[0]);
+
+    while (memqueue_read((char*)&value, sizeof(value)) == sizeof(value))
+    {
+        BOOST_CHECK_EQUAL(value.seq, next_seq[value.key]++);
+        counter++;
+    }
+    BOOST_CHECK_EQUAL(counter, messages);
+
+    memqueue_close();
+}
+
+BOOST_AUTO_TEST_CASE(MemQueuePartitionedParallelReadTest)
+{
+    const unsigned int partitions = 4;
+    const size_t queue_size = partitions * 10000;
+    const int keys = 16;
+    const int messages = 100000;
+    struct record { int key; int seq; };
+
+    memqueue_params params = { queue_size, MEMQUEUE_PARTITIONED, 0, 0 };
+    params.partitions = partitions;
+    BOOST_CHECK_EQUAL(memqueue_open_params(&params), 0);
+
+    std::atomic<int> received(0);
+    std::atomic<bool> order_kept(true);
+
+    // two readers drain disjoint partitions while producer writes
+    auto reader = [&](unsigned long long mask)
+    {
+        std::vector<int> next_seq(keys);
+        record value;
+        while (received < messages)
+        {
+            if (memqueue_read_partitions((char*)&value, sizeof(value), mask, 0) != sizeof(value))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            if ((mask & (1ULL << memqueue_key_partition(value.key))) == 0 || value.seq != next_seq[value.key]++)
+                order_kept = false;
+            received++;
+        }
+    };
+
+    std::thread reader_even(reader, 0x5ULL);
+    std::thread reader_odd(reader, 0xAULL);
+
+    for (int i = 0; i < messages; )
+    {
+        record value = { i % keys, i / keys };
+        memqueue_write_opts opts = { MEMQUEUE_WRITE_KEY, (unsigned long long)value.key };
+        if (memqueue_write_ex((const char*)&value, sizeof(value), &opts) == sizeof(value))
+            i++;
+        else
+            std::this_thread::yield();
+    }
+
+    reader_even.join();
+    reader_odd.join();
+
+    BOOST_CHECK_EQUAL(received, messages);
+    BOOST_CHECK(order_kept);
+
+    memqueue_close();
+}
+
+BOOST_AUTO_TEST_CASE(MemQueuePriorityLanesTest)
+{
+    const size_t queue_size = 100000;
+    const size_t lane_size  = 1000;
+    struct record { int lane; int seq; };
+    record value;
+
+    memqueue_params params = { queue_size, MEMQUEUE_PRIORITY_LANES };
+    BOOST_CHECK_EQUAL(memqueue_open_params(&params), EINVAL);
+    params.lanes = MEMQUEUE_LANES_MAX + 1;
+    BOOST_CHECK_EQUAL(memqueue_open_params(&params), EINVAL);
+    params.lanes = 3;
+    params.lane_size = queue_size / 2;
+    BOOST_CHECK_EQUAL(memqueue_open_params(&params), EINVAL);
+
+    auto write = [](int lane, int seq)
+    {
+        record value = { lane, seq };
+        memqueue_write_opts opts = { MEMQUEUE_WRITE_PRIORITY, 0, (unsigned int)lane };
+        return memqueue_write_ex((const char*)&value, sizeof(value), &opts);
+    };
+    auto read_lanes = [&]()
+    {
+        std::vector<int> lanes;
+        while (memqueue_read((char*)&value, sizeof(value)) == sizeof(value))
+            lanes.push_back(value.lane);
+        return lanes;
+    };
+
+    // strict priority, upper lanes have their own small memory
+    params.lane_size = lane_size;
+    BOOST_CHECK_EQUAL(memqueue_open_params(&params), 0);
+
+    BOOST_CHECK_EQUAL(write(3, 0), -EINVAL);
+
+    int counter = 0;
+    while (write(2, counter) == sizeof(value))
+        counter++;
+    BOOST_CHECK_EQUAL(counter, (lane_size - 1) / (sizeof(size_t) + sizeof(value)));
+    memqueue_depth depth;
+    BOOST_CHECK_EQUAL(memqueue_get_depth(2, &depth), 0);
+    BOOST_CHECK_EQUAL(depth.messages, counter);
+    while (memqueue_read((char*)&value, sizeof(value)) > 0)
+        ;
+
+    for (int i = 0; i < 3; i++)
+    {
+        BOOST_CHECK_EQUAL(write(0, i), sizeof(value));
+        BOOST_CHECK_EQUAL(write(1, i), sizeof(value));
+        BOOST_CHECK_EQUAL(write(2, i), sizeof(value));
+    }
+    BOOST_CHECK(read_lanes() == std::vector<int>({ 2, 2, 2, 1, 1, 1, 0, 0, 0 }));
+    memqueue_close();
+
+    // lower lane gets one message after every two upper ones
+    params.lane_size  = 0;
+    params.lane_burst = 2;
+    BOOST_CHECK_EQUAL(memqueue_open_params(&params), 0);
+    for (int i = 0; i < 3; i++)
+        BOOST_CHECK_EQUAL(write(0, i), sizeof(value));
+    for (int i = 0; i < 7; i++)
+        BOOST_CHECK_EQUAL(write(2, i), sizeof(value));
+    BOOST_CHECK(read_lanes() == std::vector<int>({ 2, 2, 0, 2, 2, 0, 2, 2, 0, 2 }));
+    memqueue_close();
+
+    // aged bulk message goes before urgent ones
+    params.lane_burst    = 0;
+    params.lane_aging_ms = 20;
+    BOOST_CHECK_EQUAL(memqueue_open_params(&params), 0);
+    BOOST_CHECK_EQUAL(write(0, 0), sizeof(value));
+    BOOST_CHECK_EQUAL(write(0, 1), sizeof(value));
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    BOOST_CHECK_EQUAL(write(2, 0), sizeof(value));
+    BOOST_CHECK_EQUAL(write(1, 0), sizeof(value));
+    BOOST_CHECK(read_lanes() == std::vector<int>({ 0, 0, 2, 1 }));
+    memqueue_close();
+}
+
+BOOST_AUTO_TEST_CASE(TimerWheelTest)
+{
+    const size_t count = 200000;
+    // up to twice as far as wheel can hold, so some entries are placed again
+    const uint64_t horizon = uint64_t(2) << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+    std::vector<timer_entry> entries(count);
+    std::vector<uint64_t> expires(count);
+    uint64_t seed = 12345;
+    timer_wheel wheel;
+
+    timer_wheel_init(&wheel, 1, 0);
+
+    for (size_t index = 0; index < count; index++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        expires[index] = index % 4 == 0 ? (seed >> 33) % 100 : (seed >> 20) % horizon;
+        timer_wheel_add(&wheel, &entries[index], expires[index]);
+    }
+    BOOST_CHECK_EQUAL(wheel.count, count);
+
+    // every entry expires at the first advance which reaches its time, 
+    // entries come in order of expiry
+    uint64_t now = 0;
+    uint64_t prev = 0;
+    size_t expired = 0;
+    bool in_time = true;
+    bool in_order = true;
+    while (wheel.count)
+    {
+        prev = now;
+        now += 1 + (now % 7 == 0 ? horizon / 1000 : 37);
+        uint64_t last = 0;
+        for (auto entry = timer_wheel_advance(&wheel, now); entry; entry = entry->next)
+        {
+            auto expiry = expires[entry - entries.data()];
+            in_time  = in_time && expiry <= now && (expiry > prev || prev == 0);
+            in_order = in_order && expiry >= last;
+            last = expiry;
+            expired++;
+        }
+    }
+    BOOST_CHECK(in_time);
+    BOOST_CHECK(in_order);
+    BOOST_CHECK_EQUAL(expired, count);
+    BOOST_CHECK(timer_wheel_drain(&wheel) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(MemQueueDelayedTest)
+{
+    const size_t queue_size  = 1000;
+    const size_t buffer_size = 100;
+    std::array<char, buffer_size> buffer;
+    memqueue_stats stats;
+
+    auto result = memqueue_open(queue_size);
+    BOOST_CHECK_EQUAL(result, 0);
+
+    memqueue_write_opts opts = {};
+    opts.flags = MEMQUEUE_WRITE_DELIVER;
+    opts.deliver_ns = memqueue_now_ns() + 30 * 1000000ULL;
+
+    buffer.fill('d');
+    BOOST_CHECK_EQUAL(memqueue_write_ex(buffer.data(), buffer_size, &opts), buffer_size);
+    buffer.fill('e');
+    BOOST_CHECK_EQUAL(memqueue_write_ex(buffer.data(), buffer_size, &opts), buffer_size);
+    memqueue_get_stats(&stats);
+    BOOST_CHECK_EQUAL(stats.delayed, 2);
+
+    // delayed messages take their space, immediate ones go first
+    buffer.fill('a');
+    int counter = 0;
+    while (memqueue_write(buffer.data(), buffer_size) == buffer_size)
+        counter++;
+    BOOST_CHECK_EQUAL(counter, queue_size / (buffer_size + sizeof(size_t)) - 2);
+
+    BOOST_CHECK_EQUAL(memqueue_write_ex(buffer.data(), buffer_size, &opts), -ENOSPC);
+
+    while (memqueue_read(buffer.data(), buffer_size) == buffer_size)
+    {
+        BOOST_CHECK_EQUAL(buffer[0], 'a');
+        counter--;
+    }
+    BOOST_CHECK_EQUAL(counter, 0);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+
+    BOOST_CHECK_EQUAL(memqueue_next_length(), buffer_size);
+    BOOST_CHECK_EQUAL(memqueue_read(buffer.data(), buffer_size), buffer_size);
+    BOOST_CHECK_EQUAL(buffer[0], 'd');
+    BOOST_CHECK_EQUAL(memqueue_read(buffer.data(), buffer_size), buffer_size);
+    BOOST_CHECK_EQUAL(buffer[0], 'e');
+
+    memqueue_get_stats(&stats);
+    BOOST_CHECK_EQUAL(stats.delayed, 0);
+    BOOST_CHECK_EQUAL(stats.delayed_dropped, 0);
+
+    // time in the past means no delay
+    opts.deliver_ns = memqueue_now_ns() - 1;
+    BOOST_CHECK_EQUAL(memqueue_write_ex(buffer.data(), buffer_size, &opts), buffer_size);
+    BOOST_CHECK_EQUAL(memqueue_read(buffer.data(), buffer_size), buffer_size);
+
+    // pending messages are freed on close
+    opts.deliver_ns = memqueue_now_ns() + 1000000000ULL;
+    BOOST_CHECK_EQUAL(memqueue_write_ex(buffer.data(), buffer_size, &opts), buffer_size);
+    memqueue_close();
+}
+
+BOOST_AUTO_TEST_CASE(MemQueueExpireTest)
+{
+    const size_t queue_size  = 1000;
+    const size_t buffer_size = 100;
+    std::array<char, buffer_size> buffer;
+    memqueue_stats stats;
+
+    memqueue_params params = {};
+    params.queue_size = queue_size;
+    params.flags      = MEMQUEUE_EXPIRE_RECLAIM;
+
+    auto result = memqueue_open_params(&params);
+    BOOST_CHECK_EQUAL(result, 0);
+
+    memqueue_write_opts opts = {};
+    opts.flags = MEMQUEUE_WRITE_EXPIRE;
+    opts.expire_ns = memqueue_now_ns() + 20 * 1000000ULL;
+
+    buffer.fill('a');
+    for (int index = 0; index < 3; index++)
+        BOOST_CHECK_EQUAL(memqueue_write_ex(buffer.data(), buffer_size, &opts), buffer_size);
+    buffer.fill('b');
+    BOOST_CHECK_EQUAL(memqueue_write(buffer.data(), buffer_size), buffer_size);
+    buffer.fill('c');
+    BOOST_CHECK_EQUAL(memqueue_write_ex(buffer.data(), buffer_size, &opts), buffer_size);
+    buffer.fill('d');
+    opts.expire_ns = memqueue_now_ns() + 1000000000ULL;
+    BOOST_CHECK_EQUAL(memqueue_write_ex(buffer.data(), buffer_size, &opts), buffer_size);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+
+    // runs of expired messages are skipped, live ones are read
+    BOOST_CHECK_EQUAL(memqueue_next_length(), buffer_size);
+    BOOST_CHECK_EQUAL(memqueue_read(buffer.data(), buffer_size), buffer_size);
+    BOOST_CHECK_EQUAL(buffer[0], 'b');
+    BOOST_CHECK_EQUAL(memqueue_read(buffer.data(), buffer_size), buffer_size);
+    BOOST_CHECK_EQUAL(buffer[0], 'd');
+    BOOST_CHECK_EQUAL(memqueue_read(buffer.data(), buffer_size), 0);
+
+    memqueue_get_stats(&stats);
+    BOOST_CHECK_EQUAL(stats.expired, 4);
+
+    // full ring gives space of its expired messages to writer
+    opts.expire_ns = memqueue_now_ns() + 20 * 1000000ULL;
+    int counter = 0;
+    while (memqueue_write_ex(buffer.data(), buffer_size, &opts) == buffer_size)
+        counter++;
+    BOOST_CHECK(counter > 0);
+    BOOST_CHECK_EQUAL(memqueue_write(buffer.data(), buffer_size), -ENOSPC);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+
+    buffer.fill('e');
+    BOOST_CHECK_EQUAL(memqueue_write(buffer.data(), buffer_size), buffer_size);
+    memqueue_get_stats(&stats);
+    BOOST_CHECK(stats.expired > 4);
+
+    BOOST_CHECK_EQUAL(memqueue_read(buffer.data(), buffer_size), buffer_size);
+    BOOST_CHECK_EQUAL(buffer[0], 'e');
+    BOOST_CHECK_EQUAL(memqueue_read(buffer.data(), buffer_size), 0);
+
+    memqueue_get_stats(&stats);
+    BOOST_CHECK_EQUAL(stats.expired, 4 + counter);
+
+    memqueue_close();
+}
+
+BOOST_AUTO_TEST_CASE(MemQueueTagFilterTest)
+{
+    const size_t queue_size  = 1000;
+    const size_t buffer_size = 10;
+    std::array<char, buffer_size> buffer;
+    memqueue_stats stats;
+
+    auto result = memqueue_open(queue_size);
+    BOOST_CHECK_EQUAL(result, 0);
+
+    memqueue_write_opts write_opts = {};
+    write_opts.flags = MEMQUEUE_WRITE_TAG;
+
+    // untagged message has tag 0
+    const unsigned int tags[] = { 0, 1, 2, 1, 3, 5 };
+    for (auto tag : tags)
+    {
+        write_opts.tag = tag;
+        buffer.fill('0' + tag);
+        BOOST_CHECK_EQUAL(memqueue_write_ex(buffer.data(), buffer_size, &write_opts), buffer_size);
+    }
+    write_opts.tag = MEMQUEUE_TAGS_MAX;
+    BOOST_CHECK_EQUAL(memqueue_write_ex(buffer.data(), buffer_size, &write_opts), -EINVAL);
+
+    memqueue_read_opts read_opts = {};
+    read_opts.flags = MEMQUEUE_READ_TAGS;
+    read_opts.tags  = 1 << 1;
+
+    BOOST_CHECK_EQUAL(memqueue_next_length_ex(&read_opts), buffer_size);
+    BOOST_CHECK_EQUAL(memqueue_read_ex(buffer.data(), buffer_size, &read_opts, 0), buffer_size);
+    BOOST_CHECK_EQUAL(buffer[0], '1');
+    BOOST_CHECK_EQUAL(memqueue_read_ex(buffer.data(), buffer_size, &read_opts, 0), buffer_size);
+    BOOST_CHECK_EQUAL(buffer[0], '1');
+
+    memqueue_get_stats(&stats);
+    BOOST_CHECK_EQUAL(stats.filtered, 2);
+
+    // in-place consumer filters the same way
+    read_opts.tags = 1 << 5;
+    std::string consumed;
+    auto consume = [](void * context, const char * segment, size_t length, size_t, size_t) -> int
+    {
+        static_cast<std::string*>(context)->append(segment, length);
+        return 0;
+    };
+    BOOST_CHECK_EQUAL(memqueue_consume_ex(consume, &consumed, 100, &read_opts), sizeof(size_t) + buffer_size);
+    BOOST_CHECK_EQUAL(consumed, std::string(buffer_size, '5'));
+    BOOST_CHECK_EQUAL(memqueue_read(buffer.data(), buffer_size), 0);
+
+    memqueue_get_stats(&stats);
+    BOOST_CHECK_EQUAL(stats.filtered, 3);
+
+    memqueue_close();
+}
+
+BOOST_AUTO_TEST_CASE(FixedRingTest)
+{
+    struct Sample
+    {
+        uint64_t sequence;
+        char payload[24];
+    };
+
+    memqueue::FixedRing<Sample, 8> ring;
+    Sample sample = {};
+
+    BOOST_CHECK_EQUAL(ring.capacity(), 8);
+    BOOST_CHECK(ring.empty());
+    BOOST_CHECK(ring.try_pop(sample) == false);
+
+    for (uint64_t index = 0; index < 8; index++)
+    {
+        sample.sequence = index;
+        BOOST_CHECK(ring.try_push(sample));
+    }
+    BOOST_CHECK(ring.try_push(sample) == false);
+    BOOST_CHECK_EQUAL(ring.size(), 8);
+
+    for (uint64_t index = 0; index < 5; index++)
+    {
+        BOOST_CHECK(ring.try_pop(sample));
+        BOOST_CHECK_EQUAL(sample.sequence, index);
+    }
+
+    // batch wraps around the end of slots
+    std::array<Sample, 8> batch;
+    for (uint64_t index = 0; index < batch.size(); index++)
+        batch[index].sequence = 100 + index;
+    BOOST_CHECK_EQUAL(ring.push(batch.data(), batch.size()), 5);
+    BOOST_CHECK_EQUAL(ring.pop(batch.data(), batch.size()), 8);
+    BOOST_CHECK_EQUAL(batch[0].sequence, 5);
+    BOOST_CHECK_EQUAL(batch[2].sequence, 7);
+    BOOST_CHECK_EQUAL(batch[3].sequence, 100);
+    BOOST_CHECK_EQUAL(batch[7].sequence, 104);
+    BOOST_CHECK(ring.empty());
+}
+
+BOOST_AUTO_TEST_CASE(FixedRingDynamicThreadsTest)
+{
+    const uint64_t count = 1000000;
+
+    // capacity is rounded up to power of two
+    memqueue::FixedRing<uint64_t> ring(1000);
+    BOOST_CHECK_EQUAL(ring.capacity(), 1024);
+
+    std::thread producer([&ring]()
+    {
+        std::array<uint64_t, 16> batch;
+        uint64_t next = 0;
+        while (next < count)
+        {
+            size_t size = std::min<uint64_t>(batch.size(), count - next);
+            for (size_t index = 0; index < size; index++)
+                batch[index] = next + index;
+            size = ring.push(batch.data(), size);
+            if (size == 0)
+                std::this_thread::yield();
+            next += size;
+        }
+    });
+
+    uint64_t expected = 0;
+    uint64_t value = 0;
+    bool ordered = true;
+    while (expected < count)
+    {
+        if (ring.try_pop(value))
+        {
+            ordered = ordered && value == expected;
+            expected++;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+
+    BOOST_CHECK(ordered);
+    BOOST_CHECK(ring.empty());
+}
+
+BOOST_AUTO_TEST_CASE(QueueInstanceTest)
+{
+    const size_t message_size = 300;
+    memqueue_params params = {};
+    params.queue_size = 1000;
+
+    // instances don't share state with each other and with memqueue_*
+    std::array<char, 10> buffer;
+    memqueue_close();
+    memqueue::Queue first  = memqueue::Queue::memory(params);
+    memqueue::Queue second = memqueue::Queue::memory(params);
+    BOOST_CHECK_EQUAL(memqueue_read(buffer.data(), buffer.size()), -EBADF);
+
+    std::vector<std::byte> message(message_size);
+    for (size_t index = 0; index < message.size(); index++)
+        message[index] = std::byte(index);
+
+    BOOST_CHECK(first.try_push(message));
+    BOOST_CHECK(first.try_push(message));
+    BOOST_CHECK(first.try_push(message));
+    BOOST_CHECK(first.try_push(message) == false);
+    BOOST_CHECK(second.consume([](std::span<const std::byte>) {}) == false);
+
+    // whole messages are passed in place
+    std::vector<const std::byte *> seen;
+    auto collect = [&seen, &message](std::span<const std::byte> data)
+    {
+        BOOST_CHECK(std::equal(data.begin(), data.end(), message.begin(), message.end()));
+        seen.push_back(data.data());
+    };
+    BOOST_CHECK_EQUAL(first.consume_batch(collect, 2), 2);
+    BOOST_CHECK(seen[1] != message.data());
+
+    // third message wraps around the end of ring and is assembled
+    BOOST_CHECK(first.try_push(message));
+    BOOST_CHECK(first.try_push(message));
+    BOOST_CHECK_EQUAL(first.consume_batch(collect, 10), 3);
+    BOOST_CHECK(first.consume(collect) == false);
+    BOOST_CHECK_EQUAL(seen.size(), 5);
+}
+
+BOOST_AUTO_TEST_CASE(QueueBatchTest)
+{
+    memqueue_params params = {};
+    params.queue_size = 10000;
+    memqueue::Queue queue = memqueue::Queue::memory(params);
+
+    std::array<uint64_t, 10> values;
+    std::array<std::span<const std::byte>, 10> batch;
+    for (size_t index = 0; index < values.size(); index++)
+    {
+        values[index] = index;
+        batch[index]  = std::as_bytes(std::span<const uint64_t>(&values[index], 1));
+    }
+    BOOST_CHECK_EQUAL(queue.try_push_batch(batch), 10);
+
+    // exception of consumer stops the batch after its message
+    uint64_t expected = 0;
+    auto check = [&expected](std::span<const std::byte> data)
+    {
+        uint64_t value = 0;
+        BOOST_CHECK_EQUAL(data.size(), sizeof(value));
+        memcpy(&value, data.data(), sizeof(value));
+        BOOST_CHECK_EQUAL(value, expected);
+        if (expected++ == 3)
+            throw std::runtime_error("stop");
+    };
+    BOOST_CHECK_THROW(queue.consume_batch(check, 10), std::runtime_error);
+    BOOST_CHECK_EQUAL(queue.consume_batch(check, 10), 6);
+    BOOST_CHECK_EQUAL(expected, 10);
+
+    std::vector<std::byte> empty;
+    BOOST_CHECK_THROW(queue.try_push(empty), std::system_error);
+}
+
+static void append_framed(std::vector<char> & batch, const std::string & message)
+{
+    size_t length = message.size();
+    batch.insert(batch.end(), reinterpret_cast<const char *>(&length), reinterpret_cast<const char *>(&length) + sizeof(length));
+    batch.insert(batch.end(), message.begin(), message.end());
+}
+
+BOOST_AUTO_TEST_CASE(MemQueueWriteFramedTest)
+{
+    memqueue_params params = {};
+    params.queue_size = 1000;
+    mq_queue * queue = nullptr;
+    BOOST_REQUIRE_EQUAL(mq_open(&queue, &params), 0);
+
+    std::vector<char> batch;
+    std::vector<std::string> messages;
+    for (size_t index = 0; index < 10; index++)
+    {
+        messages.push_back(std::string(50 + index * 20, char('a' + index)));
+        append_framed(batch, messages.back());
+    }
+
+    // messages are written in order while they fit, batch stops at message boundary
+    size_t fitting = 0;
+    size_t used = 0;
+    while (used + 2 * sizeof(size_t) + messages[fitting].size() < params.queue_size)
+        used += sizeof(size_t) + messages[fitting++].size();
+    BOOST_REQUIRE(fitting > 1 && fitting < messages.size());
+
+    ssize_t written = mq_write_framed(queue, batch.data(), batch.size(), nullptr);
+    BOOST_CHECK_EQUAL(written, used);
+    BOOST_CHECK_EQUAL(mq_write_framed(queue, batch.data() + used, batch.size() - used, nullptr), -ENOSPC);
+
+    std::vector<std::string> read;
+    std::array<char, 1000> buffer;
+    ssize_t n_bytes = 0;
+    while ((n_bytes = mq_read(queue, buffer.data(), buffer.size(), nullptr, nullptr)) > 0)
+        read.emplace_back(buffer.data(), n_bytes);
+
+    written = mq_write_framed(queue, batch.data() + used, batch.size() - used, nullptr);
+    BOOST_CHECK(written > 0);
+    while ((n_bytes = mq_read(queue, buffer.data(), buffer.size(), nullptr, nullptr)) > 0)
+        read.emplace_back(buffer.data(), n_bytes);
+    BOOST_CHECK_EQUAL(used + written, batch.size());
+    BOOST_CHECK(read == messages);
+
+    // batch cut inside prefix or data of its first message is rejected, 
+    // a cut later one is left out of written bytes
+    std::vector<char> cut;
+    append_framed(cut, "first");
+    append_framed(cut, "second");
+    BOOST_CHECK_EQUAL(mq_write_framed(queue, cut.data(), sizeof(size_t) - 1, nullptr), -EINVAL);
+    BOOST_CHECK_EQUAL(mq_write_framed(queue, cut.data(), sizeof(size_t) + 4, nullptr), -EINVAL);
+    BOOST_CHECK_EQUAL(mq_write_framed(queue, cut.data(), cut.size() - 1, nullptr), sizeof(size_t) + 5);
+    BOOST_CHECK_EQUAL(mq_write_framed(queue, cut.data(), 0, nullptr), -EINVAL);
+
+    // message can't be empty, as in mq_write
+    std::vector<char> empty;
+    append_framed(empty, "");
+    BOOST_CHECK_EQUAL(mq_write_framed(queue, empty.data(), empty.size(), nullptr), -EINVAL);
+
+    n_bytes = mq_read(queue, buffer.data(), buffer.size(), nullptr, nullptr);
+    BOOST_CHECK(std::string(buffer.data(), n_bytes) == "first");
+    BOOST_CHECK_EQUAL(mq_read(queue, buffer.data(), buffer.size(), nullptr, nullptr), 0);
+
+    mq_close(queue);
+}
+
+BOOST_AUTO_TEST_CASE(QueueFramedTest)
+{
+    memqueue_params params = {};
+    params.queue_size = 1000;
+    std::vector<std::string> messages = { "one", "two", std::string(700, 'x'), "four" };
+    std::vector<char> batch;
+    for (auto & message : messages)
+        append_framed(batch, message);
+    auto bytes = std::as_bytes(std::span<const char>(batch));
+
+    const char * path = "/var/tmp/memqueue_framed";
+    remove(path);
+    std::vector<memqueue::Queue> queues;
+    queues.push_back(memqueue::Queue::memory(params));
+    queues.push_back(memqueue::Queue::file(path, params.queue_size));
+
+    // memory queue and queue file split batch the same way
+    for (auto & queue : queues)
+    {
+        std::vector<std::string> read;
+        auto collect = [&read](std::span<const std::byte> data)
+        {
+            read.emplace_back(reinterpret_cast<const char *>(data.data()), data.size());
+        };
+
+        size_t pushed = queue.try_push_framed(bytes);
+        BOOST_CHECK_EQUAL(pushed, batch.size());
+        BOOST_CHECK_EQUAL(queue.try_push_framed(bytes), 2 * (sizeof(size_t) + 3));
+        BOOST_CHECK_EQUAL(queue.try_push_framed(bytes.subspan(2 * (sizeof(size_t) + 3))), 0);
+        BOOST_CHECK_THROW(queue.try_push_framed(bytes.first(sizeof(size_t) + 1)), std::system_error);
+
+        BOOST_CHECK_EQUAL(queue.consume_batch(collect, 10), 6);
+        BOOST_CHECK(std::equal(messages.begin(), messages.end(), read.begin()));
+        BOOST_CHECK(read[4] == "one" && read[5] == "two");
+    }
+
+    queues.clear();
+    remove(path);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,266 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#define BOOST_TEST_MODULE ToolsTestModule
+#include <boost/test/included/unit_test.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+
+#include "../daemon/Frame.h"
+#include "../tools/Histogram.h"
+#include "../tools/Replay.h"
+
+/**
+ * Directory of one test case, removed with its files.
+ */
+struct TempDir
+{
+    std::string path;
+
+    TempDir()
+    {
+        char name[] = "/var/tmp/memqueue_test_XXXXXX";
+        BOOST_REQUIRE(mkdtemp(name) != nullptr);
+        path = name;
+    }
+
+    ~TempDir() { std::filesystem::remove_all(path); }
+};
+
+// messages prefixed by length as in Batch
+static std::vector<std::byte> make_batch(const std::vector<std::string> & messages)
+{
+    std::vector<std::byte> batch;
+
+    for (auto & message : messages)
+    {
+        size_t length = message.size();
+        auto prefix = reinterpret_cast<const std::byte *>(&length);
+        auto data   = reinterpret_cast<const std::byte *>(message.data());
+        batch.insert(batch.end(), prefix, prefix + sizeof(size_t));
+        batch.insert(batch.end(), data, data + message.size());
+    }
+    return batch;
+}
+
+static void write_file(const std::string & file_name, std::span<const std::byte> data)
+{
+    std::ofstream file(file_name, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+}
+
+// messages of every size up to <count>, distinct by content
+static std::vector<std::string> make_messages(size_t count, size_t first)
+{
+    std::vector<std::string> messages;
+
+    for (size_t index = 0; index < count; index++)
+        messages.push_back(std::to_string(first + index) + std::string(index * 37 % 1000 + 1, char('a' + index % 26)));
+    return messages;
+}
+
+// replay <dir> into <queue>, it is drained by another thread while replaying
+static std::vector<std::string> replay_dir(const std::string & dir, memqueue::Queue && queue, size_t batch_bytes)
+{
+    std::vector<std::string> read;
+    std::atomic_bool replaying(true);
+    QueueOutput output(std::move(queue));
+    auto collect = [&read](std::span<const std::byte> message)
+    {
+        read.emplace_back(reinterpret_cast<const char *>(message.data()), message.size());
+    };
+
+    std::thread consumer([&]()
+    {
+        while (replaying)
+        {
+            if (output.queue().consume_batch(collect, 64) == 0)
+                std::this_thread::yield();
+        }
+        while (output.queue().consume_batch(collect, 64) != 0)
+            ;
+    });
+
+    auto input = open_input(dir);
+    ReplayStats stats = replay(*input, output, 0, batch_bytes);
+    replaying = false;
+    consumer.join();
+
+    BOOST_CHECK_EQUAL(stats.messages, read.size());
+    BOOST_CHECK_EQUAL(stats.untimed, 0);
+    return read;
+}
+
+BOOST_AUTO_TEST_SUITE(ToolsTest)
+
+BOOST_AUTO_TEST_CASE(HistogramExactTest)
+{
+    Histogram histogram;
+
+    BOOST_CHECK_EQUAL(histogram.count(), 0);
+    BOOST_CHECK_EQUAL(histogram.percentile(50), 0);
+
+    // values below sub_buckets have a bucket each
+    for (uint64_t value = 1; value <= 100; value++)
+        histogram.record(value);
+
+    BOOST_CHECK_EQUAL(histogram.count(), 100);
+    BOOST_CHECK_EQUAL(histogram.max(), 100);
+    BOOST_CHECK_EQUAL(histogram.percentile(0), 1);
+    BOOST_CHECK_EQUAL(histogram.percentile(1), 1);
+    BOOST_CHECK_EQUAL(histogram.percentile(50), 50);
+    BOOST_CHECK_EQUAL(histogram.percentile(90), 90);
+    BOOST_CHECK_EQUAL(histogram.percentile(99), 99);
+    BOOST_CHECK_EQUAL(histogram.percentile(99.5), 100);
+    BOOST_CHECK_EQUAL(histogram.percentile(100), 100);
+}
+
+BOOST_AUTO_TEST_CASE(HistogramBucketTest)
+{
+    Histogram histogram;
+
+    // 500 shares bucket [500, 501] with 501, 502 starts the next one
+    histogram.record(500);
+    BOOST_CHECK_EQUAL(histogram.percentile(50), 500);
+    histogram.record(501);
+    histogram.record(502);
+    histogram.record(499);
+    BOOST_CHECK_EQUAL(histogram.percentile(25), 499);
+    BOOST_CHECK_EQUAL(histogram.percentile(50), 501);
+    BOOST_CHECK_EQUAL(histogram.percentile(75), 501);
+    BOOST_CHECK_EQUAL(histogram.percentile(100), 502);
+
+    // the last bucket ends at the largest value, not above it
+    histogram.record(1000000);
+    BOOST_CHECK_EQUAL(histogram.percentile(100), 1000000);
+    histogram.record(UINT64_MAX);
+    BOOST_CHECK_EQUAL(histogram.percentile(100), UINT64_MAX);
+}
+
+BOOST_AUTO_TEST_CASE(HistogramErrorTest)
+{
+    Histogram histogram;
+    std::vector<uint64_t> values;
+    std::mt19937_64 random(1);
+    std::lognormal_distribution<double> latency(10, 2);
+
+    for (int sample = 0; sample < 100000; sample++)
+    {
+        values.push_back(static_cast<uint64_t>(latency(random)));
+        histogram.record(values.back());
+    }
+    std::sort(values.begin(), values.end());
+
+    // percentile is the sample of its rank rounded up to its bucket
+    for (double percent : { 10.0, 50.0, 90.0, 99.0, 99.9, 99.99 })
+    {
+        uint64_t exact = values[static_cast<size_t>(std::ceil(values.size() * percent / 100)) - 1];
+        uint64_t value = histogram.percentile(percent);
+        BOOST_CHECK_GE(value, exact);
+        BOOST_CHECK_LE(value, exact + exact / Histogram::sub_buckets);
+    }
+    BOOST_CHECK_EQUAL(histogram.percentile(100), values.back());
+}
+
+BOOST_AUTO_TEST_CASE(ReplaySegmentTest)
+{
+    TempDir dir;
+    auto first  = make_messages(300, 0);
+    auto second = make_messages(200, 300);
+    // message longer than read block of segment
+    second.push_back(std::string(5 << 20, 'L'));
+    second.push_back("last");
+
+    write_file(dir.path + "/memqueue_seg_0", make_batch(first));
+    // tail cut by crash is dropped with its segment
+    auto cut = make_batch(second);
+    auto tail = make_batch({ "cut message" });
+    cut.insert(cut.end(), tail.begin(), tail.end() - 3);
+    write_file(dir.path + "/memqueue_seg_1", cut);
+
+    std::vector<std::string> expected = first;
+    expected.insert(expected.end(), second.begin(), second.end());
+
+    memqueue_params params = {};
+    params.queue_size = 16 << 20;
+    auto read = replay_dir(dir.path, memqueue::Queue::memory(params), 64 * 1024);
+    BOOST_CHECK(read == expected);
+
+    // queue smaller than batch: batch is written by parts between reads
+    params.queue_size = 8192;
+    expected.erase(expected.end() - 2);
+    std::filesystem::remove(dir.path + "/memqueue_seg_1");
+    second.erase(second.end() - 2);
+    write_file(dir.path + "/memqueue_seg_1", make_batch(second));
+    read = replay_dir(dir.path, memqueue::Queue::memory(params), 64 * 1024);
+    BOOST_CHECK(read == expected);
+
+    // queue file takes batches the same way
+    const std::string queue_file = dir.path + "/queue";
+    read = replay_dir(dir.path, memqueue::Queue::file(queue_file.c_str(), 8192), 4096);
+    BOOST_CHECK(read == expected);
+}
+
+BOOST_AUTO_TEST_CASE(ReplayElemTest)
+{
+    TempDir dir;
+    auto messages = make_messages(120, 0);
+
+    // files are ordered by number, not by name
+    for (size_t index = 0; index < messages.size(); index++)
+        std::ofstream(dir.path + "/memqueue_elem_" + std::to_string(index), std::ios::binary) << messages[index];
+    std::ofstream(dir.path + "/memqueue_index") << "not a message";
+
+    memqueue_params params = {};
+    params.queue_size = 8192;
+    auto read = replay_dir(dir.path, memqueue::Queue::memory(params), 1000);
+    BOOST_CHECK(read == messages);
+
+    // with original timing every message has its time
+    params.queue_size = 1 << 20;
+    QueueOutput output(memqueue::Queue::memory(params));
+    auto input = open_input(dir.path);
+    ReplayStats stats = replay(*input, output, 1000, 1 << 20);
+    BOOST_CHECK_EQUAL(stats.messages, messages.size());
+    BOOST_CHECK_EQUAL(stats.untimed, 0);
+}
+
+BOOST_AUTO_TEST_CASE(ReplayFrameTest)
+{
+    TempDir dir;
+    FrameEncoder encoder(1);
+    std::vector<std::byte> frame;
+    std::vector<std::byte> segment;
+    std::vector<std::string> expected;
+
+    // batch per frame, the second segment starts a new file
+    for (size_t seq = 0; seq < 6; seq++)
+    {
+        auto messages = make_messages(50, seq * 50);
+        size_t length = encoder.encode(seq, make_batch(messages), frame);
+        segment.insert(segment.end(), frame.begin(), frame.begin() + length);
+        expected.insert(expected.end(), messages.begin(), messages.end());
+        if (seq == 2 || seq == 5)
+        {
+            write_file(dir.path + "/memqueue_zseg_" + std::to_string(seq / 3), segment);
+            segment.clear();
+        }
+    }
+
+    memqueue_params params = {};
+    params.queue_size = 8192;
+    auto read = replay_dir(dir.path, memqueue::Queue::memory(params), 4096);
+    BOOST_CHECK(read == expected);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
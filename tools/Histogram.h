@@ -0,0 +1,72 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Histogram of values with relative error below 1/sub_buckets like
+ * HdrHistogram: values of [2^k, 2^(k+1)) share <sub_buckets> buckets.
+ */
+class Histogram
+{
+public:
+    static constexpr int sub_bits = 7;
+    static constexpr uint64_t sub_buckets = 1 << sub_bits;
+
+    Histogram() : counts_((64 - sub_bits + 1) * sub_buckets) {}
+
+    void record(uint64_t value)
+    {
+        counts_[index(value)]++;
+        total_++;
+        max_ = std::max(max_, value);
+    }
+
+    /**
+     * Value below which <percent> of values are, rounded up to its bucket.
+     */
+    uint64_t percentile(double percent) const
+    {
+        uint64_t rank = static_cast<uint64_t>(std::ceil(total_ * percent / 100));
+        uint64_t seen = 0;
+
+        for (size_t bucket = 0; bucket < counts_.size(); bucket++)
+        {
+            seen += counts_[bucket];
+            if (seen >= rank && seen != 0)
+                return std::min(upper(bucket), max_);
+        }
+        return max_;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t max() const { return max_; }
+
+private:
+    static size_t index(uint64_t value)
+    {
+        if (value < sub_buckets)
+            return value;
+        int shift = 63 - __builtin_clzll(value) - sub_bits;
+        return (shift + 1) * sub_buckets + ((value >> shift) - sub_buckets);
+    }
+
+    static uint64_t upper(size_t bucket)
+    {
+        if (bucket < sub_buckets)
+            return bucket;
+        int shift = bucket / sub_buckets - 1;
+        return ((bucket % sub_buckets + sub_buckets + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    uint64_t max_ = 0;
+};
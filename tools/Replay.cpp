@@ -0,0 +1,347 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "../include/memqueue_ioctl.h"
+#include "../daemon/Source.h"
+#include "../daemon/Frame.h"
+#include "Replay.h"
+
+// files "<prefix><number>" of <dir> sorted by number
+static std::vector<std::pair<uint64_t, std::string>> list_files(const std::string & dir, const std::string & prefix, const char * suffix = "")
+{
+    std::vector<std::pair<uint64_t, std::string>> files;
+    DIR * handle = opendir(dir.c_str());
+    if (handle == nullptr)
+        throw std::runtime_error(dir + " open failed with error " + std::to_string(errno));
+
+    while (struct dirent * entry = readdir(handle))
+    {
+        char * end = nullptr;
+        if (strncmp(entry->d_name, prefix.c_str(), prefix.size()) != 0)
+            continue;
+        uint64_t number = strtoull(entry->d_name + prefix.size(), &end, 10);
+        if (end != entry->d_name + prefix.size() && strcmp(end, suffix) == 0)
+            files.emplace_back(number, dir + "/" + entry->d_name);
+    }
+    closedir(handle);
+
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+static size_t read_all(int fd, std::byte * data, size_t length)
+{
+    size_t offset = 0;
+
+    while (offset < length)
+    {
+        ssize_t n_bytes = read(fd, data + offset, length - offset);
+        if (n_bytes == -1 && errno == EINTR)
+            continue;
+        if (n_bytes == -1)
+            throw std::runtime_error("read failed with error " + std::to_string(errno));
+        if (n_bytes == 0)
+            break;
+        offset += n_bytes;
+    }
+    return offset;
+}
+
+/**
+ * Files "memqueue_elem_<counter>", a message per file, time is
+ * modification time of file.
+ */
+class ElemInput : public Input
+{
+public:
+    explicit ElemInput(const std::string & dir) : files_(list_files(dir, "memqueue_elem_")), buffer_(64 * 1024) {}
+
+    bool next(Message & message) override
+    {
+        while (index_ < files_.size())
+        {
+            struct stat st = {};
+            int fd = open(files_[index_++].second.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+                continue;
+
+            if (fstat(fd, &st) == -1)
+            {
+                close(fd);
+                continue;
+            }
+            if (buffer_.size() < static_cast<size_t>(st.st_size))
+                buffer_.resize(st.st_size);
+
+            size_t length = read_all(fd, buffer_.data(), st.st_size);
+            close(fd);
+
+            message.data    = std::span<const std::byte>(buffer_.data(), length);
+            message.time_ns = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    std::vector<std::pair<uint64_t, std::string>> files_;
+    size_t index_ = 0;
+    std::vector<std::byte> buffer_;
+};
+
+/**
+ * Segments "memqueue_seg_<counter>" of splice mode, messages prefixed
+ * by size_t length. Segment is read by large blocks.
+ */
+class SegmentInput : public Input
+{
+public:
+    explicit SegmentInput(const std::string & dir) : files_(list_files(dir, "memqueue_seg_")), buffer_(4 << 20) {}
+
+    ~SegmentInput() override
+    {
+        if (fd_ != -1)
+            close(fd_);
+    }
+
+    bool next(Message & message) override
+    {
+        while (true)
+        {
+            size_t length = 0;
+            if (end_ - pos_ >= sizeof(size_t))
+            {
+                memcpy(&length, buffer_.data() + pos_, sizeof(size_t));
+                if (end_ - pos_ - sizeof(size_t) >= length)
+                {
+                    message.data    = std::span<const std::byte>(buffer_.data() + pos_ + sizeof(size_t), length);
+                    message.time_ns = 0;
+                    pos_ += sizeof(size_t) + length;
+                    return true;
+                }
+            }
+
+            // keep the tail of message and read more after it
+            memmove(buffer_.data(), buffer_.data() + pos_, end_ - pos_);
+            end_ -= pos_;
+            pos_  = 0;
+            if (buffer_.size() < sizeof(size_t) + length)
+                buffer_.resize(sizeof(size_t) + length);
+
+            size_t n_bytes = fd_ == -1 ? 0 : read_all(fd_, buffer_.data() + end_, buffer_.size() - end_);
+            end_ += n_bytes;
+            if (n_bytes != 0)
+                continue;
+
+            // tail cut by crash is dropped with its segment
+            if (fd_ != -1)
+                close(fd_);
+            fd_ = -1;
+            pos_ = end_ = 0;
+            if (index_ == files_.size())
+                return false;
+            fd_ = open(files_[index_++].second.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd_ == -1)
+                throw std::runtime_error(files_[index_ - 1].second + " open failed with error " + std::to_string(errno));
+        }
+    }
+
+private:
+    std::vector<std::pair<uint64_t, std::string>> files_;
+    size_t index_ = 0;
+    int fd_ = -1;
+    std::vector<std::byte> buffer_;
+    size_t pos_ = 0;
+    size_t end_ = 0;
+};
+
+/**
+ * Compressed segments "memqueue_zseg_<counter>", frame by frame.
+ */
+class FrameInput : public Input
+{
+public:
+    explicit FrameInput(const std::string & dir) : files_(list_files(dir, "memqueue_zseg_")) {}
+
+    ~FrameInput() override
+    {
+        if (fd_ != -1)
+            close(fd_);
+    }
+
+    bool next(Message & message) override
+    {
+        while (batch_ == nullptr || (position_ != batch_->end()) == false)
+        {
+            if (read_frame() == false)
+                return false;
+        }
+
+        message.data    = *position_;
+        message.time_ns = 0;
+        ++position_;
+        return true;
+    }
+
+private:
+    bool read_frame()
+    {
+        FrameHeader header = {};
+
+        while (fd_ == -1 || read_all(fd_, reinterpret_cast<std::byte *>(&header), sizeof(header)) != sizeof(header))
+        {
+            if (fd_ != -1)
+                close(fd_);
+            fd_ = -1;
+            if (index_ == files_.size())
+                return false;
+            fd_ = open(files_[index_++].second.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd_ == -1)
+                throw std::runtime_error(files_[index_ - 1].second + " open failed with error " + std::to_string(errno));
+        }
+
+        frame_.resize(sizeof(header) + header.length);
+        memcpy(frame_.data(), &header, sizeof(header));
+        if (read_all(fd_, frame_.data() + sizeof(header), header.length) != header.length)
+            throw std::runtime_error(files_[index_ - 1].second + " frame is cut");
+
+        decode_frame(frame_, raw_);
+        batch_    = std::make_unique<Batch>(std::span<const std::byte>(raw_));
+        position_ = batch_->begin();
+        return true;
+    }
+
+    std::vector<std::pair<uint64_t, std::string>> files_;
+    size_t index_ = 0;
+    int fd_ = -1;
+    std::vector<std::byte> frame_;
+    std::vector<std::byte> raw_;
+    std::unique_ptr<Batch> batch_;
+    Batch::iterator position_{nullptr};
+};
+
+std::unique_ptr<Input> open_input(const std::string & dir)
+{
+    // output of per-message mode has times, segments are replayed as fast as possible
+    if (list_files(dir, "memqueue_elem_").empty() == false)
+        return std::make_unique<ElemInput>(dir);
+    if (list_files(dir, "memqueue_zseg_").empty() == false)
+        return std::make_unique<FrameInput>(dir);
+    return std::make_unique<SegmentInput>(dir);
+}
+
+DeviceOutput::DeviceOutput(const std::string & path)
+{
+    fd_ = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd_ == -1)
+        throw std::runtime_error(path + " open failed with error " + std::to_string(errno));
+    if (ioctl(fd_, MEMQUEUE_IOC_SET_FRAMED, 1) == -1)
+    {
+        int error = errno;
+        close(fd_);
+        throw std::runtime_error(path + " framed mode failed with error " + std::to_string(error));
+    }
+}
+
+DeviceOutput::~DeviceOutput()
+{
+    close(fd_);
+}
+
+size_t DeviceOutput::push(std::span<const std::byte> batch)
+{
+    while (true)
+    {
+        ssize_t n_bytes = write(fd_, batch.data(), batch.size());
+        if (n_bytes >= 0)
+            return n_bytes;
+        if (errno == ENOSPC)
+            return 0;
+        if (errno != EINTR)
+            throw std::runtime_error("write failed with error " + std::to_string(errno));
+    }
+}
+
+ReplayStats replay(Input & input, Output & output, double speed, size_t batch_bytes)
+{
+    using clock = std::chrono::steady_clock;
+
+    ReplayStats stats;
+    std::vector<std::byte> batch;
+    batch.reserve(batch_bytes + 64 * 1024);
+    WaitStrategy wait(WaitStrategy::for_latency(std::chrono::microseconds(100)), POLLOUT);
+    int fd = output.fd();
+
+    auto flush = [&]()
+    {
+        for (size_t offset = 0; offset < batch.size(); )
+        {
+            size_t n_bytes = output.push(std::span<const std::byte>(batch).subspan(offset));
+            if (n_bytes == 0)
+            {
+                wait.wait({ &fd, 1 });
+                continue;
+            }
+            wait.reset();
+            offset += n_bytes;
+        }
+        batch.clear();
+    };
+
+    Message message;
+    uint64_t first_ns = 0;
+    auto start = clock::now();
+
+    while (input.next(message))
+    {
+        if (speed > 0 && message.time_ns == 0)
+            stats.untimed++;
+
+        if (speed > 0 && message.time_ns != 0)
+        {
+            if (first_ns == 0)
+                first_ns = message.time_ns;
+
+            auto due = start + std::chrono::nanoseconds(static_cast<int64_t>((message.time_ns - first_ns) / speed));
+            if (due > clock::now())
+            {
+                flush();
+                std::this_thread::sleep_until(due);
+            }
+        }
+
+        size_t length = message.data.size();
+        size_t offset = batch.size();
+        batch.resize(offset + sizeof(size_t) + length);
+        memcpy(batch.data() + offset, &length, sizeof(size_t));
+        memcpy(batch.data() + offset + sizeof(size_t), message.data.data(), length);
+
+        stats.messages++;
+        stats.bytes += length;
+        if (batch.size() >= batch_bytes)
+            flush();
+    }
+    flush();
+
+    stats.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    stats.full    = wait.stats();
+    return stats;
+}
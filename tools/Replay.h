@@ -0,0 +1,115 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+
+#include "../include/queue.h"
+#include "../daemon/WaitStrategy.h"
+
+/**
+ * Message of stored output, <time_ns> is its write time, 0 if unknown.
+ */
+struct Message
+{
+    std::span<const std::byte> data;
+    uint64_t time_ns;
+};
+
+/**
+ * Stored messages in order they were written.
+ */
+class Input
+{
+public:
+    virtual ~Input() = default;
+
+    /**
+     * Message is valid till the next call, false at the end.
+     */
+    virtual bool next(Message & message) = 0;
+};
+
+/**
+ * Input of output directory of daemon: message files, compressed
+ * segments or segments of splice mode, whichever it has.
+ */
+std::unique_ptr<Input> open_input(const std::string & dir);
+
+/**
+ * Queue taking batches of messages prefixed by size_t length.
+ */
+class Output
+{
+public:
+    virtual ~Output() = default;
+
+    /**
+     * Write messages of <batch> in order until one doesn't fit.
+     * Return bytes of written messages, 0 if queue is full.
+     */
+    virtual size_t push(std::span<const std::byte> batch) = 0;
+
+    /**
+     * Descriptor which is writable when queue may have space, -1 if none.
+     */
+    virtual int fd() const { return -1; }
+};
+
+/**
+ * Device in framed mode, batch is written by one call.
+ */
+class DeviceOutput : public Output
+{
+public:
+    explicit DeviceOutput(const std::string & path);
+    ~DeviceOutput() override;
+
+    size_t push(std::span<const std::byte> batch) override;
+    int fd() const override { return fd_; }
+
+private:
+    int fd_;
+};
+
+/**
+ * Queue of the library (queue file or memory queue), nobody notifies
+ * about its space.
+ */
+class QueueOutput : public Output
+{
+public:
+    explicit QueueOutput(memqueue::Queue && queue) : queue_(std::move(queue)) {}
+
+    size_t push(std::span<const std::byte> batch) override { return queue_.try_push_framed(batch); }
+
+    memqueue::Queue & queue() { return queue_; }
+
+private:
+    memqueue::Queue queue_;
+};
+
+struct ReplayStats
+{
+    size_t messages = 0;
+    size_t bytes = 0;
+    // messages without time replayed at once with <speed> above 0
+    size_t untimed = 0;
+    double seconds = 0;
+    // waits for space in full queue
+    WaitStats full;
+};
+
+/**
+ * Write messages of <input> into <output> by batches of about <batch_bytes>.
+ * <speed>: 0 - as fast as possible, 1 - original timing, N - N times faster.
+ * Full queue is waited for, not polled by writes.
+ */
+ReplayStats replay(Input & input, Output & output, double speed, size_t batch_bytes);
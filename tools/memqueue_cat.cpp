@@ -0,0 +1,212 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "../daemon/MessageIndex.h"
+
+/**
+ * Output written by large blocks.
+ */
+class Output
+{
+public:
+    explicit Output(bool framed) : framed_(framed) { buffer_.reserve(1 << 20); }
+
+    void put(const std::vector<char> & message, size_t length)
+    {
+        if (framed_)
+            buffer_.insert(buffer_.end(), reinterpret_cast<const char *>(&length), reinterpret_cast<const char *>(&length) + sizeof(length));
+        buffer_.insert(buffer_.end(), message.data(), message.data() + length);
+        if (buffer_.size() >= (1 << 20))
+            flush();
+    }
+
+    void flush()
+    {
+        for (size_t offset = 0; offset < buffer_.size(); )
+        {
+            ssize_t n_bytes = write(STDOUT_FILENO, buffer_.data() + offset, buffer_.size() - offset);
+            if (n_bytes == -1 && errno == EINTR)
+                continue;
+            if (n_bytes <= 0)
+                throw std::runtime_error("stdout write failed with error " + std::to_string(errno));
+            offset += n_bytes;
+        }
+        buffer_.clear();
+    }
+
+private:
+    bool framed_;
+    std::vector<char> buffer_;
+};
+
+static uint64_t parse_time(const char * text)
+{
+    return static_cast<uint64_t>(strtod(text, nullptr) * 1e9);
+}
+
+void print_usage(const char * appName)
+{
+    std::cout << "usage: " << appName << " [-s <first seq>] [-e <last seq>] [-t <from unix time>] [-T <to unix time>] [-F] <path to dir>" << std::endl
+              << "       " << appName << " -r [-i <stride>] <path to dir>" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t first = 0;
+    uint64_t last = UINT64_MAX;
+    uint64_t from = 0;
+    uint64_t to = UINT64_MAX;
+    bool by_time = false;
+    bool framed = false;
+    bool rebuild = false;
+    size_t stride = 64;
+    int option = 0;
+
+    while ((option = getopt(argc, argv, "s:e:t:T:Fri:")) != -1)
+    {
+        switch (option)
+        {
+        case 's':
+            first = std::stoull(optarg);
+            break;
+        case 'e':
+            last = std::stoull(optarg);
+            break;
+        case 't':
+            from = parse_time(optarg);
+            by_time = true;
+            break;
+        case 'T':
+            to = parse_time(optarg);
+            by_time = true;
+            break;
+        case 'F':
+            framed = true;
+            break;
+        case 'r':
+            rebuild = true;
+            break;
+        case 'i':
+            stride = std::stoul(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc || stride == 0 || first > last || from > to)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        const std::string path = argv[optind];
+
+        if (rebuild)
+        {
+            size_t records = MessageIndex::rebuild(path, stride);
+            std::cerr << "index rebuilt, " << records << " records" << std::endl;
+            return 0;
+        }
+
+        // end of data is where a stride of files is missing after the last record
+        std::unique_ptr<MessageIndexView> index;
+        uint64_t indexed = 0;
+        try
+        {
+            index = std::make_unique<MessageIndexView>(path + "/memqueue_index");
+            stride = index->stride();
+            if (index->records().empty() == false)
+                indexed = index->records().back().seq;
+        }
+        catch (std::exception &)
+        {
+            if (by_time)
+                throw;
+        }
+
+        // index narrows the range to strides around its ends,
+        // time of every message is checked by its file
+        if (by_time)
+            std::tie(first, last) = index->narrow(first, last, from, to);
+
+        Output output(framed);
+        std::vector<char> message(64 * 1024);
+        size_t missing = 0;
+
+        for (uint64_t seq = first; seq <= last && missing < stride; seq++)
+        {
+            auto file_name = path + "/memqueue_elem_" + std::to_string(seq);
+            struct stat st = {};
+
+            int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd == -1)
+            {
+                if (errno != ENOENT)
+                    throw std::runtime_error(file_name + " open failed with error " + std::to_string(errno));
+                if (seq > indexed)
+                    missing++;
+                continue;
+            }
+            missing = 0;
+
+            if (fstat(fd, &st) == -1)
+            {
+                close(fd);
+                throw std::runtime_error(file_name + " stat failed with error " + std::to_string(errno));
+            }
+
+            uint64_t time_ns = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+            if (by_time && (time_ns < from || time_ns > to))
+            {
+                close(fd);
+                continue;
+            }
+
+            if (message.size() < static_cast<size_t>(st.st_size))
+                message.resize(st.st_size);
+
+            size_t length = 0;
+            while (length < static_cast<size_t>(st.st_size))
+            {
+                ssize_t n_bytes = read(fd, message.data() + length, st.st_size - length);
+                if (n_bytes == -1 && errno == EINTR)
+                    continue;
+                if (n_bytes <= 0)
+                    break;
+                length += n_bytes;
+            }
+            close(fd);
+
+            output.put(message, length);
+        }
+
+        output.flush();
+    }
+    catch (std::exception & ex)
+    {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
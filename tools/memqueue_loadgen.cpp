@@ -0,0 +1,334 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/queue.h"
+#include "../daemon/Source.h"
+#include "../daemon/ShmRing.h"
+#include "../daemon/WaitStrategy.h"
+#include "Histogram.h"
+
+using load_clock = std::chrono::steady_clock;
+
+static uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(load_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Head of every message: time it should have been sent by schedule
+ * and time it was written, rest of message is filler.
+ */
+struct Stamp
+{
+    uint64_t intended_ns;
+    uint64_t sent_ns;
+};
+
+struct ProducerStats
+{
+    std::atomic<uint64_t> sent{0};
+    // writes repeated because queue was full
+    std::atomic<uint64_t> full{0};
+};
+
+void print_usage(const char * appName)
+{
+    std::cout << "usage: " << appName << " [-m memory|device|shm] [-d <device>|<ring>] [-p <producers>] [-r <messages/s>] [-P] "
+              << "[-s <size>[:<max size>]] [-t <seconds>] [-S <queue size>] [-o]" << std::endl
+              << "-P - Poisson arrivals instead of constant rate, sizes are uniform in [size, max size]" << std::endl
+              << "-o - produce only, queue is drained by daemon" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::string mode = "memory";
+    std::string device = "/dev/memqueue";
+    size_t producers = 1;
+    double rate = 100000;
+    bool poisson = false;
+    size_t min_size = 64;
+    size_t max_size = 64;
+    double seconds = 5;
+    size_t queue_size = 16 << 20;
+    bool produce_only = false;
+    int option = 0;
+
+    while ((option = getopt(argc, argv, "m:d:p:r:Ps:t:S:o")) != -1)
+    {
+        switch (option)
+        {
+        case 'm':
+            mode = optarg;
+            break;
+        case 'd':
+            device = optarg;
+            break;
+        case 'p':
+            producers = std::stoul(optarg);
+            break;
+        case 'r':
+            rate = std::stod(optarg);
+            break;
+        case 'P':
+            poisson = true;
+            break;
+        case 's':
+        {
+            std::string sizes = optarg;
+            auto colon = sizes.find(':');
+            min_size = std::stoul(sizes.substr(0, colon));
+            max_size = colon == std::string::npos ? min_size : std::stoul(sizes.substr(colon + 1));
+            break;
+        }
+        case 't':
+            seconds = std::stod(optarg);
+            break;
+        case 'S':
+            queue_size = std::stoul(optarg);
+            break;
+        case 'o':
+            produce_only = true;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (mode == "shm" && device == "/dev/memqueue")
+        device = "memqueue";
+
+    if ((mode != "memory" && mode != "device" && mode != "shm") || (produce_only && mode == "memory") || producers == 0 || rate <= 0 || seconds <= 0
+        || min_size < sizeof(Stamp) || max_size < min_size)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        std::unique_ptr<memqueue::Queue> queue;
+        std::unique_ptr<ShmRing> ring;
+        std::unique_ptr<Source> source;
+
+        if (mode == "memory")
+        {
+            memqueue_params params = {};
+            params.queue_size = queue_size;
+            queue = std::make_unique<memqueue::Queue>(memqueue::Queue::memory(params));
+        }
+        else if (mode == "shm")
+        {
+            ring = std::make_unique<ShmRing>(device, queue_size);
+        }
+
+        // consumer reads device or ring like daemon does
+        if (queue == nullptr && produce_only == false)
+            source = open_source(mode == "shm" ? "shm:" + device : device);
+
+        std::vector<ProducerStats> stats(producers);
+        std::atomic_bool producing(true);
+        std::vector<std::thread> threads;
+        std::mutex error_lock;
+        std::exception_ptr error;
+        const uint64_t start_ns = now_ns() + 10000000;
+        const uint64_t end_ns = start_ns + static_cast<uint64_t>(seconds * 1e9);
+
+        // schedule doesn't wait for late writes, a stall is seen
+        // as latency of all messages it delayed
+        auto produce = [&](size_t producer)
+        {
+            std::mt19937_64 random(producer + 1);
+            std::exponential_distribution<double> gap(rate / producers);
+            std::uniform_int_distribution<size_t> size(min_size, max_size);
+            std::vector<std::byte> message(max_size, std::byte('x'));
+            const double interval_ns = 1e9 * producers / rate;
+            double intended = start_ns + producer * interval_ns / producers;
+            int fd = -1;
+
+            if (queue == nullptr && ring == nullptr)
+            {
+                fd = open(device.c_str(), O_WRONLY | O_CLOEXEC);
+                if (fd == -1)
+                    throw std::runtime_error(device + " open failed with error " + std::to_string(errno));
+            }
+
+            while (intended < end_ns)
+            {
+                uint64_t now = now_ns();
+                if (now < intended)
+                {
+                    if (intended - now > 50000)
+                        std::this_thread::sleep_for(std::chrono::nanoseconds(static_cast<uint64_t>(intended - now) - 20000));
+                    continue;
+                }
+
+                size_t length = size(random);
+                while (true)
+                {
+                    Stamp stamp = { static_cast<uint64_t>(intended), now_ns() };
+                    memcpy(message.data(), &stamp, sizeof(stamp));
+
+                    bool written = false;
+                    if (queue)
+                        written = queue->try_push(std::span<const std::byte>(message.data(), length));
+                    else if (ring)
+                        written = ring->try_push(std::span<const std::byte>(message.data(), length));
+                    else if (write(fd, message.data(), length) >= 0)
+                        written = true;
+                    else if (errno != ENOSPC)
+                        throw std::runtime_error(device + " write failed with error " + std::to_string(errno));
+
+                    if (written)
+                        break;
+                    stats[producer].full++;
+                    std::this_thread::yield();
+                }
+                stats[producer].sent++;
+
+                intended += poisson ? gap(random) * 1e9 : interval_ns;
+            }
+
+            if (fd != -1)
+                close(fd);
+        };
+
+        for (size_t producer = 0; producer < producers; producer++)
+        {
+            threads.emplace_back([&, producer]()
+            {
+                try
+                {
+                    produce(producer);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> guard(error_lock);
+                    if (error == nullptr)
+                        error = std::current_exception();
+                }
+            });
+        }
+
+        Histogram from_intended;
+        Histogram from_sent;
+        uint64_t received = 0;
+        uint64_t last_ns = 0;
+        std::vector<std::byte> buffer(1 << 20);
+        WaitStrategy wait(WaitStrategy::for_latency(std::chrono::microseconds(10)));
+        int fd = source ? source->fd() : -1;
+
+        auto consume = [&](std::span<const std::byte> message)
+        {
+            Stamp stamp;
+            uint64_t now = now_ns();
+            memcpy(&stamp, message.data(), sizeof(stamp));
+            from_intended.record(now - std::min(now, stamp.intended_ns));
+            from_sent.record(now - std::min(now, stamp.sent_ns));
+            received++;
+            last_ns = now;
+        };
+
+        std::thread joiner([&]()
+        {
+            for (auto & thread : threads)
+                thread.join();
+            producing = false;
+        });
+
+        // consumer stops when producers are done and queue is empty for a while
+        uint64_t idle_since = 0;
+        while (produce_only == false)
+        {
+            size_t count = 0;
+            if (queue)
+            {
+                count = queue->consume_batch(consume, 64);
+            }
+            else
+            {
+                size_t length = source->read_batch(buffer);
+                for (auto message : Batch(std::span<const std::byte>(buffer.data(), length)))
+                {
+                    consume(message);
+                    count++;
+                }
+            }
+
+            if (count != 0)
+            {
+                wait.reset();
+                idle_since = 0;
+                continue;
+            }
+
+            if (producing == false)
+            {
+                if (idle_since == 0)
+                    idle_since = now_ns();
+                else if (now_ns() - idle_since > 100000000)
+                    break;
+            }
+            auto blocks = wait.stats().blocks;
+            wait.wait({ &fd, 1 });
+            if (source && wait.stats().blocks != blocks)
+                source->clear_notify();
+        }
+        joiner.join();
+        if (error)
+            std::rethrow_exception(error);
+
+        uint64_t sent = 0;
+        uint64_t full = 0;
+        for (auto & producer : stats)
+        {
+            sent += producer.sent;
+            full += producer.full;
+        }
+
+        if (produce_only)
+        {
+            printf("offered %.0f msg/s, sent %.0f msg/s, full retries %llu\n", rate, sent / seconds, (unsigned long long)full);
+            return 0;
+        }
+
+        double duration = (std::max(last_ns, end_ns) - start_ns) / 1e9;
+        printf("offered %.0f msg/s, sent %.0f msg/s, consumed %.0f msg/s, lost %llu, full retries %llu\n",
+            rate, sent / seconds, received / duration, (unsigned long long)(sent - received), (unsigned long long)full);
+
+        printf("%10s %16s %14s\n", "percentile", "from_intended_us", "from_sent_us");
+        for (double percent : { 50.0, 90.0, 99.0, 99.9, 99.99, 100.0 })
+        {
+            printf("%10.2f %16.1f %14.1f\n", percent,
+                from_intended.percentile(percent) / 1e3, from_sent.percentile(percent) / 1e3);
+        }
+    }
+    catch (std::exception & ex)
+    {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
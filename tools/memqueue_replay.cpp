@@ -0,0 +1,89 @@
+/* 
+ * Copyright (C) Alexander Chuprynov <achuprynov@gmail.com>
+ * This file is part of solution of test task described in README.md.
+ */
+#include <stdio.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "Replay.h"
+
+void print_usage(const char * appName)
+{
+    std::cout << "usage: " << appName << " [-d <device> | -q <queue file> [-S <queue size>]] [-x <speed>] [-b <batch bytes>] <path to dir>" << std::endl
+              << "speed: 0 - as fast as possible, 1 - original timing, N - N times faster" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    std::string device = "/dev/memqueue";
+    std::string queue_file;
+    size_t queue_size = 64 << 20;
+    double speed = 0;
+    size_t batch_bytes = 256 * 1024;
+    int option = 0;
+
+    while ((option = getopt(argc, argv, "d:q:S:x:b:")) != -1)
+    {
+        switch (option)
+        {
+        case 'd':
+            device = optarg;
+            break;
+        case 'q':
+            queue_file = optarg;
+            break;
+        case 'S':
+            queue_size = std::stoull(optarg);
+            break;
+        case 'x':
+            speed = std::stod(optarg);
+            break;
+        case 'b':
+            batch_bytes = std::stoull(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc || speed < 0 || batch_bytes == 0)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        std::unique_ptr<Input> input = open_input(argv[optind]);
+        std::unique_ptr<Output> output;
+
+        if (queue_file.empty())
+            output = std::make_unique<DeviceOutput>(device);
+        else
+            output = std::make_unique<QueueOutput>(memqueue::Queue::file(queue_file.c_str(), queue_size));
+
+        ReplayStats stats = replay(*input, *output, speed, batch_bytes);
+        auto & full = stats.full;
+
+        printf("messages %zu, bytes %zu, seconds %.3f, %.0f msg/s, %.1f MB/s\n",
+            stats.messages, stats.bytes, stats.seconds, stats.messages / stats.seconds, stats.bytes / stats.seconds / 1e6);
+        printf("full queue: spin %.1f ms, backoff %.1f ms (%llu), blocked %.1f ms (%llu)\n",
+            full.spin_ns / 1e6, full.backoff_ns / 1e6, (unsigned long long)full.sleeps,
+            full.block_ns / 1e6, (unsigned long long)full.blocks);
+        if (stats.untimed != 0)
+            printf("%zu messages have no time, they were replayed at once\n", stats.untimed);
+    }
+    catch (std::exception & ex)
+    {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}